@@ -0,0 +1,110 @@
+// alloc_count.h - Count heap allocations in a bench
+// Replaces every form of the global operator new and delete (plain, array
+// and nothrow; sized and aligned where the language has them) with
+// malloc/free versions that count allocations in alloc_count. Include it
+// from exactly one file of a bench. The replacements are kept out of line
+// so the compiler never sees free() paired with an inlined operator new.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <cstdlib>
+#include <new>
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define ALLOC_COUNT_NOINLINE __attribute__((noinline))
+#else
+#define ALLOC_COUNT_NOINLINE
+#endif
+
+static long alloc_count = 0;
+
+namespace alloc_count_detail {
+
+ALLOC_COUNT_NOINLINE inline void *allocate(size_t n) {
+    alloc_count++;
+    return std::malloc(n ? n : 1);
+}
+
+ALLOC_COUNT_NOINLINE inline void release(void *p) { std::free(p); }
+
+}  // namespace alloc_count_detail
+
+ALLOC_COUNT_NOINLINE void *operator new(size_t n) {
+    void *p = alloc_count_detail::allocate(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+ALLOC_COUNT_NOINLINE void *operator new[](size_t n) {
+    void *p = alloc_count_detail::allocate(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+ALLOC_COUNT_NOINLINE void *operator new(size_t n, const std::nothrow_t&) noexcept {
+    return alloc_count_detail::allocate(n);
+}
+
+ALLOC_COUNT_NOINLINE void *operator new[](size_t n, const std::nothrow_t&) noexcept {
+    return alloc_count_detail::allocate(n);
+}
+
+ALLOC_COUNT_NOINLINE void operator delete(void *p) noexcept { alloc_count_detail::release(p); }
+ALLOC_COUNT_NOINLINE void operator delete[](void *p) noexcept { alloc_count_detail::release(p); }
+ALLOC_COUNT_NOINLINE void operator delete(void *p, const std::nothrow_t&) noexcept { alloc_count_detail::release(p); }
+ALLOC_COUNT_NOINLINE void operator delete[](void *p, const std::nothrow_t&) noexcept { alloc_count_detail::release(p); }
+
+#if defined(__cpp_sized_deallocation)
+ALLOC_COUNT_NOINLINE void operator delete(void *p, size_t) noexcept { alloc_count_detail::release(p); }
+ALLOC_COUNT_NOINLINE void operator delete[](void *p, size_t) noexcept { alloc_count_detail::release(p); }
+#endif
+
+#if defined(__cpp_aligned_new)
+namespace alloc_count_detail {
+
+ALLOC_COUNT_NOINLINE inline void *allocate_aligned(size_t n, std::align_val_t align) {
+    void *p = NULL;
+    alloc_count++;
+    size_t a = (size_t)align < sizeof(void *) ? sizeof(void *) : (size_t)align;
+    return posix_memalign(&p, a, n ? n : 1) == 0 ? p : NULL;
+}
+
+}  // namespace alloc_count_detail
+
+ALLOC_COUNT_NOINLINE void *operator new(size_t n, std::align_val_t a) {
+    void *p = alloc_count_detail::allocate_aligned(n, a);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+ALLOC_COUNT_NOINLINE void *operator new[](size_t n, std::align_val_t a) {
+    void *p = alloc_count_detail::allocate_aligned(n, a);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+ALLOC_COUNT_NOINLINE void *operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return alloc_count_detail::allocate_aligned(n, a);
+}
+
+ALLOC_COUNT_NOINLINE void *operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return alloc_count_detail::allocate_aligned(n, a);
+}
+
+ALLOC_COUNT_NOINLINE void operator delete(void *p, std::align_val_t) noexcept { alloc_count_detail::release(p); }
+ALLOC_COUNT_NOINLINE void operator delete[](void *p, std::align_val_t) noexcept { alloc_count_detail::release(p); }
+ALLOC_COUNT_NOINLINE void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept {
+    alloc_count_detail::release(p);
+}
+ALLOC_COUNT_NOINLINE void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept {
+    alloc_count_detail::release(p);
+}
+ALLOC_COUNT_NOINLINE void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    alloc_count_detail::release(p);
+}
+ALLOC_COUNT_NOINLINE void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    alloc_count_detail::release(p);
+}
+#endif
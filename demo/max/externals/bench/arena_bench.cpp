@@ -0,0 +1,101 @@
+// arena_bench.cpp - json.hpp with the default allocator vs keylink_arena
+// The cycle [keylink_aliases] runs for "resolve": parse a message, copy
+// it, rewrite root_note, mode and chord_type, normalize note_pattern, add
+// a metadata object and dump it. Run with
+//   json           nlohmann::json, every node from the heap
+//   arena json     keylink_arena_json, inside a keylink_arena_scope on one
+//                  arena kept across messages
+// over a small message and one with a nested object and a longer array.
+// Reported per message: time and heap allocations (alloc_count.h, the
+// arena's own blocks included). What the arena run still
+// allocates is json.hpp's working state, which takes no allocator: the
+// parser's stacks, the lexer's token copy, the dump's output adapter.
+// Usage: arena_bench [messages]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "alloc_count.h"
+#include "keylink_arena.h"
+
+static size_t sink;
+
+template <typename Json>
+static std::string text_of(const Json& j) {
+    const typename Json::string_t& s = j.template get_ref<const typename Json::string_t&>();
+    return std::string(s.data(), s.size());
+}
+
+// resolve_message's work, with the alias tables replaced by a fixed answer
+template <typename Json>
+static void resolve(const std::string& text) {
+    Json input = Json::parse(text);
+    Json resolved = input;
+    if (resolved.contains("root_note") && resolved["root_note"].is_string()) {
+        sink += text_of(resolved["root_note"]).size();
+        resolved["root_note"] = "C#";
+    }
+    if (resolved.contains("mode") && resolved["mode"].is_string()) {
+        sink += text_of(resolved["mode"]).size();
+        resolved["mode"] = "major";
+    }
+    if (resolved.contains("chord_type") && resolved["chord_type"].is_string()) {
+        sink += text_of(resolved["chord_type"]).size();
+        resolved["chord_type"] = "m7";
+    }
+    if (resolved.contains("note_pattern") && resolved["note_pattern"].is_array()) {
+        std::vector<int> pattern = resolved["note_pattern"].template get<std::vector<int> >();
+        resolved["note_pattern"] = pattern;
+    }
+    if (!resolved.contains("metadata")) resolved["metadata"] = Json::object();
+    resolved["metadata"]["resolved_by"] = "KeyLinkAliasResolver";
+    resolved["metadata"]["resolution_version"] = "1.0.0";
+    sink += resolved.dump().size();
+}
+
+template <typename F>
+static void run(const char *name, long count, F f) {
+    for (long i = 0; i < count / 10; i++) f(i);
+    alloc_count = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) f(i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / count;
+    std::printf("  %-12s %10.0f %14.1f\n", name, ns, (double)alloc_count / count);
+}
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? std::atol(argv[1]) : 100000;
+    const char *payloads[2][2] = {
+        {"small",
+         "{\"root_note\":\"db\",\"mode\":\"Ionian\",\"chord_type\":\"min7\",\"note_pattern\":[0,3,7,10],"
+         "\"tempo\":%ld}"},
+        {"nested",
+         "{\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":%ld,\"type\":\"set-state\",\"root_note\":\"des\","
+         "\"mode\":\"aeolian\",\"chord_type\":\"half-diminished\",\"note_pattern\":[0,2,3,5,7,8,10],"
+         "\"voicing\":{\"bass\":\"Db2\",\"upper\":[\"F3\",\"Ab3\",\"Cb4\",\"Eb4\"],\"spread\":0.35},"
+         "\"note\":\"Second verse: keep the voicing open and let the bass hold through the turnaround.\","
+         "\"metadata\":{\"sender\":\"web\",\"sent_at\":1712345678901}}"}};
+
+    keylink_arena arena;
+    size_t used = 0;
+    for (int p = 0; p < 2; p++) {
+        std::vector<std::string> texts(64);
+        char text[1024];
+        for (size_t i = 0; i < texts.size(); i++) {
+            std::snprintf(text, sizeof(text), payloads[p][1], 48000L + (long)i);
+            texts[i] = text;
+        }
+        std::printf("%s (%zu bytes)\n  %-12s %10s %14s\n", payloads[p][0], texts[0].size(), "", "ns/message",
+                    "allocs/message");
+        run("json", count, [&](long i) { resolve<nlohmann::json>(texts[i % texts.size()]); });
+        run("arena json", count, [&](long i) {
+            keylink_arena_scope scope(arena);
+            resolve<keylink_arena_json>(texts[i % texts.size()]);
+            used = arena.used();
+        });
+        std::printf("  arena: %zu block(s), %zu bytes used by the last message\n\n", arena.blocks(), used);
+    }
+    return sink ? 0 : 1;
+}
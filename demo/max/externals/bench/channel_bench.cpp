@@ -0,0 +1,118 @@
+// channel_bench.cpp - What a rig pays for another channel's LAN traffic
+// A receiver is set up the way [keylink] sets up a LAN link for channel
+// "stage-a", while a sender floods channel "stage-b" with tagged states in
+// bursts. After each burst the receiver drains its socket with recvmmsg
+// and reads each datagram's tag, as link_receive would before dropping it.
+// Run twice:
+//   shared        every channel on 239.255.0.1:7474 (before per-channel groups)
+//   per-channel   each channel on its keylink_channel.h group and port
+// Reported: datagrams that reached the receiver and its CPU time draining them.
+// Usage: channel_bench [datagrams] [burst]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <thread>
+#include "asio.hpp"
+#include "keylink_udp.h"
+#include "keylink_dedup.h"
+#include "keylink_channel.h"
+
+using asio::ip::udp;
+
+struct bench_result {
+    long received;
+    double cpu_ms;
+};
+
+static double thread_cpu_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void open_link_socket(udp::socket& s, const std::string& group, unsigned short port) {
+    udp::endpoint listen_ep(udp::v4(), port);
+    s.open(listen_ep.protocol());
+    s.set_option(udp::socket::reuse_address(true));
+#ifdef IP_MULTICAST_ALL
+    int all = 0;
+    setsockopt(s.native_handle(), IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+#endif
+    s.bind(listen_ep);
+    s.set_option(asio::ip::multicast::join_group(asio::ip::make_address(group)));
+    s.non_blocking(true);
+}
+
+static bench_result run(bool per_channel, int count, int burst) {
+    std::string group_a = KEYLINK_MULTICAST_ADDR, group_b = KEYLINK_MULTICAST_ADDR;
+    unsigned short port_a = KEYLINK_UDP_PORT, port_b = KEYLINK_UDP_PORT;
+    if (per_channel) {
+        keylink_channel_group("stage-a", group_a, port_a);
+        keylink_channel_group("stage-b", group_b, port_b);
+    }
+
+    asio::io_context io;
+    udp::socket receiver(io), sender(io), other(io);
+    open_link_socket(receiver, group_a, port_a);
+    // Stage B's own rig on this host, so its group is joined here too
+    open_link_socket(other, group_b, port_b);
+    sender.open(udp::v4());
+    sender.set_option(asio::ip::multicast::enable_loopback(true));
+    udp::endpoint target(asio::ip::make_address(group_b), port_b);
+
+    std::string state = "{\"type\":\"set-state\",\"state\":{\"key\":\"D\",\"mode\":\"Dorian\",\"tempo\":122.5,"
+                        "\"chord\":{\"root\":\"G\",\"type\":\"min7\"},\"scale\":[0,2,3,5,7,9,10]}}";
+    std::string tagged;
+    udp_send_queue out;
+    udp_recv_batch in(KEYLINK_UDP_BATCH, 2048);    // As keylink.cpp
+    bench_result r = {0, 0};
+    uint64_t source, seq;
+    volatile uint64_t sink = 0;
+
+    for (int sent = 0; sent < count; sent += burst) {
+        for (int i = 0; i < burst; i++) {
+            keylink_tag_message(0x9f2c4e01a7b3d658ull, (uint64_t)(sent + i + 1), state.data(), state.size(), tagged);
+            out.add(tagged.data(), tagged.size());
+        }
+        while (!out.empty()) out.flush(sender.native_handle(), target.data(), (socklen_t)target.size());
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+        double t0 = thread_cpu_ms();
+        int n;
+        while ((n = in.receive(receiver.native_handle())) > 0) {
+            for (int i = 0; i < n; i++) {
+                if (keylink_parse_tag(in.data(i), in.size(i), source, seq)) sink += seq;
+            }
+            r.received += n;
+        }
+        r.cpu_ms += thread_cpu_ms() - t0;
+
+        // Stage B's rig keeps its queue empty
+        while (in.receive(other.native_handle()) > 0) {}
+    }
+    return r;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int burst = argc > 2 ? std::atoi(argv[2]) : 200;
+
+    std::string group;
+    unsigned short port;
+    keylink_channel_group("stage-a", group, port);
+    std::printf("stage-a -> %s:%u\n", group.c_str(), port);
+    keylink_channel_group("stage-b", group, port);
+    std::printf("stage-b -> %s:%u\n", group.c_str(), port);
+    std::printf("%d datagrams to stage-b in bursts of %d; receiver listens on stage-a\n\n", count, burst);
+
+    bench_result shared = run(false, count, burst);
+    bench_result split = run(true, count, burst);
+    std::printf("shared group    received %7ld   receiver CPU %8.2f ms (%.0f ns/datagram sent)\n", shared.received,
+                shared.cpu_ms, shared.cpu_ms * 1e6 / count);
+    std::printf("per-channel     received %7ld   receiver CPU %8.2f ms (%.0f ns/datagram sent)\n", split.received,
+                split.cpu_ms, split.cpu_ms * 1e6 / count);
+    return 0;
+}
@@ -0,0 +1,87 @@
+// clock_bench.cpp - How well keylink_clock_estimate tracks a peer clock
+// Simulates a peer whose clock is off by a fixed offset and runs fast by a
+// given drift, pinged every KEYLINK_PING_INTERVAL_MS over a path with a
+// base latency plus random, asymmetric jitter (Wi-Fi bursts included).
+// After each exchange the estimate is asked where the peer's clock will be
+// one lead ahead (what a scheduled apply_at needs) and compared with the
+// truth. Also times keylink_top_level_number, which every received
+// message pays to look for apply_at.
+// Usage: clock_bench [minutes] [jitter_ms] [drift_ppm]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "keylink_clock.h"
+
+#define KEYLINK_PING_INTERVAL_MS 2000
+
+typedef std::chrono::steady_clock bench_clock;
+
+int main(int argc, char **argv) {
+    double minutes = argc > 1 ? std::atof(argv[1]) : 10;
+    double jitter = argc > 2 ? std::atof(argv[2]) : 4;
+    double drift_ppm = argc > 3 ? std::atof(argv[3]) : 50;
+    const double offset = 1834.25, latency = 0.4, lead = 100;
+
+    std::mt19937 rng(7);
+    std::exponential_distribution<double> wait(1.0 / jitter);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    // Peer clock at our time t
+    auto peer = [&](double t) { return t + offset + t * drift_ppm * 1e-6; };
+    // One-way trip: latency, exponential jitter, a 200 ms burst one time in 50
+    auto trip = [&]() { return latency + wait(rng) + (uniform(rng) < 0.02 ? 200 * uniform(rng) : 0); };
+
+    keylink_clock_estimate clock;
+    std::vector<double> errors, naive;
+    int exchanges = (int)(minutes * 60000 / KEYLINK_PING_INTERVAL_MS);
+    for (int i = 0; i < exchanges; i++) {
+        double t0 = i * (double)KEYLINK_PING_INTERVAL_MS;
+        double arrive = t0 + trip();
+        double t1 = peer(arrive), t2 = peer(arrive + 0.05);
+        double t3 = arrive + 0.05 + trip();
+        clock.add(t0, t1, t2, t3);
+
+        // Skip the first minute: the filter and the drift fit warm up
+        if (t3 < 60000) continue;
+        double at = t3 + lead;
+        errors.push_back(std::fabs(clock.offset_at(at) - (peer(at) - at)));
+        naive.push_back(std::fabs(((t1 - t0) + (t2 - t3)) / 2 - (peer(at) - at)));
+    }
+    if (errors.empty()) {
+        std::printf("run for more than a minute\n");
+        return 1;
+    }
+    std::sort(errors.begin(), errors.end());
+    std::sort(naive.begin(), naive.end());
+
+    std::printf("%.0f min, ping every %d ms, latency %.1f ms + %.1f ms mean jitter each way, drift %.0f ppm\n",
+                minutes, KEYLINK_PING_INTERVAL_MS, latency, jitter, drift_ppm);
+    std::printf("estimated drift    %.1f ppm\n", clock.drift_ppm());
+    std::printf("offset error       median   p99      max   (ms, projected %.0f ms ahead)\n", lead);
+    std::printf("  last sample    %8.3f %8.3f %8.3f\n", naive[naive.size() / 2], naive[naive.size() * 99 / 100],
+                naive.back());
+    std::printf("  estimate       %8.3f %8.3f %8.3f\n", errors[errors.size() / 2], errors[errors.size() * 99 / 100],
+                errors.back());
+
+    // apply_at lookup on a received state (found at the start, and absent)
+    std::string stamped = "{\"apply_at\":1792215454548.682,\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":42,\"type\":\"set-state\","
+                          "\"state\":{\"key\":\"D\",\"mode\":\"Dorian\",\"tempo\":122.5,\"chord\":{\"root\":\"G\"}}}";
+    std::string plain = "{\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":42,\"type\":\"set-state\","
+                        "\"state\":{\"key\":\"D\",\"mode\":\"Dorian\",\"tempo\":122.5,\"chord\":{\"root\":\"G\"}}}";
+    const int lookups = 1000000;
+    volatile double sink = 0;
+    double value;
+    bench_clock::time_point s = bench_clock::now();
+    for (int i = 0; i < lookups; i++) sink += keylink_top_level_number(stamped.data(), stamped.size(), "apply_at", value) ? value : 0;
+    double found_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - s).count() / lookups;
+    s = bench_clock::now();
+    for (int i = 0; i < lookups; i++) sink += keylink_top_level_number(plain.data(), plain.size(), "apply_at", value) ? 1 : 0;
+    double absent_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - s).count() / lookups;
+    std::printf("apply_at lookup    present %.1f ns   absent %.1f ns\n", found_ns, absent_ns);
+    return sink == -1 ? 2 : 0;
+}
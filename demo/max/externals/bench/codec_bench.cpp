@@ -0,0 +1,280 @@
+// codec_bench.cpp - JSON vs MessagePack vs CBOR: size and conversion cost
+// Messages that do not fit a binary state packet (notes, custom metadata)
+// go out schemaless. For each sample this measures:
+//   parse          text/bytes -> json object (what a receiving app pays)
+//   encode         JSON text from Max -> MessagePack/CBOR, paid once per
+//                  send when the encoding is not JSON: keylink_encode, and
+//                  json.hpp's parse + to_msgpack/to_cbor for comparison
+//   decode         MessagePack/CBOR -> JSON text for the outlet, paid once
+//                  per link on receive: keylink_decode, and json.hpp's
+//                  from_msgpack/from_cbor + dump for comparison
+// Before timing, keylink_encode must write the same bytes as json.hpp and
+// keylink_decode the same text, on the samples and on generated messages
+// (nesting, escapes, every integer width, floats, empty containers), and
+// malformed input must be refused. Any difference fails the bench.
+// Usage: codec_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "keylink_codec.h"
+
+typedef std::chrono::steady_clock bench_clock;
+using nlohmann::json;
+typedef nlohmann::ordered_json ojson;
+
+struct sample {
+    const char *name;
+    std::string text;
+};
+
+static std::vector<sample> build_samples() {
+    std::vector<sample> out;
+
+    json state;
+    state["_src"] = "9f2c4e01a7b3d658";
+    state["_seq"] = 42;
+    state["type"] = "set-state";
+    state["state"] = {{"key", "D"}, {"mode", "Dorian"}, {"tempo", 122.5}, {"enabled", true},
+                      {"chordEnabled", true}, {"chord", {{"root", "G"}, {"type", "min7"}}},
+                      {"confidence", 0.98}, {"scale", {0, 2, 4, 5, 7, 9, 11}}, {"source", "ableton"}};
+    out.push_back(sample{"state + metadata", state.dump()});
+
+    json notes;
+    notes["_src"] = "9f2c4e01a7b3d658";
+    notes["_seq"] = 43;
+    notes["type"] = "notes";
+    json list = json::array();
+    for (int i = 0; i < 16; i++) {
+        list.push_back({{"pitch", 48 + (i * 7) % 24}, {"velocity", 64 + i * 3}, {"start", i * 0.25}, {"length", 0.25}});
+    }
+    notes["notes"] = list;
+    out.push_back(sample{"16 notes", notes.dump()});
+
+    json chat;
+    chat["_src"] = "9f2c4e01a7b3d658";
+    chat["_seq"] = 44;
+    chat["type"] = "chat";
+    chat["from"] = "stage-left";
+    chat["text"] = "bridge after the next 8 bars";
+    out.push_back(sample{"short text", chat.dump()});
+    return out;
+}
+
+// A random JSON value with every kind of field the transcoder writes
+static ojson random_value(std::mt19937& rng, int depth) {
+    static const long long ints[] = {0, 1, 23, 24, 127, 128, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL,
+                                     -1, -24, -25, -32, -33, -128, -129, -32768, -32769, -2147483648LL,
+                                     -2147483649LL, 9223372036854775807LL};
+    static const double floats[] = {0.5, 122.5, 0.98, -1.25, 1e300, 3.4028234663852886e38, 1e-7, 0.1, 120.0,
+                                    -0.0, 6.02214076e23};
+    static const char *strings[] = {"", "D", "quote \" backslash \\ slash /", "tab\tnew\nline\x01\x1f", "caf\xc3\xa9",
+                                    "\xf0\x9f\x8e\xb9 keys", "0123456789012345678901234567890",
+                                    "01234567890123456789012345678901"};
+    int kind = depth > 3 ? (int)(rng() % 6) : (int)(rng() % 8);
+    switch (kind) {
+        case 0: return ints[rng() % (sizeof(ints) / sizeof(ints[0]))];
+        case 1: return floats[rng() % (sizeof(floats) / sizeof(floats[0]))];
+        case 2: return strings[rng() % (sizeof(strings) / sizeof(strings[0]))];
+        case 3: return std::string(rng() % 300, (char)('a' + rng() % 26));
+        case 4: return rng() % 2 == 0;
+        case 5: return nullptr;
+        case 6: {
+            ojson a = ojson::array();
+            size_t n = rng() % 3 == 0 ? 16 + rng() % 8 : rng() % 4;
+            for (size_t i = 0; i < n; i++) a.push_back(random_value(rng, depth + 1));
+            return a;
+        }
+        default: {
+            ojson o = ojson::object();
+            size_t n = rng() % 3 == 0 ? 16 + rng() % 12 : rng() % 4;
+            for (size_t i = 0; i < n; i++) o["k" + std::to_string(i) + strings[rng() % 3]] = random_value(rng, depth + 1);
+            return o;
+        }
+    }
+}
+
+// keylink_encode and keylink_decode against json.hpp for one message
+static bool same_as_json_hpp(const std::string& text) {
+    ojson j = ojson::parse(text, nullptr, false);
+    bool valid = !j.is_discarded() && j.is_object();
+    std::string encoded[2], expected[2], back;
+    keylink_enc encs[2] = {KEYLINK_ENC_MSGPACK, KEYLINK_ENC_CBOR};
+    for (int e = 0; e < 2; e++) {
+        bool ok = keylink_encode(encs[e], text.data(), text.size(), encoded[e]);
+        if (ok != valid) {
+            std::printf("MISMATCH %s encode %d, json.hpp %d: %s\n", keylink_enc_name(encs[e]), ok, valid, text.c_str());
+            return false;
+        }
+        if (!valid) continue;
+        if (encs[e] == KEYLINK_ENC_MSGPACK) ojson::to_msgpack(j, expected[e]);
+        else ojson::to_cbor(j, expected[e]);
+        if (encoded[e] != expected[e]) {
+            size_t at = 0;
+            while (at < encoded[e].size() && at < expected[e].size() && encoded[e][at] == expected[e][at]) at++;
+            std::printf("MISMATCH %s bytes from offset %zu: %.200s\n", keylink_enc_name(encs[e]), at, text.c_str());
+            return false;
+        }
+        uint64_t source = 1, seq = 1;
+        if (!keylink_decode(encs[e], encoded[e].data(), encoded[e].size(), back, source, seq) || back != j.dump()) {
+            std::printf("MISMATCH %s decode:\n  json.hpp %s\n  decode   %s\n", keylink_enc_name(encs[e]),
+                        j.dump().c_str(), back.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static int check(const std::vector<sample>& samples) {
+    std::vector<std::string> messages;
+    for (size_t i = 0; i < samples.size(); i++) {
+        messages.push_back(samples[i].text);
+        messages.push_back(ojson::parse(samples[i].text).dump(2));
+    }
+    const char *edge[] = {
+        "{}", " {\"a\" : [ ] , \"b\" : { } }\n", "{\"a\":\"\\u00e9\\ud83c\\udfb9\\u0000\"}", "{\"a\":-0}",
+        "{\"a\":18446744073709551615}", "{\"a\":18446744073709551616}", "{\"a\":-9223372036854775808}",
+        "{\"a\":-9223372036854775809}", "{\"a\":1e2,\"b\":1E-2,\"c\":-1.5e+3,\"d\":0.1234567890123456789}",
+        // Not JSON objects, or not JSON at all: refused by both
+        "[1,2]", "\"text\"", "42", "", "{", "{\"a\":}", "{\"a\":1,}", "{\"a\" 1}", "{\"a\":[1,]}", "{\"a\":01}",
+        "{\"a\":1.}", "{\"a\":tru}", "{\"a\":\"\\x\"}", "{\"a\":\"\\udc00\"}", "{\"a\":\"\\ud800\"}",
+        "{\"a\":\"\x01\"}", "{\"a\":\"\xc3\"}", "{\"a\":1} x", "{\"a\":1}}", "{\"a\":[1}", "{1:2}",
+        "{\"a\":1e400}", "{\"a\":-1E309}"};
+    for (size_t i = 0; i < sizeof(edge) / sizeof(edge[0]); i++) messages.push_back(edge[i]);
+
+    std::mt19937 rng(1);
+    for (int i = 0; i < 5000; i++) {
+        ojson o = ojson::object();
+        o["_src"] = "9f2c4e01a7b3d658";
+        o["_seq"] = i + 1;
+        size_t n = 1 + rng() % 6;
+        for (size_t k = 0; k < n; k++) o["f" + std::to_string(k)] = random_value(rng, 1);
+        messages.push_back(o.dump(rng() % 2 ? -1 : 1));
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < messages.size(); i++) {
+        if (!same_as_json_hpp(messages[i]) && ++failed >= 10) break;
+    }
+
+    // A repeated key goes on the wire twice; read back, the last one wins
+    // as it does when json.hpp parses the text
+    std::string twice, once;
+    uint64_t source, seq;
+    if (!keylink_encode(KEYLINK_ENC_MSGPACK, "{\"a\":1,\"a\":2}", 13, twice) ||
+        !keylink_decode(KEYLINK_ENC_MSGPACK, twice.data(), twice.size(), once, source, seq) ||
+        ojson::parse(once) != ojson::parse("{\"a\":2}")) {
+        std::printf("MISMATCH repeated key\n");
+        failed++;
+    }
+
+    // Bytes json.hpp decodes but JSON cannot hold, and truncated data
+    std::string bin("\x81\xa1" "a\xc4\x01x", 6), ext("\x81\xa1" "a\xd4\x01\x02", 6), key("\x81\x01\x02", 3), text;
+    std::string cut;
+    keylink_encode(KEYLINK_ENC_CBOR, messages[0].data(), messages[0].size(), cut);
+    cut.resize(cut.size() - 1);
+    if (keylink_decode(KEYLINK_ENC_MSGPACK, bin.data(), bin.size(), text, source, seq) ||
+        keylink_decode(KEYLINK_ENC_MSGPACK, ext.data(), ext.size(), text, source, seq) ||
+        keylink_decode(KEYLINK_ENC_MSGPACK, key.data(), key.size(), text, source, seq) ||
+        keylink_decode(KEYLINK_ENC_CBOR, cut.data(), cut.size(), text, source, seq)) {
+        std::printf("MISMATCH malformed binary decoded\n");
+        failed++;
+    }
+
+    // The tag is found as the old DOM path found it
+    std::string packed;
+    keylink_encode(KEYLINK_ENC_MSGPACK, messages[0].data(), messages[0].size(), packed);
+    if (!keylink_decode(KEYLINK_ENC_MSGPACK, packed.data(), packed.size(), text, source, seq) ||
+        source != 0x9f2c4e01a7b3d658ULL || seq != 42) {
+        std::printf("MISMATCH tag: %016llx/%llu\n", (unsigned long long)source, (unsigned long long)seq);
+        failed++;
+    }
+
+    if (failed) return 1;
+    std::printf("%zu messages converted the same as json.hpp\n", messages.size());
+    return 0;
+}
+
+template <typename F>
+static double ns_per_op(int iterations, F op) {
+    bench_clock::time_point t0 = bench_clock::now();
+    for (int i = 0; i < iterations; i++) op(i);
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count() / iterations;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+    volatile size_t sink = 0;
+    std::vector<sample> samples = build_samples();
+    if (check(samples)) return 1;
+    std::printf("%d iterations\n", iterations);
+
+    for (size_t n = 0; n < samples.size(); n++) {
+        const std::string& text = samples[n].text;
+        std::string msgpack, cbor, back;
+        uint64_t source, seq;
+        keylink_encode(KEYLINK_ENC_MSGPACK, text.data(), text.size(), msgpack);
+        keylink_encode(KEYLINK_ENC_CBOR, text.data(), text.size(), cbor);
+
+        std::printf("\n%s\n", samples[n].name);
+        std::printf("bytes on the wire     JSON %zu   MessagePack %zu   CBOR %zu\n",
+                    text.size(), msgpack.size(), cbor.size());
+
+        double json_parse = ns_per_op(iterations, [&](int) {
+            sink += json::parse(text).size();
+        });
+        double msgpack_parse = ns_per_op(iterations, [&](int) {
+            sink += json::from_msgpack(msgpack).size();
+        });
+        double cbor_parse = ns_per_op(iterations, [&](int) {
+            sink += json::from_cbor(cbor).size();
+        });
+        double msgpack_encode = ns_per_op(iterations, [&](int) {
+            keylink_encode(KEYLINK_ENC_MSGPACK, text.data(), text.size(), msgpack);
+            sink += msgpack.size();
+        });
+        double cbor_encode = ns_per_op(iterations, [&](int) {
+            keylink_encode(KEYLINK_ENC_CBOR, text.data(), text.size(), cbor);
+            sink += cbor.size();
+        });
+        double msgpack_encode_dom = ns_per_op(iterations, [&](int) {
+            msgpack.clear();
+            ojson::to_msgpack(ojson::parse(text), msgpack);
+            sink += msgpack.size();
+        });
+        double cbor_encode_dom = ns_per_op(iterations, [&](int) {
+            cbor.clear();
+            ojson::to_cbor(ojson::parse(text), cbor);
+            sink += cbor.size();
+        });
+        double msgpack_text = ns_per_op(iterations, [&](int) {
+            keylink_decode(KEYLINK_ENC_MSGPACK, msgpack.data(), msgpack.size(), back, source, seq);
+            sink += back.size();
+        });
+        double cbor_text = ns_per_op(iterations, [&](int) {
+            keylink_decode(KEYLINK_ENC_CBOR, cbor.data(), cbor.size(), back, source, seq);
+            sink += back.size();
+        });
+        double msgpack_text_dom = ns_per_op(iterations, [&](int) {
+            sink += ojson::from_msgpack(msgpack).dump().size();
+        });
+        double cbor_text_dom = ns_per_op(iterations, [&](int) {
+            sink += ojson::from_cbor(cbor).dump().size();
+        });
+
+        std::printf("parse              JSON %8.1f ns   MessagePack %8.1f ns   CBOR %8.1f ns\n",
+                    json_parse, msgpack_parse, cbor_parse);
+        std::printf("encode from text                    MessagePack %8.1f ns   CBOR %8.1f ns\n",
+                    msgpack_encode, cbor_encode);
+        std::printf("  via json.hpp DOM                  MessagePack %8.1f ns   CBOR %8.1f ns\n",
+                    msgpack_encode_dom, cbor_encode_dom);
+        std::printf("decode to text                      MessagePack %8.1f ns   CBOR %8.1f ns\n",
+                    msgpack_text, cbor_text);
+        std::printf("  via json.hpp DOM                  MessagePack %8.1f ns   CBOR %8.1f ns\n",
+                    msgpack_text_dom, cbor_text_dom);
+    }
+    return sink == 0xFFFFFFFF ? 2 : 0;
+}
@@ -0,0 +1,115 @@
+// delta_bench.cpp - Full states vs state-delta for a high-rate control
+// A sender nudges tempo (and now and then confidence) on every message,
+// the way a tap-tempo or detector stream does. Compared per message:
+//   bytes          tagged full state vs tagged delta (keyframes included)
+//   send           keylink_delta_encoder::encode vs nothing (full states
+//                  are forwarded as they are)
+//   receive        parsing the full state vs parsing the delta and applying
+//                  it to the kept base (and dumping the rebuilt state, which
+//                  is what [keylink] outputs)
+// Usage: delta_bench [messages]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "keylink_delta.h"
+#include "keylink_dedup.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static std::string state_at(int i) {
+    keylink_ojson msg;
+    msg["type"] = "set-state";
+    keylink_ojson& state = msg["state"];
+    state["key"] = "D";
+    state["mode"] = "Dorian";
+    state["tempo"] = 120.0 + (i % 50) * 0.1;
+    state["enabled"] = true;
+    state["chordEnabled"] = true;
+    state["chord"] = {{"root", "G"}, {"type", "min7"}};
+    state["confidence"] = 0.9 + (i / 10 % 10) * 0.01;
+    state["scale"] = {0, 2, 3, 5, 7, 9, 10};
+    return msg.dump();
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 100000;
+    volatile size_t sink = 0;
+    const uint64_t source = 0x9f2c4e01a7b3d658ull;
+
+    std::vector<std::string> states;
+    for (int i = 0; i < count; i++) states.push_back(state_at(i));
+
+    // Sender: tag everything; a simulated clock of 100 messages per second
+    std::vector<std::string> full(count), wire(count);
+    keylink_delta_encoder encoder;
+    std::string delta;
+    int keyframes = 0;
+    bench_clock::time_point t0 = bench_clock::now();
+    for (int i = 0; i < count; i++) {
+        if (encoder.encode(states[i].data(), states[i].size(), (uint64_t)i + 1, i * 10.0, delta)) {
+            keylink_tag_message(source, (uint64_t)i + 1, delta.data(), delta.size(), wire[i]);
+        } else {
+            keylink_tag_message(source, (uint64_t)i + 1, states[i].data(), states[i].size(), wire[i]);
+            keyframes++;
+        }
+    }
+    double encode_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count() / count;
+    for (int i = 0; i < count; i++) keylink_tag_message(source, (uint64_t)i + 1, states[i].data(), states[i].size(), full[i]);
+
+    size_t full_bytes = 0, wire_bytes = 0;
+    for (int i = 0; i < count; i++) {
+        full_bytes += full[i].size();
+        wire_bytes += wire[i].size();
+    }
+
+    // Receiver: full states are parsed; deltas are parsed and applied
+    t0 = bench_clock::now();
+    for (int i = 0; i < count; i++) sink += keylink_ojson::parse(full[i]).size();
+    double parse_full_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count() / count;
+
+    keylink_ojson base;
+    std::string text;
+    t0 = bench_clock::now();
+    for (int i = 0; i < count; i++) {
+        keylink_ojson j = keylink_ojson::parse(wire[i]);
+        if (j["type"] == "state-delta") {
+            keylink_delta_apply(base, j);
+            base["_seq"] = j["_seq"];
+        } else {
+            base.swap(j);
+        }
+        sink += base.size();
+    }
+    double apply_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count() / count;
+
+    t0 = bench_clock::now();
+    for (int i = 0; i < count; i++) {
+        keylink_ojson j = keylink_ojson::parse(wire[i]);
+        if (j["type"] == "state-delta") {
+            keylink_delta_apply(base, j);
+            base["_seq"] = j["_seq"];
+        } else {
+            base.swap(j);
+        }
+        text = base.dump();
+        sink += text.size();
+    }
+    double apply_dump_ns = std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count() / count;
+    if (text != full[count - 1]) {
+        std::printf("rebuilt state mismatch:\n  %s\n  %s\n", text.c_str(), full[count - 1].c_str());
+        return 1;
+    }
+
+    std::printf("%d messages at 100/s, %d keyframes\n", count, keyframes);
+    std::printf("full:  %s\ndelta: %s\n\n", full[count - 1].c_str(), wire[count - 1].c_str());
+    std::printf("bytes/message      full %6.1f   delta stream %6.1f  (%.0f%% less)\n",
+                (double)full_bytes / count, (double)wire_bytes / count, 100.0 - 100.0 * wire_bytes / full_bytes);
+    std::printf("send               encode        %8.1f ns\n", encode_ns);
+    std::printf("receive            parse full    %8.1f ns\n", parse_full_ns);
+    std::printf("receive            parse delta + apply         %8.1f ns\n", apply_ns);
+    std::printf("receive            parse delta + apply + dump  %8.1f ns\n", apply_dump_ns);
+    return sink == 0xFFFFFFFF ? 2 : 0;
+}
@@ -0,0 +1,149 @@
+// fragment_bench.cpp - Large messages over UDP: one datagram vs MTU fragments
+// Tagged JSON messages of a given size (a long "notes" text) go over
+// loopback multicast in bursts, the receiver draining its socket with
+// recvmmsg into 2048-byte slots as [keylink] does. Run twice:
+//   single      each message in one datagram (before fragmentation); the
+//               receive slot truncates anything longer, and on a real LAN
+//               the IP layer would split it into MTU-sized pieces
+//   fragments   each message through keylink_fragment_message and rebuilt
+//               by keylink_reassembler
+// Reported: messages received intact, payload throughput, and the receive
+// CPU per message. Then keylink_reassembler alone, with fragments arriving
+// shuffled and some lost, to show its cost and that incomplete messages are
+// expired rather than held.
+// Usage: fragment_bench [messages] [message_bytes] [burst]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "asio.hpp"
+#include "keylink_udp.h"
+#include "keylink_dedup.h"
+#include "keylink_fragment.h"
+
+typedef std::chrono::steady_clock bench_clock;
+using asio::ip::udp;
+
+struct bench_result {
+    long intact;
+    double seconds;
+    double cpu_ms;
+};
+
+static double thread_cpu_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bench_result run(bool fragment, const std::string& message, int count, int burst) {
+    asio::io_context io;
+    udp::socket receiver(io), sender(io);
+    udp::endpoint listen_ep(udp::v4(), 7399);
+    receiver.open(listen_ep.protocol());
+    receiver.set_option(udp::socket::reuse_address(true));
+    receiver.set_option(asio::socket_base::receive_buffer_size(1024 * 1024));
+    receiver.bind(listen_ep);
+    receiver.set_option(asio::ip::multicast::join_group(asio::ip::make_address("239.255.0.99")));
+    receiver.non_blocking(true);
+    sender.open(udp::v4());
+    sender.set_option(asio::ip::multicast::enable_loopback(true));
+    udp::endpoint target(asio::ip::make_address("239.255.0.99"), 7399);
+
+    const uint64_t source = 0x9f2c4e01a7b3d658ull;
+    std::string tagged, scratch, whole;
+    udp_send_queue out;
+    udp_recv_batch in(KEYLINK_UDP_BATCH, 2048);    // As keylink.cpp
+    keylink_reassembler reassembly;
+    bench_result r = {0, 0, 0};
+    uint64_t from, seq;
+
+    bench_clock::time_point t0 = bench_clock::now();
+    for (int sent = 0; sent < count; sent += burst) {
+        for (int i = 0; i < burst && sent + i < count; i++) {
+            keylink_tag_message(source, (uint64_t)(sent + i + 1), message.data(), message.size(), tagged);
+            if (fragment) {
+                keylink_fragment_message(source, (uint32_t)(sent + i + 1), tagged.data(), tagged.size(), scratch,
+                                         [&out](const char *d, size_t n) { out.add(d, n); });
+            } else {
+                out.add(tagged.data(), tagged.size());
+            }
+        }
+        while (!out.empty()) out.flush(sender.native_handle(), target.data(), (socklen_t)target.size());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        double c0 = thread_cpu_ms();
+        int n;
+        while ((n = in.receive(receiver.native_handle())) > 0) {
+            for (int i = 0; i < n; i++) {
+                const char *data = in.data(i);
+                size_t len = in.size(i);
+                if (keylink_is_fragment(data, len)) {
+                    double now = std::chrono::duration<double, std::milli>(bench_clock::now().time_since_epoch()).count();
+                    if (!reassembly.add(data, len, now, whole)) continue;
+                    data = whole.data();
+                    len = whole.size();
+                }
+                if (len == tagged.size() && keylink_parse_tag(data, len, from, seq) && data[len - 1] == '}') r.intact++;
+            }
+        }
+        r.cpu_ms += thread_cpu_ms() - c0;
+    }
+    r.seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+    return r;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 20000;
+    size_t size = argc > 2 ? (size_t)std::atol(argv[2]) : 16384;
+    int burst = argc > 3 ? std::atoi(argv[3]) : 16;
+
+    std::string message = "{\"type\":\"notes\",\"text\":\"";
+    while (message.size() + 2 < size) message += (char)('a' + message.size() % 26);
+    message += "\"}";
+    size_t frags = keylink_fragment_count(message.size() + 40);
+    std::printf("%d messages of %zu bytes (%zu fragments of <= %d bytes each), bursts of %d\n\n", count, message.size(),
+                frags, KEYLINK_UDP_MTU_PAYLOAD, burst);
+
+    bench_result single = run(false, message, count, burst);
+    bench_result split = run(true, message, count, burst);
+    std::printf("single datagram  intact %6ld/%d   %8.1f MB/s   receive CPU %6.2f us/message\n", single.intact, count,
+                single.intact * message.size() / single.seconds / 1e6, single.cpu_ms * 1e3 / count);
+    std::printf("fragments        intact %6ld/%d   %8.1f MB/s   receive CPU %6.2f us/message\n\n", split.intact, count,
+                split.intact * message.size() / split.seconds / 1e6, split.cpu_ms * 1e3 / count);
+
+    // Reassembly alone: each message's fragments shuffled among the next
+    // message's, 1% of fragments lost
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<std::string> datagrams;
+    std::string scratch, whole;
+    for (int m = 0; m < 2000; m++) {
+        keylink_fragment_message(0x77, (uint32_t)m + 1, message.data(), message.size(), scratch,
+                                 [&](const char *d, size_t n) {
+                                     if (uniform(rng) >= 0.01) datagrams.push_back(std::string(d, n));
+                                 });
+    }
+    for (size_t i = 0; i + 2 * frags < datagrams.size(); i += frags) {
+        std::shuffle(datagrams.begin() + i, datagrams.begin() + i + 2 * frags, rng);
+    }
+    keylink_reassembler reassembly;
+    long rebuilt = 0;
+    double now = 0;
+    bench_clock::time_point t0 = bench_clock::now();
+    for (size_t i = 0; i < datagrams.size(); i++) {
+        now += 0.05;
+        if (reassembly.add(datagrams[i].data(), datagrams[i].size(), now, whole)) rebuilt++;
+    }
+    double secs = std::chrono::duration<double>(bench_clock::now() - t0).count();
+    std::printf("reassembly, shuffled, 1%% loss: %ld/2000 rebuilt at %.0f MB/s; %zu pending, %zu expired, %zu evicted\n",
+                rebuilt, rebuilt * message.size() / secs / 1e6, reassembly.pending(), reassembly.expired_count(),
+                reassembly.evicted_count());
+    return 0;
+}
@@ -0,0 +1,156 @@
+// net_lifecycle_bench.cpp - Start/stop latency of the network thread
+// Reproduces keylink_start/keylink_stop outside Max: a thread binds a UDP
+// socket, arms a receive and runs the io_context. Compares the old
+// run_for(50ms) polling loop with the work-guard driven run() that a posted
+// shutdown interrupts. Reports start -> first packet delivered, stop ->
+// thread joined, and idle wakeups of the network thread.
+// Usage: net_lifecycle_bench [cycles]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "asio.hpp"
+
+typedef std::chrono::steady_clock bench_clock;
+typedef asio::executor_work_guard<asio::io_context::executor_type> work_guard;
+
+struct net {
+    std::unique_ptr<asio::io_context> io;
+    std::unique_ptr<work_guard> guard;
+    std::unique_ptr<asio::ip::udp::socket> socket;
+    asio::ip::udp::endpoint sender;
+    char buffer[2048];
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<unsigned short> port;
+    std::atomic<long> wakeups;
+    bench_clock::time_point first_packet;
+    std::atomic<bool> got_packet;     // Set after first_packet is written
+    bool poll;
+
+    net() : running(false), port(0), wakeups(0), got_packet(false), poll(false) {}
+};
+
+static void do_receive(net *n) {
+    n->socket->async_receive_from(asio::buffer(n->buffer), n->sender,
+        [n](std::error_code ec, std::size_t) {
+            if (!ec) {
+                if (!n->got_packet) {
+                    n->first_packet = bench_clock::now();
+                    n->got_packet = true;
+                }
+                do_receive(n);
+            } else if (ec != asio::error::operation_aborted && n->running) {
+                do_receive(n);
+            }
+        });
+}
+
+static void start(net *n) {
+    n->running = true;
+    n->got_packet = false;
+    n->port = 0;
+    n->socket.reset();
+    if (!n->io) {
+        n->io.reset(new asio::io_context(1));
+    } else {
+        n->io->restart();
+    }
+    if (!n->poll) n->guard.reset(new work_guard(n->io->get_executor()));
+
+    n->thread = std::thread([n]() {
+        n->socket.reset(new asio::ip::udp::socket(*n->io));
+        asio::ip::udp::endpoint ep(asio::ip::make_address("127.0.0.1"), 0);
+        n->socket->open(ep.protocol());
+        n->socket->bind(ep);
+        do_receive(n);
+        n->port = n->socket->local_endpoint().port();
+
+        if (n->poll) {
+            while (n->running) {
+                n->io->run_for(std::chrono::milliseconds(50));
+                n->wakeups++;
+            }
+        } else {
+            n->io->run();
+            n->wakeups++;
+        }
+    });
+}
+
+static void stop(net *n) {
+    n->running = false;
+    if (!n->poll) {
+        asio::post(*n->io, [n]() {
+            std::error_code ignored;
+            n->socket->close(ignored);
+            n->guard->reset();
+        });
+    }
+    n->thread.join();
+    n->guard.reset();
+}
+
+static double ms_between(bench_clock::time_point a, bench_clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+static void report(const char *label, std::vector<double>& v) {
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for (size_t i = 0; i < v.size(); i++) sum += v[i];
+    std::printf("  %-22s mean %8.3f ms  p50 %8.3f ms  max %8.3f ms\n", label,
+                sum / v.size(), v[v.size() / 2], v.back());
+}
+
+static void run(bool poll, int cycles) {
+    net n;
+    n.poll = poll;
+    asio::io_context client_io;
+    asio::ip::udp::socket client(client_io, asio::ip::udp::v4());
+    std::vector<double> to_first, to_joined;
+
+    for (int c = 0; c < cycles; c++) {
+        bench_clock::time_point t0 = bench_clock::now();
+        start(&n);
+        while (n.port == 0) std::this_thread::yield();
+        asio::ip::udp::endpoint target(asio::ip::make_address("127.0.0.1"), n.port);
+        // Resend until delivered: the first datagram can race the receive being armed
+        while (true) {
+            client.send_to(asio::buffer("{\"type\":\"ping\"}", 15), target);
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            if (n.got_packet) break;
+        }
+        to_first.push_back(ms_between(t0, n.first_packet));
+
+        bench_clock::time_point t1 = bench_clock::now();
+        stop(&n);
+        to_joined.push_back(ms_between(t1, bench_clock::now()));
+    }
+
+    // Idle wakeups: one started, silent second
+    n.wakeups = 0;
+    start(&n);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    long idle = n.wakeups;
+    stop(&n);
+
+    std::printf("%s\n", poll ? "run_for(50ms) polling loop" : "work guard + run()");
+    report("start -> first packet", to_first);
+    report("stop -> thread joined", to_joined);
+    std::printf("  %-22s %ld per idle second\n", "loop wakeups", idle);
+}
+
+int main(int argc, char **argv) {
+    int cycles = argc > 1 ? std::atoi(argv[1]) : 50;
+    std::printf("%d start/stop cycles each\n\n", cycles);
+    run(true, cycles);
+    std::printf("\n");
+    run(false, cycles);
+    return 0;
+}
@@ -0,0 +1,135 @@
+// output_soak_bench.cpp - Symbol table and memory growth by outlet format
+// Sends a million received states, each with its own _seq and timestamp
+// and a tempo that drifts, through each [keylink] output format with Max's
+// gensym stood in for by a table that, like Max's, never frees an entry:
+//   json     the whole message becomes a symbol (as before "output")
+//   fields   keylink_each_field, as "output fields": paths, and the short
+//            strings of the fields keylink_field_is_symbol names
+//   dict     the keys "output dict" makes symbols of (strings are Max
+//            strings there)
+// A second run adds a short string "id" that is new in every message, as a
+// sender might number or name its messages. Reported per format: symbols
+// created, memory they hold, resident set growth over the run, and time
+// per message. Formats run in separate processes, so one's growth does not
+// hide another's.
+// Usage: output_soak_bench [messages]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "keylink_fields.h"
+
+// Stand-in for Max's symbol table: one entry per distinct name, kept forever
+struct bench_symbol {
+    const char *s_name;
+    void *s_thing;
+};
+
+static std::unordered_map<std::string, bench_symbol> symbols;
+static size_t symbol_bytes = 0;
+
+static bench_symbol *gensym(const char *name) {
+    std::unordered_map<std::string, bench_symbol>::iterator it = symbols.find(name);
+    if (it != symbols.end()) return &it->second;
+    it = symbols.insert(std::make_pair(std::string(name), bench_symbol())).first;
+    it->second.s_name = it->first.c_str();
+    it->second.s_thing = NULL;
+    symbol_bytes += it->first.capacity() + 1 + sizeof(bench_symbol) + 2 * sizeof(void *);
+    return &it->second;
+}
+
+static long resident_kb() {
+    long pages = 0, resident = 0;
+    FILE *f = std::fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    std::fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// What output dict makes symbols of: keys only
+static void dict_symbols(const keylink_ojson& obj) {
+    for (keylink_ojson::const_iterator it = obj.begin(); it != obj.end(); ++it) {
+        gensym(it.key().c_str());
+        const keylink_ojson& v = *it;
+        if (v.is_object()) {
+            dict_symbols(v);
+        } else if (v.is_array()) {
+            for (size_t i = 0; i < v.size(); i++) {
+                if (v[i].is_object()) dict_symbols(v[i]);
+            }
+        }
+    }
+}
+
+static void run(const char *format, long count, bool ids) {
+    static const char *keys[] = {"C", "G", "D", "A", "E", "B", "F#", "F"};
+    std::string path;
+    std::vector<keylink_field_value> values;
+    char text[512];
+    long rss0 = resident_kb();
+    double tempo = 120;
+    int key = 0;
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+        tempo += (i % 7 < 3 ? 0.01 : -0.01);
+        if (i % 500 == 0) key = (key + 1) % 8;
+        char id[32] = "";
+        if (ids) std::snprintf(id, sizeof(id), "\"id\":\"m%lx\",", (unsigned long)i);
+        int n = std::snprintf(text, sizeof(text),
+                              "{%s\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":%ld,\"type\":\"set-state\",\"state\":{\"key\":\"%s\","
+                              "\"mode\":\"Dorian\",\"tempo\":%.2f,\"chord\":{\"root\":\"%s\",\"type\":\"min7\"},"
+                              "\"scale\":[0,2,3,5,7,9,10]},\"timestamp\":%lld}",
+                              id, i + 1, keys[key], tempo, keys[(key + 3) % 8], 1712345678901LL + i * 20);
+        if (format[0] == 'j') {
+            gensym("json");
+            gensym(text);
+            continue;
+        }
+        keylink_ojson j = keylink_ojson::parse(text, text + n, nullptr, false);
+        if (format[0] == 'f') {
+            keylink_each_field(j, path, values, [](const std::string& p, const std::vector<keylink_field_value>& v) {
+                gensym(p.c_str());
+                if (!keylink_field_is_symbol(p)) return;
+                for (size_t k = 0; k < v.size(); k++) {
+                    if (v[k].type == keylink_field_value::STRING && v[k].s->size() <= KEYLINK_FIELD_SYMBOL_MAX) {
+                        gensym(v[k].s->c_str());
+                    }
+                }
+            });
+        } else {
+            gensym("dictionary");
+            dict_symbols(j);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / count;
+    std::printf("%-7s %9zu symbols  %8.1f MB in symbols  RSS +%7.1f MB  %6.0f ns/message\n", format, symbols.size(),
+                symbol_bytes / 1e6, (resident_kb() - rss0) / 1024.0, ns);
+    std::fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? std::atol(argv[1]) : 1000000;
+    const char *formats[] = {"json", "fields", "dict"};
+    for (int ids = 0; ids < 2; ids++) {
+        std::printf("%s%ld received states, unique _seq and timestamp each%s\n\n", ids ? "\n" : "", count,
+                    ids ? ", and a unique short string id" : "");
+        std::fflush(stdout);
+        for (int i = 0; i < 3; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                run(formats[i], count, ids != 0);
+                _exit(0);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }
+    return 0;
+}
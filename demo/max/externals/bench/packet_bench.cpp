@@ -0,0 +1,132 @@
+// packet_bench.cpp - Binary state packet vs JSON: encode/decode cost and size
+// The same state goes through four paths:
+//   json encode    build an nlohmann::json object and dump() it (sender)
+//   json decode    parse() the text and read every field (receiver)
+//   packet encode  keylink_packet_encode into 32 bytes
+//   packet decode  keylink_packet_decode, plus expanding it back to JSON
+//                  text the way [keylink] does before its outlet
+// and, once per send, packing the JSON a Max patch hands to [keylink]
+// (keylink_packet_from_text, only paid with "format binary").
+// Usage: packet_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "keylink_packet.h"
+
+typedef std::chrono::steady_clock bench_clock;
+using nlohmann::json;
+
+struct sample_state {
+    const char *key;
+    const char *mode;
+    double tempo;
+    bool enabled;
+    bool chord_enabled;
+    const char *chord_root;
+    const char *chord_type;
+    double confidence;
+    int scale[7];
+};
+
+static const sample_state sample = {
+    "D", "Dorian", 122.5, true, true, "G", "min7", 0.98, {0, 2, 4, 5, 7, 9, 11}
+};
+
+static json build_json(const sample_state& s, uint64_t seq) {
+    json state;
+    state["key"] = s.key;
+    state["mode"] = s.mode;
+    state["tempo"] = s.tempo;
+    state["enabled"] = s.enabled;
+    state["chordEnabled"] = s.chord_enabled;
+    state["chord"] = {{"root", s.chord_root}, {"type", s.chord_type}};
+    state["confidence"] = s.confidence;
+    json scale = json::array();
+    for (int i = 0; i < 7; i++) scale.push_back(s.scale[i]);
+    state["scale"] = scale;
+    json msg;
+    msg["_src"] = "9f2c4e01a7b3d658";
+    msg["_seq"] = seq;
+    msg["type"] = "set-state";
+    msg["state"] = state;
+    return msg;
+}
+
+template <typename F>
+static double ns_per_op(int iterations, F op) {
+    bench_clock::time_point t0 = bench_clock::now();
+    for (int i = 0; i < iterations; i++) op(i);
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count() / iterations;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+    volatile size_t sink = 0;
+
+    std::string text = build_json(sample, 1).dump();
+    json untagged = build_json(sample, 1);
+    untagged.erase("_src");
+    untagged.erase("_seq");
+    std::string untagged_text = untagged.dump();
+
+    keylink_state_packet packet;
+    if (!keylink_packet_from_text(untagged_text.data(), untagged_text.size(), packet)) {
+        std::printf("sample state does not pack\n");
+        return 1;
+    }
+    packet.source = 0x9f2c4e01a7b3d658ull;
+    packet.seq = 1;
+    uint8_t wire[KEYLINK_PACKET_SIZE];
+    keylink_packet_encode(packet, wire);
+    std::string expanded;
+    keylink_packet_to_json(packet, expanded);
+    if (json::parse(expanded) != build_json(sample, 1)) {
+        std::printf("round trip mismatch:\n  %s\n  %s\n", text.c_str(), expanded.c_str());
+        return 1;
+    }
+
+    std::printf("%d iterations\n%s\n\n", iterations, text.c_str());
+    std::printf("bytes on the wire   JSON %zu   packet %d\n\n", text.size(), KEYLINK_PACKET_SIZE);
+
+    double json_encode = ns_per_op(iterations, [&](int i) {
+        sink += build_json(sample, (uint64_t)i).dump().size();
+    });
+    double json_decode = ns_per_op(iterations, [&](int) {
+        json j = json::parse(text);
+        const json& st = j["state"];
+        sink += st["key"].get_ref<const std::string&>().size() + st["mode"].get_ref<const std::string&>().size() +
+                (size_t)st["tempo"].get<double>() + st["enabled"].get<bool>() + st["chordEnabled"].get<bool>() +
+                st["chord"]["type"].get_ref<const std::string&>().size() + (size_t)(st["confidence"].get<double>() * 100) +
+                st["scale"].size() + j["_seq"].get<size_t>();
+    });
+    double packet_encode = ns_per_op(iterations, [&](int i) {
+        packet.seq = (uint64_t)i;
+        keylink_packet_encode(packet, wire);
+        sink += wire[12];
+    });
+    keylink_packet_encode(packet, wire);
+    double packet_decode = ns_per_op(iterations, [&](int) {
+        keylink_state_packet p;
+        sink += keylink_packet_decode((const char *)wire, sizeof(wire), p) ? p.tempo_milli + p.scale_mask : 0;
+    });
+    double packet_expand = ns_per_op(iterations, [&](int) {
+        keylink_state_packet p;
+        keylink_packet_decode((const char *)wire, sizeof(wire), p);
+        keylink_packet_to_json(p, expanded);
+        sink += expanded.size();
+    });
+    double packet_pack = ns_per_op(iterations, [&](int) {
+        keylink_state_packet p;
+        sink += keylink_packet_from_text(untagged_text.data(), untagged_text.size(), p) ? p.flags : 0;
+    });
+
+    std::printf("json   encode (build + dump)       %8.1f ns\n", json_encode);
+    std::printf("json   decode (parse + fields)     %8.1f ns\n", json_decode);
+    std::printf("packet encode                      %8.1f ns\n", packet_encode);
+    std::printf("packet decode                      %8.1f ns\n", packet_decode);
+    std::printf("packet decode + expand to JSON     %8.1f ns\n", packet_expand);
+    std::printf("pack JSON text from Max (send)     %8.1f ns\n", packet_pack);
+    return sink == 0xFFFFFFFF ? 2 : 0;
+}
@@ -0,0 +1,178 @@
+// redundancy_bench.cpp - Loss tolerance vs overhead of redundant state deltas
+// A sender changes one or two fields of a set-state every 20 ms and runs
+// each state through keylink_delta_encoder as [keylink] does, attaching
+// "_red" with keylink_attach_redundant; a receiver rebuilds states the way
+// link_receive does (redundant deltas chained to the base it holds first,
+// then the state itself). The link drops datagrams at random, or in bursts
+// (a Gilbert model: losses come in runs of 3 on average at the same rate).
+// For each redundancy depth, with full states and with delta on:
+//   lost      state changes never output (a delta whose base was lost is
+//             dropped until the next keyframe, as without a resync)
+//   bytes     mean datagram size, and the overhead over depth 0
+// Then what encoding with redundancy costs per state.
+// Usage: redundancy_bench [loss_percent] [states]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "keylink_delta.h"
+
+struct bench_result {
+    long lost;
+    double bytes;
+};
+
+// The states a sender goes through: tempo drifts, the key and chord move now and then
+static std::vector<std::string> make_states(long count) {
+    static const char *keys[] = {"C", "G", "D", "A", "E", "B", "F#", "F"};
+    static const char *chords[] = {"maj7", "min7", "7", "dim", "sus4"};
+    std::mt19937 rng(11);
+    std::vector<std::string> states;
+    int key = 0, chord = 0;
+    double tempo = 120;
+    char text[256];
+    for (long i = 0; i < count; i++) {
+        int r = rng() % 10;
+        if (r < 6) tempo += (rng() % 2 ? 0.5 : -0.5);
+        else if (r < 8) chord = rng() % 5;
+        else key = rng() % 8;
+        snprintf(text, sizeof(text),
+                 "{\"type\":\"set-state\",\"state\":{\"key\":\"%s\",\"mode\":\"Ionian\",\"tempo\":%.1f,"
+                 "\"chord\":{\"root\":\"%s\",\"type\":\"%s\"},\"scale\":[0,2,4,5,7,9,11]}}",
+                 keys[key], tempo, keys[(key + 3) % 8], chords[chord]);
+        states.push_back(text);
+    }
+    return states;
+}
+
+// As link_tag_message, without the parse
+static std::string tag(uint64_t seq, const std::string& msg) {
+    char head[64];
+    snprintf(head, sizeof(head), "{\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":%llu,", (unsigned long long)seq);
+    return head + msg.substr(1);
+}
+
+// As link_recover_redundant plus link_apply_delta/link_store_state, for one source
+struct bench_receiver {
+    uint64_t base_seq;
+    keylink_ojson base;
+    std::set<uint64_t> seen;
+    std::vector<bool> *got;
+
+    bool apply(uint64_t seq, const keylink_ojson& delta) {
+        if (base.is_null() || !delta.contains("base") || delta["base"].get<uint64_t>() != base_seq) return false;
+        if (!keylink_delta_apply(base, delta)) return false;
+        base_seq = seq;
+        return true;
+    }
+
+    void output(uint64_t seq) { (*got)[seq - 1] = true; }
+
+    void receive(const std::string& text) {
+        keylink_ojson j = keylink_ojson::parse(text, nullptr, false);
+        uint64_t seq = j["_seq"].get<uint64_t>();
+        if (!seen.insert(seq).second) return;
+        if (j.contains("_red")) {
+            keylink_ojson red;
+            red.swap(j["_red"]);
+            j.erase("_red");
+            for (size_t i = 0; i < red.size(); i++) {
+                uint64_t s = red[i]["_seq"].get<uint64_t>();
+                if (s <= base_seq || seen.count(s)) continue;
+                if (apply(s, red[i])) {
+                    seen.insert(s);
+                    output(s);
+                }
+            }
+        }
+        if (j["type"] == "state-delta") {
+            if (apply(seq, j)) output(seq);
+        } else if (seq > base_seq || base.is_null()) {
+            base.swap(j);
+            base_seq = seq;
+            output(seq);
+        }
+    }
+};
+
+static bench_result run(const std::vector<std::string>& states, size_t depth, bool delta_on, double loss, bool bursty) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    // Gilbert model: in the bad state every datagram is lost, runs average 3
+    const double leave_bad = 1.0 / 3, enter_bad = loss * leave_bad / (1 - loss);
+    bool bad = false;
+
+    keylink_delta_encoder encoder;
+    encoder.set_redundancy(depth);
+    std::vector<bool> got(states.size(), false);
+    bench_receiver receiver = {0, keylink_ojson(), std::set<uint64_t>(), &got};
+    std::string delta, wire, tagged;
+    double bytes = 0;
+
+    for (size_t i = 0; i < states.size(); i++) {
+        uint64_t seq = i + 1;
+        double now = i * 20.0;
+        const std::string& state = states[i];
+        bool is_delta = (delta_on || depth) && encoder.encode(state.data(), state.size(), seq, now, delta);
+        if (!delta_on) encoder.request_keyframe();
+        tagged = tag(seq, is_delta ? delta : state);
+        if (!keylink_attach_redundant(tagged.data(), tagged.size(), encoder.redundant(), wire)) wire = tagged;
+        bytes += wire.size();
+
+        bool lost;
+        if (bursty) {
+            bad = bad ? uniform(rng) >= leave_bad : uniform(rng) < enter_bad;
+            lost = bad;
+        } else {
+            lost = uniform(rng) < loss;
+        }
+        if (!lost) receiver.receive(wire);
+    }
+
+    bench_result r = {0, bytes / states.size()};
+    for (size_t i = 0; i < got.size(); i++) {
+        if (!got[i]) r.lost++;
+    }
+    return r;
+}
+
+int main(int argc, char **argv) {
+    double loss = (argc > 1 ? std::atof(argv[1]) : 5) / 100;
+    long count = argc > 2 ? std::atol(argv[2]) : 50000;
+    std::vector<std::string> states = make_states(count);
+
+    std::printf("%ld state changes every 20 ms, %.1f%% loss\n", count, loss * 100);
+    for (int delta_on = 0; delta_on < 2; delta_on++) {
+        for (int bursty = 0; bursty < 2; bursty++) {
+            std::printf("\n%s, %s loss\n", delta_on ? "delta on" : "full states", bursty ? "bursty" : "random");
+            double plain = 0;
+            for (size_t depth = 0; depth <= 3; depth++) {
+                bench_result r = run(states, depth, delta_on != 0, loss, bursty != 0);
+                if (!depth) plain = r.bytes;
+                std::printf("  redundancy %zu   lost %6ld (%5.2f%%)   %6.1f bytes/datagram (+%3.0f%%)\n", depth, r.lost,
+                            100.0 * r.lost / count, r.bytes, 100 * (r.bytes / plain - 1));
+            }
+        }
+    }
+
+    // What the sender pays per state for redundancy: a parse and a diff
+    // (without delta or redundancy a full state is sent untouched)
+    keylink_delta_encoder encoder;
+    encoder.set_redundancy(3);
+    std::string delta, wire;
+    long n = count < 20000 ? count : 20000;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++) {
+        const std::string& state = states[i];
+        encoder.encode(state.data(), state.size(), (uint64_t)i + 1, i * 20.0, delta);
+        encoder.request_keyframe();
+        keylink_attach_redundant(state.data(), state.size(), encoder.redundant(), wire);
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / n;
+    std::printf("\nsend cost, full states, redundancy 3: %.2f us/state\n", us);
+    return 0;
+}
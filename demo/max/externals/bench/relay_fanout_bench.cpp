@@ -0,0 +1,149 @@
+// relay_fanout_bench.cpp - Fan-out latency benchmark for the KeyLink relay
+// Connects N WebSocket clients to one channel of a running relay
+// (keylink-relayd or relay.js), sends timestamped messages from the first
+// client and reports per-delivery latency percentiles across the others.
+// Usage: relay_fanout_bench [host] [port] [clients] [messages] [interval_us] [channel]
+
+#define ASIO_STANDALONE
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "asio.hpp"
+#include "keylink_ws.h"
+
+using asio::ip::tcp;
+
+static long long now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct bench_state {
+    int clients_ready;
+    long long received;
+    std::vector<long long> latencies;
+};
+
+struct bench_client : std::enable_shared_from_this<bench_client> {
+    tcp::socket socket;
+    bench_state& state;
+    ws_read_buffer in;
+    bool upgraded;
+
+    bench_client(asio::io_context& io, bench_state& s) : socket(io), state(s), upgraded(false) {}
+
+    void start(const tcp::endpoint& ep, const std::string& host, const std::string& path) {
+        socket.connect(ep);
+        socket.set_option(tcp::no_delay(true));
+        std::string req =
+            "GET " + path + " HTTP/1.1\r\n"
+            "Host: " + host + "\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+        asio::write(socket, asio::buffer(req));
+        read();
+    }
+
+    void read() {
+        std::shared_ptr<bench_client> self = shared_from_this();
+        size_t free_len = 0;
+        uint8_t *dst = in.prepare(4096, free_len);
+        socket.async_read_some(asio::buffer(dst, free_len), [self](std::error_code ec, std::size_t n) {
+            if (ec) return;
+            long long t = now_ns();
+            self->in.commit(n);
+            if (!self->upgraded) {
+                std::string buffered((const char *)self->in.data(), self->in.size());
+                size_t end = buffered.find("\r\n\r\n");
+                if (end == std::string::npos) { self->read(); return; }
+                self->in.consume(end + 4);
+                self->upgraded = true;
+                self->state.clients_ready++;
+            }
+            ws_frame frame;
+            while (ws_parse_frame(self->in.data(), self->in.size(), 1 << 24, frame) == WS_PARSE_FRAME) {
+                std::string payload((const char *)frame.payload, frame.payload_len);
+                size_t pos = payload.find("\"t\":");
+                if (pos != std::string::npos) {
+                    self->state.latencies.push_back(t - std::atoll(payload.c_str() + pos + 4));
+                    self->state.received++;
+                }
+                self->in.consume(frame.frame_len);
+            }
+            self->read();
+        });
+    }
+
+    void send_text(const std::string& msg) {
+        static const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+        uint8_t header[WS_MAX_HEADER_LEN];
+        size_t header_len = ws_write_header(header, WS_OP_TEXT, msg.size(), mask);
+        std::string frame((const char *)header, header_len);
+        frame += msg;
+        ws_apply_mask((uint8_t *)&frame[header_len], msg.size(), mask);
+        asio::write(socket, asio::buffer(frame));
+    }
+};
+
+int main(int argc, char **argv) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    std::string port = argc > 2 ? argv[2] : "20801";
+    int clients = argc > 3 ? std::atoi(argv[3]) : 200;
+    int messages = argc > 4 ? std::atoi(argv[4]) : 1000;
+    int interval_us = argc > 5 ? std::atoi(argv[5]) : 1000;
+    std::string path = std::string("/") + (argc > 6 ? argv[6] : "bench");
+
+    asio::io_context io(1);
+    tcp::resolver resolver(io);
+    tcp::endpoint ep = *resolver.resolve(host, port).begin();
+
+    bench_state state;
+    state.clients_ready = 0;
+    state.received = 0;
+    state.latencies.reserve((size_t)clients * messages);
+
+    std::vector<std::shared_ptr<bench_client> > conns;
+    for (int i = 0; i < clients; i++) {
+        std::shared_ptr<bench_client> c = std::make_shared<bench_client>(io, state);
+        c->start(ep, host, path);
+        conns.push_back(c);
+    }
+    while (state.clients_ready < clients) io.run_one();
+
+    // Give the relay a moment to register every client in the channel
+    io.run_for(std::chrono::milliseconds(200));
+
+    // Representative ~300 byte state message
+    std::string filler(220, 'x');
+    long long expected = (long long)(clients - 1) * messages;
+    for (int i = 0; i < messages; i++) {
+        char msg[512];
+        std::snprintf(msg, sizeof(msg), "{\"type\":\"set-state\",\"seq\":%d,\"pad\":\"%s\",\"t\":%lld}",
+                      i, filler.c_str(), now_ns());
+        conns[0]->send_text(msg);
+        io.run_for(std::chrono::microseconds(interval_us));
+    }
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (state.received < expected && std::chrono::steady_clock::now() < deadline) {
+        io.run_for(std::chrono::milliseconds(10));
+    }
+
+    std::vector<long long>& l = state.latencies;
+    if (l.empty()) {
+        std::printf("no deliveries received\n");
+        return 1;
+    }
+    std::sort(l.begin(), l.end());
+    std::printf("clients=%d messages=%d deliveries=%zu/%lld\n", clients, messages, l.size(), expected);
+    std::printf("fan-out latency us: p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+                l[l.size() * 50 / 100] / 1000.0, l[l.size() * 90 / 100] / 1000.0,
+                l[l.size() * 99 / 100] / 1000.0, l[l.size() * 999 / 1000] / 1000.0,
+                l.back() / 1000.0);
+    return 0;
+}
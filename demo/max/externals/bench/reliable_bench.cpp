@@ -0,0 +1,260 @@
+// reliable_bench.cpp - Lost states with and without NACK recovery
+// Simulates one sender changing state now and then (and pinging every
+// KEYLINK_PING_INTERVAL_MS) to several receivers over a lossy, jittery
+// multicast group. With reliable on, the sender keeps a
+// keylink_retransmit_ring and reports its newest state as [keylink] does,
+// and each receiver runs keylink_nack_tracker; NACKs and retransmissions
+// cross the same lossy network. Reported per run:
+//   stuck      state changes a receiver never got before the next change
+//   delivery   time from a change until a receiver has it (p50/p99/max)
+//   overhead   reports, NACKs and retransmissions per state sent
+// Then the cost reliable adds to sending a state (a ring copy).
+// Usage: reliable_bench [loss_percent] [receivers] [minutes]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "keylink_reliable.h"
+
+#define KEYLINK_PING_INTERVAL_MS 2000
+
+struct sim_event {
+    double at;
+    long order;
+    std::function<void()> run;
+    bool operator<(const sim_event& o) const { return at != o.at ? at > o.at : order > o.order; }
+};
+
+struct sim_datagram {
+    uint64_t seq;
+    int kind;                   // 0 state, 1 other, 2 report, 3 nack
+    uint64_t value;             // State: its change number; report: newest state seq
+    std::vector<uint64_t> seqs; // NACK
+};
+
+struct sim_receiver {
+    std::set<uint64_t> seen;
+    keylink_nack_tracker tracker;
+    bool retry_armed;
+    uint64_t state_seq;
+    uint64_t change;            // Change number of the state held
+};
+
+struct sim_result {
+    long changes, stuck, datagrams, states;
+    long reports, nacks, resends;
+    std::vector<double> delivery;
+};
+
+static sim_result simulate(bool reliable, double loss, int count, double minutes) {
+    const double latency = 1, jitter = 2, end = minutes * 60000;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::exponential_distribution<double> wait(1.0 / jitter), gap(1.0 / 800);
+    std::priority_queue<sim_event> events;
+    long order = 0;
+    double now = 0;
+    auto at = [&](double t, std::function<void()> f) { events.push(sim_event{t, order++, f}); };
+
+    sim_result r = {0, 0, 0, 0, 0, 0, 0, std::vector<double>()};
+    std::vector<sim_receiver> receivers(count);
+    for (int i = 0; i < count; i++) {
+        receivers[i].state_seq = receivers[i].change = 0;
+        receivers[i].retry_armed = false;
+    }
+    std::vector<double> changed_at(1, 0);
+    std::vector<std::vector<bool> > got;
+
+    keylink_retransmit_ring ring;
+    uint64_t seq = 0, last_state = 0;
+    double report_due = -1;
+    std::vector<uint64_t> nack;
+    std::function<void(const sim_datagram&)> send;
+    std::function<void()> report;
+    std::function<void(int, const std::vector<uint64_t>&)> send_nack;
+    long reports = 0, nacks = 0, resends = 0;
+
+    // As link_schedule_nack_retry
+    std::function<void(int)> schedule_retry = [&](int i) {
+        if (receivers[i].retry_armed) return;
+        receivers[i].retry_armed = true;
+        at(now + KEYLINK_NACK_RETRY_MS, [&, i]() {
+            receivers[i].retry_armed = false;
+            std::vector<uint64_t> again;
+            if (receivers[i].tracker.retry(now, again, [&, i](uint64_t, const std::vector<uint64_t>& seqs) {
+                    send_nack(i, seqs);
+                })) {
+                schedule_retry(i);
+            }
+        });
+    };
+    send_nack = [&](int i, const std::vector<uint64_t>& seqs) {
+        nacks++;
+        send(sim_datagram{0, 3, 0, seqs});
+        schedule_retry(i);
+    };
+
+    auto receive = [&](int i, const sim_datagram& d) {
+        sim_receiver& rc = receivers[i];
+        if (d.kind == 3) {
+            uint64_t last = 0;
+            for (size_t k = 0; k < d.seqs.size(); k++) last = std::max(last, d.seqs[k]);
+            rc.tracker.on_nack(0x77, last, now);
+            return;
+        }
+        if (!rc.seen.insert(d.seq).second) return;
+        if (reliable && !rc.tracker.on_message(0x77, d.seq, d.kind == 0, now, nack)) return;
+        if (!nack.empty()) send_nack(i, nack);
+        if (d.kind == 2) {
+            rc.tracker.on_report(0x77, d.value, rc.state_seq, now, nack);
+            if (!nack.empty()) send_nack(i, nack);
+        } else if (d.kind == 0) {
+            rc.state_seq = std::max(rc.state_seq, d.seq);
+            rc.change = d.value;
+            if (d.value < got.size() && !got[d.value][i]) {
+                got[d.value][i] = true;
+                r.delivery.push_back(now - changed_at[d.value]);
+            }
+        }
+    };
+
+    // The sender hears NACKs; everyone else hears everything. As link_on_nack.
+    double report_sent = -KEYLINK_RETRANSMIT_HOLDOFF_MS;
+    auto on_nack = [&](const sim_datagram& d) {
+        if (!reliable) return;
+        bool held = false;
+        for (size_t k = 0; k < d.seqs.size(); k++) {
+            if (!ring.holds(0x77, d.seqs[k])) continue;
+            held = true;
+            const std::string *state = ring.resend(0x77, d.seqs[k], now);
+            if (!state) continue;
+            resends++;
+            send(sim_datagram{d.seqs[k], 0, (uint64_t)std::atoi(state->c_str()), std::vector<uint64_t>()});
+        }
+        if (!held && now - report_sent >= KEYLINK_RETRANSMIT_HOLDOFF_MS) {
+            report_sent = now;
+            reports++;
+            send(sim_datagram{++seq, 2, last_state, std::vector<uint64_t>()});
+        }
+    };
+
+    // Each sender -> receiver path keeps datagram order, as a LAN does
+    std::vector<double> path_free(count + 1, 0);
+    auto arrival = [&](int path) {
+        path_free[path] = std::max(path_free[path], now + latency + wait(rng));
+        return path_free[path];
+    };
+    send = [&](const sim_datagram& d) {
+        r.datagrams++;
+        if (d.kind != 3) {
+            for (int i = 0; i < count; i++) {
+                if (uniform(rng) < loss) continue;
+                at(arrival(i), [&, i, d]() { receive(i, d); });
+            }
+        } else {
+            if (uniform(rng) >= loss) at(now + latency + wait(rng), [&, d]() { on_nack(d); });
+            for (int i = 0; i < count; i++) {
+                if (uniform(rng) >= loss) at(now + latency + wait(rng), [&, i, d]() { receive(i, d); });
+            }
+        }
+    };
+
+    report = [&]() {
+        if (now < report_due) {
+            at(report_due, report);
+            return;
+        }
+        report_due = -1;
+        report_sent = now;
+        reports++;
+        send(sim_datagram{++seq, 2, last_state, std::vector<uint64_t>()});
+    };
+
+    std::function<void()> change = [&]() {
+        uint64_t n = changed_at.size();
+        changed_at.push_back(now);
+        got.resize(n + 1, std::vector<bool>(count, false));
+        last_state = ++seq;
+        r.states++;
+        if (reliable) {
+            char text[24];
+            std::snprintf(text, sizeof(text), "%llu", (unsigned long long)n);
+            ring.put(0x77, seq, text, std::string(text).size());
+            if (report_due < 0) at(now + KEYLINK_STATE_REPORT_MS, report);
+            report_due = now + KEYLINK_STATE_REPORT_MS;
+        }
+        send(sim_datagram{seq, 0, n, std::vector<uint64_t>()});
+        if (now + 1000 < end) at(now + 20 + gap(rng), change);
+    };
+
+    std::function<void()> tick = [&]() {
+        send(sim_datagram{++seq, 1, 0, std::vector<uint64_t>()});
+        if (reliable && last_state) {
+            reports++;
+            send(sim_datagram{++seq, 2, last_state, std::vector<uint64_t>()});
+        }
+        at(now + KEYLINK_PING_INTERVAL_MS, tick);
+    };
+
+    got.resize(1, std::vector<bool>(count, true));
+    at(100, change);
+    at(KEYLINK_PING_INTERVAL_MS, tick);
+    while (!events.empty()) {
+        sim_event e = events.top();
+        events.pop();
+        if (e.at > end) break;
+        now = e.at;
+        e.run();
+    }
+
+    for (size_t n = 1; n < got.size(); n++) {
+        for (int i = 0; i < count; i++) {
+            r.changes++;
+            if (!got[n][i]) r.stuck++;
+        }
+    }
+    std::sort(r.delivery.begin(), r.delivery.end());
+    r.reports = reports;
+    r.nacks = nacks;
+    r.resends = resends;
+    return r;
+}
+
+static void print(const char *name, const sim_result& r) {
+    size_t n = r.delivery.size();
+    std::printf("%-9s stuck %5ld/%ld (%.2f%%)   delivery p50 %5.1f ms  p99 %6.1f ms  max %7.1f ms\n", name, r.stuck,
+                r.changes, 100.0 * r.stuck / r.changes, n ? r.delivery[n / 2] : 0, n ? r.delivery[n * 99 / 100] : 0,
+                n ? r.delivery[n - 1] : 0);
+    std::printf("          per state sent: %.2f reports, %.2f NACKs, %.2f retransmissions\n", (double)r.reports / r.states,
+                (double)r.nacks / r.states, (double)r.resends / r.states);
+}
+
+int main(int argc, char **argv) {
+    double loss = (argc > 1 ? std::atof(argv[1]) : 5) / 100;
+    int count = argc > 2 ? std::atoi(argv[2]) : 4;
+    double minutes = argc > 3 ? std::atof(argv[3]) : 30;
+
+    std::printf("%d receivers, %.0f min, %.1f%% loss each way, 1 ms + 2 ms mean jitter, a state change every ~0.8 s\n"
+                "stuck: a change a receiver did not get before the next one\n\n",
+                count, minutes, loss * 100);
+    print("plain", simulate(false, loss, count, minutes));
+    print("reliable", simulate(true, loss, count, minutes));
+
+    // What reliable adds to each state sent
+    std::string state = "{\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":42,\"type\":\"set-state\",\"state\":{\"key\":\"D\","
+                        "\"mode\":\"Dorian\",\"tempo\":122.5,\"chord\":{\"root\":\"G\",\"type\":\"min7\"}}}";
+    keylink_retransmit_ring ring;
+    const int puts = 5000000;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < puts; i++) ring.put(0x9f2c4e01a7b3d658ull, (uint64_t)i, state.data(), state.size());
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / puts;
+    std::printf("\nsend cost: keeping a %zu-byte state in the ring takes %.1f ns\n", state.size(), ns);
+    return 0;
+}
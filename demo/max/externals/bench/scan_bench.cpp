@@ -0,0 +1,176 @@
+// scan_bench.cpp - On-demand field scanning vs a full json.hpp parse
+// Three payloads a receiver sees: a bare set-state, the same tagged with
+// _src/_seq and a scale, and a large one with a free-text note and an
+// array of objects the receiver never reads. For each:
+//   json::parse            nlohmann::json DOM
+//   ordered_json::parse    the DOM [keylink] builds (keylink_ojson)
+//   scan key/mode/tempo    keylink_scan: top level, then "state", reading three fields
+//   state, DOM             keylink_state_from_json after ordered_json::parse
+//   state, scan            keylink_state_from_text (every state field)
+// Throughput is message bytes per second.
+// Before timing, keylink_state_from_text is checked against
+// keylink_state_from_json on every payload, re-indented and with odd
+// whitespace; on messages with escapes, exponents, wrong types and broken
+// structure; and on generated tempos in fixed, exponent and long-fraction
+// forms. Any difference is printed and the bench exits non-zero.
+// Usage: scan_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "keylink_state.h"
+
+static double sink;
+
+// The scanner must read a message exactly as the DOM path does
+static bool same_state(const std::string& msg) {
+    keylink_state scanned, parsed;
+    bool scanned_ok = keylink_state_from_text(msg.data(), msg.size(), scanned);
+    bool parsed_ok = keylink_state_from_json(keylink_ojson::parse(msg, nullptr, false), parsed);
+    if (scanned_ok == parsed_ok && memcmp(&scanned, &parsed, sizeof(scanned)) == 0) return true;
+    std::printf("MISMATCH %s\n  scan %d has %02x tempo %.17g, DOM %d has %02x tempo %.17g\n", msg.c_str(),
+                scanned_ok, scanned.has, scanned.tempo, parsed_ok, parsed.has, parsed.tempo);
+    return false;
+}
+
+static int check(const std::string *payloads, size_t count) {
+    std::vector<std::string> messages(payloads, payloads + count);
+    for (size_t i = 0; i < count; i++) {
+        keylink_ojson j = keylink_ojson::parse(payloads[i]);
+        messages.push_back(j.dump(2));
+        messages.push_back(j.dump(1, '\t'));
+        std::string spaced;
+        bool in_string = false;
+        for (size_t k = 0; k < payloads[i].size(); k++) {
+            char c = payloads[i][k];
+            if (c == '"' && (k == 0 || payloads[i][k - 1] != '\\')) in_string = !in_string;
+            bool structural = !in_string && (c == '{' || c == '}' || c == '[' || c == ']' || c == ',' || c == ':');
+            if (structural) spaced += " \r\n";
+            spaced += c;
+            if (structural) spaced += "\t ";
+        }
+        messages.push_back(spaced);
+    }
+    static const char *const edge[] = {
+        // Escapes: in the type, in names, in unread text, in keys
+        "{\"type\":\"set-\\u0073tate\",\"state\":{\"key\":\"E\"}}",
+        "{\"type\":\"set-state\",\"state\":{\"key\":\"C\\u0023\",\"mode\":\"Dor\\u0069an\"}}",
+        "{\"type\":\"set-state\",\"note\":\"he said \\\"}\\\" {\\\\\",\"state\":{\"key\":\"D\"}}",
+        "{\"type\":\"set-state\",\"state\":{\"t\\u0065mpo\":99,\"chord\":{\"root\":\"G\",\"type\":\"m\\u0037\"}}}",
+        "{\"type\":\"chat\",\"text\":\"he said \\\"}\\\" {\"}",
+        "{\"typ\\u0065\":\"set-state\",\"st\\u0061te\":{\"key\":\"A\"}}",
+        "{\"type\":\"set-state\",\"state\":{\"chord\":{\"r\\u006fot\":\"G\",\"type\":\"7\"}}}",
+        // Repeated keys: the last one counts
+        "{\"type\":\"set-state\",\"state\":{\"key\":\"D\",\"key\":\"H\",\"tempo\":90,\"tempo\":\"x\"}}",
+        "{\"type\":\"chat\",\"type\":\"set-state\",\"state\":{\"key\":\"D\"},\"state\":{\"mode\":\"minor\"}}",
+        "{\"type\":\"set-state\",\"state\":{\"chord\":{\"root\":\"G\",\"type\":\"7\",\"root\":\"Q\"}}}",
+        // Numbers: exponents, long fractions, integers too big for the fast path
+        "{\"type\":\"keylink-state\",\"state\":{\"tempo\":1.2e2,\"confidence\":9E-1}}",
+        "{\"type\":\"set-state\",\"state\":{\"tempo\":-0.000001,\"confidence\":1}}",
+        "{\"type\":\"set-state\",\"state\":{\"tempo\":123456789012345678}}",
+        "{\"type\":\"set-state\",\"state\":{\"tempo\":0.1234567890123456789}}",
+        "{\"type\":\"set-state\",\"state\":{\"scale\":[0,11,12,-1,3e0]}}",
+        // Wrong types and unknown names
+        "{\"type\":\"state\",\"state\":{}}",
+        "{\"type\":\"state\",\"state\":{\"tempo\":\"fast\",\"chord\":{\"root\":\"X\",\"type\":\"maj\"},\"scale\":[\"a\",1]}}",
+        "{\"type\":\"set-state\",\"state\":{\"enabled\":1,\"chordEnabled\":null,\"key\":7}}",
+        "{\"type\":\"set-state\",\"state\":{\"chord\":{\"type\":\"7\",\"root\":\"F#\",\"x\":[{}]},\"key\":\"b\"}}",
+        "{\"type\":\"set-state\",\"state\":[1,2]}",
+        // Not objects, or broken
+        "{\"type\":\"set-state\",\"state\":{\"key\":\"G\"}", "[1,2]", "", "{}", "{\"a\":}", "{,}", "{\"a\":1]",
+    };
+    for (size_t i = 0; i < sizeof(edge) / sizeof(edge[0]); i++) messages.push_back(edge[i]);
+
+    std::mt19937 rng(1);
+    for (int i = 0; i < 20000; i++) {
+        char tempo[64];
+        double v = (rng() % 10000000) / (double)(1 << (rng() % 20));
+        if (i % 3 == 0) std::snprintf(tempo, sizeof(tempo), "%.*e", (int)(rng() % 17), v);
+        else std::snprintf(tempo, sizeof(tempo), "%.*f", (int)(rng() % 20), v);
+        messages.push_back(std::string("{\"type\":\"set-state\",\"state\":{\"tempo\":") + tempo + "}}");
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < messages.size(); i++) {
+        if (!same_state(messages[i]) && ++failed >= 10) break;
+    }
+    if (!failed) std::printf("%zu messages read the same by scan and DOM\n\n", messages.size());
+    return failed;
+}
+
+template <typename F>
+static void run(const char *name, const std::string& msg, long iterations, F f) {
+    for (long i = 0; i < iterations / 10; i++) f();
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) f();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / iterations;
+    std::printf("  %-22s %8.0f ns/message  %6.2f GB/s\n", name, ns, msg.size() / ns);
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? std::atol(argv[1]) : 200000;
+    std::string notes;
+    for (int i = 0; i < 12; i++) {
+        notes += i ? "," : "";
+        notes += "{\"beat\":" + std::to_string(i) + ",\"velocity\":0.8,\"pitch\":[60,64,67]}";
+    }
+    const std::string payloads[3][2] = {
+        {"bare set-state",
+         "{\"type\":\"set-state\",\"state\":{\"key\":\"D\",\"mode\":\"Dorian\",\"tempo\":122.5,"
+         "\"chord\":{\"root\":\"G\",\"type\":\"min7\"}}}"},
+        {"tagged, with scale",
+         "{\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":48213,\"type\":\"set-state\",\"state\":{\"enabled\":true,"
+         "\"key\":\"D\",\"mode\":\"Dorian\",\"tempo\":122.5,\"chordEnabled\":true,\"chord\":{\"root\":\"G\","
+         "\"type\":\"min7\"},\"confidence\":0.92,\"scale\":[0,2,3,5,7,9,10]},\"timestamp\":1712345678901}"},
+        {"large, unread fields",
+         "{\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":48213,\"type\":\"set-state\",\"note\":\"Bridge: hold the "
+         "Dorian colour, let the bass walk down to the IV before the turnaround, then back to the top.\","
+         "\"pattern\":[" + notes + "],\"state\":{\"key\":\"D\",\"mode\":\"Dorian\",\"tempo\":122.5,"
+         "\"chord\":{\"root\":\"G\",\"type\":\"min7\"},\"scale\":[0,2,3,5,7,9,10]},\"timestamp\":1712345678901}"}};
+
+    std::string texts[3] = {payloads[0][1], payloads[1][1], payloads[2][1]};
+    if (check(texts, 3)) return 1;
+
+    for (int i = 0; i < 3; i++) {
+        const std::string& msg = payloads[i][1];
+        const char *data = msg.data();
+        size_t len = msg.size();
+        std::printf("%s (%zu bytes)\n", payloads[i][0].c_str(), len);
+
+        run("json::parse", msg, iterations, [&]() {
+            nlohmann::json j = nlohmann::json::parse(data, data + len, nullptr, false);
+            sink += j.size();
+        });
+        run("ordered_json::parse", msg, iterations, [&]() {
+            keylink_ojson j = keylink_ojson::parse(data, data + len, nullptr, false);
+            sink += j.size();
+        });
+        run("scan key/mode/tempo", msg, iterations, [&]() {
+            keylink_scan top, state;
+            const char *p;
+            size_t n;
+            double tempo = 0;
+            if (top.scan(data, len) && top.object("state", state)) {
+                if (state.string("key", p, n)) sink += n;
+                if (state.string("mode", p, n)) sink += n;
+                if (state.number("tempo", tempo)) sink += tempo;
+            }
+        });
+        run("state, DOM", msg, iterations, [&]() {
+            keylink_state s;
+            keylink_ojson j = keylink_ojson::parse(data, data + len, nullptr, false);
+            keylink_state_from_json(j, s);
+            sink += s.tempo;
+        });
+        run("state, scan", msg, iterations, [&]() {
+            keylink_state s;
+            keylink_state_from_text(data, len, s);
+            sink += s.tempo;
+        });
+        std::printf("\n");
+    }
+    return sink > 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+// state_bench.cpp - Typed state outlets vs per-field symbols
+// Received set-states, each with its own _seq and a drifting tempo, go out
+// as key, mode, chord and tempo three ways:
+//   fields   "output fields" (keylink_each_field): the state is parsed on
+//            the Max thread and every path and short string is gensym'd
+//   typed    keylink_state_from_text on the network thread, then the
+//            outlets index tables of symbols made once at load
+//   packet   as typed, for a binary state packet (no parse at all)
+// gensym is stood in for by a hash table like Max's. Reported per message:
+// time on the network thread, time on the Max thread, and the symbol
+// lookups the Max thread makes (each one hashes a string).
+// Usage: state_bench [messages]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "keylink_fields.h"
+#include "keylink_state.h"
+
+struct bench_symbol {
+    const char *s_name;
+};
+
+static std::unordered_map<std::string, bench_symbol> symbols;
+static long lookups = 0;
+
+static bench_symbol *gensym(const char *name) {
+    lookups++;
+    std::unordered_map<std::string, bench_symbol>::iterator it = symbols.find(name);
+    if (it == symbols.end()) {
+        it = symbols.insert(std::make_pair(std::string(name), bench_symbol())).first;
+        it->second.s_name = it->first.c_str();
+    }
+    return &it->second;
+}
+
+// What the outlets are handed, so the work is not optimized away
+static const void *sink;
+static double sink_f;
+
+static double elapsed_ns(std::chrono::steady_clock::time_point t0, long n) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? std::atol(argv[1]) : 200000;
+    static const char *keys[] = {"C", "G", "D", "A", "E", "B", "F#", "Db"};
+    static const char *chords[] = {"maj7", "min7", "7", "dim", "sus4"};
+    std::vector<std::string> texts;
+    std::vector<keylink_state_packet> packets(count);
+    char text[512];
+    double tempo = 120;
+    for (long i = 0; i < count; i++) {
+        tempo += (i % 7 < 3 ? 0.25 : -0.25);
+        std::snprintf(text, sizeof(text),
+                      "{\"_src\":\"9f2c4e01a7b3d658\",\"_seq\":%ld,\"type\":\"set-state\",\"state\":{\"key\":\"%s\","
+                      "\"mode\":\"Dorian\",\"tempo\":%.2f,\"chord\":{\"root\":\"%s\",\"type\":\"%s\"},"
+                      "\"scale\":[0,2,3,5,7,9,10]}}",
+                      i + 1, keys[(i / 50) % 8], tempo, keys[(i / 50 + 3) % 8], chords[(i / 10) % 5]);
+        texts.push_back(text);
+        keylink_packet_from_text(texts.back().data(), texts.back().size(), packets[i]);
+    }
+
+    // The symbols typed outlets use, made once
+    bench_symbol *roots[KEYLINK_ROOT_COUNT], *modes[KEYLINK_MODE_COUNT], *chord_types[KEYLINK_CHORD_COUNT];
+    for (int i = 0; i < KEYLINK_ROOT_COUNT; i++) roots[i] = gensym(keylink_state_roots[i]);
+    for (int i = 0; i < KEYLINK_MODE_COUNT; i++) modes[i] = gensym(keylink_state_modes[i]);
+    for (int i = 0; i < KEYLINK_CHORD_COUNT; i++) chord_types[i] = gensym(keylink_state_chords[i]);
+
+    std::printf("%ld received states\n\n", count);
+    std::printf("%-8s %14s %14s %16s\n", "", "network ns/msg", "Max ns/msg", "lookups/msg");
+
+    // fields: nothing on the network thread; parse and gensym on the Max thread
+    std::string path;
+    std::vector<keylink_field_value> values;
+    lookups = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) {
+        keylink_ojson j = keylink_ojson::parse(texts[i], nullptr, false);
+        keylink_each_field(j, path, values, [](const std::string& p, const std::vector<keylink_field_value>& v) {
+            sink = gensym(p.c_str());
+            for (size_t k = 0; k < v.size(); k++) {
+                if (v[k].type == keylink_field_value::STRING) sink = gensym(v[k].s->c_str());
+                else sink_f += v[k].type == keylink_field_value::FLOAT ? v[k].f : (double)v[k].l;
+            }
+        });
+    }
+    std::printf("%-8s %14.0f %14.0f %16.1f\n", "fields", 0.0, elapsed_ns(t0, count), (double)lookups / count);
+
+    // typed and packet: the struct is filled on the network thread ...
+    std::vector<keylink_state> states(count);
+    t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) keylink_state_from_text(texts[i].data(), texts[i].size(), states[i]);
+    double typed_net = elapsed_ns(t0, count);
+    std::vector<keylink_state> packed(count);
+    t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) keylink_state_from_packet(packets[i], packed[i]);
+    double packet_net = elapsed_ns(t0, count);
+
+    // ... and the Max thread only indexes the tables
+    const std::vector<keylink_state> *runs[2] = {&states, &packed};
+    double nets[2] = {typed_net, packet_net};
+    const char *names[2] = {"typed", "packet"};
+    for (int r = 0; r < 2; r++) {
+        lookups = 0;
+        t0 = std::chrono::steady_clock::now();
+        for (long i = 0; i < count; i++) {
+            const keylink_state& s = (*runs[r])[i];
+            if (s.has & KEYLINK_STATE_HAS_TEMPO) sink_f += s.tempo;
+            if (s.has & KEYLINK_STATE_HAS_CHORD) sink = roots[s.chord_root], sink = chord_types[s.chord_type];
+            if (s.has & KEYLINK_STATE_HAS_MODE) sink = modes[s.mode];
+            if (s.has & KEYLINK_STATE_HAS_KEY) sink = roots[s.key];
+        }
+        std::printf("%-8s %14.0f %14.1f %16.1f\n", names[r], nets[r], elapsed_ns(t0, count), (double)lookups / count);
+    }
+
+    std::printf("\nsizeof(keylink_state) %zu bytes, %zu symbols in the table\n", sizeof(keylink_state), symbols.size());
+    return sink ? 0 : 1;
+}
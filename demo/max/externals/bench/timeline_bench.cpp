@@ -0,0 +1,193 @@
+// timeline_bench.cpp - How closely session peers agree on the beat
+// Simulates a session: peers with clocks seconds apart and drifting by
+// tens of ppm join one by one, ping each other and announce the timeline
+// every KEYLINK_PING_INTERVAL_MS over a lossy, jittery multicast group,
+// and change tempo now and then. Each peer runs keylink_clock_estimate and
+// keylink_timeline_judge exactly as [keylink] does. Reported:
+//   convergence    time from a tempo change until every peer has it
+//   disagreement   spread of the beat the peers are at, in ms, sampled
+//                  every 10 ms once a change has settled
+// Usage: timeline_bench [peers] [jitter_ms] [minutes]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <queue>
+#include <random>
+#include <vector>
+#include "keylink_clock.h"
+#include "keylink_timeline.h"
+
+#define KEYLINK_PING_INTERVAL_MS 2000
+#define KEYLINK_TIMELINE_LISTEN_MS 2500
+
+struct sim_event {
+    double at;
+    long order;
+    std::function<void()> run;
+    bool operator<(const sim_event& o) const { return at != o.at ? at > o.at : order > o.order; }
+};
+
+struct sim_peer {
+    double offset, drift;       // Clock = true time * (1 + drift) + offset
+    double joined;
+    bool in_session;
+    std::vector<keylink_clock_estimate> clocks;
+    keylink_timeline timeline;
+    bool estimated, provisional;
+
+    double clock(double t) const { return t * (1 + drift) + offset; }
+};
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 4;
+    double jitter = argc > 2 ? std::atof(argv[2]) : 2;
+    double minutes = argc > 3 ? std::atof(argv[3]) : 10;
+    const double latency = 0.3, loss = 0.01, end = minutes * 60000;
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::exponential_distribution<double> wait(1.0 / jitter);
+    std::priority_queue<sim_event> events;
+    long order = 0;
+    double now = 0;
+    auto at = [&](double t, std::function<void()> f) { events.push(sim_event{t, order++, f}); };
+    auto trip = [&]() { return latency + wait(rng); };
+
+    std::vector<sim_peer> peers(count);
+    for (int i = 0; i < count; i++) {
+        peers[i].offset = i == 0 ? 1.7e12 : 1.7e12 + (uniform(rng) - 0.5) * 4000;
+        peers[i].drift = (uniform(rng) - 0.5) * 100e-6;
+        peers[i].joined = i * 5000.0;
+        peers[i].in_session = false;
+        peers[i].clocks.resize(count);
+        peers[i].estimated = peers[i].provisional = false;
+    }
+
+    // Multicast to everyone else, each copy with its own delay and loss
+    auto multicast = [&](int from, std::function<void(int)> deliver) {
+        for (int j = 0; j < count; j++) {
+            if (j == from || !peers[j].in_session || uniform(rng) < loss) continue;
+            at(now + trip(), [j, deliver]() { deliver(j); });
+        }
+    };
+
+    auto announce = [&](int i) {
+        keylink_timeline t = peers[i].timeline;
+        t.anchor(peers[i].clock(now));
+        multicast(i, [&, i, t](int j) {
+            sim_peer& p = peers[j];
+            keylink_timeline theirs = t;
+            bool estimated = p.clocks[i].valid();
+            double local = p.clock(now);
+            if (estimated) theirs.time -= p.clocks[i].offset_at(local);
+            keylink_timeline_verdict v = keylink_timeline_judge(p.timeline, p.estimated, p.provisional, theirs,
+                                                                estimated, (uint64_t)i + 1 == theirs.owner);
+            if (v == KEYLINK_TIMELINE_TAKE) {
+                p.timeline = theirs;
+                p.estimated = estimated;
+                p.provisional = false;
+            }
+        });
+    };
+
+    auto ping = [&](int i) {
+        double t0 = peers[i].clock(now);
+        multicast(i, [&, i, t0](int j) {
+            double t1 = peers[j].clock(now), t2 = peers[j].clock(now + 0.05);
+            if (uniform(rng) < loss) return;
+            at(now + 0.05 + trip(), [&, i, j, t0, t1, t2]() { peers[i].clocks[j].add(t0, t1, t2, peers[i].clock(now)); });
+        });
+    };
+
+    // Each peer's tick: ping, then announce once past listening
+    std::function<void(int)> tick = [&](int i) {
+        sim_peer& p = peers[i];
+        ping(i);
+        if (p.provisional && now - p.joined >= KEYLINK_TIMELINE_LISTEN_MS) p.provisional = false;
+        if (!p.provisional) announce(i);
+        at(now + KEYLINK_PING_INTERVAL_MS, [&, i]() { tick(i); });
+    };
+
+    for (int i = 0; i < count; i++) {
+        at(peers[i].joined, [&, i]() {
+            sim_peer& p = peers[i];
+            p.in_session = true;
+            p.timeline = keylink_timeline_change(keylink_timeline(), 0, 0, p.clock(now), (uint64_t)i + 1);
+            p.provisional = p.estimated = true;
+            at(now + uniform(rng) * KEYLINK_PING_INTERVAL_MS, [&, i]() { tick(i); });
+        });
+    }
+
+    // Tempo changes from different peers; first from peer 0 once everyone has joined
+    std::vector<double> changes;
+    for (double t = count * 5000.0 + 10000; t < end - 30000; t += 90000) changes.push_back(t);
+    for (size_t n = 0; n < changes.size(); n++) {
+        int who = (int)(n % count);
+        double bpm = 90 + 10 * (double)(n % 5);
+        at(changes[n], [&, who, bpm]() {
+            sim_peer& p = peers[who];
+            p.timeline = keylink_timeline_change(p.timeline, bpm, 0, p.clock(now), (uint64_t)who + 1);
+            p.provisional = false;
+            p.estimated = true;
+            announce(who);
+        });
+    }
+
+    // Sample the beat every peer is at for the same true instant
+    std::vector<double> spread, converge;
+    size_t next_change = 0;
+    double changed_at = -1;
+    std::function<void()> sample = [&]() {
+        if (next_change < changes.size() && now >= changes[next_change]) {
+            changed_at = changes[next_change++];
+        }
+        bool agree = true;
+        for (int i = 1; i < count; i++) {
+            agree = agree && peers[i].in_session && peers[i].timeline.version == peers[0].timeline.version &&
+                    peers[i].timeline.owner == peers[0].timeline.owner;
+        }
+        if (changed_at >= 0 && agree) {
+            converge.push_back(now - changed_at);
+            changed_at = -2;
+        }
+        // Settled: everyone on one version for a while, clocks measured
+        bool settled = agree && now > count * 5000.0 + 60000 &&
+                       (next_change == 0 || now - changes[next_change - 1] > 20000);
+        if (settled) {
+            double lo = 1e300, hi = -1e300;
+            for (int i = 0; i < count; i++) {
+                double b = peers[i].timeline.beat_at(peers[i].clock(now));
+                lo = std::min(lo, b);
+                hi = std::max(hi, b);
+            }
+            spread.push_back((hi - lo) * 60000.0 / peers[0].timeline.tempo);
+        }
+        if (now + 10 < end) at(now + 10, sample);
+    };
+    at(0, sample);
+
+    while (!events.empty()) {
+        sim_event e = events.top();
+        events.pop();
+        if (e.at > end) break;
+        now = e.at;
+        e.run();
+    }
+
+    if (spread.empty()) {
+        std::printf("session never settled\n");
+        return 1;
+    }
+    std::sort(spread.begin(), spread.end());
+    std::sort(converge.begin(), converge.end());
+    std::printf("%d peers, %.0f min, latency %.1f ms + %.1f ms mean jitter, %.0f%% loss, clocks up to 2 s apart, +-50 ppm\n",
+                count, minutes, latency, jitter, loss * 100);
+    std::printf("tempo changes      %zu, all peers on the new version after median %.1f ms, max %.1f ms\n",
+                converge.size(), converge.empty() ? 0 : converge[converge.size() / 2], converge.empty() ? 0 : converge.back());
+    std::printf("beat disagreement  median %.3f ms   p99 %.3f ms   max %.3f ms   (%zu samples)\n",
+                spread[spread.size() / 2], spread[spread.size() * 99 / 100], spread.back(), spread.size());
+    return 0;
+}
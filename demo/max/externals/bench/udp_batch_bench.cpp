@@ -0,0 +1,143 @@
+// udp_batch_bench.cpp - Packets/sec of per-datagram asio UDP vs batched mmsg
+// Receive: a burst of datagrams is queued on a loopback socket, then drained
+// either with one async_receive_from completion per datagram (the old
+// udp_do_receive) or with async_wait + udp_recv_batch (recvmmsg). Only the
+// draining is timed.
+// Send: the same payloads go out with one async_send_to per datagram (the
+// old send_message) or through udp_send_queue (sendmmsg).
+// Usage: udp_batch_bench [packets] [burst] [payload_bytes]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include "asio.hpp"
+#include "keylink_udp.h"
+
+typedef std::chrono::steady_clock bench_clock;
+using asio::ip::udp;
+
+static double seconds_since(bench_clock::time_point t0) {
+    return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+// Queue `burst` datagrams on the receiver without timing it
+static void fill(udp::socket& sender, const udp::endpoint& target, const std::string& payload, int burst) {
+    udp_send_queue q;
+    for (int i = 0; i < burst; i++) q.add(payload.data(), payload.size());
+    while (!q.empty()) q.flush(sender.native_handle(), target.data(), (socklen_t)target.size());
+}
+
+struct per_packet_receiver {
+    udp::socket& socket;
+    udp::endpoint from;
+    char buffer[2048];
+    int remaining;
+
+    explicit per_packet_receiver(udp::socket& s) : socket(s), remaining(0) {}
+
+    void arm() {
+        socket.async_receive_from(asio::buffer(buffer), from, [this](std::error_code ec, std::size_t) {
+            if (!ec && --remaining > 0) arm();
+        });
+    }
+};
+
+struct batch_receiver {
+    udp::socket& socket;
+    udp_recv_batch in;
+    int remaining;
+
+    explicit batch_receiver(udp::socket& s) : socket(s), in(KEYLINK_UDP_BATCH, 2048), remaining(0) {}
+
+    void arm() {
+        socket.async_wait(asio::socket_base::wait_read, [this](std::error_code ec) {
+            if (ec) return;
+            int n;
+            while ((n = in.receive(socket.native_handle())) > 0) {
+                remaining -= n;
+                if ((size_t)n < in.count) break;
+            }
+            if (remaining > 0) arm();
+        });
+    }
+};
+
+int main(int argc, char **argv) {
+    int packets = argc > 1 ? std::atoi(argv[1]) : 200000;
+    int burst = argc > 2 ? std::atoi(argv[2]) : 128;
+    size_t payload_len = argc > 3 ? (size_t)std::atoi(argv[3]) : 200;
+    std::string payload(payload_len, 'k');
+
+    asio::io_context io(1);
+    udp::socket receiver(io, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    receiver.set_option(asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+    udp::socket sender(io, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    udp::endpoint target = receiver.local_endpoint();
+
+    int rounds = packets / burst;
+    std::printf("%d packets in bursts of %d, %zu byte payload\n\n", rounds * burst, burst, payload_len);
+
+    // Receive, per datagram
+    {
+        per_packet_receiver r(receiver);
+        double t = 0;
+        for (int i = 0; i < rounds; i++) {
+            fill(sender, target, payload, burst);
+            bench_clock::time_point t0 = bench_clock::now();
+            r.remaining = burst;
+            r.arm();
+            io.restart();
+            io.run();
+            t += seconds_since(t0);
+        }
+        std::printf("receive  async_receive_from      %10.0f packets/s\n", rounds * burst / t);
+    }
+
+    // Receive, batched
+    {
+        batch_receiver r(receiver);
+        double t = 0;
+        for (int i = 0; i < rounds; i++) {
+            fill(sender, target, payload, burst);
+            bench_clock::time_point t0 = bench_clock::now();
+            r.remaining = burst;
+            r.arm();
+            io.restart();
+            io.run();
+            t += seconds_since(t0);
+        }
+        std::printf("receive  async_wait + recvmmsg   %10.0f packets/s\n", rounds * burst / t);
+    }
+
+    // The sink is never drained; loopback drops what does not fit
+    udp::socket sink(io, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    udp::endpoint sink_ep = sink.local_endpoint();
+
+    // Send, per datagram
+    {
+        bench_clock::time_point t0 = bench_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            for (int j = 0; j < burst; j++) {
+                std::shared_ptr<std::string> p = std::make_shared<std::string>(payload);
+                sender.async_send_to(asio::buffer(*p), sink_ep, [p](std::error_code, std::size_t) {});
+            }
+            io.restart();
+            io.run();
+        }
+        std::printf("send     async_send_to           %10.0f packets/s\n", rounds * burst / seconds_since(t0));
+    }
+
+    // Send, batched
+    {
+        udp_send_queue q;
+        bench_clock::time_point t0 = bench_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            for (int j = 0; j < burst; j++) q.add(payload.data(), payload.size());
+            while (!q.empty()) q.flush(sender.native_handle(), sink_ep.data(), (socklen_t)sink_ep.size());
+        }
+        std::printf("send     udp_send_queue/sendmmsg %10.0f packets/s\n", rounds * burst / seconds_since(t0));
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+// udp_uring_bench.cpp - UDP receive cost: epoll + recvmmsg vs io_uring multishot
+// A paced sender pushes datagrams at a fixed rate to a loopback socket for
+// each rate in the list; the receiver thread runs an asio io_context with
+// either the udp_recv_batch path (async_wait + recvmmsg) or
+// udp_uring_receiver (async_wait on the ring fd + drain). Reports datagrams
+// received, loss and receiver-thread CPU time per datagram.
+// Usage: udp_uring_bench [seconds_per_rate] [payload_bytes]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <time.h>
+#include "asio.hpp"
+#include "keylink_udp.h"
+#include "keylink_uring.h"
+
+typedef std::chrono::steady_clock bench_clock;
+using asio::ip::udp;
+
+static double thread_cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct receiver_result {
+    long received;
+    double cpu;
+    unsigned long wakeups;
+    unsigned long rearms;
+};
+
+struct receiver {
+    asio::io_context io;
+    udp::socket socket;
+    udp_recv_batch batch;
+    std::atomic<long> received;
+    unsigned long wakeups;
+    bool use_uring;
+#if KEYLINK_HAS_IO_URING
+    udp_uring_receiver uring;
+    std::unique_ptr<asio::posix::stream_descriptor> ring;
+#endif
+
+    explicit receiver(bool uring_mode)
+        : io(1), socket(io, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0)),
+          batch(KEYLINK_UDP_BATCH, 2048), received(0), wakeups(0), use_uring(uring_mode) {
+        socket.set_option(asio::socket_base::receive_buffer_size(4 * 1024 * 1024));
+    }
+
+    void arm_epoll() {
+        socket.async_wait(asio::socket_base::wait_read, [this](std::error_code ec) {
+            if (ec) return;
+            wakeups++;
+            int n;
+            while ((n = batch.receive(socket.native_handle())) > 0) {
+                received += n;
+                if ((size_t)n < batch.count) break;
+            }
+            arm_epoll();
+        });
+    }
+
+#if KEYLINK_HAS_IO_URING
+    void arm_uring() {
+        ring->async_wait(asio::posix::stream_descriptor::wait_read, [this](std::error_code ec) {
+            if (ec) return;
+            wakeups++;
+            long n = (long)uring.drain([](const char *, size_t) {});
+            received += n;
+            arm_uring();
+        });
+    }
+#endif
+
+    bool start(std::string& error) {
+        if (!use_uring) {
+            arm_epoll();
+            return true;
+        }
+#if KEYLINK_HAS_IO_URING
+        if (!uring.open(socket.native_handle(), 1024, 2048, error)) return false;
+        ring.reset(new asio::posix::stream_descriptor(io, uring.fd()));
+        arm_uring();
+        return true;
+#else
+        error = "io_uring not available on this platform";
+        return false;
+#endif
+    }
+
+    void shutdown() {
+        std::error_code ignored;
+        socket.cancel(ignored);
+#if KEYLINK_HAS_IO_URING
+        // The ring fd belongs to udp_uring_receiver
+        if (ring) {
+            ring->cancel(ignored);
+            ring->release();
+        }
+#endif
+    }
+};
+
+static bool run_rate(bool uring, int rate, double seconds, size_t payload_len) {
+    receiver r(uring);
+    std::string error;
+    if (!r.start(error)) {
+        std::printf("  %-8s %7d pps  unavailable: %s\n", uring ? "io_uring" : "epoll", rate, error.c_str());
+        return false;
+    }
+    udp::endpoint target = r.socket.local_endpoint();
+
+    receiver_result result;
+    std::thread t([&r, &result]() {
+        double c0 = thread_cpu_seconds();
+        r.io.run();
+        result.cpu = thread_cpu_seconds() - c0;
+        result.wakeups = r.wakeups;
+#if KEYLINK_HAS_IO_URING
+        result.rearms = r.uring.rearm_count();
+#else
+        result.rearms = 0;
+#endif
+    });
+
+    // Pace in 1 ms ticks with sendmmsg bursts
+    asio::io_context send_io;
+    udp::socket sender(send_io, udp::v4());
+    std::string payload(payload_len, 'k');
+    udp_send_queue q;
+    long sent = 0;
+    long target_total = (long)(rate * seconds);
+    bench_clock::time_point t0 = bench_clock::now();
+    while (sent < target_total) {
+        double elapsed = std::chrono::duration<double>(bench_clock::now() - t0).count();
+        long due = std::min(target_total, (long)(elapsed * rate));
+        for (; sent < due; sent++) q.add(payload.data(), payload.size());
+        while (!q.empty()) q.flush(sender.native_handle(), target.data(), (socklen_t)target.size());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    asio::post(r.io, [&r]() { r.shutdown(); });
+    t.join();
+    result.received = r.received;
+
+    std::printf("  %-8s %7d pps  received %8ld  loss %5.2f%%  %6.3f us CPU/datagram  %8lu wakeups  %lu re-arms\n",
+                uring ? "io_uring" : "epoll", rate, result.received,
+                100.0 * (sent - result.received) / sent,
+                result.received ? result.cpu * 1e6 / result.received : 0.0,
+                result.wakeups, result.rearms);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? std::atof(argv[1]) : 2.0;
+    size_t payload_len = argc > 2 ? (size_t)std::atoi(argv[2]) : 200;
+    static const int rates[] = {10000, 50000, 100000, 200000};
+    std::printf("%.1f s per rate, %zu byte datagrams, loopback\n\n", seconds, payload_len);
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        run_rate(false, rates[i], seconds, payload_len);
+        run_rate(true, rates[i], seconds, payload_len);
+    }
+    return 0;
+}
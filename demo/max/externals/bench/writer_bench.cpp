@@ -0,0 +1,131 @@
+// writer_bench.cpp - Building an outgoing set-state: json.hpp vs keylink_writer
+// The same state (key, mode, tempo, chord, confidence, scale, a drifting
+// tempo so no two messages are equal) is written as
+//   {"type":"set-state","state":{...},"source":...,"timestamp":N}
+// three ways:
+//   json dump        nlohmann::json built field by field, then dump()
+//   ordered dump     the same with ordered_json (field order kept)
+//   writer           keylink_write_state into a reused keylink_writer
+// Reported per message: time and heap allocations (alloc_count.h).
+// First, every root, mode and chord type, with whole and fractional tempos,
+// is written both ways and the two outputs parsed back: they must be the
+// same JSON, field order included, or the bench fails. The text is not
+// byte for byte the same: the writer drops a whole number's ".0" and keeps
+// at most six decimals.
+// Usage: writer_bench [messages]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "alloc_count.h"
+#include "keylink_writer.h"
+
+static size_t sink;
+
+template <typename Json>
+static std::string dump_state(const keylink_state& s, long long timestamp) {
+    Json scale = Json::array();
+    for (int pc = 0; pc < 12; pc++) {
+        if (s.scale_mask & (1 << pc)) scale.push_back(pc);
+    }
+    Json msg = {
+        {"type", "set-state"},
+        {"state", {
+            {"key", keylink_state_roots[s.key]},
+            {"mode", keylink_state_modes[s.mode]},
+            {"tempo", s.tempo},
+            {"chord", {{"root", keylink_state_roots[s.chord_root]}, {"type", keylink_state_chords[s.chord_type]}}},
+            {"confidence", s.confidence},
+            {"scale", scale}
+        }},
+        {"source", "max_offline"},
+        {"timestamp", timestamp}
+    };
+    return msg.dump();
+}
+
+static void write_message(keylink_writer& w, const keylink_state& s, long long timestamp) {
+    w.clear();
+    w.literal("{\"type\":\"set-state\",\"state\":");
+    keylink_write_state(w, s);
+    w.literal(",\"source\":\"max_offline\",\"timestamp\":");
+    w.integer(timestamp);
+    w.literal("}");
+}
+
+// The writer's message, parsed, against json.hpp's for the same state
+static bool check(const keylink_state& s, long long timestamp) {
+    keylink_writer w;
+    write_message(w, s, timestamp);
+    std::string expected = dump_state<nlohmann::ordered_json>(s, timestamp);
+    nlohmann::ordered_json written = nlohmann::ordered_json::parse(w.data(), w.data() + w.size(), nullptr, false);
+    if (w.ok() && written == nlohmann::ordered_json::parse(expected)) return true;
+    std::printf("MISMATCH\n  json.hpp: %s\n  writer:   %.*s\n", expected.c_str(), (int)w.size(), w.data());
+    return false;
+}
+
+template <typename F>
+static void run(const char *name, long count, F f) {
+    for (long i = 0; i < count / 10; i++) f(i);
+    alloc_count = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (long i = 0; i < count; i++) f(i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / count;
+    std::printf("%-14s %10.0f %14.1f\n", name, ns, (double)alloc_count / count);
+}
+
+int main(int argc, char **argv) {
+    long count = argc > 1 ? std::atol(argv[1]) : 200000;
+    keylink_state s;
+    memset(&s, 0, sizeof(s));
+    s.key = KEYLINK_ROOT_D;
+    s.mode = KEYLINK_MODE_DORIAN;
+    s.chord_root = KEYLINK_ROOT_G;
+    s.chord_type = KEYLINK_CHORD_M7;
+    s.confidence = 0.92;
+    s.scale_mask = 0x6AD;      // 0,2,3,5,7,9,10
+    s.has = KEYLINK_STATE_HAS_KEY | KEYLINK_STATE_HAS_MODE | KEYLINK_STATE_HAS_TEMPO | KEYLINK_STATE_HAS_CHORD |
+            KEYLINK_STATE_HAS_CONFIDENCE | KEYLINK_STATE_HAS_SCALE;
+    const long long timestamp = 1712345678901LL;
+
+    static const double tempos[] = {120, 122.5, 60.125, 87.333333, 200, 33.3, 0.25};
+    static const double confidences[] = {0, 1, 0.92, 0.5, 0.123456};
+    static const uint16_t scales[] = {0x6AD, 0xAB5, 0, 0xFFF, 0x001};
+    long checked = 0, failed = 0;
+    for (int key = 0; key < KEYLINK_ROOT_COUNT; key++) {
+        for (int mode = 0; mode < KEYLINK_MODE_COUNT; mode++) {
+            for (int chord = 0; chord < KEYLINK_CHORD_COUNT; chord++, checked++) {
+                keylink_state c = s;
+                c.key = (uint8_t)key;
+                c.mode = (uint8_t)mode;
+                c.chord_root = (uint8_t)((key + 7) % KEYLINK_ROOT_COUNT);
+                c.chord_type = (uint8_t)chord;
+                c.tempo = tempos[checked % 7];
+                c.confidence = confidences[checked % 5];
+                c.scale_mask = scales[checked % 5];
+                if (!check(c, timestamp + checked) && ++failed >= 5) return 1;
+            }
+        }
+    }
+    if (failed) return 1;
+    std::printf("%ld states written the same as json.hpp\n\n", checked);
+
+    keylink_writer w;
+
+    std::printf("%ld messages\n%-14s %10s %14s\n", count, "", "ns/message", "allocs/message");
+    run("json dump", count, [&](long i) {
+        s.tempo = 120 + (i % 64) * 0.25;
+        sink += dump_state<nlohmann::json>(s, timestamp + i).size();
+    });
+    run("ordered dump", count, [&](long i) {
+        s.tempo = 120 + (i % 64) * 0.25;
+        sink += dump_state<nlohmann::ordered_json>(s, timestamp + i).size();
+    });
+    run("writer", count, [&](long i) {
+        s.tempo = 120 + (i % 64) * 0.25;
+        write_message(w, s, timestamp + i);
+        sink += w.size();
+    });
+    return sink ? 0 : 1;
+}
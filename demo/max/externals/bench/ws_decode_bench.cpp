@@ -0,0 +1,108 @@
+// ws_decode_bench.cpp - Throughput of the streaming WebSocket frame decoder
+// Builds a stream of mixed frames (small/medium/64-bit-length payloads,
+// masked and unmasked, fragmented messages, interleaved pings) and feeds it
+// through ws_read_buffer in uneven read-sized chunks, the way ws_read sees it.
+// Usage: ws_decode_bench [iterations]
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "keylink_ws.h"
+
+static void append_frame(std::string& out, uint8_t opcode, bool fin, const std::string& payload, bool masked) {
+    static const uint8_t mask[4] = {0xA1, 0xB2, 0xC3, 0xD4};
+    uint8_t header[WS_MAX_HEADER_LEN];
+    size_t header_len = ws_write_header(header, opcode, payload.size(), masked ? mask : NULL);
+    if (!fin) header[0] &= 0x7F;
+    size_t start = out.size();
+    out.append((const char *)header, header_len);
+    out += payload;
+    if (masked) ws_apply_mask((uint8_t *)&out[start + header_len], payload.size(), mask);
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 200;
+
+    // One pass of the stream
+    std::string small = "{\"root\":\"C\",\"mode\":\"Dorian\",\"tempo\":120}";
+    std::string medium = "{\"type\":\"set-state\",\"state\":{\"key\":\"G\",\"mode\":\"Mixolydian\",\"pad\":\"" +
+                         std::string(250, 'x') + "\"}}";
+    std::string large = "{\"notes\":[" + std::string(70000, '6') + "]}";
+    std::string stream;
+    int messages_per_pass = 0;
+    int frames_per_pass = 0;
+    for (int i = 0; i < 1000; i++) {
+        append_frame(stream, WS_OP_TEXT, true, small, i & 1); messages_per_pass++; frames_per_pass++;
+        append_frame(stream, WS_OP_BINARY, true, medium, false); messages_per_pass++; frames_per_pass++;
+        if (i % 10 == 0) {
+            // Fragmented message with a ping between fragments
+            append_frame(stream, WS_OP_TEXT, false, medium.substr(0, 100), true);
+            append_frame(stream, WS_OP_PING, true, "hb", true);
+            append_frame(stream, WS_OP_CONTINUATION, true, medium.substr(100), true);
+            messages_per_pass++; frames_per_pass += 3;
+        }
+        if (i % 100 == 0) {
+            append_frame(stream, WS_OP_TEXT, true, large, false); messages_per_pass++; frames_per_pass++;
+        }
+    }
+
+    // Uneven read sizes, like async_read_some on a busy socket
+    static const size_t chunks[] = {1, 7, 1500, 4096, 333, 65536, 2, 9000};
+
+    ws_read_buffer in(4096);
+    ws_message_assembler assembler;
+    long long frames = 0, messages = 0, bytes = 0;
+    size_t checksum = 0;
+
+    // Parse every complete frame in the buffer; returns bytes still needed
+    auto drain = [&](size_t want) -> size_t {
+        for (;;) {
+            ws_frame frame;
+            ws_parse_result r = ws_parse_frame(in.data(), in.size(), 1 << 24, frame);
+            if (r == WS_PARSE_ERROR) { std::printf("parse error\n"); std::exit(1); }
+            if (r == WS_PARSE_NEED_MORE) {
+                if (frame.frame_len > in.size() + want) want = frame.frame_len - in.size();
+                return want;
+            }
+            frames++;
+            if (!(frame.opcode & 0x08)) {
+                const char *data; size_t len; uint8_t opcode;
+                if (ws_assemble(assembler, frame, data, len, opcode) == WS_PARSE_FRAME) {
+                    messages++;
+                    checksum += len + (unsigned char)data[len / 2];
+                }
+            }
+            in.consume(frame.frame_len);
+        }
+    };
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++) {
+        size_t pos = 0, c = 0;
+        while (pos < stream.size()) {
+            size_t want = drain(4096);
+            size_t n = std::min(chunks[c++ % (sizeof(chunks) / sizeof(chunks[0]))], stream.size() - pos);
+
+            // Decoding unmasks in place, so the pristine stream is copied in
+            size_t free_len = 0;
+            uint8_t *dst = in.prepare(std::max(want, n), free_len);
+            memcpy(dst, stream.data() + pos, n);
+            in.commit(n);
+            pos += n;
+            bytes += n;
+        }
+    }
+    drain(0);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+
+    long long expected_frames = (long long)frames_per_pass * iterations;
+    std::printf("frames=%lld/%lld messages=%lld/%lld checksum=%zu\n", frames, expected_frames,
+                messages, (long long)messages_per_pass * iterations, checksum);
+    std::printf("decode: %.2f M frames/s, %.1f MB/s, buffer capacity %zu bytes, fragment buffer %zu bytes\n",
+                frames / secs / 1e6, bytes / secs / 1e6, in.storage.capacity(), assembler.fragments.capacity());
+    return frames == expected_frames ? 0 : 1;
+}
@@ -15,53 +15,377 @@
 #include <vector>
 #include <mutex>
 #include <condition_variable>
+#include <future>
+#include <functional>
 #include "asio.hpp"
 #include "thirdparty/json.hpp"
+#include "keylink_queue.h"
+#include "keylink_ws.h"
+#include "keylink_udp.h"
+#include "keylink_uring.h"
+#include "keylink_dedup.h"
+#include "keylink_packet.h"
+#include "keylink_codec.h"
+#include "keylink_delta.h"
+#include "keylink_clock.h"
+#include "keylink_timeline.h"
+#include "keylink_channel.h"
+#include "keylink_fragment.h"
+#include "keylink_reliable.h"
+#include "keylink_state.h"
+#include "keylink_writer.h"
+#include "keylink_output.h"
 #include <memory>
 #include <regex>
 #include <chrono>
+#include <algorithm>
+#include <random>
+#include <map>
+#include <stdarg.h>
 
-// Default network settings
-#define KEYLINK_MULTICAST_ADDR "239.255.0.1"
-#define KEYLINK_UDP_PORT 7474
+// Default network settings (multicast groups: keylink_channel.h)
 #define KEYLINK_WS_PORT 20801
 #define KEYLINK_WAN_WS_URL "wss://keylink-relay.fly.dev/"
 
+// WebSocket connection: per-attempt timeout, delay before racing the next
+// candidate endpoint, reconnect backoff bounds and DNS cache lifetime
+#define KEYLINK_WS_LAN_URL "ws://localhost:20801"
+#define KEYLINK_WS_CONNECT_TIMEOUT_MS 3000
+#define KEYLINK_WS_RACE_DELAY_MS 250
+#define KEYLINK_WS_BACKOFF_MIN_MS 250
+#define KEYLINK_WS_BACKOFF_MAX_MS 30000
+#define KEYLINK_DNS_TTL_MS 60000
+
+// Max thread -> network thread command queue depth
+#define KEYLINK_COMMAND_QUEUE_SIZE 1024
+
+// WebSocket receive limits
+#define KEYLINK_WS_READ_CHUNK 4096
+#define KEYLINK_WS_MAX_MESSAGE (16 * 1024 * 1024)
+
+// WebSocket send limits: frames queued behind a slow socket are dropped
+// past this many bytes instead of growing without bound
+#define KEYLINK_WS_MAX_PENDING_BYTES (4 * 1024 * 1024)
+
+// Network thread -> Max scheduler inbound queue depth
+#define KEYLINK_INBOUND_QUEUE_SIZE 1024
+
+// Largest UDP datagram received; datagrams queued for sending before new ones are dropped.
+// Longer messages are sent as KEYLINK_UDP_MTU_PAYLOAD fragments (keylink_fragment.h).
+#define KEYLINK_UDP_MAX_DATAGRAM 2048
+#define KEYLINK_UDP_MAX_PENDING 1024
+// Receive buffer asked for, so a burst of fragments is not dropped by the kernel
+#define KEYLINK_UDP_RECV_BUFFER (1024 * 1024)
+
+// io_uring receive: provided buffers in the ring (power of two)
+#define KEYLINK_URING_BUFFERS 1024
+
+// Encoding negotiation: peers not heard from for this long no longer count,
+// and hello announcements are sent at most this often
+#define KEYLINK_PEER_TIMEOUT_MS 60000
+#define KEYLINK_HELLO_INTERVAL_MS 1000
+
+// t_keylink::encoding: the keylink_enc in the low bits, this bit for auto
+#define KEYLINK_ENCODING_AUTO 0x100
+
+// Deltas: a receiver that misses a base asks the sender for a keyframe at
+// most this often
+#define KEYLINK_RESYNC_INTERVAL_MS 250
+
+// Clock sync: ping peers this often while scheduled messages are in use;
+// an apply_at further ahead than this is treated as bogus and output at once
+#define KEYLINK_PING_INTERVAL_MS 2000
+#define KEYLINK_APPLY_MAX_AHEAD_MS 60000
+
+// Session timeline: a link that has just joined listens this long for an
+// established session before announcing its own; a peer announcing an
+// older timeline is answered at most this often
+#define KEYLINK_TIMELINE_LISTEN_MS 2500
+#define KEYLINK_TIMELINE_REPLY_MS 250
+
+// Transports for link_send_control
+#define KEYLINK_VIA_UDP 1
+#define KEYLINK_VIA_WS 2
+
 // Network modes
 enum NetworkMode {
     MODE_LAN = 0,
     MODE_WAN = 1
 };
 
-// Struct for the Max object
-typedef struct _keylink {
-    t_object ob;
-    void *outlet;
-    std::thread net_thread;
-    std::atomic<bool> running;
-    
-    // Network mode and channel
+// Commands pushed from Max methods and executed on the network thread
+enum CommandType {
+    CMD_SEND = 0
+};
+
+struct keylink_command {
+    CommandType type;
+    std::string payload;
+};
+
+// A received message, classified once on the network thread and shared
+// read-only by every subscribed instance
+struct keylink_message {
+    std::string text;
+    bool is_state;
+    bool replaceable;                   // A typed state: coalescing keeps only the newest per source
+    uint64_t source;                    // Sender's _src, 0 = untagged
+    double apply_ms;                    // Local keylink_now_ms() to output at (apply_at), 0 = on arrival
+    keylink_state state;                // Typed fields of a state, for the state outlets
+};
+typedef std::shared_ptr<const keylink_message> keylink_message_ptr;
+
+// One resolved endpoint we may try to connect to
+struct ws_candidate {
+    std::string url;
+    std::string host;
+    std::string path;
+    int port;
+    asio::ip::tcp::endpoint endpoint;
+};
+
+// One in-flight connect + handshake
+struct ws_attempt {
+    ws_candidate target;
+    asio::ip::tcp::socket socket;
+    asio::steady_timer timeout;
+    std::string request;
+    std::string accept_key;
+    std::unique_ptr<ws_read_buffer> in;
+    bool finished;
+
+    ws_attempt(asio::io_context& io, const ws_candidate& c)
+        : target(c), socket(io), timeout(io), in(new ws_read_buffer(KEYLINK_WS_READ_CHUNK)), finished(false) {}
+};
+
+// Connection racing and reconnect state for one link
+struct ws_connector {
+    unsigned generation;                // Bumped per connect round; stale callbacks compare against it
+    std::vector<ws_candidate> candidates;   // Resolved, not yet tried
+    std::vector<std::shared_ptr<ws_attempt>> attempts;
+    int resolves_pending;
+    std::vector<std::shared_ptr<asio::ip::tcp::resolver>> resolvers;
+    asio::steady_timer race_timer;
+    asio::steady_timer reconnect_timer;
+    int backoff_ms;
+    std::mt19937 rng;
+
+    explicit ws_connector(asio::io_context& io)
+        : generation(0), resolves_pending(0), race_timer(io), reconnect_timer(io),
+          backoff_ms(KEYLINK_WS_BACKOFF_MIN_MS), rng(std::random_device()()) {}
+};
+
+// A remote source heard on a link and the encodings it can decode
+struct keylink_peer {
+    unsigned encodings;                 // KEYLINK_ENC_BIT set; JSON only until it says hello
+    double last_heard_ms;
+};
+
+// The last full state heard from a source: the base its next delta applies to
+struct keylink_state_base {
+    uint64_t seq;
+    keylink_message_ptr msg;
+    keylink_ojson parsed;               // Parsed on the first delta, then kept current
+    double heard_ms;
+    double resync_ms;                   // Last resync request for this source
+
+    keylink_state_base() : seq(0), heard_ms(0), resync_ms(-KEYLINK_RESYNC_INTERVAL_MS) {}
+};
+
+// Scheduled messages by local due time; filled on the network thread,
+// drained by the apply clock on the scheduler thread
+struct keylink_schedule {
+    std::mutex lock;
+    std::multimap<double, keylink_message_ptr> due;
+};
+
+// The link's session timeline as last published, for Max threads
+struct keylink_timeline_slot {
+    std::mutex lock;
+    keylink_timeline timeline;
+};
+
+struct _keylink;
+
+// One network transport per (mode, channel), shared by every [keylink]
+// subscribed to it: a UDP multicast socket (LAN) and a WebSocket client.
+// Owned by the hub and only touched on the hub's network thread.
+struct keylink_link : std::enable_shared_from_this<keylink_link> {
+    std::string key;
     NetworkMode network_mode;
     std::string channel;
     std::string ws_url;
-    
-    // Networking
-    std::unique_ptr<asio::io_context> io_ctx;
+    bool use_uring;
+    bool open;                          // False once closed; pending handlers bail out
+    std::vector<struct _keylink *> subscribers;
+
+    asio::io_context& io;
+
+    // UDP multicast (LAN mode)
     std::unique_ptr<asio::ip::udp::socket> udp_socket;
     asio::ip::udp::endpoint multicast_endpoint;
-    char recv_buffer[2048];
-    
+    udp_recv_batch udp_in;              // Slab drained per readiness wakeup
+    udp_send_queue udp_out;             // Flushed once per command drain
+    bool udp_flush_waiting;
+#if KEYLINK_HAS_IO_URING
+    std::unique_ptr<udp_uring_receiver> udp_uring;
+    std::unique_ptr<asio::posix::stream_descriptor> udp_ring;   // Ring fd, owned by udp_uring
+#endif
+
     // WebSocket client
+    ws_connector ws_conn;
     std::unique_ptr<asio::ip::tcp::socket> ws_socket;
     std::string ws_host;
     std::string ws_path;
     int ws_port;
     bool ws_connected;
-    
-    // Message tracking to prevent loops
-    std::string last_sent_msg;
-    std::chrono::steady_clock::time_point last_sent_time;
-    
+    std::unique_ptr<ws_read_buffer> ws_in;              // Per-connection, grows to the largest frame
+    std::unique_ptr<ws_message_assembler> ws_message;   // Fragment reassembly
+    std::string ws_scratch;
+    std::unique_ptr<ws_frame_batch> ws_out_pending;     // Frames waiting for the next write
+    std::unique_ptr<ws_frame_batch> ws_out_inflight;    // Frames owned by the write in progress
+    std::vector<asio::const_buffer> ws_out_buffers;
+    bool ws_writing;
+    bool ws_flush_posted;
+    bool ws_closing;                                    // Close frame queued; socket closes once it is written
+    uint64_t ws_mask_state;
+
+    // Drops repeats and our own echoes by (source, sequence)
+    keylink_dedup dedup;
+    std::string tag_scratch;
+
+    // Messages over one MTU: fragment ids for sends, partial messages on receive
+    uint32_t frag_id;
+    std::string frag_scratch;
+    keylink_reassembler reassembly;
+
+    // Reliable states: what we sent (for NACKs), what peers sent (to NACK)
+    keylink_retransmit_ring retransmit;
+    keylink_nack_tracker nacks;
+    std::vector<uint64_t> nack_scratch;
+    asio::steady_timer report_timer;
+    bool report_armed;
+    double report_due_ms;
+    double report_sent_ms;
+    asio::steady_timer nack_timer;
+    bool nack_armed;
+
+    // Encoding negotiation (UDP): the binary encodings are used only while
+    // every peer heard recently has announced it can decode them
+    std::map<uint64_t, keylink_peer> peers;
+    double legacy_heard_ms;             // Last untagged message (a peer that cannot say hello)
+    double hello_sent_ms;
+    bool hello_pending;
+    asio::steady_timer hello_timer;
+    std::string enc_scratch;
+
+    // Delta updates: per-source bases on receive, scratch for sends
+    std::map<uint64_t, keylink_state_base> state_bases;
+    std::string delta_scratch;
+    std::string delta_tagged;
+    std::string red_scratch;            // The network copy with "_red" attached
+
+    // Clock sync: an estimate per peer process, found by any of its sources
+    std::map<uint64_t, keylink_clock_estimate> clocks;
+    std::map<uint64_t, uint64_t> clock_alias;
+    asio::steady_timer ping_timer;
+    double clock_wanted_ms;             // Last sign that a peer schedules or syncs
+    std::string stamp_scratch;
+
+    // Session timeline, on the local clock; copied to every subscriber
+    keylink_timeline timeline;
+    bool timeline_provisional;          // Made here on joining, not announced yet
+    bool timeline_estimated;            // Converted with a measured clock offset
+    double timeline_joined_ms;
+    double timeline_sent_ms;
+
+    keylink_link(asio::io_context& ctx, const std::string& k, NetworkMode mode, const std::string& ch,
+                 const std::string& url, bool uring)
+        : key(k), network_mode(mode), channel(ch), ws_url(url), use_uring(uring), open(true), io(ctx),
+          udp_in(KEYLINK_UDP_BATCH, KEYLINK_UDP_MAX_DATAGRAM), udp_flush_waiting(false),
+          ws_conn(ctx), ws_port(0), ws_connected(false), ws_writing(false), ws_flush_posted(false), ws_closing(false),
+          ws_mask_state(1), frag_id(0), report_timer(ctx), report_armed(false), report_due_ms(0),
+          report_sent_ms(-KEYLINK_RETRANSMIT_HOLDOFF_MS), nack_timer(ctx), nack_armed(false),
+          legacy_heard_ms(-KEYLINK_PEER_TIMEOUT_MS), hello_sent_ms(-KEYLINK_HELLO_INTERVAL_MS),
+          hello_pending(false), hello_timer(ctx), ping_timer(ctx), clock_wanted_ms(-KEYLINK_PEER_TIMEOUT_MS),
+          timeline_provisional(false), timeline_estimated(false), timeline_joined_ms(0),
+          timeline_sent_ms(-KEYLINK_TIMELINE_REPLY_MS) {}
+};
+typedef std::shared_ptr<keylink_link> keylink_link_ptr;
+
+typedef asio::executor_work_guard<asio::io_context::executor_type> keylink_work_guard;
+
+// Process-wide network hub: one io_context and one thread for every
+// [keylink] in the process, running while at least one instance is started
+struct keylink_hub {
+    std::mutex lock;                    // Guards refs and the thread (Max threads only)
+    int refs;
+    asio::io_context io;
+    std::unique_ptr<keylink_work_guard> work_guard;
+    std::thread thread;
+    std::map<std::string, keylink_link_ptr> links;  // Network thread only
+
+    keylink_hub() : refs(0), io(1) {}
+};
+
+// Struct for the Max object
+typedef struct _keylink {
+    t_object ob;
+    void *outlet;
+    std::atomic<bool> running;
+
+    // Network mode and channel
+    NetworkMode network_mode;
+    std::string channel;
+    std::string ws_url;
+    bool use_uring;                     // Opt-in io_uring receive (Linux), applied on start
+    std::atomic<bool> send_binary;      // States that fit go out as a keylink_packet.h packet
+    std::atomic<int> encoding;          // Schemaless wire encoding, | KEYLINK_ENCODING_AUTO to negotiate it
+    std::atomic<bool> send_delta;       // States go out as state-delta between keyframes
+    std::atomic<bool> send_reliable;    // States are kept for NACKs and reported (keylink_reliable.h)
+    std::atomic<long> redundancy;       // Earlier state deltas carried by each state (keylink_delta.h)
+    uint64_t last_state_seq;            // Network thread only
+    std::unique_ptr<keylink_delta_encoder> delta;   // Network thread only
+
+    // Shared transport; set and read on the network thread only
+    keylink_link_ptr link;
+
+    // Tag for outgoing messages; send_seq is only touched on the network thread
+    uint64_t source_id;
+    uint64_t send_seq;
+
+    // Commands from Max threads, drained on the network thread
+    std::unique_ptr<keylink_ring<keylink_command>> commands;
+    std::atomic<bool> drain_pending;
+    std::atomic<long> commands_dropped;
+
+    // Inbound messages, delivered to the outlet on a Max thread
+    std::unique_ptr<keylink_ring<keylink_message_ptr>> inbound;
+    std::unique_ptr<keylink_output> output;             // keylink_deliver
+    std::unique_ptr<keylink_output> scheduled_output;   // keylink_apply_tick
+    std::unique_ptr<keylink_state_outlets> state_outlets;
+    std::atomic<long> inbound_dropped;
+    void *deliver_clock;                // High priority: scheduler thread
+    void *deliver_qelem;                // Low priority: main thread
+    std::atomic<bool> delivery_scheduled;
+    std::atomic<double> last_delivery_ms;
+    std::atomic<bool> high_priority;
+    std::atomic<bool> coalesce;
+    std::atomic<bool> verbose;          // Post every received message to the console
+    std::atomic<double> max_rate;       // Deliveries per second, 0 = unlimited
+    std::atomic<double> lead_ms;        // Stamp sent states with apply_at = now + lead, 0 = off
+    std::atomic<bool> in_session;       // Announce and keep the shared beat timeline
+    std::unique_ptr<keylink_timeline_slot> timeline;
+
+    // Latest-state-wins slots (coalesce mode), one per source
+    std::atomic<bool> state_lock;
+    std::unique_ptr<std::vector<keylink_message_ptr>> pending_states;
+    std::unique_ptr<std::vector<keylink_message_ptr>> ready_states;     // keylink_deliver
+
+    // Messages with apply_at, output on the scheduler thread when due
+    std::unique_ptr<keylink_schedule> schedule;
+    void *apply_clock;
+
 } t_keylink;
 
 // Prototypes
@@ -70,16 +394,96 @@ void keylink_free(t_keylink *x);
 void keylink_assist(t_keylink *x, void *b, long m, long a, char *s);
 void keylink_bang(t_keylink *x);
 void keylink_symbol(t_keylink *x, t_symbol *s);
+void keylink_send_state(t_keylink *x, t_symbol *s, long argc, t_atom *argv);
 void keylink_start(t_keylink *x);
 void keylink_stop(t_keylink *x);
+void keylink_net_stop(t_keylink *x);
 void keylink_mode(t_keylink *x, t_symbol *s);
 void keylink_channel(t_keylink *x, t_symbol *s);
-void udp_do_receive(t_keylink *x);
-void ws_connect(t_keylink *x);
-void ws_send(t_keylink *x, const std::string& msg);
-void ws_read(t_keylink *x);
+void keylink_priority(t_keylink *x, t_symbol *s);
+void keylink_rate(t_keylink *x, double hz);
+void keylink_coalesce(t_keylink *x, long on);
+void keylink_verbose(t_keylink *x, long on);
+void keylink_uring(t_keylink *x, long on);
+void keylink_format(t_keylink *x, t_symbol *s);
+void keylink_set_encoding(t_keylink *x, t_symbol *s);
+void keylink_set_output(t_keylink *x, t_symbol *s);
+void keylink_delta(t_keylink *x, long on);
+void keylink_reliable(t_keylink *x, long on);
+void keylink_redundancy(t_keylink *x, long depth);
+void keylink_lead(t_keylink *x, double ms);
+void keylink_clocks(t_keylink *x);
+void keylink_apply_tick(t_keylink *x);
+void keylink_session(t_keylink *x, long on);
+void keylink_tempo(t_keylink *x, double bpm);
+void keylink_quantum(t_keylink *x, double beats);
+void keylink_phase(t_keylink *x);
+void keylink_beatat(t_keylink *x, double ms);
+void keylink_timeat(t_keylink *x, double beat);
+void keylink_enqueue_inbound(t_keylink *x, const keylink_message_ptr& msg);
+void keylink_deliver_tick(t_keylink *x);
+void keylink_deliver(t_keylink *x);
+bool keylink_is_state_message(const char *msg, size_t len, bool *typed = NULL);
+keylink_hub *keylink_hub_get();
+void keylink_hub_acquire();
+void keylink_hub_release();
+void link_subscribe(t_keylink *x, NetworkMode mode, const std::string& channel, const std::string& ws_url,
+                    bool use_uring);
+void link_unsubscribe(t_keylink *x);
+void link_start(const keylink_link_ptr& l);
+void link_close(const keylink_link_ptr& l);
+void link_post(keylink_link *l, const char *fmt, ...);
+void link_receive(keylink_link *l, const char *data, size_t len, const char *transport);
+void link_fanout(keylink_link *l, const char *data, size_t len, t_keylink *from);
+void link_note_source(keylink_link *l, uint64_t source);
+void link_on_hello(keylink_link *l, uint64_t source, const keylink_ojson& hello);
+void link_store_state(keylink_link *l, uint64_t source, uint64_t seq, const keylink_message_ptr& msg);
+bool link_apply_delta(keylink_link *l, uint64_t source, uint64_t seq, const keylink_ojson& delta,
+                      const std::shared_ptr<keylink_message>& msg);
+void link_recover_redundant(keylink_link *l, uint64_t source, keylink_message& msg, const char *transport);
+void link_deliver(keylink_link *l, uint64_t source, const std::shared_ptr<keylink_message>& msg, const char *transport);
+void link_request_resync(keylink_link *l, uint64_t source);
+void link_on_resync(keylink_link *l, const keylink_ojson& request);
+void link_send_control(const keylink_link_ptr& l, const std::string& text, int via);
+bool link_queue_udp(keylink_link *l, uint64_t source, const char *data, size_t len);
+bool link_track_seq(keylink_link *l, uint64_t source, uint64_t seq, bool state);
+void link_send_nack(keylink_link *l, uint64_t source, const std::vector<uint64_t>& seqs);
+void link_schedule_nack_retry(const keylink_link_ptr& l);
+void link_on_nack(keylink_link *l, const keylink_ojson& nack);
+void link_on_state_report(keylink_link *l, const keylink_ojson& report);
+void link_schedule_report(const keylink_link_ptr& l);
+void link_send_state_report(const keylink_link_ptr& l);
+void link_schedule_ping(const keylink_link_ptr& l);
+void link_on_ping(keylink_link *l, uint64_t source, const keylink_ojson& ping, double arrival, int via);
+void link_on_pong(keylink_link *l, uint64_t source, const keylink_ojson& pong, double arrival);
+double link_local_time(keylink_link *l, uint64_t source, double apply_at);
+double link_peer_offset(keylink_link *l, uint64_t source, double at, bool& estimated);
+void link_join_session(keylink_link *l);
+void link_change_timeline(keylink_link *l, t_keylink *x, double tempo, double quantum);
+void link_on_timeline(keylink_link *l, uint64_t source, const keylink_ojson& j);
+void link_send_timeline(const keylink_link_ptr& l);
+void link_publish_timeline(keylink_link *l);
+void link_request_hello(const keylink_link_ptr& l);
+void link_send_hello(const keylink_link_ptr& l);
+keylink_enc link_udp_encoding(keylink_link *l);
+double keylink_now_ms();
+void udp_do_receive(const keylink_link_ptr& l);
+void udp_uring_receive(const keylink_link_ptr& l);
+void ws_connect(const keylink_link_ptr& l);
+void ws_race_next(const keylink_link_ptr& l);
+void ws_attempt_start(const keylink_link_ptr& l, const ws_candidate& c);
+void ws_attempt_done(const keylink_link_ptr& l, const std::shared_ptr<ws_attempt>& a, const char *error);
+void ws_schedule_reconnect(const keylink_link_ptr& l);
+void ws_on_disconnect(const keylink_link_ptr& l, const char *reason);
+void ws_read(const keylink_link_ptr& l);
+bool ws_process_frames(const keylink_link_ptr& l, size_t& want);
+void ws_send_frame(const keylink_link_ptr& l, uint8_t opcode, const char *data, size_t len);
+void ws_close(const keylink_link_ptr& l, const char *status, size_t status_len, const char *reason);
+void ws_flush(const keylink_link_ptr& l);
 void send_message(t_keylink *x, const std::string& msg);
-bool is_duplicate_message(t_keylink *x, const std::string& msg);
+void udp_flush(const keylink_link_ptr& l);
+void keylink_post_send(t_keylink *x, const char *msg, size_t len);
+void keylink_drain_commands(t_keylink *x);
 
 // Class pointer
 static t_class *keylink_class = NULL;
@@ -89,26 +493,80 @@ extern "C" void ext_main(void *r) {
     t_class *c = class_new("keylink", (method)keylink_new, (method)keylink_free, (long)sizeof(t_keylink), 0L, A_GIMME, 0);
     class_addmethod(c, (method)keylink_bang, "bang", 0);
     class_addmethod(c, (method)keylink_symbol, "symbol", A_SYM, 0);
+    class_addmethod(c, (method)keylink_send_state, "state", A_GIMME, 0);
     class_addmethod(c, (method)keylink_start, "start", 0);
     class_addmethod(c, (method)keylink_stop, "stop", 0);
     class_addmethod(c, (method)keylink_mode, "mode", A_SYM, 0);
     class_addmethod(c, (method)keylink_channel, "channel", A_SYM, 0);
+    class_addmethod(c, (method)keylink_priority, "priority", A_SYM, 0);
+    class_addmethod(c, (method)keylink_rate, "rate", A_FLOAT, 0);
+    class_addmethod(c, (method)keylink_coalesce, "coalesce", A_LONG, 0);
+    class_addmethod(c, (method)keylink_verbose, "verbose", A_LONG, 0);
+    class_addmethod(c, (method)keylink_uring, "uring", A_LONG, 0);
+    class_addmethod(c, (method)keylink_format, "format", A_SYM, 0);
+    class_addmethod(c, (method)keylink_set_encoding, "encoding", A_SYM, 0);
+    class_addmethod(c, (method)keylink_set_output, "output", A_SYM, 0);
+    class_addmethod(c, (method)keylink_delta, "delta", A_LONG, 0);
+    class_addmethod(c, (method)keylink_reliable, "reliable", A_LONG, 0);
+    class_addmethod(c, (method)keylink_redundancy, "redundancy", A_LONG, 0);
+    class_addmethod(c, (method)keylink_lead, "lead", A_FLOAT, 0);
+    class_addmethod(c, (method)keylink_clocks, "clocks", 0);
+    class_addmethod(c, (method)keylink_session, "session", A_LONG, 0);
+    class_addmethod(c, (method)keylink_tempo, "tempo", A_FLOAT, 0);
+    class_addmethod(c, (method)keylink_quantum, "quantum", A_FLOAT, 0);
+    class_addmethod(c, (method)keylink_phase, "phase", 0);
+    class_addmethod(c, (method)keylink_beatat, "beatat", A_DEFFLOAT, 0);
+    class_addmethod(c, (method)keylink_timeat, "timeat", A_FLOAT, 0);
     class_addmethod(c, (method)keylink_assist, "assist", A_CANT, 0);
     class_register(CLASS_BOX, c);
+    keylink_state_symbols_init();
     keylink_class = c;
 }
 
 void *keylink_new(t_symbol *s, long argc, t_atom *argv) {
     t_keylink *x = (t_keylink *)object_alloc(keylink_class);
     if (x) {
+        x->state_outlets.reset(new keylink_state_outlets((t_object *)x));
         x->outlet = outlet_new((t_object *)x, NULL);
         x->running = false;
         x->network_mode = MODE_LAN;
-        x->channel = "__LAN__";
+        x->channel = KEYLINK_LAN_CHANNEL;
         x->ws_url = "ws://localhost:20801";
-        x->last_sent_msg = "";
-        x->last_sent_time = std::chrono::steady_clock::now();
-        
+        x->use_uring = false;
+        x->send_binary = false;
+        x->encoding = KEYLINK_ENC_JSON;
+        x->send_delta = false;
+        x->send_reliable = false;
+        x->redundancy = 0;
+        x->last_state_seq = 0;
+        x->delta.reset(new keylink_delta_encoder());
+        std::random_device rd;
+        x->source_id = ((uint64_t)rd() << 32) | rd();
+        x->send_seq = 0;
+        x->commands.reset(new keylink_ring<keylink_command>(KEYLINK_COMMAND_QUEUE_SIZE));
+        x->drain_pending = false;
+        x->commands_dropped = 0;
+        x->inbound.reset(new keylink_ring<keylink_message_ptr>(KEYLINK_INBOUND_QUEUE_SIZE));
+        x->inbound_dropped = 0;
+        x->output.reset(new keylink_output());
+        x->scheduled_output.reset(new keylink_output());
+        x->deliver_clock = clock_new(x, (method)keylink_deliver_tick);
+        x->deliver_qelem = qelem_new(x, (method)keylink_deliver);
+        x->delivery_scheduled = false;
+        x->last_delivery_ms = 0.0;
+        x->high_priority = true;
+        x->coalesce = true;
+        x->verbose = false;
+        x->max_rate = 0.0;
+        x->state_lock = false;
+        x->pending_states.reset(new std::vector<keylink_message_ptr>());
+        x->ready_states.reset(new std::vector<keylink_message_ptr>());
+        x->lead_ms = 0.0;
+        x->schedule.reset(new keylink_schedule());
+        x->apply_clock = clock_new(x, (method)keylink_apply_tick);
+        x->in_session = false;
+        x->timeline.reset(new keylink_timeline_slot());
+
         // Parse arguments
         if (argc >= 1) {
             if (atom_gettype(argv) == A_SYM) {
@@ -122,51 +580,127 @@ void *keylink_new(t_symbol *s, long argc, t_atom *argv) {
                 }
             }
         }
-        
+
         if (argc >= 2) {
             if (atom_gettype(argv + 1) == A_SYM) {
                 x->channel = atom_getsym(argv + 1)->s_name;
             }
         }
-        
-        object_post((t_object *)x, "KeyLink: Created in %s mode, channel: %s", 
+
+        object_post((t_object *)x, "KeyLink: Created in %s mode, channel: %s",
                    x->network_mode == MODE_LAN ? "LAN" : "WAN", x->channel.c_str());
     }
     return (x);
 }
 
 void keylink_free(t_keylink *x) {
-    x->running = false;
-    if (x->net_thread.joinable()) x->net_thread.join();
-    if (x->udp_socket) {
-        x->udp_socket->close();
-    }
-    if (x->ws_socket) {
-        x->ws_socket->close();
-    }
+    keylink_net_stop(x);
+    x->commands.reset();
+    clock_unset(x->deliver_clock);
+    qelem_unset(x->deliver_qelem);
+    clock_unset(x->apply_clock);
+    object_free(x->deliver_clock);
+    object_free(x->apply_clock);
+    qelem_free(x->deliver_qelem);
+    x->inbound.reset();
+    x->pending_states.reset();
+    x->ready_states.reset();
+    x->output.reset();
+    x->scheduled_output.reset();
+    x->state_outlets.reset();
+    x->delta.reset();
+    x->schedule.reset();
+    x->timeline.reset();
 }
 
 void keylink_assist(t_keylink *x, void *b, long m, long a, char *s) {
     if (m == ASSIST_INLET) {
-        sprintf(s, "Input (symbol, bang, start, stop, mode, channel)");
+        sprintf(s, "Input (symbol, state, bang, start, stop, mode, channel, priority, rate, coalesce, verbose, uring, format, encoding, output, delta, reliable, redundancy, lead, clocks, session, tempo, quantum, phase, beatat, timeat)");
+    } else if (a == 0) {
+        sprintf(s, "Output (JSON string, dictionary or fields)");
     } else {
-        sprintf(s, "Output (JSON string)");
+        static const char *fields[] = {"Key (symbol)", "Mode (symbol)", "Chord (root type)", "Tempo (float)"};
+        sprintf(s, "%s", fields[(a - 1) % 4]);
     }
 }
 
 void keylink_bang(t_keylink *x) {
     if (!x->running) return;
-    
+
     // Send a ping message
-    std::string msg = "{\"type\":\"ping\",\"source\":\"max\"}";
-    send_message(x, msg);
+    static const char msg[] = "{\"type\":\"ping\",\"source\":\"max\"}";
+    keylink_post_send(x, msg, sizeof(msg) - 1);
 }
 
 void keylink_symbol(t_keylink *x, t_symbol *s) {
     if (!x->running) return;
-    
+
     // Send the symbol as JSON
-    send_message(x, s->s_name);
+    keylink_post_send(x, s->s_name, strlen(s->s_name));
+}
+
+// state key D mode dorian tempo 122.5 chord G m7 enabled 1 chordEnabled 1
+// confidence 0.9 scale 0 2 3 5 7 9 10 (any of them, in any order): send a
+// set-state with those fields. It is written straight into a buffer on the
+// stack (keylink_writer.h), so no DOM, no heap and no symbol is made for
+// it, and either Max thread may call this at control rate.
+void keylink_send_state(t_keylink *x, t_symbol *s, long argc, t_atom *argv) {
+    if (!x->running) return;
+
+    keylink_state state;
+    memset(&state, 0, sizeof(state));
+    for (long i = 0; i < argc;) {
+        if (atom_gettype(argv + i) != A_SYM) {
+            object_error((t_object *)x, "KeyLink: state takes field names and values");
+            return;
+        }
+        const char *field = atom_getsym(argv + i++)->s_name;
+        bool has_value = i < argc;
+        const char *name = has_value && atom_gettype(argv + i) == A_SYM ? atom_getsym(argv + i)->s_name : NULL;
+        int v;
+        if (!strcmp(field, "key") && name && (v = keylink_state_root_of(name, strlen(name))) >= 0) {
+            state.key = (uint8_t)v;
+            state.has |= KEYLINK_STATE_HAS_KEY;
+            i++;
+        } else if (!strcmp(field, "mode") && name && (v = keylink_state_mode_of(name, strlen(name))) >= 0) {
+            state.mode = (uint8_t)v;
+            state.has |= KEYLINK_STATE_HAS_MODE;
+            i++;
+        } else if (!strcmp(field, "chord") && name && i + 1 < argc && atom_gettype(argv + i + 1) == A_SYM &&
+                   (v = keylink_state_root_of(name, strlen(name))) >= 0) {
+            const char *type = atom_getsym(argv + i + 1)->s_name;
+            int t = keylink_state_chord_of(type, strlen(type));
+            if (t < 0) {
+                object_error((t_object *)x, "KeyLink: state: unknown chord type %s", type);
+                return;
+            }
+            state.chord_root = (uint8_t)v;
+            state.chord_type = (uint8_t)t;
+            state.has |= KEYLINK_STATE_HAS_CHORD;
+            i += 2;
+        } else if (has_value && !name && (!strcmp(field, "tempo") || !strcmp(field, "confidence"))) {
+            (!strcmp(field, "tempo") ? state.tempo : state.confidence) = atom_getfloat(argv + i++);
+            state.has |= !strcmp(field, "tempo") ? KEYLINK_STATE_HAS_TEMPO : KEYLINK_STATE_HAS_CONFIDENCE;
+        } else if (has_value && !name && (!strcmp(field, "enabled") || !strcmp(field, "chordEnabled"))) {
+            (!strcmp(field, "enabled") ? state.enabled : state.chord_enabled) = atom_getfloat(argv + i++) != 0;
+            state.has |= !strcmp(field, "enabled") ? KEYLINK_STATE_HAS_ENABLED : KEYLINK_STATE_HAS_CHORD_ENABLED;
+        } else if (!strcmp(field, "scale")) {
+            for (; i < argc && atom_gettype(argv + i) != A_SYM; i++) {
+                long pc = (long)atom_getfloat(argv + i);
+                if (pc >= 0 && pc < 12) state.scale_mask |= (uint16_t)(1 << pc);
+            }
+            state.has |= KEYLINK_STATE_HAS_SCALE;
+        } else {
+            object_error((t_object *)x, "KeyLink: state: bad or missing value for %s", field);
+            return;
+        }
+    }
+
+    keylink_writer w;
+    w.literal("{\"type\":\"set-state\",\"state\":");
+    keylink_write_state(w, state);
+    w.literal("}");
+    keylink_post_send(x, w.data(), w.size());
 }
 
 void keylink_mode(t_keylink *x, t_symbol *s) {
@@ -187,308 +721,2100 @@ void keylink_channel(t_keylink *x, t_symbol *s) {
     object_post((t_object *)x, "KeyLink: Channel set to %s", x->channel.c_str());
 }
 
+// priority high: deliver on the scheduler thread (timing-accurate)
+// priority low: deliver on the main thread via a qelem (UI-safe, may lag)
+void keylink_priority(t_keylink *x, t_symbol *s) {
+    std::string p = s->s_name;
+    bool high;
+    if (p == "high") {
+        high = true;
+    } else if (p == "low") {
+        high = false;
+    } else {
+        object_error((t_object *)x, "KeyLink: priority must be high or low");
+        return;
+    }
+    x->high_priority = high;
+    object_post((t_object *)x, "KeyLink: %s priority delivery", high ? "high" : "low");
+}
+
+// Maximum outlet deliveries per second (0 = as fast as messages arrive)
+void keylink_rate(t_keylink *x, double hz) {
+    double rate = hz > 0 ? hz : 0;
+    x->max_rate = rate;
+    object_post((t_object *)x, "KeyLink: max delivery rate %s", rate > 0 ? std::to_string(rate).c_str() : "unlimited");
+}
+
+// 1: state updates pending at delivery time collapse to the newest one
+void keylink_coalesce(t_keylink *x, long on) {
+    x->coalesce = on != 0;
+    object_post((t_object *)x, "KeyLink: coalescing %s", on ? "on" : "off");
+}
+
+// 1: post every received message to the console (off by default: formatting
+// and posting each message costs more than delivering it)
+void keylink_verbose(t_keylink *x, long on) {
+    x->verbose = on != 0;
+    object_post((t_object *)x, "KeyLink: verbose %s", on ? "on" : "off");
+}
+
+// uring 1: receive multicast through io_uring (Linux only, takes effect on the next start)
+void keylink_uring(t_keylink *x, long on) {
+    x->use_uring = on != 0;
+#if KEYLINK_HAS_IO_URING
+    object_post((t_object *)x, "KeyLink: io_uring receive %s (applies on next start)", x->use_uring ? "on" : "off");
+#else
+    if (x->use_uring) object_post((t_object *)x, "KeyLink: io_uring is not available on this platform");
+#endif
+}
+
+// format json: send everything as JSON text
+// format binary: send states that fit as 32-byte packets, everything else as JSON
+// Both are always accepted on receive.
+void keylink_format(t_keylink *x, t_symbol *s) {
+    std::string f = s->s_name;
+    if (f == "json") {
+        x->send_binary = false;
+    } else if (f == "binary") {
+        x->send_binary = true;
+    } else {
+        object_error((t_object *)x, "KeyLink: format must be json or binary");
+        return;
+    }
+    object_post((t_object *)x, "KeyLink: sending %s states", x->send_binary ? "binary" : "JSON");
+}
+
+// encoding json|msgpack|cbor: schemaless messages go out on UDP in this encoding
+// encoding auto: MessagePack/CBOR over UDP once every peer has announced
+// support, JSON while any peer has not
+// WebSocket always stays JSON.
+// Every encoding is always accepted on receive.
+void keylink_set_encoding(t_keylink *x, t_symbol *s) {
+    std::string e = s->s_name;
+    keylink_enc enc = keylink_enc_from_name(e);
+    if (e == "auto") {
+        x->encoding = KEYLINK_ENCODING_AUTO | KEYLINK_ENC_JSON;
+    } else if (enc != KEYLINK_ENC_UNKNOWN) {
+        x->encoding = enc;
+    } else {
+        object_error((t_object *)x, "KeyLink: encoding must be json, msgpack, cbor or auto");
+        return;
+    }
+    object_post((t_object *)x, "KeyLink: %s encoding", e == "auto" ? "negotiated" : keylink_enc_name(enc));
+}
+
+// output json|dict|fields: received messages as a JSON symbol, a reused
+// dictionary, or one message per field (see keylink_output.h). Only json
+// makes a new symbol of every message.
+void keylink_set_output(t_keylink *x, t_symbol *s) {
+    if (!x->output->set_mode(s->s_name)) {
+        object_error((t_object *)x, "KeyLink: output must be json, dict or fields");
+        return;
+    }
+    x->scheduled_output->set_mode(s->s_name);
+    object_post((t_object *)x, "KeyLink: output as %s", x->output->mode_name());
+}
+
+// delta 1: after a full state, send only the fields that changed
+// (state-delta), with a full keyframe every 2 s and whenever a receiver
+// asks for one. Deltas are always accepted on receive.
+void keylink_delta(t_keylink *x, long on) {
+    x->send_delta = on != 0;
+    object_post((t_object *)x, "KeyLink: delta updates %s", x->send_delta ? "on" : "off");
+}
+
+// reliable 0/1: keep sent states for retransmission when a receiver NACKs
+// a loss over UDP
+void keylink_reliable(t_keylink *x, long on) {
+    x->send_reliable = on != 0;
+    object_post((t_object *)x, "KeyLink: reliable states %s", x->send_reliable ? "on" : "off");
+}
+
+// redundancy <n>: each state also carries the changes of the n states sent
+// before it, so a receiver rebuilds a lost one from the next without
+// asking (0 = off, at most 8)
+void keylink_redundancy(t_keylink *x, long depth) {
+    depth = depth < 0 ? 0 : depth > KEYLINK_REDUNDANCY_MAX ? KEYLINK_REDUNDANCY_MAX : depth;
+    x->redundancy = depth;
+    if (depth) {
+        object_post((t_object *)x, "KeyLink: states carry the last %ld state change(s)", depth);
+    } else {
+        object_post((t_object *)x, "KeyLink: redundancy off");
+    }
+}
+
+// lead <ms>: stamp each sent state with apply_at = now + ms (KeyLink time),
+// so every receiver outputs it at the same moment; 0 turns it off
+void keylink_lead(t_keylink *x, double ms) {
+    x->lead_ms = ms > 0 ? ms : 0;
+    if (ms > 0) {
+        object_post((t_object *)x, "KeyLink: states apply %.1f ms after sending", ms);
+    } else {
+        object_post((t_object *)x, "KeyLink: states apply on arrival");
+    }
+}
+
+// clocks: post the offset, delay and drift of every peer clock on this link
+void keylink_clocks(t_keylink *x) {
+    if (!x->running) {
+        object_post((t_object *)x, "KeyLink: not running");
+        return;
+    }
+    asio::post(keylink_hub_get()->io, [x]() {
+        keylink_link *l = x->link.get();
+        if (!l) return;
+        double now = keylink_wall_ms();
+        if (l->clocks.empty()) object_post((t_object *)x, "KeyLink: no peer clocks measured yet");
+        for (std::map<uint64_t, keylink_clock_estimate>::iterator it = l->clocks.begin(); it != l->clocks.end(); ++it) {
+            const keylink_clock_estimate& c = it->second;
+            object_post((t_object *)x, "KeyLink: clock %016llx offset %.3f ms, delay %.3f ms, drift %.1f ppm, %d samples",
+                        (unsigned long long)it->first, c.offset_at(now), c.delay_ms(), c.drift_ppm(), (int)c.samples());
+        }
+    });
+}
+
+// session 1: keep and announce the shared beat timeline (joining any
+// session already running on the channel); 0 stops announcing
+void keylink_session(t_keylink *x, long on) {
+    x->in_session = on != 0;
+    object_post((t_object *)x, "KeyLink: session timeline %s", on ? "on" : "off");
+    if (on && x->running) asio::post(keylink_hub_get()->io, [x]() {
+        if (x->link) link_join_session(x->link.get());
+    });
+}
+
+// tempo <bpm> / quantum <beats>: change the session timeline for every peer
+void keylink_tempo(t_keylink *x, double bpm) {
+    if (!x->running) {
+        object_post((t_object *)x, "KeyLink: not running");
+        return;
+    }
+    x->in_session = true;
+    asio::post(keylink_hub_get()->io, [x, bpm]() {
+        if (x->link) link_change_timeline(x->link.get(), x, bpm, 0);
+    });
+}
+
+void keylink_quantum(t_keylink *x, double beats) {
+    if (!x->running) {
+        object_post((t_object *)x, "KeyLink: not running");
+        return;
+    }
+    x->in_session = true;
+    asio::post(keylink_hub_get()->io, [x, beats]() {
+        if (x->link) link_change_timeline(x->link.get(), x, 0, beats);
+    });
+}
+
+static bool keylink_session_timeline(t_keylink *x, keylink_timeline& out) {
+    std::lock_guard<std::mutex> guard(x->timeline->lock);
+    out = x->timeline->timeline;
+    return out.valid();
+}
+
+// phase: output "phase <beat> <phase> <tempo> <quantum>" for now
+void keylink_phase(t_keylink *x) {
+    keylink_timeline t;
+    if (!keylink_session_timeline(x, t)) {
+        object_post((t_object *)x, "KeyLink: no session timeline (send session 1 or tempo)");
+        return;
+    }
+    double now = keylink_wall_ms();
+    t_atom a[4];
+    atom_setfloat(a, t.beat_at(now));
+    atom_setfloat(a + 1, t.phase_at(now));
+    atom_setfloat(a + 2, t.tempo);
+    atom_setfloat(a + 3, t.quantum);
+    outlet_anything(x->outlet, gensym("phase"), 4, a);
+}
+
+// beatat <ms>: output "beatat <ms> <beat>" for a KeyLink time (0 = now)
+void keylink_beatat(t_keylink *x, double ms) {
+    keylink_timeline t;
+    if (!keylink_session_timeline(x, t)) {
+        object_post((t_object *)x, "KeyLink: no session timeline (send session 1 or tempo)");
+        return;
+    }
+    if (ms <= 0) ms = keylink_wall_ms();
+    t_atom a[2];
+    atom_setfloat(a, ms);
+    atom_setfloat(a + 1, t.beat_at(ms));
+    outlet_anything(x->outlet, gensym("beatat"), 2, a);
+}
+
+// timeat <beat>: output "timeat <beat> <ms>", the KeyLink time of a beat
+// (usable as apply_at)
+void keylink_timeat(t_keylink *x, double beat) {
+    keylink_timeline t;
+    if (!keylink_session_timeline(x, t)) {
+        object_post((t_object *)x, "KeyLink: no session timeline (send session 1 or tempo)");
+        return;
+    }
+    t_atom a[2];
+    atom_setfloat(a, beat);
+    atom_setfloat(a + 1, t.time_at(beat));
+    outlet_anything(x->outlet, gensym("timeat"), 2, a);
+}
+
 void keylink_start(t_keylink *x) {
     if (x->running) return;
     x->running = true;
-    
-    // Create IO context
-    x->io_ctx.reset(new asio::io_context());
-    
-    // Start network thread
-    x->net_thread = std::thread([x]() {
-        try {
-            bool udp_ok = false;
-            bool ws_ok = false;
-            
-            // Setup UDP for LAN mode
-            if (x->network_mode == MODE_LAN) {
-                try {
-    x->udp_socket.reset(new asio::ip::udp::socket(*x->io_ctx));
-    asio::ip::udp::endpoint listen_ep(asio::ip::udp::v4(), KEYLINK_UDP_PORT);
-    x->udp_socket->open(listen_ep.protocol());
-    x->udp_socket->set_option(asio::ip::udp::socket::reuse_address(true));
-    x->udp_socket->bind(listen_ep);
-                    
-    // Join multicast group
-    asio::ip::address multicast_addr = asio::ip::make_address(KEYLINK_MULTICAST_ADDR);
-    x->udp_socket->set_option(asio::ip::multicast::join_group(multicast_addr));
-    x->multicast_endpoint = asio::ip::udp::endpoint(multicast_addr, KEYLINK_UDP_PORT);
-                    
-        udp_do_receive(x);
-                    object_post((t_object *)x, "KeyLink: UDP multicast started on %s:%d", KEYLINK_MULTICAST_ADDR, KEYLINK_UDP_PORT);
-                    udp_ok = true;
-                } catch (const std::exception& e) {
-                    object_post((t_object *)x, "KeyLink: UDP setup failed: %s", e.what());
-                }
-            }
-            
-            // Setup WebSocket client
-            try {
-                ws_connect(x);
-                ws_ok = true;
-            } catch (const std::exception& e) {
-                object_post((t_object *)x, "KeyLink: WebSocket connection failed: %s", e.what());
-                x->ws_connected = false;
-            }
-            
-            // Report status
-            if (!udp_ok && !ws_ok) {
-                object_post((t_object *)x, "KeyLink: No network connections available");
-            } else if (udp_ok && !ws_ok) {
-                object_post((t_object *)x, "KeyLink: Running in UDP-only mode");
-            } else {
-                object_post((t_object *)x, "KeyLink: Running in full mode (UDP + WebSocket)");
-            }
-            
-            // Run IO context
-        while (x->running) {
-                try {
-                    x->io_ctx->run_for(std::chrono::milliseconds(50));
-                } catch (const std::exception& e) {
-                    object_error((t_object *)x, "KeyLink IO error: %s", e.what());
-                }
-            }
-        } catch (const std::exception& e) {
-            object_error((t_object *)x, "KeyLink network error: %s", e.what());
-        }
-    });
-    
+
+    // Discard commands left over from a previous run
+    keylink_command stale;
+    while (x->commands->pop([&stale](keylink_command& c) { stale.payload.swap(c.payload); })) {}
+    x->drain_pending = false;
+
+    // Join (or open) the shared link for this mode and channel. The
+    // settings are copied here: the Max thread may change them while the
+    // network thread subscribes
+    NetworkMode mode = x->network_mode;
+    std::string channel = x->channel;
+    std::string ws_url = x->ws_url;
+    bool use_uring = x->use_uring;
+    keylink_hub_acquire();
+    asio::post(keylink_hub_get()->io,
+               [x, mode, channel, ws_url, use_uring]() { link_subscribe(x, mode, channel, ws_url, use_uring); });
+
     object_post((t_object *)x, "KeyLink: started in %s mode", x->network_mode == MODE_LAN ? "LAN" : "WAN");
 }
 
 void keylink_stop(t_keylink *x) {
-    x->running = false;
-    if (x->net_thread.joinable()) x->net_thread.join();
+    if (!x->running) return;
+    keylink_net_stop(x);
     object_post((t_object *)x, "KeyLink: stopped");
 }
 
-void udp_do_receive(t_keylink *x) {
-    if (!x->udp_socket) return;
-    
-    x->udp_socket->async_receive_from(
-        asio::buffer(x->recv_buffer, sizeof(x->recv_buffer)),
-        x->multicast_endpoint,
-        [x](std::error_code ec, std::size_t bytes_recvd) {
-            if (!ec && bytes_recvd > 0) {
-                std::string msg(x->recv_buffer, bytes_recvd);
-                
-                // Prevent echo of our own messages
-                if (!is_duplicate_message(x, msg)) {
-                    // Output the message
-                t_atom a;
-                atom_setsym(&a, gensym(msg.c_str()));
-                outlet_anything(x->outlet, gensym("json"), 1, &a);
-                    object_post((t_object *)x, "KeyLink: Received UDP: %s", msg.c_str());
-                }
-                
-                // Continue receiving
-                udp_do_receive(x);
-            } else if (x->running) {
-                // Continue receiving even on error
-                udp_do_receive(x);
-            }
-        }
-    );
-}
+// Leave the shared link and wait until the network thread no longer
+// references this instance
+void keylink_net_stop(t_keylink *x) {
+    if (!x->running) return;
+    x->running = false;
 
-void ws_connect(t_keylink *x) {
-    try {
-        // Parse WebSocket URL
-        std::regex ws_regex("ws://([^:/]+):([0-9]+)(/.*)?");
-        std::smatch match;
-        
-        if (std::regex_match(x->ws_url, match, ws_regex)) {
-            x->ws_host = match[1].str();
-            x->ws_port = std::stoi(match[2].str());
-            x->ws_path = match[3].str();
-            if (x->ws_path.empty()) x->ws_path = "/";
-        } else {
-            object_post((t_object *)x, "KeyLink: Invalid WebSocket URL: %s", x->ws_url.c_str());
+    std::promise<void> done;
+    std::future<void> left = done.get_future();
+    std::function<void()> leave;
+    leave = [x, &done, &leave]() {
+        // A drain posted just before running was cleared is still queued: go after it
+        if (x->drain_pending) {
+            asio::post(keylink_hub_get()->io, leave);
             return;
         }
-        
-        object_post((t_object *)x, "KeyLink: Attempting WebSocket connection to %s:%d%s", 
-                   x->ws_host.c_str(), x->ws_port, (x->ws_path + x->channel).c_str());
-        
-        // Create socket
-        x->ws_socket.reset(new asio::ip::tcp::socket(*x->io_ctx));
-        
-        // Resolve hostname
-        asio::ip::tcp::resolver resolver(*x->io_ctx);
-        auto endpoints = resolver.resolve(x->ws_host, std::to_string(x->ws_port));
-        
-        object_post((t_object *)x, "KeyLink: Resolved hostname, attempting connection...");
-        
-        // Connect
-        asio::connect(*x->ws_socket, endpoints);
-        
-        object_post((t_object *)x, "KeyLink: TCP connection established, sending WebSocket handshake...");
-        
-        // Send WebSocket handshake
-        std::string ws_key = "dGhlIHNhbXBsZSBub25jZQ=="; // Base64 encoded
-        std::string handshake = 
-            "GET " + x->ws_path + x->channel + " HTTP/1.1\r\n"
-            "Host: " + x->ws_host + "\r\n"
-            "Upgrade: websocket\r\n"
-            "Connection: Upgrade\r\n"
-            "Sec-WebSocket-Key: " + ws_key + "\r\n"
-            "Sec-WebSocket-Version: 13\r\n"
-            "\r\n";
-        
-        object_post((t_object *)x, "KeyLink: Sending handshake: %s", handshake.c_str());
-        
-        asio::write(*x->ws_socket, asio::buffer(handshake));
-        
-        // Read response
-        char response[1024];
-        size_t len = x->ws_socket->read_some(asio::buffer(response, sizeof(response)));
-        
-        if (len > 0) {
-            std::string resp(response, len);
-            object_post((t_object *)x, "KeyLink: Received response: %s", resp.c_str());
-            
-            if (resp.find("101 Switching Protocols") != std::string::npos) {
-                x->ws_connected = true;
-                object_post((t_object *)x, "KeyLink: WebSocket connected to %s%s", x->ws_url.c_str(), x->channel.c_str());
-                
-                // Start reading WebSocket messages
-                ws_read(x);
-            } else {
-                object_post((t_object *)x, "KeyLink: WebSocket handshake failed - no 101 response");
-                x->ws_connected = false;
-            }
-        } else {
-            object_post((t_object *)x, "KeyLink: WebSocket handshake failed - no response received");
-            x->ws_connected = false;
-        }
-    } catch (const std::exception& e) {
-        object_post((t_object *)x, "KeyLink: WebSocket connection failed: %s", e.what());
-        x->ws_connected = false;
-    }
-}
-
-void ws_send(t_keylink *x, const std::string& msg) {
-    if (!x->ws_connected || !x->ws_socket) return;
-    
-    try {
-        // Simple WebSocket frame (no masking for client)
-        std::vector<uint8_t> frame;
-        frame.push_back(0x81); // FIN + text frame
-        
-        if (msg.length() < 126) {
-            frame.push_back(msg.length());
-        } else if (msg.length() < 65536) {
-            frame.push_back(126);
-            frame.push_back((msg.length() >> 8) & 0xFF);
-            frame.push_back(msg.length() & 0xFF);
-        } else {
-            frame.push_back(127);
-            for (int i = 7; i >= 0; i--) {
-                frame.push_back((msg.length() >> (i * 8)) & 0xFF);
+        link_unsubscribe(x);
+        done.set_value();
+    };
+    asio::post(keylink_hub_get()->io, leave);
+    left.wait();
+
+    keylink_hub_release();
+}
+
+// --- Network hub ---
+// One io_context and thread serve every instance. The thread runs from the
+// first start to the last stop; run() is held open by a work guard and
+// returns as soon as the guard is released and cancelled operations drain.
+
+// Created on first use and kept for the life of the process
+keylink_hub *keylink_hub_get() {
+    static keylink_hub *hub = new keylink_hub();
+    return hub;
+}
+
+void keylink_hub_acquire() {
+    keylink_hub *hub = keylink_hub_get();
+    std::lock_guard<std::mutex> guard(hub->lock);
+    if (hub->refs++ > 0) return;
+
+    hub->io.restart();
+    hub->work_guard.reset(new keylink_work_guard(hub->io.get_executor()));
+    hub->thread = std::thread([hub]() {
+        for (;;) {
+            try {
+                hub->io.run();
+                break;
+            } catch (const std::exception& e) {
+                object_error(NULL, "KeyLink IO error: %s", e.what());
             }
         }
-        
-        // Add payload
-        frame.insert(frame.end(), msg.begin(), msg.end());
-        
-        asio::write(*x->ws_socket, asio::buffer(frame));
-    } catch (const std::exception& e) {
-        object_post((t_object *)x, "KeyLink: WebSocket send failed: %s", e.what());
-        x->ws_connected = false;
-    }
-}
-
-void ws_read(t_keylink *x) {
-    if (!x->ws_socket) return;
-    
-    x->ws_socket->async_read_some(
-        asio::buffer(x->recv_buffer, sizeof(x->recv_buffer)),
-        [x](std::error_code ec, std::size_t bytes_recvd) {
-            if (!ec && bytes_recvd > 0) {
-                // Simple WebSocket frame parsing
-                if (bytes_recvd >= 2) {
-                    uint8_t opcode = x->recv_buffer[0] & 0x0F;
-                    uint8_t payload_len = x->recv_buffer[1] & 0x7F;
-                    size_t header_len = 2;
-                    
-                    if (payload_len == 126) {
-                        header_len = 4;
-                        payload_len = (x->recv_buffer[2] << 8) | x->recv_buffer[3];
-                    } else if (payload_len == 127) {
-                        header_len = 10;
-                        payload_len = 0;
-                        for (int i = 0; i < 8; i++) {
-                            payload_len = (payload_len << 8) | x->recv_buffer[2 + i];
-                        }
-                    }
-                    
-                    if (opcode == 0x1 && bytes_recvd >= header_len + payload_len) {
-                        std::string msg(x->recv_buffer + header_len, payload_len);
-                        
-                        // Prevent echo of our own messages
-                        if (!is_duplicate_message(x, msg)) {
-                            // Output the message
-                            t_atom a;
-                            atom_setsym(&a, gensym(msg.c_str()));
-                            outlet_anything(x->outlet, gensym("json"), 1, &a);
-                            object_post((t_object *)x, "KeyLink: Received WebSocket: %s", msg.c_str());
-                        }
-                    }
-                }
-                
-                // Continue reading
-                ws_read(x);
-            } else if (x->running) {
-                // Continue reading even on error
-                ws_read(x);
-            }
+    });
+}
+
+void keylink_hub_release() {
+    keylink_hub *hub = keylink_hub_get();
+    std::lock_guard<std::mutex> guard(hub->lock);
+    if (--hub->refs > 0) return;
+
+    // Every link was closed by its last unsubscribe
+    asio::post(hub->io, [hub]() { hub->work_guard->reset(); });
+    hub->thread.join();
+    hub->work_guard.reset();
+}
+
+// A WAN link is one server connection, so instances share it only when
+// they name the same server as well as the same channel
+static std::string link_key(NetworkMode mode, const std::string& channel, const std::string& ws_url) {
+    if (mode == MODE_LAN) return "lan:" + channel;
+    return "wan:" + ws_url + "\n" + channel;
+}
+
+// Network thread: attach an instance to the link for the mode, channel and
+// server it had at start, opening the link if this is the first subscriber
+void link_subscribe(t_keylink *x, NetworkMode mode, const std::string& channel, const std::string& ws_url,
+                    bool use_uring) {
+    keylink_hub *hub = keylink_hub_get();
+    std::string key = link_key(mode, channel, ws_url);
+
+    std::map<std::string, keylink_link_ptr>::iterator it = hub->links.find(key);
+    if (it == hub->links.end()) {
+        keylink_link_ptr l = std::make_shared<keylink_link>(hub->io, key, mode, channel, ws_url, use_uring);
+        hub->links[key] = l;
+        l->subscribers.push_back(x);
+        x->link = l;
+        link_start(l);
+        link_request_hello(l);
+    } else {
+        keylink_link_ptr& l = it->second;
+        l->subscribers.push_back(x);
+        x->link = l;
+        object_post((t_object *)x, "KeyLink: sharing %s link for channel %s (%d instances)",
+                    l->network_mode == MODE_LAN ? "LAN" : "WAN", l->channel.c_str(), (int)l->subscribers.size());
+        // The receive path was chosen by the first instance
+        if (use_uring != l->use_uring) {
+            object_warn((t_object *)x, "KeyLink: uring %s ignored, the shared link already %s io_uring",
+                        use_uring ? "on" : "off", l->use_uring ? "uses" : "does not use");
         }
-    );
+        // Peers learn the new instance's source
+        link_request_hello(l);
+    }
+    if (x->in_session) link_join_session(x->link.get());
+    link_publish_timeline(x->link.get());
 }
 
-void send_message(t_keylink *x, const std::string& msg) {
-    if (!x->running) return;
-    
-    // Prevent duplicate messages
-    if (is_duplicate_message(x, msg)) return;
-    
-    // Send via UDP if available
-    if (x->udp_socket && x->udp_socket->is_open()) {
+// Network thread: detach an instance; the last one out closes the link
+void link_unsubscribe(t_keylink *x) {
+    keylink_link_ptr l = x->link;
+    x->link.reset();
+    if (!l) return;
+    {
+        std::lock_guard<std::mutex> guard(x->timeline->lock);
+        x->timeline->timeline = keylink_timeline();
+    }
+
+    l->subscribers.erase(std::remove(l->subscribers.begin(), l->subscribers.end(), x), l->subscribers.end());
+    if (l->subscribers.empty()) {
+        link_close(l);
+        keylink_hub_get()->links.erase(l->key);
+    }
+}
+
+// Logs through the first subscriber so the message is attributed to a box
+void link_post(keylink_link *l, const char *fmt, ...) {
+    if (l->subscribers.empty()) return;
+    char buf[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    object_post((t_object *)l->subscribers[0], "%s", buf);
+}
+
+// Network thread: open the UDP socket (LAN) and start connecting the WebSocket
+void link_start(const keylink_link_ptr& l) {
+    bool udp_ok = false;
+
+    // Setup UDP for LAN mode: the channel's own group and port
+    if (l->network_mode == MODE_LAN) {
+        std::string group;
+        unsigned short port;
+        keylink_channel_group(l->channel, group, port);
         try {
-            x->udp_socket->async_send_to(
-                asio::buffer(msg),
-                x->multicast_endpoint,
-                [](std::error_code ec, std::size_t bytes_sent) {
-                    if (ec) {
-                        // Silent error - UDP might be offline
-                    }
+            l->udp_socket.reset(new asio::ip::udp::socket(l->io));
+            asio::ip::udp::endpoint listen_ep(asio::ip::udp::v4(), port);
+            l->udp_socket->open(listen_ep.protocol());
+            l->udp_socket->set_option(asio::ip::udp::socket::reuse_address(true));
+#ifdef IP_MULTICAST_ALL
+            // Linux otherwise delivers every group joined on the host to a
+            // socket bound to the port, whichever socket joined it
+            int all = 0;
+            setsockopt(l->udp_socket->native_handle(), IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+#endif
+            l->udp_socket->bind(listen_ep);
+            try {
+                l->udp_socket->set_option(asio::socket_base::receive_buffer_size(KEYLINK_UDP_RECV_BUFFER));
+            } catch (const std::exception&) {
+                // Keep the system default
+            }
+
+            // Join multicast group
+            asio::ip::address multicast_addr = asio::ip::make_address(group);
+            l->udp_socket->set_option(asio::ip::multicast::join_group(multicast_addr));
+            l->multicast_endpoint = asio::ip::udp::endpoint(multicast_addr, port);
+
+            bool uring_ok = false;
+#if KEYLINK_HAS_IO_URING
+            if (l->use_uring) {
+                std::string error;
+                l->udp_uring.reset(new udp_uring_receiver());
+                if (l->udp_uring->open(l->udp_socket->native_handle(), KEYLINK_URING_BUFFERS, KEYLINK_UDP_MAX_DATAGRAM, error)) {
+                    l->udp_ring.reset(new asio::posix::stream_descriptor(l->io, l->udp_uring->fd()));
+                    udp_uring_receive(l);
+                    link_post(l.get(), "KeyLink: UDP receive using io_uring");
+                    uring_ok = true;
+                } else {
+                    l->udp_uring.reset();
+                    link_post(l.get(), "KeyLink: io_uring unavailable (%s), using recvmmsg", error.c_str());
                 }
-            );
+            }
+#endif
+            if (!uring_ok) udp_do_receive(l);
+            link_post(l.get(), "KeyLink: UDP multicast started on %s:%d for channel %s", group.c_str(), (int)port,
+                      l->channel.c_str());
+            udp_ok = true;
         } catch (const std::exception& e) {
-            object_post((t_object *)x, "KeyLink: UDP send failed: %s", e.what());
+            link_post(l.get(), "KeyLink: UDP setup failed: %s", e.what());
         }
     }
-    
-    // Send via WebSocket if available
-    if (x->ws_connected) {
-        ws_send(x, msg);
+
+    // Setup WebSocket client (asynchronous, reconnects on its own)
+    ws_connect(l);
+    link_schedule_ping(l);
+
+    // Report status
+    if (udp_ok) {
+        link_post(l.get(), "KeyLink: Running with UDP, WebSocket connecting in background");
+    } else {
+        link_post(l.get(), "KeyLink: WebSocket connecting in background");
     }
-    
-    // Update tracking
-    x->last_sent_msg = msg;
-    x->last_sent_time = std::chrono::steady_clock::now();
 }
 
-bool is_duplicate_message(t_keylink *x, const std::string& msg) {
-    auto now = std::chrono::steady_clock::now();
-    auto time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - x->last_sent_time).count();
-    
-    // Check if this is the same message sent recently
-    if (msg == x->last_sent_msg && time_diff < 100) {
-        return true;
+// Network thread: cancel every pending operation so its handler completes
+// with operation_aborted. Handlers hold the link alive until they drain.
+void link_close(const keylink_link_ptr& l) {
+    std::error_code ignored;
+    l->open = false;
+
+    ws_connector& conn = l->ws_conn;
+    conn.generation++;
+    conn.race_timer.cancel();
+    conn.reconnect_timer.cancel();
+    for (size_t i = 0; i < conn.attempts.size(); i++) {
+        conn.attempts[i]->finished = true;
+        conn.attempts[i]->timeout.cancel();
+        conn.attempts[i]->socket.close(ignored);
+    }
+    conn.attempts.clear();
+    // An in-flight getaddrinfo cannot be interrupted; its handler is
+    // discarded when it returns
+    for (size_t i = 0; i < conn.resolvers.size(); i++) conn.resolvers[i]->cancel();
+    conn.resolvers.clear();
+    l->hello_timer.cancel();
+    l->ping_timer.cancel();
+    l->report_timer.cancel();
+    l->nack_timer.cancel();
+
+    l->ws_connected = false;
+    if (l->ws_socket) l->ws_socket->close(ignored);
+#if KEYLINK_HAS_IO_URING
+    if (l->udp_ring) {
+        l->udp_ring->cancel(ignored);
+        l->udp_ring->release();
+        l->udp_uring->close();      // The ring holds a reference to the socket
+    }
+#endif
+    if (l->udp_socket) l->udp_socket->close(ignored);
+}
+
+// Write msg into out with "apply_at" as its first field (replacing any
+// apply_at already there is not attempted: the patch's own wins)
+static bool keylink_stamp_apply_at(const char *msg, size_t len, double at, std::string& out) {
+    double existing;
+    if (keylink_top_level_number(msg, len, "apply_at", existing)) return false;
+    size_t i = 0;
+    while (i < len && (msg[i] == ' ' || msg[i] == '\t' || msg[i] == '\n' || msg[i] == '\r')) i++;
+    if (i >= len || msg[i] != '{') return false;
+    size_t body = i + 1;
+    while (body < len && (msg[body] == ' ' || msg[body] == '\t' || msg[body] == '\n' || msg[body] == '\r')) body++;
+
+    char field[48];
+    int n = snprintf(field, sizeof(field), "{\"apply_at\":%.3f%s", at, body < len && msg[body] == '}' ? "" : ",");
+    out.assign(field, (size_t)n);
+    out.append(msg + body, len - body);
+    return true;
+}
+
+// Messages the link handles itself (see link_receive)
+static bool keylink_is_link_message(const std::string& text) {
+    return text.find("\"state-delta\"") != std::string::npos || text.find("\"state-resync\"") != std::string::npos ||
+           text.find("\"keylink-hello\"") != std::string::npos || text.find("\"time-p") != std::string::npos ||
+           text.find("\"state-seq\"") != std::string::npos || text.find("\"state-nack\"") != std::string::npos ||
+           text.find("\"keylink-timeline\"") != std::string::npos;
+}
+
+// Network thread: one received message, parsed once and shared by every subscriber
+void link_receive(keylink_link *l, const char *data, size_t len, const char *transport) {
+    // A fragment of a message over one MTU: handled once the last piece is in
+    if (keylink_is_fragment(data, len)) {
+        std::string whole;
+        if (!l->reassembly.add(data, len, keylink_now_ms(), whole) || keylink_is_fragment(whole.data(), whole.size())) {
+            return;
+        }
+        link_receive(l, whole.data(), whole.size(), transport);
+        return;
+    }
+
+    double arrival = keylink_wall_ms();
+    std::shared_ptr<keylink_message> msg;
+    uint64_t source = 0, seq = 0;
+
+    keylink_enc enc = keylink_detect_encoding(data, len);
+    if (enc == KEYLINK_ENC_PACKET) {
+        // Binary state packets are expanded to the JSON they were packed from
+        keylink_state_packet packet;
+        if (!keylink_packet_decode(data, len, packet)) return;
+        source = packet.source;
+        seq = packet.seq;
+        if (source && !l->dedup.accept(source, seq)) return;
+        msg = std::make_shared<keylink_message>();
+        keylink_packet_to_json(packet, msg->text);
+        keylink_state_from_packet(packet, msg->state);
+        msg->is_state = true;
+    } else if (enc == KEYLINK_ENC_MSGPACK || enc == KEYLINK_ENC_CBOR) {
+        // Converted to JSON text once here, for every subscriber
+        if (!keylink_decode(enc, data, len, l->enc_scratch, source, seq)) return;
+        if (source && !l->dedup.accept(source, seq)) return;
+        msg = std::make_shared<keylink_message>();
+        msg->text.swap(l->enc_scratch);
+        msg->is_state = keylink_is_state_message(msg->text.data(), msg->text.size());
+    } else {
+        // Repeats, multipath copies and echoes of our own messages
+        if (keylink_parse_tag(data, len, source, seq) && !l->dedup.accept(source, seq)) return;
+        msg = std::make_shared<keylink_message>();
+        msg->text.assign(data, len);
+        msg->is_state = keylink_is_state_message(data, len);
+    }
+    // Only UDP is negotiated; WebSocket peers always get JSON text
+    bool udp = strcmp(transport, "UDP") == 0;
+    if (udp) link_note_source(l, source);
+
+    // Reliable senders: late retransmissions are dropped, missed states asked for
+    bool carries_state = msg->is_state || msg->text.find("\"state-delta\"") != std::string::npos;
+    if (source && !link_track_seq(l, source, seq, carries_state)) return;
+
+    // Redundant deltas first: they rebuild states we missed before this one
+    if (carries_state && source && msg->text.find("\"_red\"") != std::string::npos) {
+        link_recover_redundant(l, source, *msg, transport);
+    }
+
+    // Link-level messages: encoding announcements and resync requests stop
+    // here, and a delta becomes the full state it describes. The keylink-
+    // types count only when tagged; untagged, they are the application's.
+    if (!msg->is_state && keylink_is_link_message(msg->text)) {
+        keylink_ojson j = keylink_ojson::parse(msg->text, nullptr, false);
+        keylink_ojson::const_iterator type = j.is_object() ? j.find("type") : j.end();
+        std::string t = type != j.end() && type->is_string() ? type->get<std::string>() : std::string();
+        if (t == "keylink-hello" && source) {
+            if (udp) link_on_hello(l, source, j);
+            return;
+        } else if (t == "state-resync") {
+            link_on_resync(l, j);
+            return;
+        } else if (t == "time-ping") {
+            link_on_ping(l, source, j, arrival, udp ? KEYLINK_VIA_UDP : KEYLINK_VIA_WS);
+            return;
+        } else if (t == "time-pong") {
+            link_on_pong(l, source, j, arrival);
+            return;
+        } else if (t == "keylink-timeline" && source) {
+            link_on_timeline(l, source, j);
+            return;
+        } else if (t == "state-seq") {
+            link_on_state_report(l, j);
+            return;
+        } else if (t == "state-nack") {
+            link_on_nack(l, j);
+            return;
+        } else if (t == "state-delta") {
+            if (!source || !link_apply_delta(l, source, seq, j, msg)) return;
+            msg->is_state = true;
+        }
+    } else if (msg->is_state && source) {
+        link_store_state(l, source, seq, msg);
+    }
+
+    link_deliver(l, source, msg, transport);
+}
+
+// Network thread: hand a received message to every subscriber. Scheduled
+// messages go out when the sender's apply_at comes round on our clock.
+// A state not typed yet on the way here is parsed for the state outlets.
+void link_deliver(keylink_link *l, uint64_t source, const std::shared_ptr<keylink_message>& msg, const char *transport) {
+    if (msg->is_state && !msg->state.has) keylink_state_from_text(msg->text.data(), msg->text.size(), msg->state);
+    if (msg->is_state) keylink_is_state_message(msg->text.data(), msg->text.size(), &msg->replaceable);
+    msg->source = source;
+    double apply_at;
+    if (keylink_top_level_number(msg->text.data(), msg->text.size(), "apply_at", apply_at)) {
+        msg->apply_ms = link_local_time(l, source, apply_at);
+        l->clock_wanted_ms = keylink_now_ms();
+    }
+
+    keylink_message_ptr shared = msg;
+    for (size_t i = 0; i < l->subscribers.size(); i++) {
+        t_keylink *x = l->subscribers[i];
+        keylink_enqueue_inbound(x, shared);
+        if (x->verbose) object_post((t_object *)x, "KeyLink: Received %s: %s", transport, msg->text.c_str());
+    }
+}
+
+// Network thread: a message sent by one instance reaches the others on the
+// same link directly (its network echo is dropped by the link's dedup window)
+void link_fanout(keylink_link *l, const char *data, size_t len, t_keylink *from) {
+    if (l->subscribers.size() < 2) return;
+
+    std::shared_ptr<keylink_message> msg = std::make_shared<keylink_message>();
+    msg->text.assign(data, len);
+    msg->is_state = keylink_is_state_message(data, len, &msg->replaceable);
+    msg->source = from->source_id;
+    if (msg->is_state) keylink_state_from_text(data, len, msg->state);
+    double apply_at;
+    if (keylink_top_level_number(data, len, "apply_at", apply_at)) msg->apply_ms = link_local_time(l, 0, apply_at);
+
+    keylink_message_ptr shared = msg;
+    for (size_t i = 0; i < l->subscribers.size(); i++) {
+        if (l->subscribers[i] != from) keylink_enqueue_inbound(l->subscribers[i], shared);
+    }
+}
+
+// Network thread: remember who is talking on UDP. Untagged messages come
+// from senders that predate tagging and can only read JSON.
+void link_note_source(keylink_link *l, uint64_t source) {
+    double now = keylink_now_ms();
+    if (!source) {
+        l->legacy_heard_ms = now;
+        return;
+    }
+    std::map<uint64_t, keylink_peer>::iterator it = l->peers.find(source);
+    if (it != l->peers.end()) {
+        it->second.last_heard_ms = now;
+        return;
+    }
+    keylink_peer peer;
+    peer.encodings = KEYLINK_ENC_BIT(KEYLINK_ENC_JSON);
+    peer.last_heard_ms = now;
+    l->peers[source] = peer;
+}
+
+// Network thread: a peer announced what it can decode for itself and the
+// other sources in its process. Answer if it is new to us, so it learns
+// about our instances too.
+void link_on_hello(keylink_link *l, uint64_t source, const keylink_ojson& hello) {
+    if (!source) return;
+    static const keylink_ojson none;
+    keylink_ojson::const_iterator found = hello.find("encodings");
+    const keylink_ojson& names = found != hello.end() ? *found : none;
+    found = hello.find("sources");
+    const keylink_ojson& listed = found != hello.end() ? *found : none;
+
+    unsigned encodings = 0;
+    for (size_t i = 0; names.is_array() && i < names.size(); i++) {
+        keylink_enc e = names[i].is_string() ? keylink_enc_from_name(names[i].get<std::string>()) : KEYLINK_ENC_UNKNOWN;
+        if (e != KEYLINK_ENC_UNKNOWN) encodings |= KEYLINK_ENC_BIT(e);
+    }
+    encodings |= KEYLINK_ENC_BIT(KEYLINK_ENC_JSON);
+
+    std::vector<uint64_t> sources(1, source);
+    for (size_t i = 0; listed.is_array() && i < listed.size(); i++) {
+        uint64_t s = 0;
+        if (listed[i].is_string() && keylink_parse_source(listed[i].get<std::string>(), s) && s) sources.push_back(s);
+    }
+
+    bool changed = false;
+    double now = keylink_now_ms();
+    for (size_t i = 0; i < sources.size(); i++) {
+        keylink_peer& peer = l->peers[sources[i]];
+        if (peer.encodings != encodings) changed = true;
+        peer.encodings = encodings;
+        peer.last_heard_ms = now;
+    }
+    l->clock_wanted_ms = now;
+    if (changed) link_request_hello(l->shared_from_this());
+}
+
+// Network thread: announce at most once per KEYLINK_HELLO_INTERVAL_MS
+void link_request_hello(const keylink_link_ptr& l) {
+    if (!l->udp_socket || l->hello_pending) return;
+    double wait = l->hello_sent_ms + KEYLINK_HELLO_INTERVAL_MS - keylink_now_ms();
+    if (wait <= 0) {
+        link_send_hello(l);
+        return;
+    }
+    l->hello_pending = true;
+    l->hello_timer.expires_after(std::chrono::milliseconds((long long)wait + 1));
+    l->hello_timer.async_wait([l](std::error_code ec) {
+        l->hello_pending = false;
+        if (!ec && l->open) link_send_hello(l);
+    });
+}
+
+// Network thread: {"_src":..,"_seq":..,"type":"keylink-hello","encodings":[..],"sources":[..]}
+// in JSON, so every peer can read it. Tagged with the first subscriber's
+// source; "sources" lists every instance on this link.
+void link_send_hello(const keylink_link_ptr& l) {
+    if (!l->udp_socket || !l->udp_socket->is_open() || l->subscribers.empty()) return;
+    l->hello_sent_ms = keylink_now_ms();
+
+    std::string sources;
+    for (size_t i = 0; i < l->subscribers.size(); i++) {
+        char hex[24];
+        snprintf(hex, sizeof(hex), "%s\"%016llx\"", i ? "," : "", (unsigned long long)l->subscribers[i]->source_id);
+        sources += hex;
+    }
+    std::string hello = "{\"type\":\"keylink-hello\",\"encodings\":[\"msgpack\",\"cbor\",\"json\",\"packet\"],"
+                        "\"sources\":[" + sources + "]}";
+
+    link_send_control(l, hello, KEYLINK_VIA_UDP);
+}
+
+// Network thread: send a link-level message tagged with the first
+// subscriber's source, over UDP and/or the WebSocket
+void link_send_control(const keylink_link_ptr& l, const std::string& text, int via) {
+    if (l->subscribers.empty()) return;
+    t_keylink *x = l->subscribers[0];
+    if (!keylink_tag_message(x->source_id, x->send_seq + 1, text.data(), text.size(), l->tag_scratch)) return;
+    l->dedup.accept(x->source_id, ++x->send_seq);
+    if ((via & KEYLINK_VIA_UDP) && link_queue_udp(l.get(), x->source_id, l->tag_scratch.data(), l->tag_scratch.size())) {
+        udp_flush(l);
+    }
+    if ((via & KEYLINK_VIA_WS) && l->ws_connected) ws_send_frame(l, WS_OP_TEXT, l->tag_scratch.data(), l->tag_scratch.size());
+}
+
+// Network thread: remember the newest full state from a source. Costs a
+// map lookup; the message is only parsed if a delta arrives for it.
+void link_store_state(keylink_link *l, uint64_t source, uint64_t seq, const keylink_message_ptr& msg) {
+    std::map<uint64_t, keylink_state_base>::iterator it = l->state_bases.find(source);
+    if (it == l->state_bases.end()) {
+        if (l->state_bases.size() >= KEYLINK_DEDUP_SOURCES) {
+            std::map<uint64_t, keylink_state_base>::iterator oldest = l->state_bases.begin();
+            for (std::map<uint64_t, keylink_state_base>::iterator i = l->state_bases.begin(); i != l->state_bases.end(); ++i) {
+                if (i->second.heard_ms < oldest->second.heard_ms) oldest = i;
+            }
+            l->state_bases.erase(oldest);
+        }
+        it = l->state_bases.insert(std::make_pair(source, keylink_state_base())).first;
+    }
+    keylink_state_base& base = it->second;
+    if (base.msg && seq < base.seq) return;     // Reordered behind a newer state
+    base.seq = seq;
+    base.msg = msg;
+    base.parsed = nullptr;
+    base.heard_ms = keylink_now_ms();
+}
+
+// Network thread: rebuild the full state from the delta's base and make it
+// the new base. A delta whose base we do not hold is dropped and the
+// sender is asked for a keyframe.
+bool link_apply_delta(keylink_link *l, uint64_t source, uint64_t seq, const keylink_ojson& delta,
+                      const std::shared_ptr<keylink_message>& msg) {
+    std::map<uint64_t, keylink_state_base>::iterator it = l->state_bases.find(source);
+    keylink_ojson::const_iterator base_seq = delta.find("base");
+    if (it == l->state_bases.end() || !it->second.msg || base_seq == delta.end() || !base_seq->is_number_unsigned() ||
+        base_seq->get<uint64_t>() != it->second.seq) {
+        link_request_resync(l, source);
+        return false;
+    }
+
+    keylink_state_base& base = it->second;
+    if (base.parsed.is_null()) base.parsed = keylink_ojson::parse(base.msg->text, nullptr, false);
+    if (base.parsed.is_discarded() || !keylink_delta_apply(base.parsed, delta)) {
+        base.msg.reset();
+        link_request_resync(l, source);
+        return false;
+    }
+    base.parsed["_seq"] = seq;
+    msg->text = base.parsed.dump();
+    keylink_state_from_json(base.parsed, msg->state);
+    base.seq = seq;
+    base.msg = msg;
+    base.heard_ms = keylink_now_ms();
+    return true;
+}
+
+// Network thread: take "_red" off a state or delta from source and output
+// each state it describes that we missed: those chained to the base we
+// hold and not yet seen, oldest first. Each becomes the new base.
+void link_recover_redundant(keylink_link *l, uint64_t source, keylink_message& msg, const char *transport) {
+    keylink_ojson j = keylink_ojson::parse(msg.text, nullptr, false);
+    keylink_ojson::iterator found = j.is_object() ? j.find("_red") : j.end();
+    if (found == j.end()) return;
+    keylink_ojson red;
+    red.swap(*found);
+    j.erase(found);
+    msg.text = j.dump();
+
+    std::map<uint64_t, keylink_state_base>::iterator it = l->state_bases.find(source);
+    if (!red.is_array() || it == l->state_bases.end() || !it->second.msg) return;
+    keylink_state_base& base = it->second;
+    for (size_t i = 0; i < red.size(); i++) {
+        const keylink_ojson& entry = red[i];
+        keylink_ojson::const_iterator seq = entry.is_object() ? entry.find("_seq") : entry.end();
+        keylink_ojson::const_iterator base_seq = entry.is_object() ? entry.find("base") : entry.end();
+        if (seq == entry.end() || base_seq == entry.end() || !seq->is_number_unsigned() ||
+            !base_seq->is_number_unsigned() || base_seq->get<uint64_t>() != base.seq ||
+            seq->get<uint64_t>() <= base.seq || !l->dedup.accept(source, seq->get<uint64_t>())) {
+            continue;
+        }
+
+        if (base.parsed.is_null()) base.parsed = keylink_ojson::parse(base.msg->text, nullptr, false);
+        if (base.parsed.is_discarded() || !keylink_delta_apply(base.parsed, entry)) {
+            base.msg.reset();
+            return;
+        }
+        base.parsed["_seq"] = seq->get<uint64_t>();
+        std::shared_ptr<keylink_message> rebuilt = std::make_shared<keylink_message>();
+        rebuilt->text = base.parsed.dump();
+        rebuilt->is_state = true;
+        keylink_state_from_json(base.parsed, rebuilt->state);
+        base.seq = seq->get<uint64_t>();
+        base.msg = rebuilt;
+        base.heard_ms = keylink_now_ms();
+        link_post(l, "KeyLink: rebuilt state %llu from %016llx from a redundant copy", (unsigned long long)base.seq,
+                  (unsigned long long)source);
+        link_deliver(l, source, rebuilt, transport);
+    }
+}
+
+// Network thread: {"type":"state-resync","source":"<hex>"}, at most once
+// per KEYLINK_RESYNC_INTERVAL_MS per source
+void link_request_resync(keylink_link *l, uint64_t source) {
+    keylink_state_base& base = l->state_bases[source];
+    double now = keylink_now_ms();
+    if (now - base.resync_ms < KEYLINK_RESYNC_INTERVAL_MS) return;
+    base.resync_ms = now;
+    if (!base.heard_ms) base.heard_ms = now;
+
+    char request[64];
+    snprintf(request, sizeof(request), "{\"type\":\"state-resync\",\"source\":\"%016llx\"}", (unsigned long long)source);
+    link_post(l, "KeyLink: missed the base of a delta from %016llx, requesting a keyframe", (unsigned long long)source);
+    link_send_control(l->shared_from_this(), request, KEYLINK_VIA_UDP | KEYLINK_VIA_WS);
+}
+
+// Network thread: a receiver missed one of our deltas; resend the last
+// state whole, unless a keyframe just went out
+void link_on_resync(keylink_link *l, const keylink_ojson& request) {
+    keylink_ojson::const_iterator target = request.find("source");
+    uint64_t source = 0;
+    if (target == request.end() || !target->is_string() || !keylink_parse_source(target->get<std::string>(), source)) return;
+
+    double now = keylink_now_ms();
+    for (size_t i = 0; i < l->subscribers.size(); i++) {
+        t_keylink *x = l->subscribers[i];
+        if (x->source_id != source || !x->send_delta || !x->delta->has_state()) continue;
+        if (now - x->delta->keyframe_time() < KEYLINK_RESYNC_INTERVAL_MS) continue;
+        x->delta->request_keyframe();
+        send_message(x, x->delta->last_state());
+        udp_flush(x->link);
+    }
+}
+
+// Network thread: note a tagged message from source for the NACK tracker.
+// False for a state older than one already output from a reliable source.
+bool link_track_seq(keylink_link *l, uint64_t source, uint64_t seq, bool state) {
+    if (!l->nacks.on_message(source, seq, state, keylink_now_ms(), l->nack_scratch)) return false;
+    if (!l->nack_scratch.empty()) link_send_nack(l, source, l->nack_scratch);
+    return true;
+}
+
+// Network thread: {"type":"state-nack","source":"<hex>","seqs":[...]}, over UDP
+void link_send_nack(keylink_link *l, uint64_t source, const std::vector<uint64_t>& seqs) {
+    if (!l->udp_socket || !l->udp_socket->is_open()) return;
+    std::string nack = "{\"type\":\"state-nack\",\"source\":\"";
+    char num[24];
+    snprintf(num, sizeof(num), "%016llx", (unsigned long long)source);
+    nack += num;
+    nack += "\",\"seqs\":[";
+    for (size_t i = 0; i < seqs.size(); i++) {
+        snprintf(num, sizeof(num), "%s%llu", i ? "," : "", (unsigned long long)seqs[i]);
+        nack += num;
+    }
+    nack += "]}";
+    link_post(l, "KeyLink: missed %zu message(s) from %016llx, asking again", seqs.size(), (unsigned long long)source);
+    link_send_control(l->shared_from_this(), nack, KEYLINK_VIA_UDP);
+    link_schedule_nack_retry(l->shared_from_this());
+}
+
+// Network thread: repeat NACKs nobody answered until they are answered or
+// have been sent KEYLINK_NACK_TRIES times
+void link_schedule_nack_retry(const keylink_link_ptr& l) {
+    if (l->nack_armed) return;
+    l->nack_armed = true;
+    l->nack_timer.expires_after(std::chrono::milliseconds(KEYLINK_NACK_RETRY_MS));
+    l->nack_timer.async_wait([l](std::error_code ec) {
+        l->nack_armed = false;
+        if (ec || !l->open) return;
+        keylink_link *raw = l.get();
+        bool waiting = l->nacks.retry(keylink_now_ms(), l->nack_scratch, [raw](uint64_t source, const std::vector<uint64_t>& seqs) {
+            link_send_nack(raw, source, seqs);
+        });
+        if (waiting) link_schedule_nack_retry(l);
+    });
+}
+
+// Network thread: resend the states a receiver asked for, if they are ours
+// and still in the ring. Someone else's NACK holds back our own for the same states.
+void link_on_nack(keylink_link *l, const keylink_ojson& nack) {
+    keylink_ojson::const_iterator target = nack.find("source");
+    keylink_ojson::const_iterator seqs = nack.find("seqs");
+    uint64_t source = 0;
+    if (target == nack.end() || !target->is_string() || !keylink_parse_source(target->get<std::string>(), source) ||
+        seqs == nack.end() || !seqs->is_array()) {
+        return;
+    }
+
+    double now = keylink_now_ms();
+    bool ours = false;
+    for (size_t i = 0; i < l->subscribers.size(); i++) ours = ours || l->subscribers[i]->source_id == source;
+    if (!ours) {
+        uint64_t last = 0;
+        for (keylink_ojson::const_iterator s = seqs->begin(); s != seqs->end(); ++s) {
+            if (s->is_number_unsigned() && s->get<uint64_t>() > last) last = s->get<uint64_t>();
+        }
+        l->nacks.on_nack(source, last, now);
+        return;
+    }
+
+    // None of them a state we still have: say which state is newest instead
+    bool held = false, queued = false;
+    for (keylink_ojson::const_iterator s = seqs->begin(); s != seqs->end(); ++s) {
+        if (!s->is_number_unsigned() || !l->retransmit.holds(source, s->get<uint64_t>())) continue;
+        held = true;
+        const std::string *state = l->retransmit.resend(source, s->get<uint64_t>(), now);
+        if (state) queued = link_queue_udp(l, source, state->data(), state->size()) || queued;
+    }
+    if (queued) udp_flush(l->shared_from_this());
+    if (!held && now - l->report_sent_ms >= KEYLINK_RETRANSMIT_HOLDOFF_MS) link_send_state_report(l->shared_from_this());
+}
+
+// Network thread: {"type":"state-seq","states":{"<hex>":seq,...}} from a
+// reliable sender; ask for any newest state we have not received
+void link_on_state_report(keylink_link *l, const keylink_ojson& report) {
+    keylink_ojson::const_iterator states = report.find("states");
+    if (states == report.end() || !states->is_object()) return;
+    double now = keylink_now_ms();
+    for (keylink_ojson::const_iterator it = states->begin(); it != states->end(); ++it) {
+        uint64_t source = 0;
+        if (!it->is_number_unsigned() || !keylink_parse_source(it.key(), source)) continue;
+        bool ours = false;
+        for (size_t i = 0; i < l->subscribers.size(); i++) ours = ours || l->subscribers[i]->source_id == source;
+        if (ours) continue;
+        std::map<uint64_t, keylink_state_base>::const_iterator base = l->state_bases.find(source);
+        uint64_t received = base != l->state_bases.end() && base->second.msg ? base->second.seq : 0;
+        l->nacks.on_report(source, it->get<uint64_t>(), received, now, l->nack_scratch);
+        if (!l->nack_scratch.empty()) link_send_nack(l, source, l->nack_scratch);
+    }
+}
+
+// Network thread: report our newest states once sending has been quiet for
+// KEYLINK_STATE_REPORT_MS, so a receiver that lost the last one finds out
+void link_schedule_report(const keylink_link_ptr& l) {
+    l->report_due_ms = keylink_now_ms() + KEYLINK_STATE_REPORT_MS;
+    if (l->report_armed) return;
+    l->report_armed = true;
+    l->report_timer.expires_after(std::chrono::milliseconds(KEYLINK_STATE_REPORT_MS));
+    l->report_timer.async_wait([l](std::error_code ec) {
+        l->report_armed = false;
+        if (ec || !l->open) return;
+        double wait = l->report_due_ms - keylink_now_ms();
+        if (wait > 0) {
+            l->report_armed = true;
+            l->report_timer.expires_after(std::chrono::milliseconds((long long)wait + 1));
+            l->report_timer.async_wait([l](std::error_code ec) {
+                l->report_armed = false;
+                if (!ec && l->open) link_send_state_report(l);
+            });
+            return;
+        }
+        link_send_state_report(l);
+    });
+}
+
+// Network thread: the newest state of every reliable instance on this link, over UDP
+void link_send_state_report(const keylink_link_ptr& l) {
+    std::string report;
+    for (size_t i = 0; i < l->subscribers.size(); i++) {
+        t_keylink *x = l->subscribers[i];
+        if (!x->send_reliable || !x->last_state_seq) continue;
+        char entry[48];
+        snprintf(entry, sizeof(entry), "%s\"%016llx\":%llu", report.empty() ? "" : ",", (unsigned long long)x->source_id,
+                 (unsigned long long)x->last_state_seq);
+        report += entry;
+    }
+    if (report.empty()) return;
+    l->report_sent_ms = keylink_now_ms();
+    link_send_control(l, "{\"type\":\"state-seq\",\"states\":{" + report + "}}", KEYLINK_VIA_UDP);
+}
+
+// Network thread: the best encoding every live UDP peer can decode. JSON
+// while a legacy sender is around or before anyone has said hello.
+keylink_enc link_udp_encoding(keylink_link *l) {
+    double now = keylink_now_ms();
+    if (now - l->legacy_heard_ms < KEYLINK_PEER_TIMEOUT_MS) return KEYLINK_ENC_JSON;
+
+    unsigned common = KEYLINK_ENC_ALL_SCHEMALESS;
+    bool any = false;
+    std::map<uint64_t, keylink_peer>::iterator it = l->peers.begin();
+    while (it != l->peers.end()) {
+        if (now - it->second.last_heard_ms >= KEYLINK_PEER_TIMEOUT_MS) {
+            l->peers.erase(it++);
+            continue;
+        }
+        common &= it->second.encodings;
+        any = true;
+        ++it;
+    }
+    if (!any) return KEYLINK_ENC_JSON;
+    if (common & KEYLINK_ENC_BIT(KEYLINK_ENC_MSGPACK)) return KEYLINK_ENC_MSGPACK;
+    if (common & KEYLINK_ENC_BIT(KEYLINK_ENC_CBOR)) return KEYLINK_ENC_CBOR;
+    return KEYLINK_ENC_JSON;
+}
+
+// Network thread: ping every KEYLINK_PING_INTERVAL_MS while a peer has said
+// hello, scheduled messages are arriving or one of our instances sends them
+void link_schedule_ping(const keylink_link_ptr& l) {
+    l->ping_timer.expires_after(std::chrono::milliseconds(KEYLINK_PING_INTERVAL_MS));
+    l->ping_timer.async_wait([l](std::error_code ec) {
+        if (ec || !l->open) return;
+        double now = keylink_now_ms();
+        bool wanted = now - l->clock_wanted_ms < KEYLINK_PEER_TIMEOUT_MS;
+        bool session = false;
+        for (size_t i = 0; i < l->subscribers.size(); i++) {
+            wanted = wanted || l->subscribers[i]->lead_ms > 0;
+            session = session || l->subscribers[i]->in_session;
+        }
+        if (wanted || session) {
+            char ping[64];
+            snprintf(ping, sizeof(ping), "{\"type\":\"time-ping\",\"t0\":%.3f}", keylink_wall_ms());
+            link_send_control(l, ping, KEYLINK_VIA_UDP | KEYLINK_VIA_WS);
+        }
+
+        // Session peers keep announcing the timeline, so late joiners and
+        // peers with better clock estimates converge
+        if (session && l->timeline.valid()) {
+            if (l->timeline_provisional && now - l->timeline_joined_ms >= KEYLINK_TIMELINE_LISTEN_MS) {
+                l->timeline_provisional = false;
+            }
+            if (!l->timeline_provisional) link_send_timeline(l);
+        }
+
+        // Reliable senders repeat their report, in case it or a NACK was lost
+        link_send_state_report(l);
+
+        // Forget peers that stopped answering
+        double wall = keylink_wall_ms();
+        std::map<uint64_t, keylink_clock_estimate>::iterator it = l->clocks.begin();
+        while (it != l->clocks.end()) {
+            if (wall - it->second.last_sample_ms() < KEYLINK_PEER_TIMEOUT_MS) {
+                ++it;
+                continue;
+            }
+            std::map<uint64_t, uint64_t>::iterator a = l->clock_alias.begin();
+            while (a != l->clock_alias.end()) {
+                if (a->second == it->first) l->clock_alias.erase(a++);
+                else ++a;
+            }
+            l->clocks.erase(it++);
+        }
+        link_schedule_ping(l);
+    });
+}
+
+// Network thread: answer a ping on the transport it came in on, listing
+// our sources so the pinger can map any of them to this clock
+void link_on_ping(keylink_link *l, uint64_t source, const keylink_ojson& ping, double arrival, int via) {
+    keylink_ojson::const_iterator t0 = ping.find("t0");
+    if (!source || t0 == ping.end() || !t0->is_number()) return;
+    l->clock_wanted_ms = keylink_now_ms();
+
+    char head[160];
+    snprintf(head, sizeof(head), "{\"type\":\"time-pong\",\"to\":\"%016llx\",\"t0\":%.3f,\"t1\":%.3f,\"t2\":%.3f,\"sources\":[",
+             (unsigned long long)source, t0->get<double>(), arrival, keylink_wall_ms());
+    std::string pong = head;
+    for (size_t i = 0; i < l->subscribers.size(); i++) {
+        char hex[24];
+        snprintf(hex, sizeof(hex), "%s\"%016llx\"", i ? "," : "", (unsigned long long)l->subscribers[i]->source_id);
+        pong += hex;
+    }
+    pong += "]}";
+    link_send_control(l->shared_from_this(), pong, via);
+}
+
+// Network thread: a pong answering one of our pings is one clock sample
+void link_on_pong(keylink_link *l, uint64_t source, const keylink_ojson& pong, double arrival) {
+    keylink_ojson::const_iterator to = pong.find("to");
+    keylink_ojson::const_iterator t0 = pong.find("t0");
+    keylink_ojson::const_iterator t1 = pong.find("t1");
+    keylink_ojson::const_iterator t2 = pong.find("t2");
+    uint64_t target = 0;
+    if (!source || to == pong.end() || !to->is_string() || !keylink_parse_source(to->get<std::string>(), target)) return;
+    if (t0 == pong.end() || t1 == pong.end() || t2 == pong.end() || !t0->is_number() || !t1->is_number() ||
+        !t2->is_number()) {
+        return;
+    }
+    bool ours = false;
+    for (size_t i = 0; i < l->subscribers.size(); i++) ours = ours || l->subscribers[i]->source_id == target;
+    if (!ours) return;
+
+    l->clocks[source].add(t0->get<double>(), t1->get<double>(), t2->get<double>(), arrival);
+    l->clock_alias[source] = source;
+    keylink_ojson::const_iterator listed = pong.find("sources");
+    for (size_t i = 0; listed != pong.end() && listed->is_array() && i < listed->size(); i++) {
+        uint64_t s = 0;
+        if ((*listed)[i].is_string() && keylink_parse_source((*listed)[i].get<std::string>(), s) && s) {
+            l->clock_alias[s] = source;
+        }
+    }
+}
+
+// Network thread: apply_at on the sender's clock -> keylink_now_ms() here.
+// Without an estimate for the sender the clocks are taken to agree. 0 means
+// output on arrival (already due, or implausibly far ahead).
+double link_local_time(keylink_link *l, uint64_t source, double apply_at) {
+    bool estimated;
+    double offset = link_peer_offset(l, source, apply_at, estimated);
+    double now = keylink_now_ms();
+    double local = now + (apply_at - offset - keylink_wall_ms());
+    if (local <= now || local - now > KEYLINK_APPLY_MAX_AHEAD_MS) return 0;
+    return local;
+}
+
+// Network thread: a source's clock minus ours around time at; 0 (and
+// estimated false) if that peer has not been measured
+double link_peer_offset(keylink_link *l, uint64_t source, double at, bool& estimated) {
+    estimated = false;
+    std::map<uint64_t, uint64_t>::iterator alias = source ? l->clock_alias.find(source) : l->clock_alias.end();
+    if (alias == l->clock_alias.end()) return 0;
+    std::map<uint64_t, keylink_clock_estimate>::iterator c = l->clocks.find(alias->second);
+    if (c == l->clocks.end() || !c->second.valid()) return 0;
+    estimated = true;
+    return c->second.offset_at(at);
+}
+
+static bool link_same_process(keylink_link *l, uint64_t a, uint64_t b) {
+    if (a == b) return true;
+    std::map<uint64_t, uint64_t>::iterator pa = l->clock_alias.find(a), pb = l->clock_alias.find(b);
+    return pa != l->clock_alias.end() && pb != l->clock_alias.end() && pa->second == pb->second;
+}
+
+// Network thread: an instance joined the session. Without a timeline the
+// link starts its own at the default tempo, but only announces it after
+// listening for an established session first.
+void link_join_session(keylink_link *l) {
+    l->clock_wanted_ms = keylink_now_ms();
+    if (l->timeline.valid() || l->subscribers.empty()) return;
+    l->timeline = keylink_timeline_change(keylink_timeline(), 0, 0, keylink_wall_ms(), l->subscribers[0]->source_id);
+    l->timeline_provisional = true;
+    l->timeline_estimated = true;
+    l->timeline_joined_ms = keylink_now_ms();
+    link_publish_timeline(l);
+}
+
+// Network thread: a local tempo/quantum change is a new version, announced at once
+void link_change_timeline(keylink_link *l, t_keylink *x, double tempo, double quantum) {
+    l->clock_wanted_ms = keylink_now_ms();
+    l->timeline = keylink_timeline_change(l->timeline, tempo, quantum, keylink_wall_ms(), x->source_id);
+    l->timeline_provisional = false;
+    l->timeline_estimated = true;
+    link_publish_timeline(l);
+    link_send_timeline(l->shared_from_this());
+    object_post((t_object *)x, "KeyLink: session tempo %.2f bpm, quantum %.2f", l->timeline.tempo, l->timeline.quantum);
+}
+
+// Network thread: a peer's timeline, with times on its clock. Take it if it
+// orders after ours (or we are still listening), refresh ours from the
+// owner once its clock is measured, and answer a peer that is behind.
+void link_on_timeline(keylink_link *l, uint64_t source, const keylink_ojson& j) {
+    static const char *numbers[] = {"tempo", "quantum", "beat", "time", "changed"};
+    double v[5];
+    for (int i = 0; i < 5; i++) {
+        keylink_ojson::const_iterator it = j.find(numbers[i]);
+        if (it == j.end() || !it->is_number()) return;
+        v[i] = it->get<double>();
+    }
+    keylink_ojson::const_iterator version = j.find("version");
+    keylink_ojson::const_iterator owner = j.find("owner");
+    keylink_timeline t;
+    if (!source || version == j.end() || !version->is_number_unsigned() || owner == j.end() || !owner->is_string() ||
+        !keylink_parse_source(owner->get<std::string>(), t.owner)) {
+        return;
+    }
+    if (v[0] < KEYLINK_TIMELINE_MIN_TEMPO || v[0] > KEYLINK_TIMELINE_MAX_TEMPO || v[1] <= 0) return;
+    l->clock_wanted_ms = keylink_now_ms();
+
+    bool estimated;
+    double offset = link_peer_offset(l, source, v[3], estimated);
+    t.tempo = v[0];
+    t.quantum = v[1];
+    t.beat = v[2];
+    t.time = v[3] - offset;
+    t.changed = v[4];
+    t.version = version->get<uint64_t>();
+
+    keylink_timeline_verdict verdict = keylink_timeline_judge(l->timeline, l->timeline_estimated, l->timeline_provisional, t,
+                                                              estimated, link_same_process(l, source, t.owner));
+    if (verdict == KEYLINK_TIMELINE_TAKE) {
+        l->timeline = t;
+        l->timeline_provisional = false;
+        l->timeline_estimated = estimated;
+        link_publish_timeline(l);
+        return;
+    }
+    if (verdict == KEYLINK_TIMELINE_IGNORE) return;
+
+    bool session = false;
+    for (size_t i = 0; i < l->subscribers.size(); i++) session = session || l->subscribers[i]->in_session;
+    if (session && keylink_now_ms() - l->timeline_sent_ms >= KEYLINK_TIMELINE_REPLY_MS) link_send_timeline(l->shared_from_this());
+}
+
+// Network thread: {"type":"keylink-timeline",..} anchored at now on our clock
+void link_send_timeline(const keylink_link_ptr& l) {
+    if (!l->timeline.valid()) return;
+    keylink_timeline t = l->timeline;
+    t.anchor(keylink_wall_ms());
+    l->timeline_sent_ms = keylink_now_ms();
+
+    char text[320];
+    snprintf(text, sizeof(text),
+             "{\"type\":\"keylink-timeline\",\"version\":%llu,\"owner\":\"%016llx\",\"changed\":%.3f,\"tempo\":%.17g,"
+             "\"quantum\":%.17g,\"beat\":%.17g,\"time\":%.3f}",
+             (unsigned long long)t.version, (unsigned long long)t.owner, t.changed, t.tempo, t.quantum, t.beat, t.time);
+    link_send_control(l, text, KEYLINK_VIA_UDP | KEYLINK_VIA_WS);
+}
+
+// Network thread: copy the timeline to every subscriber for Max threads
+void link_publish_timeline(keylink_link *l) {
+    for (size_t i = 0; i < l->subscribers.size(); i++) {
+        std::lock_guard<std::mutex> guard(l->subscribers[i]->timeline->lock);
+        l->subscribers[i]->timeline->timeline = l->timeline;
+    }
+}
+
+// Wait for readiness, then drain every queued datagram with as few
+// syscalls as possible (recvmmsg on Linux) before re-arming
+void udp_do_receive(const keylink_link_ptr& l) {
+    if (!l->udp_socket) return;
+
+    l->udp_socket->async_wait(asio::socket_base::wait_read, [l](std::error_code ec) {
+        if (ec) {
+            if (ec != asio::error::operation_aborted && l->open) udp_do_receive(l);
+            return;
+        }
+
+        udp_recv_batch& in = l->udp_in;
+        int n;
+        while ((n = in.receive(l->udp_socket->native_handle())) > 0) {
+            for (int i = 0; i < n; i++) link_receive(l.get(), in.data(i), in.size(i), "UDP");
+            if ((size_t)n < in.count) break;
+        }
+
+        // Continue receiving even on error
+        udp_do_receive(l);
+    });
+}
+
+#if KEYLINK_HAS_IO_URING
+// The multishot receive stays armed in the kernel; this only waits for the
+// ring fd to report completions and drains them
+void udp_uring_receive(const keylink_link_ptr& l) {
+    l->udp_ring->async_wait(asio::posix::stream_descriptor::wait_read, [l](std::error_code ec) {
+        if (ec) return;
+        keylink_link *raw = l.get();
+        l->udp_uring->drain([raw](const char *data, size_t len) { link_receive(raw, data, len, "UDP"); });
+        udp_uring_receive(l);
+    });
+}
+#else
+void udp_uring_receive(const keylink_link_ptr& l) {}
+#endif
+
+// --- WebSocket connection ---
+// Everything below runs on the network thread and never blocks: resolve,
+// connect and handshake are asynchronous with a timeout, resolved endpoints
+// are cached, candidate endpoints are raced happy-eyeballs style, and a
+// dropped connection reconnects with jittered exponential backoff.
+
+struct ws_dns_entry {
+    std::vector<asio::ip::tcp::endpoint> endpoints;
+    std::chrono::steady_clock::time_point expires;
+};
+
+// Shared by every [keylink] in the process
+static std::mutex ws_dns_lock;
+static std::map<std::string, ws_dns_entry> ws_dns_cache;
+
+static bool ws_dns_lookup(const std::string& key, std::vector<asio::ip::tcp::endpoint>& out, bool allow_stale) {
+    std::lock_guard<std::mutex> lock(ws_dns_lock);
+    std::map<std::string, ws_dns_entry>::iterator it = ws_dns_cache.find(key);
+    if (it == ws_dns_cache.end()) return false;
+    if (!allow_stale && it->second.expires < std::chrono::steady_clock::now()) return false;
+    out = it->second.endpoints;
+    return true;
+}
+
+static void ws_dns_store(const std::string& key, const std::vector<asio::ip::tcp::endpoint>& endpoints) {
+    std::lock_guard<std::mutex> lock(ws_dns_lock);
+    ws_dns_entry& e = ws_dns_cache[key];
+    e.endpoints = endpoints;
+    e.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(KEYLINK_DNS_TTL_MS);
+}
+
+// URLs raced against each other: the configured relay, plus the LAN relay
+// when the configured one is remote
+static std::vector<std::string> ws_candidate_urls(keylink_link *l) {
+    std::vector<std::string> urls;
+    urls.push_back(l->ws_url);
+    if (l->ws_url != KEYLINK_WS_LAN_URL) urls.push_back(KEYLINK_WS_LAN_URL);
+    return urls;
+}
+
+static void ws_add_candidates(keylink_link *l, const ws_candidate& base, const std::vector<asio::ip::tcp::endpoint>& endpoints) {
+    for (size_t i = 0; i < endpoints.size(); i++) {
+        ws_candidate c = base;
+        c.endpoint = endpoints[i];
+        l->ws_conn.candidates.push_back(c);
+    }
+}
+
+void ws_connect(const keylink_link_ptr& l) {
+    if (!l->open) return;
+    ws_connector& conn = l->ws_conn;
+    unsigned gen = ++conn.generation;
+
+    // Abandon anything left from a previous round
+    for (size_t i = 0; i < conn.attempts.size(); i++) {
+        conn.attempts[i]->finished = true;
+        std::error_code ignored;
+        conn.attempts[i]->socket.close(ignored);
+        conn.attempts[i]->timeout.cancel();
+    }
+    conn.attempts.clear();
+    conn.candidates.clear();
+    conn.resolvers.clear();
+    conn.resolves_pending = 0;
+
+    std::vector<std::string> urls = ws_candidate_urls(l.get());
+    std::regex ws_regex("(wss?)://([^:/]+)(:([0-9]+))?(/.*)?");
+    for (size_t i = 0; i < urls.size(); i++) {
+        std::smatch match;
+        if (!std::regex_match(urls[i], match, ws_regex)) {
+            link_post(l.get(), "KeyLink: Invalid WebSocket URL: %s", urls[i].c_str());
+            continue;
+        }
+        if (match[1].str() == "wss") {
+            // No TLS in this build: wss:// relays must be reached through a ws:// proxy
+            link_post(l.get(), "KeyLink: Skipping %s (wss:// is not supported, use a ws:// relay)", urls[i].c_str());
+            continue;
+        }
+
+        ws_candidate base;
+        base.url = urls[i];
+        base.host = match[2].str();
+        base.port = match[4].matched ? std::stoi(match[4].str()) : 80;
+        base.path = match[5].str();
+        if (base.path.empty()) base.path = "/";
+
+        std::string service = std::to_string(base.port);
+        std::string key = base.host + ":" + service;
+        std::vector<asio::ip::tcp::endpoint> cached;
+        if (ws_dns_lookup(key, cached, false)) {
+            ws_add_candidates(l.get(), base, cached);
+            continue;
+        }
+
+        conn.resolves_pending++;
+        std::shared_ptr<asio::ip::tcp::resolver> resolver = std::make_shared<asio::ip::tcp::resolver>(l->io);
+        conn.resolvers.push_back(resolver);
+        resolver->async_resolve(base.host, service,
+            [l, gen, base, key, resolver](std::error_code ec, asio::ip::tcp::resolver::results_type results) {
+                if (l->ws_conn.generation != gen) return;
+                std::vector<std::shared_ptr<asio::ip::tcp::resolver>>& rs = l->ws_conn.resolvers;
+                rs.erase(std::remove(rs.begin(), rs.end(), resolver), rs.end());
+                l->ws_conn.resolves_pending--;
+
+                std::vector<asio::ip::tcp::endpoint> endpoints;
+                if (!ec) {
+                    for (asio::ip::tcp::resolver::results_type::iterator it = results.begin(); it != results.end(); ++it) {
+                        endpoints.push_back(it->endpoint());
+                    }
+                    ws_dns_store(key, endpoints);
+                } else if (!ws_dns_lookup(key, endpoints, true)) {
+                    link_post(l.get(), "KeyLink: Could not resolve %s: %s", base.host.c_str(), ec.message().c_str());
+                }
+                ws_add_candidates(l.get(), base, endpoints);
+
+                // Start right away if nothing is in flight, otherwise the race timer picks it up
+                if (l->ws_conn.attempts.empty()) ws_race_next(l);
+            });
+    }
+
+    ws_race_next(l);
+}
+
+// Start the next candidate; if more remain, start another one after a short
+// delay unless a connection wins first
+void ws_race_next(const keylink_link_ptr& l) {
+    ws_connector& conn = l->ws_conn;
+    if (l->ws_connected || !l->open) return;
+
+    if (conn.candidates.empty()) {
+        if (conn.attempts.empty() && conn.resolves_pending == 0) ws_schedule_reconnect(l);
+        return;
+    }
+
+    ws_candidate next = conn.candidates.front();
+    conn.candidates.erase(conn.candidates.begin());
+    ws_attempt_start(l, next);
+
+    if (!conn.candidates.empty()) {
+        unsigned gen = conn.generation;
+        conn.race_timer.expires_after(std::chrono::milliseconds(KEYLINK_WS_RACE_DELAY_MS));
+        conn.race_timer.async_wait([l, gen](std::error_code ec) {
+            if (ec || l->ws_conn.generation != gen) return;
+            ws_race_next(l);
+        });
+    }
+}
+
+static void ws_attempt_read(const keylink_link_ptr& l, const std::shared_ptr<ws_attempt>& a) {
+    size_t free_len = 0;
+    uint8_t *dst = a->in->prepare(1024, free_len);
+    a->socket.async_read_some(asio::buffer(dst, free_len), [l, a](std::error_code ec, std::size_t n) {
+        if (a->finished) return;
+        if (ec) { ws_attempt_done(l, a, ec.message().c_str()); return; }
+        a->in->commit(n);
+
+        std::string resp((const char *)a->in->data(), a->in->size());
+        size_t header_end = resp.find("\r\n\r\n");
+        if (header_end == std::string::npos) {
+            if (resp.size() > 8192) { ws_attempt_done(l, a, "handshake response too large"); return; }
+            ws_attempt_read(l, a);
+            return;
+        }
+        resp.resize(header_end + 4);
+        a->in->consume(resp.size());
+
+        if (resp.find(" 101 ") == std::string::npos) {
+            ws_attempt_done(l, a, "handshake failed - no 101 response");
+        } else if (resp.find(a->accept_key) == std::string::npos) {
+            ws_attempt_done(l, a, "handshake failed - bad Sec-WebSocket-Accept");
+        } else {
+            ws_attempt_done(l, a, NULL);
+        }
+    });
+}
+
+void ws_attempt_start(const keylink_link_ptr& l, const ws_candidate& c) {
+    ws_connector& conn = l->ws_conn;
+    std::shared_ptr<ws_attempt> a = std::make_shared<ws_attempt>(l->io, c);
+    conn.attempts.push_back(a);
+
+    a->timeout.expires_after(std::chrono::milliseconds(KEYLINK_WS_CONNECT_TIMEOUT_MS));
+    a->timeout.async_wait([l, a](std::error_code ec) {
+        if (ec || a->finished) return;
+        ws_attempt_done(l, a, "timed out");
+    });
+
+    // Random nonce so the server's accept key can be checked
+    uint8_t nonce[16];
+    for (int i = 0; i < 16; i++) nonce[i] = (uint8_t)(conn.rng() & 0xFF);
+    std::string ws_key = ws_base64(nonce, sizeof(nonce));
+    a->accept_key = ws_accept_key(ws_key);
+    a->request =
+        "GET " + c.path + l->channel + " HTTP/1.1\r\n"
+        "Host: " + c.host + "\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: " + ws_key + "\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "\r\n";
+
+    a->socket.async_connect(c.endpoint, [l, a](std::error_code ec) {
+        if (a->finished) return;
+        if (ec) { ws_attempt_done(l, a, ec.message().c_str()); return; }
+        std::error_code ignored;
+        a->socket.set_option(asio::ip::tcp::no_delay(true), ignored);
+        asio::async_write(a->socket, asio::buffer(a->request), [l, a](std::error_code ec, std::size_t) {
+            if (a->finished) return;
+            if (ec) { ws_attempt_done(l, a, ec.message().c_str()); return; }
+            ws_attempt_read(l, a);
+        });
+    });
+}
+
+// error == NULL: the attempt completed its handshake
+void ws_attempt_done(const keylink_link_ptr& l, const std::shared_ptr<ws_attempt>& a, const char *error) {
+    a->finished = true;
+    a->timeout.cancel();
+
+    ws_connector& conn = l->ws_conn;
+    conn.attempts.erase(std::remove(conn.attempts.begin(), conn.attempts.end(), a), conn.attempts.end());
+
+    if (error || l->ws_connected || !l->open) {
+        std::error_code ignored;
+        a->socket.close(ignored);
+        if (error) {
+            link_post(l.get(), "KeyLink: WebSocket %s (%s) failed: %s", a->target.url.c_str(),
+                      a->target.endpoint.address().to_string().c_str(), error);
+        }
+        // Nothing left in flight: try the next candidate now instead of waiting
+        if (conn.attempts.empty()) ws_race_next(l);
+        return;
+    }
+
+    // Winner: cancel the rest of the race
+    conn.race_timer.cancel();
+    conn.candidates.clear();
+    for (size_t i = 0; i < conn.attempts.size(); i++) {
+        conn.attempts[i]->finished = true;
+        std::error_code ignored;
+        conn.attempts[i]->socket.close(ignored);
+        conn.attempts[i]->timeout.cancel();
+    }
+    conn.attempts.clear();
+    conn.backoff_ms = KEYLINK_WS_BACKOFF_MIN_MS;
+
+    l->ws_socket.reset(new asio::ip::tcp::socket(std::move(a->socket)));
+    l->ws_host = a->target.host;
+    l->ws_port = a->target.port;
+    l->ws_path = a->target.path;
+
+    // Any frame bytes that arrived behind the handshake stay buffered
+    l->ws_in = std::move(a->in);
+    l->ws_message.reset(new ws_message_assembler(KEYLINK_WS_MAX_MESSAGE));
+
+    // Outgoing frame queue, reused for the life of the connection
+    l->ws_out_pending.reset(new ws_frame_batch());
+    l->ws_out_inflight.reset(new ws_frame_batch());
+    l->ws_writing = false;
+    l->ws_flush_posted = false;
+    l->ws_closing = false;
+    l->ws_mask_state = ((uint64_t)conn.rng() << 32) | conn.rng() | 1;
+
+    l->ws_connected = true;
+    link_post(l.get(), "KeyLink: WebSocket connected to %s%s", a->target.url.c_str(), l->channel.c_str());
+
+    // Start reading WebSocket messages
+    ws_read(l);
+}
+
+// Equal-jitter exponential backoff: wait between half and all of the
+// current backoff, then double it (capped)
+void ws_schedule_reconnect(const keylink_link_ptr& l) {
+    if (!l->open) return;
+    ws_connector& conn = l->ws_conn;
+
+    int delay = conn.backoff_ms / 2 + (int)(conn.rng() % (unsigned)(conn.backoff_ms / 2 + 1));
+    conn.backoff_ms = std::min(conn.backoff_ms * 2, KEYLINK_WS_BACKOFF_MAX_MS);
+
+    unsigned gen = conn.generation;
+    conn.reconnect_timer.expires_after(std::chrono::milliseconds(delay));
+    conn.reconnect_timer.async_wait([l, gen](std::error_code ec) {
+        if (ec || l->ws_conn.generation != gen) return;
+        ws_connect(l);
+    });
+    link_post(l.get(), "KeyLink: WebSocket reconnecting in %d ms", delay);
+}
+
+// The live connection dropped (read/write error, close frame, protocol error)
+void ws_on_disconnect(const keylink_link_ptr& l, const char *reason) {
+    if (!l->ws_connected) return;
+    l->ws_connected = false;
+    link_post(l.get(), "KeyLink: WebSocket disconnected: %s", reason);
+    // After a close frame the socket stays open until ws_flush has written it
+    bool flushing = l->ws_closing && (l->ws_writing || !l->ws_out_pending->empty());
+    if (l->ws_socket && !flushing) {
+        std::error_code ignored;
+        l->ws_socket->close(ignored);
+    }
+    ws_schedule_reconnect(l);
+}
+
+// Send a close frame with status (2 bytes, or none) and disconnect; the
+// socket is closed when the frame has been written, so the peer sees the
+// closing handshake
+void ws_close(const keylink_link_ptr& l, const char *status, size_t status_len, const char *reason) {
+    ws_send_frame(l, WS_OP_CLOSE, status, status_len);
+    l->ws_closing = true;
+    ws_on_disconnect(l, reason);
+}
+
+// Runs on the network thread. Masks the payload straight into the pending
+// batch; frames queued before the flush runs go out in one gather write.
+void ws_send_frame(const keylink_link_ptr& l, uint8_t opcode, const char *data, size_t len) {
+    if (!l->ws_connected || !l->ws_socket) return;
+
+    if (l->ws_out_pending->bytes() + len > KEYLINK_WS_MAX_PENDING_BYTES) {
+        link_post(l.get(), "KeyLink: WebSocket send queue full, dropping message");
+        return;
+    }
+
+    uint8_t mask[4];
+    ws_next_mask(l->ws_mask_state, mask);
+    l->ws_out_pending->add(opcode, data, len, mask);
+
+    if (!l->ws_writing && !l->ws_flush_posted) {
+        l->ws_flush_posted = true;
+        keylink_link_ptr self = l;
+        asio::post(l->io, [self]() {
+            self->ws_flush_posted = false;
+            ws_flush(self);
+        });
+    }
+}
+
+// Write every pending frame as one buffer sequence (header, payload, header, ...)
+void ws_flush(const keylink_link_ptr& l) {
+    if (l->ws_writing || l->ws_out_pending->empty() || !l->ws_socket || !l->ws_socket->is_open()) return;
+
+    std::swap(l->ws_out_pending, l->ws_out_inflight);
+    l->ws_out_pending->clear();
+
+    ws_frame_batch& batch = *l->ws_out_inflight;
+    l->ws_out_buffers.clear();
+    for (size_t i = 0; i < batch.entries.size(); i++) {
+        const ws_frame_batch::entry& e = batch.entries[i];
+        l->ws_out_buffers.push_back(asio::buffer(&batch.headers[e.header_offset], e.header_len));
+        if (e.payload_len) l->ws_out_buffers.push_back(asio::buffer(&batch.payloads[e.payload_offset], e.payload_len));
+    }
+
+    l->ws_writing = true;
+    keylink_link_ptr self = l;
+    unsigned gen = l->ws_conn.generation;
+    asio::async_write(*l->ws_socket, l->ws_out_buffers,
+        [self, gen](std::error_code ec, std::size_t) {
+            // A reconnect round has begun since this write started
+            if (self->ws_conn.generation != gen) return;
+            self->ws_writing = false;
+            if (ec) {
+                if (ec != asio::error::operation_aborted) ws_on_disconnect(self, ec.message().c_str());
+                return;
+            }
+            // Frames queued while this write was in flight
+            ws_flush(self);
+            // The close frame is out: nothing more is sent on this connection
+            if (self->ws_closing && !self->ws_writing) {
+                std::error_code ignored;
+                self->ws_socket->close(ignored);
+            }
+        });
+}
+
+void ws_read(const keylink_link_ptr& l) {
+    if (!l->ws_socket) return;
+
+    // Frames may already be buffered (behind the handshake or a previous read)
+    size_t want = KEYLINK_WS_READ_CHUNK;
+    if (!ws_process_frames(l, want)) return;
+
+    size_t free_len = 0;
+    uint8_t *dst = l->ws_in->prepare(want, free_len);
+    keylink_link_ptr self = l;
+    l->ws_socket->async_read_some(
+        asio::buffer(dst, free_len),
+        [self](std::error_code ec, std::size_t bytes_recvd) {
+            if (!ec) {
+                self->ws_in->commit(bytes_recvd);
+                ws_read(self);
+            } else if (ec != asio::error::operation_aborted) {
+                ws_on_disconnect(self, ec.message().c_str());
+            }
+        }
+    );
+}
+
+// Parse every complete frame in the connection buffer. A frame split over
+// several reads stays in the buffer until the rest arrives; want is set to
+// the bytes still needed so the buffer grows once for large frames.
+// Returns false if the connection should stop reading.
+bool ws_process_frames(const keylink_link_ptr& l, size_t& want) {
+    ws_read_buffer& in = *l->ws_in;
+
+    while (in.size() > 0) {
+        ws_frame frame;
+        ws_parse_result r = ws_parse_frame(in.data(), in.size(), KEYLINK_WS_MAX_MESSAGE, frame);
+        if (r == WS_PARSE_NEED_MORE) {
+            if (frame.frame_len > in.size() + want) want = frame.frame_len - in.size();
+            return true;
+        }
+        if (r == WS_PARSE_ERROR) {
+            link_post(l.get(), "KeyLink: WebSocket protocol error, closing");
+            ws_close(l, "\x03\xea", 2, "protocol error"); // 1002 protocol error
+            return false;
+        }
+
+        const char *payload = (const char *)frame.payload;
+        switch (frame.opcode) {
+            case WS_OP_PING:
+                ws_send_frame(l, WS_OP_PONG, payload, frame.payload_len);
+                break;
+            case WS_OP_PONG:
+                break;
+            case WS_OP_CLOSE:
+                // Echo the status code and stop reading
+                ws_close(l, payload, std::min<size_t>(frame.payload_len, 2), "closed by server");
+                return false;
+            default: {
+                const char *data = NULL;
+                size_t len = 0;
+                uint8_t opcode = 0;
+                r = ws_assemble(*l->ws_message, frame, data, len, opcode);
+                if (r == WS_PARSE_ERROR) {
+                    link_post(l.get(), "KeyLink: WebSocket fragmentation error, closing");
+                    ws_on_disconnect(l, "fragmentation error");
+                    return false;
+                }
+                if (r == WS_PARSE_FRAME) {
+                    // Text and binary both carry JSON (relay.js forwards as binary)
+                    link_receive(l.get(), data, len, "WebSocket");
+                }
+                break;
+            }
+        }
+        in.consume(frame.frame_len);
+    }
+    return true;
+}
+
+double keylink_now_ms() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// State updates carry no top-level "type" (flat states) or a
+// set-state/keylink-state/state type; typed is set for the latter. Events
+// (ping, toggles, custom types) are not states.
+bool keylink_is_state_message(const char *msg, size_t len, bool *typed) {
+    int depth = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = msg[i];
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        } else if (c == '"') {
+            size_t start = ++i;
+            while (i < len && msg[i] != '"') {
+                if (msg[i] == '\\') i++;
+                i++;
+            }
+            if (depth != 1 || i - start != 4 || memcmp(msg + start, "type", 4) != 0) continue;
+
+            // Top-level "type" key (not a value): compare its string value
+            size_t j = i + 1;
+            while (j < len && (msg[j] == ' ' || msg[j] == '\t')) j++;
+            if (j >= len || msg[j] != ':') continue;
+            j++;
+            while (j < len && (msg[j] == ' ' || msg[j] == '\t')) j++;
+            if (j >= len || msg[j] != '"') return false;
+            size_t v = ++j;
+            while (j < len && msg[j] != '"') j++;
+            std::string type(msg + v, j - v);
+            bool state = type == "set-state" || type == "keylink-state" || type == "state";
+            if (typed) *typed = state;
+            return state;
+        }
+    }
+    if (typed) *typed = false;
+    return true;
+}
+
+// Called on the network thread for every accepted message. Outlets are
+// only ever called from keylink_deliver, on a Max thread.
+void keylink_enqueue_inbound(t_keylink *x, const keylink_message_ptr& msg) {
+    // Settings are set on Max threads; read each once for this message
+    const bool coalesce = x->coalesce;
+    const double max_rate = x->max_rate;
+    const bool high_priority = x->high_priority;
+
+    if (msg->apply_ms > 0) {
+        // Timed: never coalesced, output by the apply clock
+        std::lock_guard<std::mutex> guard(x->schedule->lock);
+        std::multimap<double, keylink_message_ptr>::iterator it = x->schedule->due.insert(std::make_pair(msg->apply_ms, msg));
+        if (it == x->schedule->due.begin()) clock_fdelay(x->apply_clock, msg->apply_ms - keylink_now_ms());
+        return;
+    }
+    if (coalesce && msg->replaceable) {
+        bool expected = false;
+        while (!x->state_lock.compare_exchange_weak(expected, true, std::memory_order_acquire)) expected = false;
+        std::vector<keylink_message_ptr>& pending = *x->pending_states;
+        size_t i = 0;
+        while (i < pending.size() && pending[i]->source != msg->source) i++;
+        if (i < pending.size()) {
+            pending[i] = msg;
+        } else {
+            pending.push_back(msg);
+        }
+        x->state_lock.store(false, std::memory_order_release);
+    } else if (!x->inbound->push([&msg](keylink_message_ptr& slot) { slot = msg; })) {
+        if (x->inbound_dropped++ == 0) {
+            object_warn((t_object *)x, "KeyLink: inbound queue full, dropping messages");
+        }
+        return;
+    }
+
+    if (x->delivery_scheduled.exchange(true)) return;
+
+    double delay = 0;
+    if (max_rate > 0) {
+        delay = x->last_delivery_ms + 1000.0 / max_rate - keylink_now_ms();
+        if (delay < 0) delay = 0;
+    }
+    // Clocks and qelems are safe to set from any thread
+    if (high_priority || delay > 0) {
+        clock_fdelay(x->deliver_clock, delay);
+    } else {
+        qelem_set(x->deliver_qelem);
+    }
+}
+
+// Scheduler thread: deliver now, or hand over to the main thread
+void keylink_deliver_tick(t_keylink *x) {
+    if (x->high_priority) {
+        keylink_deliver(x);
+    } else {
+        qelem_set(x->deliver_qelem);
+    }
+}
+
+// Scheduler thread: output every scheduled message that is due, in order,
+// and re-arm for the next one
+void keylink_apply_tick(t_keylink *x) {
+    std::vector<keylink_message_ptr> ready;
+    {
+        std::lock_guard<std::mutex> guard(x->schedule->lock);
+        std::multimap<double, keylink_message_ptr>& due = x->schedule->due;
+        double now = keylink_now_ms();
+        while (!due.empty() && due.begin()->first <= now + 0.25) {
+            ready.push_back(due.begin()->second);
+            due.erase(due.begin());
+        }
+        if (!due.empty()) clock_fdelay(x->apply_clock, due.begin()->first - now);
+    }
+
+    for (size_t i = 0; i < ready.size(); i++) {
+        x->state_outlets->send(ready[i]->state);
+        x->scheduled_output->send(x->outlet, ready[i]->text);
+    }
+}
+
+// Max scheduler or main thread: flush everything queued since the last tick
+void keylink_deliver(t_keylink *x) {
+    // Clear first so messages arriving during delivery schedule another tick
+    x->delivery_scheduled = false;
+    x->last_delivery_ms = keylink_now_ms();
+
+    keylink_message_ptr msg;
+    while (x->inbound->pop([&msg](keylink_message_ptr& slot) { msg.swap(slot); })) {
+        x->state_outlets->send(msg->state);
+        x->output->send(x->outlet, msg->text);
+    }
+    msg.reset();
+
+    std::vector<keylink_message_ptr>& ready = *x->ready_states;
+    bool expected = false;
+    while (!x->state_lock.compare_exchange_weak(expected, true, std::memory_order_acquire)) expected = false;
+    ready.swap(*x->pending_states);
+    x->state_lock.store(false, std::memory_order_release);
+
+    for (size_t i = 0; i < ready.size(); i++) {
+        x->state_outlets->send(ready[i]->state);
+        x->output->send(x->outlet, ready[i]->text);
+    }
+    ready.clear();
+}
+
+// Queue a send for the network thread. Called from Max's main or scheduler
+// thread: never touches a socket, only copies into a preallocated slot.
+void keylink_post_send(t_keylink *x, const char *msg, size_t len) {
+    if (!x->running) return;
+
+    bool queued = x->commands->push([msg, len](keylink_command& c) {
+        c.type = CMD_SEND;
+        c.payload.assign(msg, len);
+    });
+    if (!queued) {
+        // Network thread is not keeping up; drop rather than block the patcher
+        if (x->commands_dropped++ == 0) {
+            object_warn((t_object *)x, "KeyLink: send queue full, dropping messages");
+        }
+        return;
+    }
+
+    // One drain in flight at a time
+    if (!x->drain_pending.exchange(true)) {
+        asio::post(keylink_hub_get()->io, [x]() { keylink_drain_commands(x); });
+    }
+}
+
+// Runs on the network thread
+void keylink_drain_commands(t_keylink *x) {
+    // Clear first so a push racing with this drain schedules another one
+    x->drain_pending = false;
+
+    keylink_command cmd;
+    while (x->commands->pop([&cmd](keylink_command& c) {
+        cmd.type = c.type;
+        cmd.payload.swap(c.payload);
+    })) {
+        switch (cmd.type) {
+            case CMD_SEND:
+                send_message(x, cmd.payload);
+                break;
+        }
+    }
+
+    // Everything queued by this drain goes out in one sendmmsg
+    if (x->link) udp_flush(x->link);
+}
+
+// Runs on the network thread
+void send_message(t_keylink *x, const std::string& msg) {
+    keylink_link_ptr& l = x->link;
+    if (!l) return;
+
+    // Settings are set on Max threads; read each once for this message
+    const bool send_binary = x->send_binary;
+    const bool send_delta = x->send_delta;
+    const double lead_ms = x->lead_ms;
+    const bool send_reliable = x->send_reliable;
+    const long redundancy = x->redundancy;
+    const int encoding = x->encoding;
+    const bool encoding_auto = (encoding & KEYLINK_ENCODING_AUTO) != 0;
+
+    // JSON objects carry our source and sequence number; marking the pair
+    // as seen makes the echo from the network a duplicate. In binary format
+    // a state that fits is packed instead, and the other instances on this
+    // link get the JSON a remote receiver would expand it to.
+    const char *data = msg.data();
+    size_t len = msg.size();
+    const char *local = data;
+    size_t local_len = len;
+    uint8_t opcode = WS_OP_TEXT;
+    keylink_state_packet packet;
+    uint8_t wire[KEYLINK_PACKET_SIZE];
+    bool tagged = false;
+
+    // With delta on, a state between keyframes goes out as a state-delta;
+    // the other instances here still get the full state
+    bool state = (send_binary || send_delta || lead_ms > 0 || send_reliable || redundancy) &&
+                 keylink_is_state_message(data, len);
+
+    // With a lead, states carry the KeyLink time every receiver outputs them at
+    if (state && lead_ms > 0 && keylink_stamp_apply_at(data, len, keylink_wall_ms() + lead_ms, l->stamp_scratch)) {
+        data = local = l->stamp_scratch.data();
+        len = local_len = l->stamp_scratch.size();
+    }
+
+    // With redundancy on, the encoder also keeps the last few deltas; they
+    // ride on the network copy of this state, which is then never a packet
+    if (x->delta->redundancy() != (size_t)redundancy) x->delta->set_redundancy((size_t)redundancy);
+    bool delta = state && (send_delta || redundancy) &&
+                 x->delta->encode(data, len, x->send_seq + 1, keylink_now_ms(), l->delta_scratch);
+    bool redundant = state && redundancy && !x->delta->redundant().empty();
+    if (!send_delta) x->delta->request_keyframe();
+
+    if (!delta && !redundant && send_binary && state && keylink_packet_from_text(data, len, packet)) {
+        packet.source = x->source_id;
+        packet.seq = ++x->send_seq;
+        l->dedup.accept(packet.source, packet.seq);
+        keylink_packet_encode(packet, wire);
+        keylink_packet_to_json(packet, l->tag_scratch);
+        data = (const char *)wire;
+        len = KEYLINK_PACKET_SIZE;
+        local = l->tag_scratch.data();
+        local_len = l->tag_scratch.size();
+        opcode = WS_OP_BINARY;
+        tagged = true;
+    } else if (keylink_tag_message(x->source_id, x->send_seq + 1, data, len, l->tag_scratch)) {
+        l->dedup.accept(x->source_id, ++x->send_seq);
+        tagged = true;
+        data = local = l->tag_scratch.data();
+        len = local_len = l->tag_scratch.size();
+        if (delta && keylink_tag_message(x->source_id, x->send_seq, l->delta_scratch.data(), l->delta_scratch.size(),
+                                         l->delta_tagged)) {
+            data = l->delta_tagged.data();
+            len = l->delta_tagged.size();
+        }
+        if (redundant && keylink_attach_redundant(data, len, x->delta->redundant(), l->red_scratch)) {
+            data = l->red_scratch.data();
+            len = l->red_scratch.size();
+        }
+    }
+
+    // Schemaless messages may go out as MessagePack/CBOR over UDP, when
+    // negotiated or forced. WebSocket peers (browsers behind relay.js) never
+    // negotiate, so the WebSocket copy stays JSON text.
+    const char *udp_data = data;
+    size_t udp_len = len;
+    if (opcode == WS_OP_TEXT) {
+        keylink_enc enc = encoding_auto ? link_udp_encoding(l.get()) : (keylink_enc)(encoding & ~KEYLINK_ENCODING_AUTO);
+        if (enc != KEYLINK_ENC_JSON && keylink_encode(enc, data, len, l->enc_scratch)) {
+            udp_data = l->enc_scratch.data();
+            udp_len = l->enc_scratch.size();
+        }
+    }
+
+    // Queue for UDP if available; keylink_drain_commands flushes the batch.
+    // Reliable states are kept as sent, for receivers that NACK them.
+    if (link_queue_udp(l.get(), x->source_id, udp_data, udp_len) && send_reliable && state && tagged) {
+        l->retransmit.put(x->source_id, x->send_seq, udp_data, udp_len);
+        x->last_state_seq = x->send_seq;
+        link_schedule_report(l);
+    }
+
+    // Send via WebSocket if available
+    if (l->ws_connected) {
+        ws_send_frame(l, opcode, data, len);
+    }
+
+    // Other instances on this link
+    link_fanout(l.get(), local, local_len, x);
+}
+
+// Network thread: queue one message for UDP, in fragments if it is over
+// one MTU. A message goes out whole or not at all.
+bool link_queue_udp(keylink_link *l, uint64_t source, const char *data, size_t len) {
+    if (!l->udp_socket || !l->udp_socket->is_open()) return false;
+    if (len <= KEYLINK_UDP_MTU_PAYLOAD) {
+        if (l->udp_out.pending() >= KEYLINK_UDP_MAX_PENDING) return false;
+        l->udp_out.add(data, len);
+        return true;
+    }
+    if (len > KEYLINK_FRAGMENT_MAX_MESSAGE) {
+        link_post(l, "KeyLink: %zu-byte message too large for UDP (max %d), not sent", len, KEYLINK_FRAGMENT_MAX_MESSAGE);
+        return false;
+    }
+    if (l->udp_out.pending() + keylink_fragment_count(len) > KEYLINK_UDP_MAX_PENDING) return false;
+    keylink_fragment_message(source, ++l->frag_id, data, len, l->frag_scratch,
+                             [l](const char *d, size_t n) { l->udp_out.add(d, n); });
+    return true;
+}
+
+// Runs on the network thread. If the socket buffer is full the rest of the
+// batch waits for writability instead of blocking.
+void udp_flush(const keylink_link_ptr& l) {
+    if (!l->udp_socket || !l->udp_socket->is_open() || l->udp_out.empty() || l->udp_flush_waiting) return;
+
+    const asio::ip::udp::endpoint& dest = l->multicast_endpoint;
+    if (!l->udp_out.flush(l->udp_socket->native_handle(), dest.data(), (socklen_t)dest.size())) {
+        // Silent error - UDP might be offline
+    }
+
+    if (!l->udp_out.empty()) {
+        l->udp_flush_waiting = true;
+        keylink_link_ptr self = l;
+        l->udp_socket->async_wait(asio::socket_base::wait_write, [self](std::error_code ec) {
+            self->udp_flush_waiting = false;
+            if (!ec) udp_flush(self);
+        });
     }
-    
-    return false;
 }
 
-// --- End of keylink.cpp --- 
\ No newline at end of file
+// --- End of keylink.cpp ---
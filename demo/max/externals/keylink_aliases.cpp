@@ -12,7 +12,9 @@
 #include <vector>
 #include <algorithm>
 #include <cctype>
+#include <memory>
 #include "thirdparty/json.hpp"
+#include "keylink_arena.h"
 
 using json = nlohmann::json;
 
@@ -519,23 +521,31 @@ std::vector<int> get_comprehensive_primitive_indices() {
     return indices;
 }
 
-// Resolve complete message
-json resolve_message(const json& input_msg) {
-    json resolved = input_msg;
+// The std::string a string value holds (json.hpp reads std::string as an
+// array of chars when string_t is not std::string)
+static std::string arena_string(const keylink_arena_json& value) {
+    const keylink_arena_string& s = value.get_ref<const keylink_arena_string&>();
+    return std::string(s.data(), s.size());
+}
+
+// Resolve complete message. Values are keylink_arena_json: call inside a
+// keylink_arena_scope (keylink_aliases_resolve keeps one arena per object).
+keylink_arena_json resolve_message(const keylink_arena_json& input_msg) {
+    keylink_arena_json resolved = input_msg;
     
     // Resolve root note
     if (resolved.contains("root_note") && resolved["root_note"].is_string()) {
-        resolved["root_note"] = resolve_root_note(resolved["root_note"].get<std::string>());
+        resolved["root_note"] = resolve_root_note(arena_string(resolved["root_note"])).c_str();
     }
     
     // Resolve mode
     if (resolved.contains("mode") && resolved["mode"].is_string()) {
-        resolved["mode"] = resolve_mode(resolved["mode"].get<std::string>());
+        resolved["mode"] = resolve_mode(arena_string(resolved["mode"])).c_str();
     }
     
     // Resolve chord type
     if (resolved.contains("chord_type") && resolved["chord_type"].is_string()) {
-        resolved["chord_type"] = resolve_chord_type(resolved["chord_type"].get<std::string>());
+        resolved["chord_type"] = resolve_chord_type(arena_string(resolved["chord_type"])).c_str();
     }
     
     // Resolve note pattern if present
@@ -547,7 +557,7 @@ json resolve_message(const json& input_msg) {
             resolved["note_pattern"] = normalized;
         } else if (resolved["note_pattern"].is_string()) {
             // String input, resolve to pattern
-            std::string pattern_str = resolved["note_pattern"].get<std::string>();
+            std::string pattern_str = arena_string(resolved["note_pattern"]);
             std::vector<int> pattern = resolve_note_pattern(pattern_str);
             resolved["note_pattern"] = pattern;
         }
@@ -555,7 +565,7 @@ json resolve_message(const json& input_msg) {
     
     // Add resolution metadata
     if (!resolved.contains("metadata")) {
-        resolved["metadata"] = json::object();
+        resolved["metadata"] = keylink_arena_json::object();
     }
     resolved["metadata"]["resolved_by"] = "KeyLinkAliasResolver";
     resolved["metadata"]["resolution_version"] = "1.0.0";
@@ -567,6 +577,7 @@ json resolve_message(const json& input_msg) {
 typedef struct _keylink_aliases {
     t_object ob;
     void *outlet;
+    std::unique_ptr<keylink_arena> arena;       // Backs every resolve's parse, copy and dump
 } t_keylink_aliases;
 
 void *keylink_aliases_new(t_symbol *s, long argc, t_atom *argv);
@@ -598,6 +609,7 @@ void *keylink_aliases_new(t_symbol *s, long argc, t_atom *argv) {
     t_keylink_aliases *x = (t_keylink_aliases *)object_alloc(keylink_aliases_class);
     if (x) {
         x->outlet = outlet_new((t_object *)x, NULL);
+        x->arena.reset(new keylink_arena());
         initialize_aliases();
         object_post((t_object *)x, "KeyLink Aliases: Initialized with comprehensive naming standards and note primitives");
     }
@@ -605,7 +617,7 @@ void *keylink_aliases_new(t_symbol *s, long argc, t_atom *argv) {
 }
 
 void keylink_aliases_free(t_keylink_aliases *x) {
-    // Cleanup if needed
+    x->arena.reset();
 }
 
 void keylink_aliases_assist(t_keylink_aliases *x, void *b, long m, long a, char *s) {
@@ -620,17 +632,26 @@ void keylink_aliases_resolve(t_keylink_aliases *x, t_symbol *s, long argc, t_ato
     if (argc < 1) return;
     
     try {
-        // Parse input as JSON
-        std::string input_str = atom_getsym(argv)->s_name;
-        json input_json = json::parse(input_str);
-        
-        // Resolve the message
-        json resolved = resolve_message(input_json);
+        t_atom a;
+        {
+            // Everything in this block comes from x->arena and is freed at once
+            // when the scope closes: a few large allocations per message, or
+            // none once the arena has grown to fit. The output goes out after,
+            // so a patch feeding it straight back in finds the arena free.
+            keylink_arena_scope scope(*x->arena);
+            
+            // Parse input as JSON
+            const char *input_str = atom_getsym(argv)->s_name;
+            keylink_arena_json input_json = keylink_arena_json::parse(input_str);
+            
+            // Resolve the message
+            keylink_arena_json resolved = resolve_message(input_json);
+            
+            keylink_arena_string output_str = resolved.dump();
+            atom_setsym(&a, gensym(output_str.c_str()));
+        }
         
         // Output resolved JSON
-        std::string output_str = resolved.dump();
-        t_atom a;
-        atom_setsym(&a, gensym(output_str.c_str()));
         outlet_anything(x->outlet, gensym("json"), 1, &a);
         
         object_post((t_object *)x, "KeyLink Aliases: Resolved message with note primitives");
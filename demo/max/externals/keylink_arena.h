@@ -0,0 +1,172 @@
+// keylink_arena.h - A monotonic arena for json.hpp values
+// A parsed message is dozens of small strings, map nodes and vectors, all
+// freed together when the message is done. keylink_arena_json is a
+// nlohmann::basic_json whose strings, objects and arrays are allocated by
+// bumping a pointer through large blocks; freeing is a no-op. reset()
+// rewinds the arena for the next message. If the last message needed more
+// than one block, they are swapped for a single block that big, so a steady
+// stream of similar messages stops touching the heap at all:
+//   keylink_arena arena;                    // one per object, kept
+//   {
+//       keylink_arena_scope scope(arena);   // before any value using it
+//       keylink_arena_json j = keylink_arena_json::parse(text);
+//       ...
+//   }                                       // values die, then the reset
+// json.hpp default-constructs its allocators wherever it needs one, so the
+// allocator cannot carry the arena: it uses the innermost scope on this
+// thread. Every arena value must be destroyed before its scope ends, and
+// allocating with no scope open throws std::bad_alloc. A scope nested in
+// one on the same arena (a re-entrant call) only adds to it; the outermost
+// scope does the reset.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <new>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "thirdparty/json.hpp"
+
+#define KEYLINK_ARENA_BLOCK 4096
+
+class keylink_arena {
+public:
+    explicit keylink_arena(size_t first_block = KEYLINK_ARENA_BLOCK)
+        : head(NULL), cursor(NULL), end(NULL), next_size(first_block), block_count(0) {}
+
+    ~keylink_arena() { release(); }
+
+    void *allocate(size_t n, size_t align) {
+        char *p = align_up(cursor, align);
+        if (!cursor || p > end || n > (size_t)(end - p)) {
+            grow(n + align);
+            p = align_up(cursor, align);
+        }
+        cursor = p + n;
+        return p;
+    }
+
+    // Rewind for the next message, merging the blocks into one if there
+    // were several
+    void reset() {
+        if (head && head->next) {
+            size_t total = 0;
+            for (block *b = head; b; b = b->next) total += b->size;
+            release();
+            next_size = total;
+            grow(0);
+        }
+        if (head) {
+            cursor = head->data();
+            end = cursor + head->size;
+        }
+    }
+
+    // Blocks held, and bytes handed out from the newest one
+    size_t blocks() const { return block_count; }
+    size_t used() const { return head ? (size_t)(cursor - head->data()) : 0; }
+
+    // The arena of the innermost keylink_arena_scope on this thread
+    static keylink_arena *&current() {
+        static thread_local keylink_arena *arena = NULL;
+        return arena;
+    }
+
+private:
+    struct block {
+        block *next;
+        size_t size;
+        char *data() { return (char *)(this + 1); }
+    };
+
+    block *head;
+    char *cursor, *end;
+    size_t next_size;
+    size_t block_count;
+
+    keylink_arena(const keylink_arena&);
+    keylink_arena& operator=(const keylink_arena&);
+
+    static char *align_up(char *p, size_t align) {
+        return (char *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    void grow(size_t at_least) {
+        size_t size = next_size < at_least ? at_least : next_size;
+        block *b = (block *)::operator new(sizeof(block) + size);
+        b->next = head;
+        b->size = size;
+        head = b;
+        cursor = b->data();
+        end = cursor + size;
+        next_size = size * 2;
+        block_count++;
+    }
+
+    void release() {
+        while (head) {
+            block *next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+        cursor = end = NULL;
+        block_count = 0;
+    }
+};
+
+// Opens arena for allocations on this thread; on exit restores the outer
+// scope's arena and resets this one, unless the outer scope is still using it
+class keylink_arena_scope {
+public:
+    explicit keylink_arena_scope(keylink_arena& a) : arena(a), outer(keylink_arena::current()) {
+        keylink_arena::current() = &arena;
+    }
+
+    ~keylink_arena_scope() {
+        keylink_arena::current() = outer;
+        if (outer != &arena) arena.reset();
+    }
+
+private:
+    keylink_arena& arena;
+    keylink_arena *outer;
+
+    keylink_arena_scope(const keylink_arena_scope&);
+    keylink_arena_scope& operator=(const keylink_arena_scope&);
+};
+
+template <typename T>
+struct keylink_arena_allocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef keylink_arena_allocator<U> other;
+    };
+
+    keylink_arena_allocator() {}
+    template <typename U>
+    keylink_arena_allocator(const keylink_arena_allocator<U>&) {}
+
+    T *allocate(size_t n) {
+        keylink_arena *arena = keylink_arena::current();
+        if (!arena) throw std::bad_alloc();
+        return (T *)arena->allocate(n * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T *, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const keylink_arena_allocator<T>&, const keylink_arena_allocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const keylink_arena_allocator<T>&, const keylink_arena_allocator<U>&) { return false; }
+
+typedef std::basic_string<char, std::char_traits<char>, keylink_arena_allocator<char> > keylink_arena_string;
+
+typedef nlohmann::basic_json<std::map, std::vector, keylink_arena_string, bool, std::int64_t, std::uint64_t, double,
+                             keylink_arena_allocator> keylink_arena_json;
@@ -0,0 +1,45 @@
+// keylink_channel.h - Multicast group and port for a LAN channel
+// Each channel gets its own group in the administratively scoped
+// 239.255.0.0/16 range and its own UDP port, both from an FNV-1a hash of
+// the name, so the NIC (group MAC filter) and the kernel (port) drop other
+// channels' traffic before it reaches us. The default channel keeps
+// 239.255.0.1:7474, which relays and older peers use.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define KEYLINK_LAN_CHANNEL "__LAN__"
+#define KEYLINK_MULTICAST_ADDR "239.255.0.1"
+#define KEYLINK_UDP_PORT 7474
+// Other channels use ports KEYLINK_CHANNEL_PORT_BASE .. + KEYLINK_CHANNEL_PORTS - 1
+#define KEYLINK_CHANNEL_PORT_BASE 7475
+#define KEYLINK_CHANNEL_PORTS 500
+
+inline uint32_t keylink_channel_hash(const std::string& channel) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < channel.size(); i++) {
+        h ^= (unsigned char)channel[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Fills addr ("239.255.x.y") and port for channel
+inline void keylink_channel_group(const std::string& channel, std::string& addr, unsigned short& port) {
+    if (channel == KEYLINK_LAN_CHANNEL) {
+        addr = KEYLINK_MULTICAST_ADDR;
+        port = KEYLINK_UDP_PORT;
+        return;
+    }
+    uint32_t h = keylink_channel_hash(channel);
+    // 239.255.0.0 and the default channel's 239.255.0.1 are never picked
+    uint32_t group = 2 + (h & 0xffff) % 0xfffe;
+    char text[16];
+    snprintf(text, sizeof(text), "239.255.%u.%u", (unsigned)(group >> 8), (unsigned)(group & 0xff));
+    addr = text;
+    port = (unsigned short)(KEYLINK_CHANNEL_PORT_BASE + (h >> 16) % KEYLINK_CHANNEL_PORTS);
+}
@@ -0,0 +1,166 @@
+// keylink_clock.h - Peer clock offset and drift estimation
+// KeyLink time is wall-clock ms since the epoch, read through a monotonic
+// clock so it never jumps while running. Peers estimate each other's
+// offset NTP-style:
+//   A -> {"type":"time-ping","t0":..}                       t0: A sends
+//   B -> {"type":"time-pong","to":"<A>","t0":..,"t1":..,"t2":..}
+//                                       t1: B received, t2: B replies
+//   A receives the pong at t3:
+//     offset = ((t1 - t0) + (t2 - t3)) / 2    (B's clock minus A's)
+//     delay  = (t3 - t0) - (t2 - t1)
+// Like NTP's clock filter, the sample with the lowest delay among the last
+// few is trusted; a least-squares line through the trusted samples gives
+// the drift, so the offset can be projected to a scheduled time.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <chrono>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Samples the lowest-delay filter picks from
+#define KEYLINK_CLOCK_FILTER 8
+// Trusted samples the drift fit runs over
+#define KEYLINK_CLOCK_HISTORY 32
+// Span of trusted samples needed before drift is estimated
+#define KEYLINK_CLOCK_DRIFT_SPAN_MS 10000
+// Drift beyond this is treated as measurement noise (crystals are within ~100 ppm)
+#define KEYLINK_CLOCK_MAX_DRIFT 0.0005
+
+// KeyLink time: wall-clock ms, advanced by the steady clock
+inline double keylink_wall_ms() {
+    typedef std::chrono::duration<double, std::milli> ms;
+    static const double base = std::chrono::duration_cast<ms>(std::chrono::system_clock::now().time_since_epoch()).count() -
+                               std::chrono::duration_cast<ms>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return std::chrono::duration_cast<ms>(std::chrono::steady_clock::now().time_since_epoch()).count() + base;
+}
+
+// The value of a top-level number field, without parsing the message
+inline bool keylink_top_level_number(const char *msg, size_t len, const char *key, double& out) {
+    size_t key_len = strlen(key);
+    int depth = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = msg[i];
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        } else if (c == '"') {
+            size_t start = ++i;
+            while (i < len && msg[i] != '"') {
+                if (msg[i] == '\\') i++;
+                i++;
+            }
+            if (depth != 1 || i - start != key_len || memcmp(msg + start, key, key_len) != 0) continue;
+
+            size_t j = i + 1;
+            while (j < len && (msg[j] == ' ' || msg[j] == '\t')) j++;
+            if (j >= len || msg[j] != ':') continue;
+            j++;
+            while (j < len && (msg[j] == ' ' || msg[j] == '\t')) j++;
+            char number[32];
+            size_t n = 0;
+            while (j < len && n < sizeof(number) - 1 && strchr("0123456789+-.eE", msg[j])) number[n++] = msg[j++];
+            number[n] = 0;
+            char *end;
+            out = strtod(number, &end);
+            return n > 0 && end == number + n;
+        }
+    }
+    return false;
+}
+
+class keylink_clock_estimate {
+public:
+    keylink_clock_estimate() : recent_count(0), recent_next(0), history_count(0), history_next(0),
+                               slope(0), mean_at(0), mean_offset(0), last_trusted_at(-1) {}
+
+    // One ping/pong exchange: t0/t3 on our clock, t1/t2 on the peer's
+    void add(double t0, double t1, double t2, double t3) {
+        sample s;
+        s.delay = (t3 - t0) - (t2 - t1);
+        if (s.delay < 0) return;
+        s.offset = ((t1 - t0) + (t2 - t3)) / 2;
+        s.at = t3;
+        recent[recent_next] = s;
+        recent_next = (recent_next + 1) % KEYLINK_CLOCK_FILTER;
+        if (recent_count < KEYLINK_CLOCK_FILTER) recent_count++;
+
+        const sample& best = lowest_delay();
+        if (best.at == last_trusted_at) return;
+        last_trusted_at = best.at;
+        history[history_next] = best;
+        history_next = (history_next + 1) % KEYLINK_CLOCK_HISTORY;
+        if (history_count < KEYLINK_CLOCK_HISTORY) history_count++;
+        fit();
+    }
+
+    bool valid() const { return recent_count > 0; }
+
+    // Peer clock minus ours at our time t
+    double offset_at(double t) const {
+        if (slope == 0) return lowest_delay().offset;
+        return mean_offset + slope * (t - mean_at);
+    }
+
+    // Peer clock rate relative to ours, in parts per million
+    double drift_ppm() const { return slope * 1e6; }
+
+    // Round trip of the trusted sample; the offset is good to about half of it
+    double delay_ms() const { return valid() ? lowest_delay().delay : 0; }
+
+    size_t samples() const { return history_count; }
+
+    double last_sample_ms() const { return valid() ? recent[(recent_next + KEYLINK_CLOCK_FILTER - 1) % KEYLINK_CLOCK_FILTER].at : 0; }
+
+private:
+    struct sample {
+        double at;
+        double offset;
+        double delay;
+    };
+
+    sample recent[KEYLINK_CLOCK_FILTER];
+    size_t recent_count, recent_next;
+    sample history[KEYLINK_CLOCK_HISTORY];
+    size_t history_count, history_next;
+    double slope, mean_at, mean_offset;
+    double last_trusted_at;
+
+    const sample& lowest_delay() const {
+        size_t best = 0;
+        for (size_t i = 1; i < recent_count; i++) {
+            if (recent[i].delay < recent[best].delay) best = i;
+        }
+        return recent[best];
+    }
+
+    // Least squares through the trusted samples
+    void fit() {
+        double first = history[0].at, last = history[0].at;
+        double sum_at = 0, sum_offset = 0;
+        for (size_t i = 0; i < history_count; i++) {
+            first = history[i].at < first ? history[i].at : first;
+            last = history[i].at > last ? history[i].at : last;
+            sum_at += history[i].at;
+            sum_offset += history[i].offset;
+        }
+        mean_at = sum_at / history_count;
+        mean_offset = sum_offset / history_count;
+        if (history_count < 4 || last - first < KEYLINK_CLOCK_DRIFT_SPAN_MS) {
+            slope = 0;
+            return;
+        }
+        double sxx = 0, sxy = 0;
+        for (size_t i = 0; i < history_count; i++) {
+            double dx = history[i].at - mean_at;
+            sxx += dx * dx;
+            sxy += dx * (history[i].offset - mean_offset);
+        }
+        slope = sxx > 0 ? sxy / sxx : 0;
+        if (fabs(slope) > KEYLINK_CLOCK_MAX_DRIFT) slope = 0;
+    }
+};
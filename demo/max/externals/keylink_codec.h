@@ -0,0 +1,783 @@
+// keylink_codec.h - Wire encodings for KeyLink messages
+// A message is JSON text, MessagePack, CBOR or a binary state packet
+// (keylink_packet.h). The first byte tells them apart: JSON objects start
+// with '{' (or whitespace), MessagePack maps with 0x80-0x8f/0xde/0xdf,
+// CBOR maps with 0xa0-0xbb/0xbf and packets with 0xcb. Schemaless
+// messages are converted in one pass each way, with no DOM in between:
+// JSON text is tokenized straight into MessagePack/CBOR, and MessagePack/
+// CBOR is read straight into JSON text. Field order is kept, so the
+// _src/_seq tag stays in front, and lengths and numbers are written in the
+// same shortest form as json.hpp's to_msgpack/to_cbor, so a message
+// converted back to text reads as json.hpp would dump it.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <cfloat>
+#include <clocale>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "thirdparty/json.hpp"
+#include "keylink_packet.h"
+
+enum keylink_enc {
+    KEYLINK_ENC_JSON = 0,
+    KEYLINK_ENC_MSGPACK = 1,
+    KEYLINK_ENC_CBOR = 2,
+    KEYLINK_ENC_PACKET = 3,
+    KEYLINK_ENC_UNKNOWN = 4
+};
+
+// Bit per encoding, for capability sets
+#define KEYLINK_ENC_BIT(e) (1u << (e))
+#define KEYLINK_ENC_ALL_SCHEMALESS (KEYLINK_ENC_BIT(KEYLINK_ENC_JSON) | KEYLINK_ENC_BIT(KEYLINK_ENC_MSGPACK) | KEYLINK_ENC_BIT(KEYLINK_ENC_CBOR))
+
+inline const char *keylink_enc_name(keylink_enc e) {
+    switch (e) {
+        case KEYLINK_ENC_JSON: return "json";
+        case KEYLINK_ENC_MSGPACK: return "msgpack";
+        case KEYLINK_ENC_CBOR: return "cbor";
+        case KEYLINK_ENC_PACKET: return "packet";
+        default: return "unknown";
+    }
+}
+
+inline keylink_enc keylink_enc_from_name(const std::string& name) {
+    if (name == "json") return KEYLINK_ENC_JSON;
+    if (name == "msgpack") return KEYLINK_ENC_MSGPACK;
+    if (name == "cbor") return KEYLINK_ENC_CBOR;
+    return KEYLINK_ENC_UNKNOWN;
+}
+
+inline keylink_enc keylink_detect_encoding(const char *data, size_t len) {
+    if (len == 0) return KEYLINK_ENC_UNKNOWN;
+    uint8_t b = (uint8_t)data[0];
+    if (b == '{' || b == ' ' || b == '\t' || b == '\r' || b == '\n') return KEYLINK_ENC_JSON;
+    if (b == KEYLINK_PACKET_MAGIC0 && keylink_is_packet(data, len)) return KEYLINK_ENC_PACKET;
+    if ((b >= 0x80 && b <= 0x8f) || b == 0xde || b == 0xdf) return KEYLINK_ENC_MSGPACK;
+    if ((b >= 0xa0 && b <= 0xbb) || b == 0xbf) return KEYLINK_ENC_CBOR;
+    return KEYLINK_ENC_UNKNOWN;
+}
+
+// A _src value: 16 lowercase hex digits
+inline bool keylink_parse_source(const char *hex, size_t len, uint64_t& source) {
+    if (len != 16) return false;
+    uint64_t s = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = hex[i];
+        if (c >= '0' && c <= '9') s = (s << 4) | (uint64_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') s = (s << 4) | (uint64_t)(c - 'a' + 10);
+        else return false;
+    }
+    source = s;
+    return true;
+}
+
+inline bool keylink_parse_source(const std::string& hex, uint64_t& source) {
+    return keylink_parse_source(hex.data(), hex.size(), source);
+}
+
+namespace keylink_codec_detail {
+
+// Containers nested deeper than this are not converted (sent as JSON)
+#define KEYLINK_CODEC_MAX_DEPTH 64
+
+inline bool space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+inline void put_be(std::string& out, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) out.push_back((char)(uint8_t)(v >> (8 * i)));
+}
+
+// Length of the valid UTF-8 sequence at p (at most end - p bytes), 0 if invalid
+inline size_t utf8_length(const uint8_t *p, const uint8_t *end) {
+    uint8_t c = p[0];
+    size_t n;
+    uint32_t cp;
+    if (c < 0x80) return 1;
+    if (c >= 0xc2 && c <= 0xdf) n = 2, cp = c & 0x1f;
+    else if (c >= 0xe0 && c <= 0xef) n = 3, cp = c & 0x0f;
+    else if (c >= 0xf0 && c <= 0xf4) n = 4, cp = c & 0x07;
+    else return 0;
+    if ((size_t)(end - p) < n) return 0;
+    for (size_t i = 1; i < n; i++) {
+        if ((p[i] & 0xc0) != 0x80) return 0;
+        cp = (cp << 6) | (p[i] & 0x3f);
+    }
+    if ((n == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) || (n == 4 && (cp < 0x10000 || cp > 0x10ffff))) {
+        return 0;
+    }
+    return n;
+}
+
+inline void put_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back((char)cp);
+    } else if (cp < 0x800) {
+        out.push_back((char)(0xc0 | (cp >> 6)));
+        out.push_back((char)(0x80 | (cp & 0x3f)));
+    } else if (cp < 0x10000) {
+        out.push_back((char)(0xe0 | (cp >> 12)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back((char)(0x80 | (cp & 0x3f)));
+    } else {
+        out.push_back((char)(0xf0 | (cp >> 18)));
+        out.push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+        out.push_back((char)(0x80 | (cp & 0x3f)));
+    }
+}
+
+// Writes MessagePack or CBOR while a JSON text is tokenized. A container
+// or string's length is known only at its end: a one-byte header is
+// reserved at the start and widened in place if the length needs more.
+class binary_writer {
+public:
+    binary_writer(keylink_enc e, std::string& o) : cbor(e == KEYLINK_ENC_CBOR), out(o) {}
+
+    size_t reserve() {
+        out.push_back(0);
+        return out.size() - 1;
+    }
+
+    void map(size_t at, uint64_t n) { header(at, n, cbor ? 0xa0 : 0x80, cbor ? 0xa0 : 0xde); }
+    void array(size_t at, uint64_t n) { header(at, n, cbor ? 0x80 : 0x90, cbor ? 0x80 : 0xdc); }
+    void string(size_t at) { header(at, out.size() - at - 1, cbor ? 0x60 : 0xa0, cbor ? 0x60 : 0xd9); }
+
+    void literal(int v) {   // 0 false, 1 true, 2 null
+        static const uint8_t msgpack[] = {0xc2, 0xc3, 0xc0}, cbor_simple[] = {0xf4, 0xf5, 0xf6};
+        out.push_back((char)(cbor ? cbor_simple[v] : msgpack[v]));
+    }
+
+    void unsigned_integer(uint64_t v) {
+        if (cbor) {
+            cbor_head(0x00, v);
+        } else if (v < 0x80) {
+            out.push_back((char)v);
+        } else if (v <= 0xff) {
+            out.push_back((char)0xcc), put_be(out, v, 1);
+        } else if (v <= 0xffff) {
+            out.push_back((char)0xcd), put_be(out, v, 2);
+        } else if (v <= 0xffffffffu) {
+            out.push_back((char)0xce), put_be(out, v, 4);
+        } else {
+            out.push_back((char)0xcf), put_be(out, v, 8);
+        }
+    }
+
+    void negative_integer(int64_t v) {
+        if (cbor) {
+            cbor_head(0x20, (uint64_t)(-1 - v));
+        } else if (v >= -32) {
+            out.push_back((char)(int8_t)v);
+        } else if (v >= INT8_MIN) {
+            out.push_back((char)0xd0), put_be(out, (uint64_t)v, 1);
+        } else if (v >= INT16_MIN) {
+            out.push_back((char)0xd1), put_be(out, (uint64_t)v, 2);
+        } else if (v >= INT32_MIN) {
+            out.push_back((char)0xd2), put_be(out, (uint64_t)v, 4);
+        } else {
+            out.push_back((char)0xd3), put_be(out, (uint64_t)v, 8);
+        }
+    }
+
+    // Single precision when that holds the value exactly, as json.hpp does
+    void number(double v) {
+        if (v >= -(double)FLT_MAX && v <= (double)FLT_MAX && (double)(float)v == v) {
+            float f = (float)v;
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            out.push_back((char)(cbor ? 0xfa : 0xca));
+            put_be(out, bits, 4);
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            out.push_back((char)(cbor ? 0xfb : 0xcb));
+            put_be(out, bits, 8);
+        }
+    }
+
+private:
+    bool cbor;
+    std::string& out;
+
+    void cbor_head(uint8_t major, uint64_t v) {
+        if (v <= 0x17) {
+            out.push_back((char)(major | v));
+        } else if (v <= 0xff) {
+            out.push_back((char)(major | 0x18)), put_be(out, v, 1);
+        } else if (v <= 0xffff) {
+            out.push_back((char)(major | 0x19)), put_be(out, v, 2);
+        } else if (v <= 0xffffffffu) {
+            out.push_back((char)(major | 0x1a)), put_be(out, v, 4);
+        } else {
+            out.push_back((char)(major | 0x1b)), put_be(out, v, 8);
+        }
+    }
+
+    // fix is the one-byte form's base; MessagePack's 8/16/32-bit forms are
+    // wide, wide + 1, wide + 2 (strings have an 8-bit form, maps and arrays
+    // do not). CBOR's are fix | 0x18..0x1a.
+    void header(size_t at, uint64_t n, uint8_t fix, uint8_t wide) {
+        uint8_t h[5];
+        size_t len;
+        if (cbor) {
+            if (n <= 0x17) h[0] = (uint8_t)(fix | n), len = 1;
+            else if (n <= 0xff) h[0] = fix | 0x18, h[1] = (uint8_t)n, len = 2;
+            else if (n <= 0xffff) h[0] = fix | 0x19, len = 3;
+            else h[0] = fix | 0x1a, len = 5;
+        } else {
+            bool str = fix == 0xa0;
+            uint64_t fix_max = str ? 31 : 15;
+            if (n <= fix_max) h[0] = (uint8_t)(fix | n), len = 1;
+            else if (str && n <= 0xff) h[0] = wide, h[1] = (uint8_t)n, len = 2;
+            else if (n <= 0xffff) h[0] = (uint8_t)(wide + (str ? 1 : 0)), len = 3;
+            else h[0] = (uint8_t)(wide + (str ? 2 : 1)), len = 5;
+        }
+        if (len == 3) h[1] = (uint8_t)(n >> 8), h[2] = (uint8_t)n;
+        if (len == 5) h[1] = (uint8_t)(n >> 24), h[2] = (uint8_t)(n >> 16), h[3] = (uint8_t)(n >> 8), h[4] = (uint8_t)n;
+        if (len > 1) out.insert(at + 1, len - 1, '\0');
+        memcpy(&out[at], h, len);
+    }
+};
+
+// JSON string at text[i] == '"' -> its bytes appended to out, unescaped;
+// i is left after the closing quote
+inline bool json_string(const char *text, size_t len, size_t& i, std::string& out) {
+    i++;
+    size_t run = i;
+    while (i < len) {
+        uint8_t c = (uint8_t)text[i];
+        if (c == '"') {
+            out.append(text + run, i - run);
+            i++;
+            return true;
+        }
+        if (c < 0x20) return false;
+        if (c >= 0x80) {
+            size_t n = utf8_length((const uint8_t *)text + i, (const uint8_t *)text + len);
+            if (!n) return false;
+            i += n;
+            continue;
+        }
+        if (c != '\\') {
+            i++;
+            continue;
+        }
+        out.append(text + run, i - run);
+        if (++i >= len) return false;
+        switch (text[i++]) {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                uint32_t cp = 0;
+                for (int pair = 0; pair < 2; pair++) {
+                    if (len - i < 4) return false;
+                    uint32_t unit = 0;
+                    for (int k = 0; k < 4; k++) {
+                        char h = text[i++];
+                        unit <<= 4;
+                        if (h >= '0' && h <= '9') unit |= (uint32_t)(h - '0');
+                        else if (h >= 'a' && h <= 'f') unit |= (uint32_t)(h - 'a' + 10);
+                        else if (h >= 'A' && h <= 'F') unit |= (uint32_t)(h - 'A' + 10);
+                        else return false;
+                    }
+                    if (pair == 0) {
+                        if (unit >= 0xdc00 && unit <= 0xdfff) return false;
+                        cp = unit;
+                        if (unit < 0xd800 || unit > 0xdbff) break;
+                        // A high surrogate needs its low half next
+                        if (len - i < 2 || text[i] != '\\' || text[i + 1] != 'u') return false;
+                        i += 2;
+                    } else {
+                        if (unit < 0xdc00 || unit > 0xdfff) return false;
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (unit - 0xdc00);
+                    }
+                }
+                put_utf8(out, cp);
+                break;
+            }
+            default: return false;
+        }
+        run = i;
+    }
+    return false;
+}
+
+// JSON number at text[i]: integers that fit 64 bits stay integers (as in
+// json.hpp), anything else is a double
+inline bool json_number(const char *text, size_t len, size_t& i, binary_writer& w) {
+    size_t start = i;
+    bool negative = text[i] == '-';
+    if (negative) i++;
+    if (i >= len || text[i] < '0' || text[i] > '9') return false;
+    if (text[i] == '0' && i + 1 < len && text[i + 1] >= '0' && text[i + 1] <= '9') return false;
+    uint64_t mantissa = 0;
+    int digits = 0, fraction = 0;
+    bool exact = true;
+    for (; i < len && text[i] >= '0' && text[i] <= '9'; i++, digits++) {
+        uint64_t d = (uint64_t)(text[i] - '0');
+        if (mantissa > (UINT64_MAX - d) / 10) exact = false;
+        mantissa = mantissa * 10 + d;
+    }
+    bool integer = true;
+    if (i < len && text[i] == '.') {
+        integer = false;
+        size_t f = ++i;
+        for (; i < len && text[i] >= '0' && text[i] <= '9'; i++, digits++) mantissa = mantissa * 10 + (uint64_t)(text[i] - '0');
+        fraction = (int)(i - f);
+        if (!fraction) return false;
+    }
+    if (i < len && (text[i] == 'e' || text[i] == 'E')) {
+        integer = false;
+        exact = false;
+        i++;
+        if (i < len && (text[i] == '+' || text[i] == '-')) i++;
+        if (i >= len || text[i] < '0' || text[i] > '9') return false;
+        while (i < len && text[i] >= '0' && text[i] <= '9') i++;
+    }
+
+    if (integer && exact) {
+        if (!negative) {
+            w.unsigned_integer(mantissa);
+            return true;
+        }
+        if (mantissa <= (uint64_t)INT64_MAX + 1) {
+            if (mantissa == 0) w.unsigned_integer(0);
+            else w.negative_integer(mantissa == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)mantissa);
+            return true;
+        }
+    }
+    // Up to 15 digits without an exponent are exact as one division;
+    // the rest goes through strtod, with the locale's decimal point
+    if (exact && digits <= 15) {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+                                        1e14, 1e15};
+        double v = (double)mantissa / powers[fraction];
+        w.number(negative ? -v : v);
+        return true;
+    }
+    char buf[64];
+    if (i - start >= sizeof(buf)) return false;
+    memcpy(buf, text + start, i - start);
+    buf[i - start] = '\0';
+    char point = *std::localeconv()->decimal_point;
+    if (point != '.') {
+        char *dot = strchr(buf, '.');
+        if (dot) *dot = point;
+    }
+    // Out of double range: json.hpp refuses the message, and so do we
+    double v = std::strtod(buf, NULL);
+    if (!std::isfinite(v)) return false;
+    w.number(v);
+    return true;
+}
+
+// Appends the JSON text of one MessagePack/CBOR value; see keylink_decode
+class text_writer {
+public:
+    text_writer(keylink_enc e, const uint8_t *first, size_t len, std::string& o)
+        : cbor(e == KEYLINK_ENC_CBOR), p(first), end(first + len), out(o) {}
+
+    bool value(int depth, bool top, uint64_t& source, uint64_t& seq) {
+        if (p >= end || depth > KEYLINK_CODEC_MAX_DEPTH) return false;
+        return cbor ? cbor_value(depth, top, source, seq) : msgpack_value(depth, top, source, seq);
+    }
+
+    bool done() const { return p == end; }
+
+private:
+    bool cbor;
+    const uint8_t *p, *end;
+    std::string& out;
+
+    bool take(size_t n, uint64_t& v) {
+        if ((size_t)(end - p) < n) return false;
+        v = 0;
+        for (size_t i = 0; i < n; i++) v = (v << 8) | *p++;
+        return true;
+    }
+
+    void integer(uint64_t v, bool negative) {
+        char digits[24];
+        char *d = digits + sizeof(digits);
+        do {
+            *--d = (char)('0' + v % 10);
+            v /= 10;
+        } while (v);
+        if (negative) *--d = '-';
+        out.append(d, (size_t)(digits + sizeof(digits) - d));
+    }
+
+    // Shortest round-trip form, as json.hpp dumps it; null for NaN and infinity
+    void number(double v) {
+        if (!std::isfinite(v)) {
+            out.append("null", 4);
+            return;
+        }
+        char buf[64];
+        char *e = nlohmann::detail::to_chars(buf, buf + sizeof(buf), v);
+        out.append(buf, (size_t)(e - buf));
+    }
+
+    // n string bytes at p, quoted and escaped as json.hpp does; false if
+    // they are not valid UTF-8
+    bool string(uint64_t n, const uint8_t **bytes = NULL) {
+        if ((uint64_t)(end - p) < n) return false;
+        const uint8_t *s = p, *e = p + n;
+        if (bytes) *bytes = s;
+        p = e;
+        out.push_back('"');
+        const uint8_t *run = s;
+        while (s < e) {
+            uint8_t c = *s;
+            if (c >= 0x80) {
+                size_t k = utf8_length(s, e);
+                if (!k) return false;
+                s += k;
+                continue;
+            }
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                s++;
+                continue;
+            }
+            out.append((const char *)run, (size_t)(s - run));
+            switch (c) {
+                case '"': out.append("\\\"", 2); break;
+                case '\\': out.append("\\\\", 2); break;
+                case '\b': out.append("\\b", 2); break;
+                case '\f': out.append("\\f", 2); break;
+                case '\n': out.append("\\n", 2); break;
+                case '\r': out.append("\\r", 2); break;
+                case '\t': out.append("\\t", 2); break;
+                default: {
+                    static const char hex[] = "0123456789abcdef";
+                    char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                    out.append(u, 6);
+                }
+            }
+            run = ++s;
+        }
+        out.append((const char *)run, (size_t)(s - run));
+        out.push_back('"');
+        return true;
+    }
+
+    // count entries (pairs for a map), or up to a break byte when -1
+    // (CBOR indefinite length). The top map's _src and _seq are read back
+    // from the text written for them.
+    bool container(bool map, int64_t count, int depth, bool top, uint64_t& source, uint64_t& seq) {
+        out.push_back(map ? '{' : '[');
+        size_t src_at = 0, seq_at = 0;
+        for (int64_t i = 0; count < 0 || i < count; i++) {
+            if (count < 0) {
+                if (p >= end) return false;
+                if (*p == 0xff) {
+                    p++;
+                    break;
+                }
+            }
+            if (i) out.push_back(',');
+            if (map) {
+                // Keys must be strings, as json.hpp requires
+                const uint8_t *key = NULL;
+                uint64_t key_len = 0;
+                if (p >= end || !string_length(key_len) || !string(key_len, &key)) return false;
+                out.push_back(':');
+                if (top && key_len == 4 && memcmp(key, "_src", 4) == 0) src_at = out.size();
+                if (top && key_len == 4 && memcmp(key, "_seq", 4) == 0) seq_at = out.size();
+            }
+            if (!value(depth + 1, false, source, seq)) return false;
+        }
+        out.push_back(map ? '}' : ']');
+
+        if (src_at && seq_at && out[src_at] == '"' && out.size() - src_at > 18 && out[src_at + 17] == '"' &&
+            keylink_parse_source(out.data() + src_at + 1, 16, source)) {
+            uint64_t v = 0;
+            size_t k = seq_at;
+            for (; out[k] >= '0' && out[k] <= '9'; k++) v = v * 10 + (uint64_t)(out[k] - '0');
+            if (k > seq_at && (out[k] == ',' || out[k] == '}')) {
+                seq = v;
+            } else {
+                source = 0;
+            }
+        }
+        return true;
+    }
+
+    // If p is at a string header, consume it and give its byte length
+    bool string_length(uint64_t& n) {
+        uint8_t b = *p;
+        if (cbor) {
+            if ((b & 0xe0) != 0x60 || (b & 0x1f) > 0x1b) return false;
+            p++;
+            return argument(b & 0x1f, n);
+        }
+        if (b >= 0xa0 && b <= 0xbf) {
+            p++;
+            n = b & 0x1f;
+            return true;
+        }
+        if (b < 0xd9 || b > 0xdb) return false;
+        p++;
+        return take((size_t)1 << (b - 0xd9), n);
+    }
+
+    // CBOR additional information: the value itself, or 1/2/4/8 bytes after
+    bool argument(uint8_t info, uint64_t& v) {
+        if (info <= 0x17) {
+            v = info;
+            return true;
+        }
+        if (info > 0x1b) return false;
+        return take((size_t)1 << (info - 0x18), v);
+    }
+
+    bool msgpack_value(int depth, bool top, uint64_t& source, uint64_t& seq) {
+        uint8_t b = *p;
+        uint64_t n;
+        if (top && !((b >= 0x80 && b <= 0x8f) || b == 0xde || b == 0xdf)) return false;
+        if (b <= 0x7f) {
+            p++;
+            integer(b, false);
+            return true;
+        }
+        if (b >= 0xe0) {
+            p++;
+            integer((uint64_t)(0x100 - b), true);
+            return true;
+        }
+        if (b <= 0x8f) return p++, container(true, b & 0x0f, depth, top, source, seq);
+        if (b <= 0x9f) return p++, container(false, b & 0x0f, depth, top, source, seq);
+        if (b <= 0xbf || (b >= 0xd9 && b <= 0xdb)) return string_length(n) && string(n);
+        p++;
+        switch (b) {
+            case 0xc0: out.append("null", 4); return true;
+            case 0xc2: out.append("false", 5); return true;
+            case 0xc3: out.append("true", 4); return true;
+            case 0xca: {
+                uint32_t bits;
+                float f;
+                if (!take(4, n)) return false;
+                bits = (uint32_t)n;
+                memcpy(&f, &bits, sizeof(f));
+                number(f);
+                return true;
+            }
+            case 0xcb: {
+                double d;
+                if (!take(8, n)) return false;
+                memcpy(&d, &n, sizeof(d));
+                number(d);
+                return true;
+            }
+            case 0xcc: case 0xcd: case 0xce: case 0xcf:
+                if (!take((size_t)1 << (b - 0xcc), n)) return false;
+                integer(n, false);
+                return true;
+            case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+                size_t k = (size_t)1 << (b - 0xd0);
+                if (!take(k, n)) return false;
+                // Sign-extend the k-byte value
+                int64_t v = k == 8 ? (int64_t)n : (int64_t)(n << (64 - 8 * k)) >> (64 - 8 * k);
+                if (v < 0) integer(0 - (uint64_t)v, true);
+                else integer((uint64_t)v, false);
+                return true;
+            }
+            case 0xdc: case 0xdd:
+                if (!take(b == 0xdc ? 2 : 4, n)) return false;
+                return container(false, (int64_t)n, depth, top, source, seq);
+            case 0xde: case 0xdf:
+                if (!take(b == 0xde ? 2 : 4, n)) return false;
+                return container(true, (int64_t)n, depth, top, source, seq);
+            default:
+                // Binary, extension types and the unused byte have no JSON form
+                return false;
+        }
+    }
+
+    bool cbor_value(int depth, bool top, uint64_t& source, uint64_t& seq) {
+        uint8_t b = *p++;
+        uint8_t major = b >> 5, info = b & 0x1f;
+        uint64_t n;
+        if (top && major != 5) return false;
+        switch (major) {
+            case 0:
+                if (!argument(info, n)) return false;
+                integer(n, false);
+                return true;
+            case 1:
+                if (!argument(info, n)) return false;
+                // -1 - n: its magnitude is n + 1, which may not fit 64 bits
+                if (n == UINT64_MAX) {
+                    out.append("-18446744073709551616", 21);
+                } else {
+                    integer(n + 1, true);
+                }
+                return true;
+            case 3:
+                return argument(info, n) && string(n);
+            case 4:
+            case 5:
+                if (info == 0x1f) return container(major == 5, -1, depth, top, source, seq);
+                if (!argument(info, n)) return false;
+                return container(major == 5, (int64_t)n, depth, top, source, seq);
+            case 7:
+                switch (info) {
+                    case 20: out.append("false", 5); return true;
+                    case 21: out.append("true", 4); return true;
+                    case 22: out.append("null", 4); return true;
+                    case 25: {
+                        // Half precision
+                        if (!take(2, n)) return false;
+                        unsigned half = (unsigned)n, exp = (half >> 10) & 0x1f, mant = half & 0x3ff;
+                        double v = exp == 0 ? std::ldexp((double)mant, -24)
+                                 : exp != 31 ? std::ldexp((double)(mant + 1024), (int)exp - 25)
+                                 : mant == 0 ? HUGE_VAL : NAN;
+                        number(half & 0x8000 ? -v : v);
+                        return true;
+                    }
+                    case 26: {
+                        uint32_t bits;
+                        float f;
+                        if (!take(4, n)) return false;
+                        bits = (uint32_t)n;
+                        memcpy(&f, &bits, sizeof(f));
+                        number(f);
+                        return true;
+                    }
+                    case 27: {
+                        double d;
+                        if (!take(8, n)) return false;
+                        memcpy(&d, &n, sizeof(d));
+                        number(d);
+                        return true;
+                    }
+                    default: return false;
+                }
+            default:
+                // Byte strings, tags and indefinite-length text have no place here
+                return false;
+        }
+    }
+};
+
+}  // namespace keylink_codec_detail
+
+// JSON object text -> MessagePack or CBOR in out (reused between calls).
+// False if the text is not a JSON object; the caller then sends the text.
+inline bool keylink_encode(keylink_enc e, const char *text, size_t len, std::string& out) {
+    using namespace keylink_codec_detail;
+    if (e != KEYLINK_ENC_MSGPACK && e != KEYLINK_ENC_CBOR) return false;
+    out.clear();
+    binary_writer w(e, out);
+
+    // Open containers: where each header goes, its entry count, and
+    // whether it is an object; expect is what the next token may be
+    struct open {
+        size_t at;
+        uint64_t count;
+        bool object;
+    } stack[KEYLINK_CODEC_MAX_DEPTH];
+    int depth = 0;
+    enum { VALUE, KEY_OR_END, KEY, COLON, COMMA_OR_END, VALUE_OR_END } expect = VALUE;
+
+    size_t i = 0;
+    while (i < len && space(text[i])) i++;
+    if (i >= len || text[i] != '{') return false;
+    while (i < len) {
+        char c = text[i];
+        if (space(c)) {
+            i++;
+            continue;
+        }
+        if (expect == COLON) {
+            if (c != ':') return false;
+            i++;
+            expect = VALUE;
+            continue;
+        }
+        if (expect == COMMA_OR_END) {
+            if (c == ',') {
+                i++;
+                expect = stack[depth - 1].object ? KEY : VALUE;
+                continue;
+            }
+            if (c != (stack[depth - 1].object ? '}' : ']')) return false;
+        }
+        if ((expect == KEY_OR_END && c == '}') || (expect == VALUE_OR_END && c == ']') ||
+            (expect == COMMA_OR_END)) {
+            i++;
+            open& top = stack[--depth];
+            if (top.object) w.map(top.at, top.count);
+            else w.array(top.at, top.count);
+            if (!depth) break;
+            expect = COMMA_OR_END;
+            continue;
+        }
+        if (expect == KEY || expect == KEY_OR_END) {
+            if (c != '"') return false;
+            size_t at = w.reserve();
+            if (!json_string(text, len, i, out)) return false;
+            w.string(at);
+            stack[depth - 1].count++;
+            expect = COLON;
+            continue;
+        }
+
+        // A value
+        if (depth && !stack[depth - 1].object) stack[depth - 1].count++;
+        if (c == '{' || c == '[') {
+            if (depth == KEYLINK_CODEC_MAX_DEPTH) return false;
+            open& o = stack[depth++];
+            o.at = w.reserve();
+            o.count = 0;
+            o.object = c == '{';
+            i++;
+            expect = o.object ? KEY_OR_END : VALUE_OR_END;
+            continue;
+        }
+        if (c == '"') {
+            size_t at = w.reserve();
+            if (!json_string(text, len, i, out)) return false;
+            w.string(at);
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            if (!json_number(text, len, i, w)) return false;
+        } else if (len - i >= 4 && memcmp(text + i, "true", 4) == 0) {
+            w.literal(1), i += 4;
+        } else if (len - i >= 5 && memcmp(text + i, "false", 5) == 0) {
+            w.literal(0), i += 5;
+        } else if (len - i >= 4 && memcmp(text + i, "null", 4) == 0) {
+            w.literal(2), i += 4;
+        } else {
+            return false;
+        }
+        expect = COMMA_OR_END;
+    }
+    if (depth) return false;
+    while (i < len && space(text[i])) i++;
+    return i == len;
+}
+
+// MessagePack or CBOR -> JSON text in text (reused), plus its _src/_seq
+// tag if present (source 0 when untagged). False if the data is not one
+// map, or holds something JSON cannot (binary, extensions, non-string keys,
+// invalid UTF-8).
+inline bool keylink_decode(keylink_enc e, const char *data, size_t len, std::string& text,
+                           uint64_t& source, uint64_t& seq) {
+    if (e != KEYLINK_ENC_MSGPACK && e != KEYLINK_ENC_CBOR) return false;
+    source = 0;
+    seq = 0;
+    text.clear();
+    keylink_codec_detail::text_writer r(e, (const uint8_t *)data, len, text);
+    return r.value(0, true, source, seq) && r.done();
+}
@@ -0,0 +1,146 @@
+// keylink_dedup.h - Source/sequence tagging and duplicate suppression
+// Every JSON object a KeyLink endpoint sends starts with its source ID and
+// a per-source sequence number:
+//   {"_src":"9f2c4e01a7b3d658","_seq":42, ...original fields...}
+// Receivers keep an RTP-style sliding bitmap per source, so a message that
+// arrives twice (UDP and WebSocket, a relay loop, our own multicast echo) is
+// dropped in O(1) without comparing payloads. Untagged messages always pass.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Sequence numbers tracked behind the newest one seen from a source
+#define KEYLINK_DEDUP_WINDOW 256
+// Sources tracked at once; the least recently heard one is evicted
+#define KEYLINK_DEDUP_SOURCES 64
+// Slots probed per lookup
+#define KEYLINK_DEDUP_PROBE 8
+
+#define KEYLINK_TAG_PREFIX "{\"_src\":\""
+#define KEYLINK_TAG_PREFIX_LEN 9
+#define KEYLINK_TAG_SRC_LEN 16
+
+// Parse the tag at the front of msg. Returns false for untagged messages.
+inline bool keylink_parse_tag(const char *msg, size_t len, uint64_t& source, uint64_t& seq) {
+    // {"_src":"<16 hex>","_seq":<digits>
+    static const size_t seq_at = KEYLINK_TAG_PREFIX_LEN + KEYLINK_TAG_SRC_LEN + 9;
+    if (len <= seq_at || memcmp(msg, KEYLINK_TAG_PREFIX, KEYLINK_TAG_PREFIX_LEN) != 0) return false;
+    if (memcmp(msg + KEYLINK_TAG_PREFIX_LEN + KEYLINK_TAG_SRC_LEN, "\",\"_seq\":", 9) != 0) return false;
+
+    source = 0;
+    for (size_t i = KEYLINK_TAG_PREFIX_LEN; i < KEYLINK_TAG_PREFIX_LEN + KEYLINK_TAG_SRC_LEN; i++) {
+        char c = msg[i];
+        unsigned v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else return false;
+        source = (source << 4) | v;
+    }
+
+    seq = 0;
+    size_t i = seq_at;
+    for (; i < len && i < seq_at + 20 && msg[i] >= '0' && msg[i] <= '9'; i++) seq = seq * 10 + (uint64_t)(msg[i] - '0');
+    return i > seq_at && i < len && (msg[i] == ',' || msg[i] == '}');
+}
+
+// Write msg into out with the tag inserted after the opening brace.
+// Returns false (out untouched) if msg is not a JSON object.
+inline bool keylink_tag_message(uint64_t source, uint64_t seq, const char *msg, size_t len, std::string& out) {
+    size_t i = 0;
+    while (i < len && (msg[i] == ' ' || msg[i] == '\t' || msg[i] == '\n' || msg[i] == '\r')) i++;
+    if (i >= len || msg[i] != '{') return false;
+    size_t body = i + 1;
+    while (body < len && (msg[body] == ' ' || msg[body] == '\t' || msg[body] == '\n' || msg[body] == '\r')) body++;
+
+    char tag[64];
+    int n = snprintf(tag, sizeof(tag), "{\"_src\":\"%016llx\",\"_seq\":%llu%s",
+                     (unsigned long long)source, (unsigned long long)seq,
+                     body < len && msg[body] == '}' ? "" : ",");
+    out.assign(tag, (size_t)n);
+    out.append(msg + body, len - body);
+    return true;
+}
+
+class keylink_dedup {
+public:
+    keylink_dedup() : clock(0) {
+        memset(slots, 0, sizeof(slots));
+    }
+
+    // True the first time (source, seq) is seen; false for a repeat or a
+    // sequence number that has fallen out of the window
+    bool accept(uint64_t source, uint64_t seq) {
+        slot& s = find(source);
+        s.last_used = ++clock;
+
+        if (!s.used || seq > s.highest) {
+            uint64_t shift = s.used ? seq - s.highest : KEYLINK_DEDUP_WINDOW;
+            shift_window(s, shift);
+            s.used = true;
+            s.highest = seq;
+            s.bits[0] |= 1;
+            return true;
+        }
+
+        uint64_t behind = s.highest - seq;
+        if (behind >= KEYLINK_DEDUP_WINDOW) return false;
+        uint64_t& word = s.bits[behind / 64];
+        uint64_t bit = (uint64_t)1 << (behind % 64);
+        if (word & bit) return false;
+        word |= bit;
+        return true;
+    }
+
+private:
+    enum { WORDS = KEYLINK_DEDUP_WINDOW / 64 };
+
+    struct slot {
+        uint64_t source;
+        uint64_t highest;
+        uint64_t last_used;
+        uint64_t bits[WORDS];       // Bit n: highest - n was seen
+        bool used;
+    };
+
+    slot slots[KEYLINK_DEDUP_SOURCES];
+    uint64_t clock;
+
+    // Linear probe from the source's home slot; reuse the stalest slot if
+    // the source is not found
+    slot& find(uint64_t source) {
+        size_t home = (size_t)((source * 0x9E3779B97F4A7C15ull) >> 32) % KEYLINK_DEDUP_SOURCES;
+        slot *victim = NULL;
+        for (size_t p = 0; p < KEYLINK_DEDUP_PROBE; p++) {
+            slot& s = slots[(home + p) % KEYLINK_DEDUP_SOURCES];
+            if (s.used && s.source == source) return s;
+            if (!s.used) {
+                if (!victim || victim->used) victim = &s;
+            } else if (!victim || (victim->used && s.last_used < victim->last_used)) {
+                victim = &s;
+            }
+        }
+        memset(victim, 0, sizeof(*victim));
+        victim->source = source;
+        return *victim;
+    }
+
+    static void shift_window(slot& s, uint64_t shift) {
+        if (shift >= KEYLINK_DEDUP_WINDOW) {
+            memset(s.bits, 0, sizeof(s.bits));
+            return;
+        }
+        size_t words = (size_t)(shift / 64);
+        unsigned bits = (unsigned)(shift % 64);
+        for (int i = WORDS - 1; i >= 0; i--) {
+            uint64_t v = i - (int)words >= 0 ? s.bits[i - words] << bits : 0;
+            if (bits && i - (int)words - 1 >= 0) v |= s.bits[i - words - 1] >> (64 - bits);
+            s.bits[i] = v;
+        }
+    }
+};
@@ -0,0 +1,225 @@
+// keylink_delta.h - Field-level state deltas
+// A sender that has already sent a state can send only the fields that
+// changed since, chained to the earlier message by its _seq:
+//   {"_src":"9f2c4e01a7b3d658","_seq":43,"type":"state-delta","base":42,"state":{"tempo":121}}
+// "state" holds the changed fields of the base's "state" object (set-state,
+// keylink-state) or of the base itself (a flat, untyped state). A field set
+// to null was removed. For typed states, any other top-level field of the
+// delta (a new "timestamp", say) replaces the base's. Any full state
+// message is a keyframe; one goes out every KEYLINK_KEYFRAME_INTERVAL_MS
+// and whenever a receiver that missed the base asks for it with
+//   {"type":"state-resync","source":"9f2c4e01a7b3d658"}
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include "thirdparty/json.hpp"
+
+// Longest run of deltas between two full states
+#define KEYLINK_KEYFRAME_INTERVAL_MS 2000
+// Most earlier deltas carried by one state
+#define KEYLINK_REDUNDANCY_MAX 8
+
+typedef nlohmann::ordered_json keylink_ojson;
+
+// Fields a delta never carries as changes
+inline bool keylink_delta_reserved(const std::string& key) {
+    return key == "_src" || key == "_seq" || key == "type" || key == "base" || key == "state" || key == "_red";
+}
+
+// True for a state the encoder can diff: set-state/keylink-state with a
+// "state" object, or a flat object without "type"
+inline bool keylink_delta_eligible(const keylink_ojson& j, bool& typed) {
+    if (!j.is_object()) return false;
+    keylink_ojson::const_iterator type = j.find("type");
+    if (type == j.end()) {
+        typed = false;
+        return true;
+    }
+    keylink_ojson::const_iterator state = j.find("state");
+    if (!type->is_string() || state == j.end() || !state->is_object()) return false;
+    const std::string& t = type->get_ref<const std::string&>();
+    typed = true;
+    return t == "set-state" || t == "keylink-state";
+}
+
+// Apply a parsed delta to a full state message in place, keeping field
+// order (new fields are appended)
+inline bool keylink_delta_apply(keylink_ojson& full, const keylink_ojson& delta) {
+    bool typed;
+    if (!keylink_delta_eligible(full, typed)) return false;
+    keylink_ojson::const_iterator changes = delta.find("state");
+    if (changes == delta.end() || !changes->is_object()) return false;
+
+    keylink_ojson& fields = typed ? full["state"] : full;
+    for (keylink_ojson::const_iterator it = changes->begin(); it != changes->end(); ++it) {
+        if (!typed && keylink_delta_reserved(it.key())) continue;
+        if (it->is_null()) {
+            fields.erase(it.key());
+        } else {
+            fields[it.key()] = *it;
+        }
+    }
+    if (typed) {
+        for (keylink_ojson::const_iterator it = delta.begin(); it != delta.end(); ++it) {
+            if (!keylink_delta_reserved(it.key())) full[it.key()] = *it;
+        }
+    }
+    return true;
+}
+
+// Sender side: turns each state message into a delta against the previous
+// one, or says to send it whole
+class keylink_delta_encoder {
+public:
+    keylink_delta_encoder() : last_seq(0), last_typed(false), keyframe_ms(0), keyframe_due(true), depth(0) {}
+
+    // msg is an untagged message about to go out as sequence number seq.
+    // Returns true with the delta in out; false means send msg as it is.
+    // With redundancy on, redundant() is then what to attach to it.
+    bool encode(const char *msg, size_t len, uint64_t seq, double now_ms, std::string& out) {
+        red.clear();
+        keylink_ojson j = keylink_ojson::parse(msg, msg + len, nullptr, false);
+        bool typed = false;
+        if (!keylink_delta_eligible(j, typed)) {
+            last = nullptr;
+            keyframe_due = true;
+            history.clear();
+            return false;
+        }
+
+        // Keyframes are diffed too while redundancy is on: the next states carry it
+        keylink_ojson delta;
+        bool keyframe = keyframe_due || last.is_null() || typed != last_typed ||
+                        now_ms - keyframe_ms >= KEYLINK_KEYFRAME_INTERVAL_MS;
+        bool diffed = (!keyframe || depth) && !last.is_null() && typed == last_typed && diff(j, typed, delta);
+        if (!diffed) keyframe = true;
+        if (depth) remember(seq, delta, diffed);
+
+        last.swap(j);
+        last_typed = typed;
+        if (keyframe) {
+            last_seq = seq;
+            keyframe_ms = now_ms;
+            keyframe_due = false;
+            return false;
+        }
+        last_seq = seq;
+        out = delta.dump();
+        return true;
+    }
+
+    // The next state goes out whole
+    void request_keyframe() { keyframe_due = true; }
+
+    // Carry the deltas of the last depth states sent (0 = off)
+    void set_redundancy(size_t d) {
+        depth = d < KEYLINK_REDUNDANCY_MAX ? d : KEYLINK_REDUNDANCY_MAX;
+        while (history.size() > depth) history.pop_front();
+    }
+
+    size_t redundancy() const { return depth; }
+
+    // The "_red" array for the state just encoded, oldest first; empty if
+    // there is nothing to carry
+    const std::string& redundant() const { return red; }
+
+    bool has_state() const { return !last.is_null(); }
+
+    // When the last keyframe went out (ms, the clock passed to encode)
+    double keyframe_time() const { return keyframe_ms; }
+
+    // The last state sent, to resend as a keyframe
+    std::string last_state() const { return last.dump(); }
+
+private:
+    keylink_ojson last;
+    uint64_t last_seq;
+    bool last_typed;
+    double keyframe_ms;
+    bool keyframe_due;
+    size_t depth;
+    std::deque<std::string> history;    // {"_seq":..,"base":..,"state":{..}} of recent states
+    std::string red;
+
+    // Build red from the states before seq, then add seq's own delta. A
+    // state no delta describes breaks the chain, so older ones are dropped.
+    void remember(uint64_t seq, const keylink_ojson& delta, bool diffed) {
+        if (!history.empty()) {
+            red = "[";
+            for (size_t i = 0; i < history.size(); i++) {
+                if (i) red += ',';
+                red += history[i];
+            }
+            red += ']';
+        }
+        if (!diffed) {
+            history.clear();
+            return;
+        }
+        keylink_ojson entry = keylink_ojson::object();
+        entry["_seq"] = seq;
+        for (keylink_ojson::const_iterator it = delta.begin(); it != delta.end(); ++it) {
+            if (it.key() != "type") entry[it.key()] = *it;
+        }
+        history.push_back(entry.dump());
+        while (history.size() > depth) history.pop_front();
+    }
+
+    static void diff_fields(const keylink_ojson& before, const keylink_ojson& after, bool skip_reserved,
+                            keylink_ojson& changes) {
+        for (keylink_ojson::const_iterator it = after.begin(); it != after.end(); ++it) {
+            if (skip_reserved && keylink_delta_reserved(it.key())) continue;
+            keylink_ojson::const_iterator was = before.find(it.key());
+            if (was == before.end() || *was != *it) changes[it.key()] = *it;
+        }
+        for (keylink_ojson::const_iterator it = before.begin(); it != before.end(); ++it) {
+            if (skip_reserved && keylink_delta_reserved(it.key())) continue;
+            if (after.find(it.key()) == after.end()) changes[it.key()] = nullptr;
+        }
+    }
+
+    // Build {"type":"state-delta","base":..,[changed top-level fields,]"state":{..}}.
+    // False if a delta cannot describe the change (a top-level field of a
+    // typed state was removed, or a flat state uses a reserved name).
+    bool diff(const keylink_ojson& after, bool typed, keylink_ojson& delta) const {
+        keylink_ojson changes = keylink_ojson::object();
+        delta["type"] = "state-delta";
+        delta["base"] = last_seq;
+        if (typed) {
+            keylink_ojson envelope = keylink_ojson::object();
+            diff_fields(last, after, true, envelope);
+            for (keylink_ojson::iterator it = envelope.begin(); it != envelope.end(); ++it) {
+                if (it->is_null()) return false;
+                delta[it.key()] = *it;
+            }
+            if (after["type"] != last["type"]) return false;
+            diff_fields(last["state"], after["state"], false, changes);
+        } else {
+            for (keylink_ojson::const_iterator it = after.begin(); it != after.end(); ++it) {
+                if (keylink_delta_reserved(it.key())) return false;
+            }
+            diff_fields(last, after, false, changes);
+        }
+        delta["state"] = changes;
+        return true;
+    }
+};
+
+// Insert ,"_red":red before the closing brace of a JSON object message
+inline bool keylink_attach_redundant(const char *msg, size_t len, const std::string& red, std::string& out) {
+    size_t end = len;
+    while (end > 0 && (msg[end - 1] == ' ' || msg[end - 1] == '\t' || msg[end - 1] == '\n' || msg[end - 1] == '\r')) end--;
+    if (red.empty() || end < 2 || msg[0] != '{' || msg[end - 1] != '}') return false;
+    size_t body = end - 1;
+    while (body > 1 && (msg[body - 1] == ' ' || msg[body - 1] == '\t' || msg[body - 1] == '\n' || msg[body - 1] == '\r')) body--;
+    out.assign(msg, body);
+    out += msg[body - 1] == '{' ? "\"_red\":" : ",\"_red\":";
+    out += red;
+    out += '}';
+    return true;
+}
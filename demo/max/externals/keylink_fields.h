@@ -0,0 +1,126 @@
+// keylink_fields.h - A received message as a list of named fields
+// Walks a parsed message and hands each leaf to a callback as a path and
+// its values, so an outlet can send them as Max messages such as
+//   key C
+//   tempo 122.5
+//   chord.root G
+//   scale 0 2 3 5 7 9 10
+// without turning the message, or anything else that changes from one
+// message to the next, into a symbol. Paths join object keys with '.';
+// the "state" object of a set-state/keylink-state is walked without its
+// prefix, since that is where the music is. Arrays give one path with all
+// their scalar values (objects and arrays inside arrays are left out).
+// Null fields are left out.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include "thirdparty/json.hpp"
+
+// Strings up to this long may become symbols, and only in fields that
+// hold one of a few names (see keylink_field_is_symbol)
+#define KEYLINK_FIELD_SYMBOL_MAX 64
+
+typedef nlohmann::ordered_json keylink_ojson;
+
+// One value of a field. A string points into the parsed message.
+struct keylink_field_value {
+    enum kind { LONG, FLOAT, STRING } type;
+    long long l;
+    double f;
+    const std::string *s;
+};
+
+namespace keylink_fields_detail {
+
+inline bool scalar(const keylink_ojson& v, keylink_field_value& out) {
+    switch (v.type()) {
+    case keylink_ojson::value_t::number_integer:
+        out.type = keylink_field_value::LONG;
+        out.l = v.get<long long>();
+        return true;
+    case keylink_ojson::value_t::number_unsigned:
+        out.type = keylink_field_value::LONG;
+        out.l = (long long)v.get<unsigned long long>();
+        return true;
+    case keylink_ojson::value_t::number_float:
+        out.type = keylink_field_value::FLOAT;
+        out.f = v.get<double>();
+        return true;
+    case keylink_ojson::value_t::boolean:
+        out.type = keylink_field_value::LONG;
+        out.l = v.get<bool>() ? 1 : 0;
+        return true;
+    case keylink_ojson::value_t::string:
+        out.type = keylink_field_value::STRING;
+        out.s = &v.get_ref<const std::string&>();
+        return true;
+    default:
+        return false;
+    }
+}
+
+// One field and everything under it, at path + '.' + key
+template <typename Emit>
+void field(const std::string& key, const keylink_ojson& v, std::string& path,
+           std::vector<keylink_field_value>& values, Emit& emit) {
+    size_t prefix = path.size();
+    if (prefix) path += '.';
+    path += key;
+    if (v.is_object()) {
+        for (keylink_ojson::const_iterator it = v.begin(); it != v.end(); ++it) {
+            field(it.key(), *it, path, values, emit);
+        }
+    } else {
+        values.clear();
+        keylink_field_value value;
+        if (v.is_array()) {
+            for (size_t i = 0; i < v.size(); i++) {
+                if (scalar(v[i], value)) values.push_back(value);
+            }
+            emit(path, values);
+        } else if (scalar(v, value)) {
+            values.push_back(value);
+            emit(path, values);
+        }
+    }
+    path.resize(prefix);
+}
+
+}  // namespace keylink_fields_detail
+
+// Whether the strings at path name something from a small set (a root,
+// mode, chord type or message type) and so may become symbols. Strings
+// anywhere else (ids, names, free text) can differ in every message, and
+// Max never frees a symbol.
+inline bool keylink_field_is_symbol(const std::string& path) {
+    return path == "key" || path == "mode" || path == "type" || path == "chord" || path.compare(0, 6, "chord.") == 0;
+}
+
+// emit(const std::string& path, const std::vector<keylink_field_value>& values)
+// for each leaf of msg, in message order. path and values are reused
+// between calls. False if msg is not an object.
+template <typename Emit>
+inline bool keylink_each_field(const keylink_ojson& msg, std::string& path, std::vector<keylink_field_value>& values,
+                               Emit emit) {
+    if (!msg.is_object()) return false;
+    keylink_ojson::const_iterator type = msg.find("type");
+    keylink_ojson::const_iterator state = msg.find("state");
+    bool typed = type != msg.end() && type->is_string() && state != msg.end() && state->is_object() &&
+                 (*type == "set-state" || *type == "keylink-state" || *type == "state");
+
+    path.clear();
+    for (keylink_ojson::const_iterator it = msg.begin(); it != msg.end(); ++it) {
+        if (typed && it == state) {
+            for (keylink_ojson::const_iterator f = it->begin(); f != it->end(); ++f) {
+                keylink_fields_detail::field(f.key(), *f, path, values, emit);
+            }
+        } else {
+            keylink_fields_detail::field(it.key(), *it, path, values, emit);
+        }
+    }
+    return true;
+}
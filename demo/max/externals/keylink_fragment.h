@@ -0,0 +1,185 @@
+// keylink_fragment.h - Splitting large UDP messages into MTU-sized datagrams
+// A message (any encoding) longer than KEYLINK_UDP_MTU_PAYLOAD goes out as
+// numbered fragments, each a datagram that fits an Ethernet frame, so the
+// IP layer never fragments and no receive buffer has to hold more than one
+// MTU. Receivers tell fragments apart by the first two bytes (0xCB 'F',
+// not valid UTF-8 and not a state packet) and rebuild the message in a
+// bounded table; a message with a fragment missing is dropped after
+// KEYLINK_REASSEMBLY_TIMEOUT_MS.
+//
+// Layout, little-endian (see docs/protocol.md, Fragmentation):
+//   0  u8  magic 0xCB          12 u32 message id (per sender)
+//   1  u8  magic 'F'           16 u16 fragment index
+//   2  u8  version             18 u16 fragment count
+//   3  u8  reserved (0)        20 u32 offset of this payload in the message
+//   4  u64 source (_src)       24 u32 message length
+//   28 payload
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define KEYLINK_FRAGMENT_MAGIC0 0xCB
+#define KEYLINK_FRAGMENT_MAGIC1 'F'
+#define KEYLINK_FRAGMENT_VERSION 1
+#define KEYLINK_FRAGMENT_HEADER 28
+
+// Largest datagram sent: 1500-byte Ethernet MTU less IPv4/UDP headers and
+// room for tunnels/VLAN tags
+#define KEYLINK_UDP_MTU_PAYLOAD 1400
+#define KEYLINK_FRAGMENT_PAYLOAD (KEYLINK_UDP_MTU_PAYLOAD - KEYLINK_FRAGMENT_HEADER)
+// Largest message sent or rebuilt over UDP
+#define KEYLINK_FRAGMENT_MAX_MESSAGE (1024 * 1024)
+// Reassembly table: messages in progress, bytes held, and how long a message may take
+#define KEYLINK_REASSEMBLY_SLOTS 32
+#define KEYLINK_REASSEMBLY_MAX_BYTES (4 * 1024 * 1024)
+#define KEYLINK_REASSEMBLY_TIMEOUT_MS 2000
+
+inline bool keylink_is_fragment(const char *data, size_t len) {
+    return len >= KEYLINK_FRAGMENT_HEADER && (uint8_t)data[0] == KEYLINK_FRAGMENT_MAGIC0 &&
+           data[1] == KEYLINK_FRAGMENT_MAGIC1;
+}
+
+inline size_t keylink_fragment_count(size_t len) {
+    return len <= KEYLINK_UDP_MTU_PAYLOAD ? 1 : (len + KEYLINK_FRAGMENT_PAYLOAD - 1) / KEYLINK_FRAGMENT_PAYLOAD;
+}
+
+// Hand msg to sink(data, len) as fragments (msg must be longer than
+// KEYLINK_UDP_MTU_PAYLOAD and at most KEYLINK_FRAGMENT_MAX_MESSAGE).
+// scratch is reused for each datagram.
+template <typename Sink>
+inline void keylink_fragment_message(uint64_t source, uint32_t id, const char *msg, size_t len, std::string& scratch,
+                                     Sink sink) {
+    size_t count = keylink_fragment_count(len);
+    scratch.resize(KEYLINK_UDP_MTU_PAYLOAD);
+    uint8_t *h = (uint8_t *)&scratch[0];
+    h[0] = KEYLINK_FRAGMENT_MAGIC0;
+    h[1] = KEYLINK_FRAGMENT_MAGIC1;
+    h[2] = KEYLINK_FRAGMENT_VERSION;
+    h[3] = 0;
+    for (int i = 0; i < 8; i++) h[4 + i] = (uint8_t)(source >> (8 * i));
+    for (int i = 0; i < 4; i++) h[12 + i] = (uint8_t)(id >> (8 * i));
+    for (int i = 0; i < 2; i++) h[18 + i] = (uint8_t)(count >> (8 * i));
+    for (int i = 0; i < 4; i++) h[24 + i] = (uint8_t)((uint32_t)len >> (8 * i));
+
+    for (size_t index = 0; index < count; index++) {
+        size_t offset = index * KEYLINK_FRAGMENT_PAYLOAD;
+        size_t chunk = len - offset < KEYLINK_FRAGMENT_PAYLOAD ? len - offset : KEYLINK_FRAGMENT_PAYLOAD;
+        for (int i = 0; i < 2; i++) h[16 + i] = (uint8_t)(index >> (8 * i));
+        for (int i = 0; i < 4; i++) h[20 + i] = (uint8_t)((uint32_t)offset >> (8 * i));
+        memcpy(h + KEYLINK_FRAGMENT_HEADER, msg + offset, chunk);
+        sink((const char *)h, KEYLINK_FRAGMENT_HEADER + chunk);
+    }
+}
+
+// Receiver side: collects fragments until a message is whole
+class keylink_reassembler {
+public:
+    keylink_reassembler() : held(0), expired(0), evicted(0) {}
+
+    // One fragment received at now_ms. True when it completes a message,
+    // which is moved into out.
+    bool add(const char *data, size_t len, double now_ms, std::string& out) {
+        if (!keylink_is_fragment(data, len) || (uint8_t)data[2] != KEYLINK_FRAGMENT_VERSION) return false;
+        const uint8_t *h = (const uint8_t *)data;
+        uint64_t source = 0;
+        uint32_t id = 0, offset = 0, total = 0;
+        uint16_t index = 0, count = 0;
+        for (int i = 0; i < 8; i++) source |= (uint64_t)h[4 + i] << (8 * i);
+        for (int i = 0; i < 4; i++) id |= (uint32_t)h[12 + i] << (8 * i);
+        for (int i = 0; i < 2; i++) index |= (uint16_t)(h[16 + i] << (8 * i));
+        for (int i = 0; i < 2; i++) count |= (uint16_t)(h[18 + i] << (8 * i));
+        for (int i = 0; i < 4; i++) offset |= (uint32_t)h[20 + i] << (8 * i);
+        for (int i = 0; i < 4; i++) total |= (uint32_t)h[24 + i] << (8 * i);
+        size_t chunk = len - KEYLINK_FRAGMENT_HEADER;
+        if (count == 0 || index >= count || total > KEYLINK_FRAGMENT_MAX_MESSAGE || (size_t)offset + chunk > total) {
+            return false;
+        }
+
+        expire(now_ms);
+        size_t slot = find(source, id);
+        if (slot == slots.size()) {
+            while (!slots.empty() && (slots.size() >= KEYLINK_REASSEMBLY_SLOTS || held + total > KEYLINK_REASSEMBLY_MAX_BYTES)) {
+                drop(oldest());
+                evicted++;
+            }
+            slots.push_back(partial());
+            partial& p = slots.back();
+            p.source = source;
+            p.id = id;
+            p.count = count;
+            p.got = 0;
+            p.started_ms = now_ms;
+            p.data.resize(total);
+            p.have.assign(count, 0);
+            held += total;
+            slot = slots.size() - 1;
+        }
+
+        partial& p = slots[slot];
+        if (p.count != count || p.data.size() != total || p.have[index]) return false;
+        memcpy(&p.data[offset], data + KEYLINK_FRAGMENT_HEADER, chunk);
+        p.have[index] = 1;
+        if (++p.got < p.count) return false;
+
+        out.swap(p.data);
+        drop(slot);
+        return true;
+    }
+
+    size_t pending() const { return slots.size(); }
+    size_t bytes_held() const { return held; }
+    // Messages given up on: timed out, or pushed out by newer ones
+    size_t expired_count() const { return expired; }
+    size_t evicted_count() const { return evicted; }
+
+private:
+    struct partial {
+        uint64_t source;
+        uint32_t id;
+        uint16_t count, got;
+        double started_ms;
+        std::string data;
+        std::vector<uint8_t> have;
+    };
+
+    std::vector<partial> slots;
+    size_t held;
+    size_t expired, evicted;
+
+    size_t find(uint64_t source, uint32_t id) const {
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].source == source && slots[i].id == id) return i;
+        }
+        return slots.size();
+    }
+
+    size_t oldest() const {
+        size_t o = 0;
+        for (size_t i = 1; i < slots.size(); i++) {
+            if (slots[i].started_ms < slots[o].started_ms) o = i;
+        }
+        return o;
+    }
+
+    void drop(size_t i) {
+        held -= slots[i].data.size();
+        if (i != slots.size() - 1) std::swap(slots[i], slots.back());
+        slots.pop_back();
+    }
+
+    void expire(double now_ms) {
+        for (size_t i = slots.size(); i-- > 0;) {
+            if (now_ms - slots[i].started_ms > KEYLINK_REASSEMBLY_TIMEOUT_MS) {
+                drop(i);
+                expired++;
+            }
+        }
+    }
+};
@@ -13,12 +13,16 @@
 #include "thirdparty/json.hpp"
 #include <memory>
 #include <chrono>
+#include "keylink_output.h"
+#include "keylink_writer.h"
 
 // Struct for the Max object
 typedef struct _keylink_offline {
     t_object ob;
     void *outlet;
     std::atomic<bool> running;
+    std::unique_ptr<keylink_output> output;
+    std::unique_ptr<keylink_writer> writer;     // Reused for every message built here
     
     // Message tracking to prevent loops
     std::string last_sent_msg;
@@ -35,8 +39,10 @@ void keylink_offline_dict(t_keylink_offline *x, t_symbol *s);
 void keylink_offline_symbol(t_keylink_offline *x, t_symbol *s);
 void keylink_offline_start(t_keylink_offline *x);
 void keylink_offline_stop(t_keylink_offline *x);
-void keylink_offline_send_message(t_keylink_offline *x, const std::string& msg);
-bool keylink_offline_is_duplicate_message(t_keylink_offline *x, const std::string& msg);
+void keylink_offline_output(t_keylink_offline *x, t_symbol *s);
+void keylink_offline_send_message(t_keylink_offline *x, const char *msg, size_t len);
+bool keylink_offline_is_duplicate_message(t_keylink_offline *x, const char *msg, size_t len);
+long long keylink_offline_now_ms();
 
 // Class pointer
 static t_class *keylink_offline_class = NULL;
@@ -49,6 +55,7 @@ extern "C" void ext_main(void *r) {
     class_addmethod(c, (method)keylink_offline_symbol, "symbol", A_SYM, 0);
     class_addmethod(c, (method)keylink_offline_start, "start", 0);
     class_addmethod(c, (method)keylink_offline_stop, "stop", 0);
+    class_addmethod(c, (method)keylink_offline_output, "output", A_SYM, 0);
     class_addmethod(c, (method)keylink_offline_assist, "assist", A_CANT, 0);
     class_register(CLASS_BOX, c);
     keylink_offline_class = c;
@@ -59,6 +66,8 @@ void *keylink_offline_new(t_symbol *s, long argc, t_atom *argv) {
     if (x) {
         x->outlet = outlet_new((t_object *)x, NULL);
         x->running = false;
+        x->output.reset(new keylink_output());
+        x->writer.reset(new keylink_writer());
         x->last_sent_msg = "";
         x->last_sent_time = std::chrono::steady_clock::now();
         
@@ -69,46 +78,58 @@ void *keylink_offline_new(t_symbol *s, long argc, t_atom *argv) {
 
 void keylink_offline_free(t_keylink_offline *x) {
     x->running = false;
+    x->output.reset();
+    x->writer.reset();
 }
 
 void keylink_offline_assist(t_keylink_offline *x, void *b, long m, long a, char *s) {
     if (m == ASSIST_INLET) {
-        sprintf(s, "Input (dict, symbol, bang, start, stop)");
+        sprintf(s, "Input (dict, symbol, bang, start, stop, output)");
     } else {
-        sprintf(s, "Output (JSON string)");
+        sprintf(s, "Output (JSON string, dictionary or fields)");
     }
 }
 
+long long keylink_offline_now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Messages are written into x->writer (keylink_writer.h): no DOM and no
+// allocation per send
+
 void keylink_offline_bang(t_keylink_offline *x) {
     // Send a ping message
-    nlohmann::json ping = {
-        {"type", "ping"},
-        {"source", "max_offline"},
-        {"timestamp", std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count()}
-    };
-    keylink_offline_send_message(x, ping.dump());
+    keylink_writer& w = *x->writer;
+    w.clear();
+    w.literal("{\"type\":\"ping\",\"source\":\"max_offline\",\"timestamp\":");
+    w.integer(keylink_offline_now_ms());
+    w.literal("}");
+    keylink_offline_send_message(x, w.data(), w.size());
 }
 
 void keylink_offline_dict(t_keylink_offline *x, t_symbol *s) {
-    // Convert dict to JSON and send
-    nlohmann::json msg = {
-        {"type", "set-state"},
-        {"state", {
-            {"key", "C"},
-            {"mode", "Ionian"},
-            {"tempo", 120}
-        }},
-        {"source", "max_offline"},
-        {"timestamp", std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count()}
-    };
-    keylink_offline_send_message(x, msg.dump());
+    // Send the default state
+    keylink_state state;
+    memset(&state, 0, sizeof(state));
+    state.key = KEYLINK_ROOT_C;
+    state.mode = KEYLINK_MODE_MAJOR;
+    state.tempo = 120;
+    state.has = KEYLINK_STATE_HAS_KEY | KEYLINK_STATE_HAS_MODE | KEYLINK_STATE_HAS_TEMPO;
+
+    keylink_writer& w = *x->writer;
+    w.clear();
+    w.literal("{\"type\":\"set-state\",\"state\":");
+    keylink_write_state(w, state);
+    w.literal(",\"source\":\"max_offline\",\"timestamp\":");
+    w.integer(keylink_offline_now_ms());
+    w.literal("}");
+    keylink_offline_send_message(x, w.data(), w.size());
 }
 
 void keylink_offline_symbol(t_keylink_offline *x, t_symbol *s) {
     // Send the JSON string directly
-    keylink_offline_send_message(x, s->s_name);
+    keylink_offline_send_message(x, s->s_name, strlen(s->s_name));
 }
 
 void keylink_offline_start(t_keylink_offline *x) {
@@ -121,32 +142,40 @@ void keylink_offline_stop(t_keylink_offline *x) {
     object_post((t_object *)x, "KeyLink Offline: Stopped");
 }
 
-bool keylink_offline_is_duplicate_message(t_keylink_offline *x, const std::string& msg) {
+// output json|dict|fields (see keylink_output.h)
+void keylink_offline_output(t_keylink_offline *x, t_symbol *s) {
+    if (!x->output->set_mode(s->s_name)) {
+        object_error((t_object *)x, "KeyLink Offline: output must be json, dict or fields");
+        return;
+    }
+    object_post((t_object *)x, "KeyLink Offline: output as %s", x->output->mode_name());
+}
+
+bool keylink_offline_is_duplicate_message(t_keylink_offline *x, const char *msg, size_t len) {
     auto now = std::chrono::steady_clock::now();
     auto time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - x->last_sent_time).count();
     
     // Check if this is the same message sent recently (within 100ms)
-    if (msg == x->last_sent_msg && time_diff < 100) {
+    if (x->last_sent_msg.size() == len && memcmp(x->last_sent_msg.data(), msg, len) == 0 && time_diff < 100) {
         return true;
     }
     
-    x->last_sent_msg = msg;
+    // Keeps its capacity, so this stops allocating once it has seen the longest message
+    x->last_sent_msg.assign(msg, len);
     x->last_sent_time = now;
     return false;
 }
 
-void keylink_offline_send_message(t_keylink_offline *x, const std::string& msg) {
+void keylink_offline_send_message(t_keylink_offline *x, const char *msg, size_t len) {
     if (!x->running) return;
     
     // Prevent duplicate messages
-    if (keylink_offline_is_duplicate_message(x, msg)) {
+    if (keylink_offline_is_duplicate_message(x, msg, len)) {
         return;
     }
     
     // Output locally (for recursive handling)
-    t_atom a;
-    atom_setsym(&a, gensym(msg.c_str()));
-    outlet_anything(x->outlet, gensym("json"), 1, &a);
+    x->output->send(x->outlet, msg, len);
     
     object_post((t_object *)x, "KeyLink Offline: Sent message locally");
 }
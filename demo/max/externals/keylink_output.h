@@ -0,0 +1,236 @@
+// keylink_output.h - How received messages leave a KeyLink outlet
+//   output json     "json <message>" (default). The whole message becomes a
+//                   symbol, and Max never frees symbols: with a timestamp
+//                   or _seq in every message, the symbol table grows by
+//                   one entry per message for as long as Max runs.
+//   output dict     "dictionary <name>": the message in a dictionary the
+//                   object reuses, for [dict.unpack]/[dict.route]
+//   output fields   one message per field, for [route]: "key C",
+//                   "tempo 122.5", "chord.root G" (see keylink_fields.h)
+// dict and fields make symbols only of keys and, in fields, of the short
+// strings keylink_field_is_symbol names (roots, modes, chord and message
+// types), which repeat. Numbers stay numbers; every string is a Max string
+// in a dict, and other strings are left out of fields. Anything that is
+// not a JSON object still goes out as json.
+// Call from a Max thread; one instance per thread that outputs.
+//
+// keylink_state_outlets sends a state already typed on the network thread
+// (keylink_state.h) from outlets of its own: key, mode, chord and tempo.
+// Every root, mode and chord type is a symbol made once, at load, by
+// keylink_state_symbols_init, so sending does no string building or gensym.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include "ext.h"
+#include "ext_obex.h"
+#include "ext_dictobj.h"
+#include "ext_obstring.h"
+#undef post
+#undef error
+#include <string>
+#include <string.h>
+#include <vector>
+#include "keylink_fields.h"
+#include "keylink_state.h"
+
+enum keylink_output_mode {
+    KEYLINK_OUTPUT_JSON,
+    KEYLINK_OUTPUT_DICT,
+    KEYLINK_OUTPUT_FIELDS
+};
+
+class keylink_output {
+public:
+    keylink_output() : mode(KEYLINK_OUTPUT_JSON), dict(NULL), dict_name(NULL) {}
+
+    ~keylink_output() {
+        if (dict) object_free(dict);
+    }
+
+    // json, dict or fields; false for anything else
+    bool set_mode(const std::string& name) {
+        if (name == "json") {
+            mode = KEYLINK_OUTPUT_JSON;
+        } else if (name == "dict") {
+            mode = KEYLINK_OUTPUT_DICT;
+        } else if (name == "fields") {
+            mode = KEYLINK_OUTPUT_FIELDS;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    const char *mode_name() const {
+        return mode == KEYLINK_OUTPUT_DICT ? "dict" : mode == KEYLINK_OUTPUT_FIELDS ? "fields" : "json";
+    }
+
+    void send(void *outlet, const std::string& text) { send(outlet, text.data(), text.size(), NULL); }
+
+    void send(void *outlet, const char *text, size_t len) { send(outlet, text, len, NULL); }
+
+    // A message that is a symbol already goes out as it is in json mode
+    void send(void *outlet, t_symbol *s) { send(outlet, s->s_name, strlen(s->s_name), s); }
+
+private:
+    keylink_output_mode mode;
+    t_dictionary *dict;
+    t_symbol *dict_name;
+    std::string path;
+    std::vector<keylink_field_value> values;
+    std::vector<t_atom> atoms;
+
+    void send(void *outlet, const char *text, size_t len, t_symbol *s) {
+        if (mode != KEYLINK_OUTPUT_JSON) {
+            keylink_ojson j = keylink_ojson::parse(text, text + len, nullptr, false);
+            if (j.is_object()) {
+                if (mode == KEYLINK_OUTPUT_DICT) {
+                    send_dict(outlet, j);
+                } else {
+                    send_fields(outlet, j);
+                }
+                return;
+            }
+        }
+        t_atom a;
+        atom_setsym(&a, s ? s : gensym(std::string(text, len).c_str()));
+        outlet_anything(outlet, gensym("json"), 1, &a);
+    }
+
+    void send_dict(void *outlet, const keylink_ojson& j) {
+        if (!dict) dict = dictobj_register(dictionary_new(), &dict_name);
+        dictionary_clear(dict);
+        fill(dict, j);
+        t_atom a;
+        atom_setsym(&a, dict_name);
+        outlet_anything(outlet, gensym("dictionary"), 1, &a);
+    }
+
+    void send_fields(void *outlet, const keylink_ojson& j) {
+        keylink_each_field(j, path, values, [this, outlet](const std::string& p, const std::vector<keylink_field_value>& v) {
+            atoms.resize(v.size());
+            size_t n = 0;
+            bool symbols = keylink_field_is_symbol(p);
+            for (size_t i = 0; i < v.size(); i++) {
+                if (v[i].type == keylink_field_value::LONG) {
+                    atom_setlong(&atoms[n++], (t_atom_long)v[i].l);
+                } else if (v[i].type == keylink_field_value::FLOAT) {
+                    atom_setfloat(&atoms[n++], v[i].f);
+                } else if (symbols && v[i].s->size() <= KEYLINK_FIELD_SYMBOL_MAX) {
+                    atom_setsym(&atoms[n++], gensym(v[i].s->c_str()));
+                }
+            }
+            if (n || v.empty()) outlet_anything(outlet, gensym(p.c_str()), (short)n, n ? &atoms[0] : NULL);
+        });
+    }
+
+    // A scalar as an atom; a string becomes a string object, which the
+    // dictionary it goes into then owns. False for null, objects and arrays.
+    static bool atom_from(const keylink_ojson& v, t_atom& a) {
+        keylink_field_value value;
+        if (!keylink_fields_detail::scalar(v, value)) return false;
+        if (value.type == keylink_field_value::LONG) {
+            atom_setlong(&a, (t_atom_long)value.l);
+        } else if (value.type == keylink_field_value::FLOAT) {
+            atom_setfloat(&a, value.f);
+        } else {
+            atom_setobj(&a, (t_object *)string_new(value.s->c_str()));
+        }
+        return true;
+    }
+
+    // Objects become nested dictionaries (which d then owns), arrays atom
+    // lists, strings Max strings; arrays inside arrays and nulls are left out
+    static void fill(t_dictionary *d, const keylink_ojson& obj) {
+        for (keylink_ojson::const_iterator it = obj.begin(); it != obj.end(); ++it) {
+            t_symbol *key = gensym(it.key().c_str());
+            const keylink_ojson& v = *it;
+            t_atom a;
+            if (v.is_object()) {
+                t_dictionary *sub = dictionary_new();
+                fill(sub, v);
+                dictionary_appenddictionary(d, key, (t_object *)sub);
+            } else if (v.is_array()) {
+                std::vector<t_atom> list;
+                list.reserve(v.size());
+                for (size_t i = 0; i < v.size(); i++) {
+                    if (v[i].is_object()) {
+                        t_dictionary *sub = dictionary_new();
+                        fill(sub, v[i]);
+                        atom_setobj(&a, (t_object *)sub);
+                        list.push_back(a);
+                    } else if (atom_from(v[i], a)) {
+                        list.push_back(a);
+                    }
+                }
+                dictionary_appendatoms(d, key, (long)list.size(), list.empty() ? NULL : &list[0]);
+            } else if (v.is_string()) {
+                dictionary_appendstring(d, key, v.get_ref<const std::string&>().c_str());
+            } else if (atom_from(v, a)) {
+                dictionary_appendatom(d, key, &a);
+            }
+        }
+    }
+};
+
+// Made once from ext_main; index for index with the keylink_state tables
+struct keylink_state_symbols {
+    t_symbol *roots[KEYLINK_ROOT_COUNT];
+    t_symbol *modes[KEYLINK_MODE_COUNT];
+    t_symbol *chords[KEYLINK_CHORD_COUNT];
+    t_symbol *symbol;
+};
+
+inline keylink_state_symbols& keylink_state_syms() {
+    static keylink_state_symbols syms;
+    return syms;
+}
+
+inline void keylink_state_symbols_init() {
+    keylink_state_symbols& syms = keylink_state_syms();
+    for (int i = 0; i < KEYLINK_ROOT_COUNT; i++) syms.roots[i] = gensym(keylink_state_roots[i]);
+    for (int i = 0; i < KEYLINK_MODE_COUNT; i++) syms.modes[i] = gensym(keylink_state_modes[i]);
+    for (int i = 0; i < KEYLINK_CHORD_COUNT; i++) syms.chords[i] = gensym(keylink_state_chords[i]);
+    syms.symbol = gensym("symbol");
+}
+
+// Outlets for the fields of a state. Outlets are created right to left, so
+// make this before the object's main outlet to put them on its right.
+// Holds nothing that changes, so any Max thread may send through it.
+class keylink_state_outlets {
+public:
+    explicit keylink_state_outlets(t_object *owner) {
+        tempo = outlet_new(owner, NULL);
+        chord = outlet_new(owner, NULL);
+        mode = outlet_new(owner, NULL);
+        key = outlet_new(owner, NULL);
+    }
+
+    // Right to left, as Max outlets fire: tempo as a float, chord as
+    // "<root> <type>", mode and key as symbols. Fields the state did not
+    // carry are not sent.
+    void send(const keylink_state& s) const {
+        const keylink_state_symbols& syms = keylink_state_syms();
+        t_atom a;
+        if (s.has & KEYLINK_STATE_HAS_TEMPO) outlet_float(tempo, s.tempo);
+        if (s.has & KEYLINK_STATE_HAS_CHORD) {
+            atom_setsym(&a, syms.chords[s.chord_type]);
+            outlet_anything(chord, syms.roots[s.chord_root], 1, &a);
+        }
+        if (s.has & KEYLINK_STATE_HAS_MODE) {
+            atom_setsym(&a, syms.modes[s.mode]);
+            outlet_anything(mode, syms.symbol, 1, &a);
+        }
+        if (s.has & KEYLINK_STATE_HAS_KEY) {
+            atom_setsym(&a, syms.roots[s.key]);
+            outlet_anything(key, syms.symbol, 1, &a);
+        }
+    }
+
+private:
+    void *key;
+    void *mode;
+    void *chord;
+    void *tempo;
+};
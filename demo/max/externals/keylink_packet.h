@@ -0,0 +1,297 @@
+// keylink_packet.h - Fixed-size binary KeyLink state packet
+// A set-state / keylink-state message in 32 bytes instead of 200-400 bytes
+// of JSON. Receivers tell the two apart by the first byte: JSON starts with
+// '{' or whitespace, a packet with KEYLINK_PACKET_MAGIC0 (not valid UTF-8).
+// Only states that survive the round trip exactly are packed; anything
+// else (unknown fields, names outside the tables below) stays JSON.
+//
+// Layout, little-endian (see docs/protocol.md, Binary State Packet):
+//   0  u8  magic 0xCB          20 u8  key       (index into keylink_packet_roots, 0xFF = absent)
+//   1  u8  magic 'L'           21 u8  mode      (keylink_packet_modes)
+//   2  u8  version             22 u8  chord root (keylink_packet_roots)
+//   3  u8  kind                23 u8  chord type (keylink_packet_chords)
+//   4  u64 source (_src)       24 u32 tempo in 1/1000 BPM
+//   12 u64 sequence (_seq)     28 u8  flags
+//                              29 u8  confidence in percent
+//                              30 u16 scale pitch-class mask (bit 0 = C)
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <string>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "thirdparty/json.hpp"
+
+#define KEYLINK_PACKET_MAGIC0 0xCB
+#define KEYLINK_PACKET_MAGIC1 'L'
+#define KEYLINK_PACKET_VERSION 1
+#define KEYLINK_PACKET_SIZE 32
+#define KEYLINK_PACKET_NONE 0xFF
+
+// kind: which message type the state came in
+enum keylink_packet_kind {
+    KEYLINK_PACKET_SET_STATE = 1,
+    KEYLINK_PACKET_KEYLINK_STATE = 2
+};
+
+// flags
+#define KEYLINK_PACKET_HAS_ENABLED 0x01
+#define KEYLINK_PACKET_ENABLED 0x02
+#define KEYLINK_PACKET_HAS_CHORD_ENABLED 0x04
+#define KEYLINK_PACKET_CHORD_ENABLED 0x08
+#define KEYLINK_PACKET_HAS_TEMPO 0x10
+#define KEYLINK_PACKET_HAS_CHORD 0x20
+#define KEYLINK_PACKET_HAS_CONFIDENCE 0x40
+#define KEYLINK_PACKET_HAS_SCALE 0x80
+
+// Name tables are part of the format: append only, never reorder
+static const char *const keylink_packet_roots[] = {
+    "C", "C#", "Db", "D", "D#", "Eb", "E", "F", "F#", "Gb", "G", "G#", "Ab", "A", "A#", "Bb", "B"
+};
+static const char *const keylink_packet_modes[] = {
+    "major", "minor", "ionian", "dorian", "phrygian", "lydian", "mixolydian", "aeolian", "locrian",
+    "harmonic_minor", "melodic_minor", "pentatonic_major", "pentatonic_minor", "blues", "whole_tone", "chromatic",
+    "Major", "Minor", "Ionian", "Dorian", "Phrygian", "Lydian", "Mixolydian", "Aeolian", "Locrian"
+};
+static const char *const keylink_packet_chords[] = {
+    "maj", "min", "dim", "aug", "sus2", "sus4", "7", "maj7", "min7", "m7", "dim7", "m7b5", "none",
+    "6", "min6", "9", "maj9", "min9", "add9"
+};
+
+#define KEYLINK_PACKET_TABLE_SIZE(t) (sizeof(t) / sizeof((t)[0]))
+
+struct keylink_state_packet {
+    uint8_t kind;
+    uint64_t source;
+    uint64_t seq;
+    uint8_t key;
+    uint8_t mode;
+    uint8_t chord_root;
+    uint8_t chord_type;
+    uint32_t tempo_milli;
+    uint8_t flags;
+    uint8_t confidence;
+    uint16_t scale_mask;
+};
+
+inline bool keylink_is_packet(const char *data, size_t len) {
+    return len >= 3 && (uint8_t)data[0] == KEYLINK_PACKET_MAGIC0 && data[1] == KEYLINK_PACKET_MAGIC1;
+}
+
+inline void keylink_packet_encode(const keylink_state_packet& p, uint8_t out[KEYLINK_PACKET_SIZE]) {
+    out[0] = KEYLINK_PACKET_MAGIC0;
+    out[1] = KEYLINK_PACKET_MAGIC1;
+    out[2] = KEYLINK_PACKET_VERSION;
+    out[3] = p.kind;
+    for (int i = 0; i < 8; i++) out[4 + i] = (uint8_t)(p.source >> (8 * i));
+    for (int i = 0; i < 8; i++) out[12 + i] = (uint8_t)(p.seq >> (8 * i));
+    out[20] = p.key;
+    out[21] = p.mode;
+    out[22] = p.chord_root;
+    out[23] = p.chord_type;
+    for (int i = 0; i < 4; i++) out[24 + i] = (uint8_t)(p.tempo_milli >> (8 * i));
+    out[28] = p.flags;
+    out[29] = p.confidence;
+    out[30] = (uint8_t)p.scale_mask;
+    out[31] = (uint8_t)(p.scale_mask >> 8);
+}
+
+// False if data is not a packet this version understands or an index is
+// out of range for its table
+inline bool keylink_packet_decode(const char *data, size_t len, keylink_state_packet& p) {
+    const uint8_t *in = (const uint8_t *)data;
+    if (len != KEYLINK_PACKET_SIZE || !keylink_is_packet(data, len) || in[2] != KEYLINK_PACKET_VERSION) return false;
+    p.kind = in[3];
+    if (p.kind != KEYLINK_PACKET_SET_STATE && p.kind != KEYLINK_PACKET_KEYLINK_STATE) return false;
+    p.source = 0;
+    p.seq = 0;
+    for (int i = 7; i >= 0; i--) p.source = (p.source << 8) | in[4 + i];
+    for (int i = 7; i >= 0; i--) p.seq = (p.seq << 8) | in[12 + i];
+    p.key = in[20];
+    p.mode = in[21];
+    p.chord_root = in[22];
+    p.chord_type = in[23];
+    p.tempo_milli = (uint32_t)in[24] | ((uint32_t)in[25] << 8) | ((uint32_t)in[26] << 16) | ((uint32_t)in[27] << 24);
+    p.flags = in[28];
+    p.confidence = in[29];
+    p.scale_mask = (uint16_t)(in[30] | (in[31] << 8));
+
+    if (p.key != KEYLINK_PACKET_NONE && p.key >= KEYLINK_PACKET_TABLE_SIZE(keylink_packet_roots)) return false;
+    if (p.mode != KEYLINK_PACKET_NONE && p.mode >= KEYLINK_PACKET_TABLE_SIZE(keylink_packet_modes)) return false;
+    if (p.flags & KEYLINK_PACKET_HAS_CHORD) {
+        if (p.chord_root >= KEYLINK_PACKET_TABLE_SIZE(keylink_packet_roots)) return false;
+        if (p.chord_type >= KEYLINK_PACKET_TABLE_SIZE(keylink_packet_chords)) return false;
+    }
+    return p.confidence <= 100 && (p.scale_mask & 0xF000) == 0;
+}
+
+inline int keylink_packet_lookup(const char *const *table, size_t n, const std::string& name) {
+    for (size_t i = 0; i < n; i++) {
+        if (name == table[i]) return (int)i;
+    }
+    return -1;
+}
+
+// Pack {"type":"set-state"|"keylink-state","state":{...}} if every field
+// fits. source/seq are left for the caller.
+inline bool keylink_packet_from_json(const nlohmann::json& msg, keylink_state_packet& p) {
+    if (!msg.is_object()) return false;
+    memset(&p, 0, sizeof(p));
+    p.key = p.mode = p.chord_root = p.chord_type = KEYLINK_PACKET_NONE;
+
+    const nlohmann::json *state = NULL;
+    for (nlohmann::json::const_iterator it = msg.begin(); it != msg.end(); ++it) {
+        if (it.key() == "type" && it.value().is_string()) {
+            const std::string& type = it.value().get_ref<const std::string&>();
+            if (type == "set-state") p.kind = KEYLINK_PACKET_SET_STATE;
+            else if (type == "keylink-state") p.kind = KEYLINK_PACKET_KEYLINK_STATE;
+            else return false;
+        } else if (it.key() == "state" && it.value().is_object()) {
+            state = &it.value();
+        } else {
+            return false;
+        }
+    }
+    if (!p.kind || !state) return false;
+
+    for (nlohmann::json::const_iterator it = state->begin(); it != state->end(); ++it) {
+        const std::string& k = it.key();
+        const nlohmann::json& v = it.value();
+        if ((k == "key" || k == "mode") && v.is_string()) {
+            int i = k == "key"
+                ? keylink_packet_lookup(keylink_packet_roots, KEYLINK_PACKET_TABLE_SIZE(keylink_packet_roots), v.get_ref<const std::string&>())
+                : keylink_packet_lookup(keylink_packet_modes, KEYLINK_PACKET_TABLE_SIZE(keylink_packet_modes), v.get_ref<const std::string&>());
+            if (i < 0) return false;
+            (k == "key" ? p.key : p.mode) = (uint8_t)i;
+        } else if (k == "tempo" && v.is_number()) {
+            double t = v.get<double>();
+            if (!(t >= 0 && t < 4000000.0)) return false;
+            double milli = floor(t * 1000.0 + 0.5);
+            if (fabs(milli / 1000.0 - t) > 1e-9) return false;
+            p.tempo_milli = (uint32_t)milli;
+            p.flags |= KEYLINK_PACKET_HAS_TEMPO;
+        } else if (k == "enabled" && v.is_boolean()) {
+            p.flags |= KEYLINK_PACKET_HAS_ENABLED | (v.get<bool>() ? KEYLINK_PACKET_ENABLED : 0);
+        } else if (k == "chordEnabled" && v.is_boolean()) {
+            p.flags |= KEYLINK_PACKET_HAS_CHORD_ENABLED | (v.get<bool>() ? KEYLINK_PACKET_CHORD_ENABLED : 0);
+        } else if (k == "chord" && v.is_object() && v.size() == 2) {
+            nlohmann::json::const_iterator r = v.find("root");
+            nlohmann::json::const_iterator t = v.find("type");
+            if (r == v.end() || t == v.end() || !r->is_string() || !t->is_string()) return false;
+            int ri = keylink_packet_lookup(keylink_packet_roots, KEYLINK_PACKET_TABLE_SIZE(keylink_packet_roots), r->get_ref<const std::string&>());
+            int ti = keylink_packet_lookup(keylink_packet_chords, KEYLINK_PACKET_TABLE_SIZE(keylink_packet_chords), t->get_ref<const std::string&>());
+            if (ri < 0 || ti < 0) return false;
+            p.chord_root = (uint8_t)ri;
+            p.chord_type = (uint8_t)ti;
+            p.flags |= KEYLINK_PACKET_HAS_CHORD;
+        } else if (k == "confidence" && v.is_number()) {
+            double c = v.get<double>();
+            double pct = floor(c * 100.0 + 0.5);
+            if (!(c >= 0 && c <= 1) || fabs(pct / 100.0 - c) > 1e-9) return false;
+            p.confidence = (uint8_t)pct;
+            p.flags |= KEYLINK_PACKET_HAS_CONFIDENCE;
+        } else if (k == "scale" && v.is_array()) {
+            // Ascending pitch classes only, so the mask decodes to the same array
+            int last = -1;
+            for (size_t i = 0; i < v.size(); i++) {
+                if (!v[i].is_number_integer()) return false;
+                int pc = v[i].get<int>();
+                if (pc <= last || pc > 11) return false;
+                p.scale_mask |= (uint16_t)(1 << pc);
+                last = pc;
+            }
+            p.flags |= KEYLINK_PACKET_HAS_SCALE;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse JSON text and pack it; false if it is not JSON or does not fit
+inline bool keylink_packet_from_text(const char *msg, size_t len, keylink_state_packet& p) {
+    nlohmann::json j = nlohmann::json::parse(msg, msg + len, nullptr, false);
+    return !j.is_discarded() && keylink_packet_from_json(j, p);
+}
+
+// Expand a packet back into the JSON message it was packed from, with its
+// _src/_seq tag in front (docs/protocol.md, Sequencing)
+inline void keylink_packet_to_json(const keylink_state_packet& p, std::string& out) {
+    char buf[128];
+    out.clear();
+    if (p.source) {
+        snprintf(buf, sizeof(buf), "{\"_src\":\"%016llx\",\"_seq\":%llu,",
+                 (unsigned long long)p.source, (unsigned long long)p.seq);
+        out += buf;
+    } else {
+        out += '{';
+    }
+    out += p.kind == KEYLINK_PACKET_SET_STATE ? "\"type\":\"set-state\",\"state\":{" : "\"type\":\"keylink-state\",\"state\":{";
+
+    bool first = true;
+    if (p.key != KEYLINK_PACKET_NONE) {
+        out += "\"key\":\"";
+        out += keylink_packet_roots[p.key];
+        out += '"';
+        first = false;
+    }
+    if (p.mode != KEYLINK_PACKET_NONE) {
+        out += first ? "\"mode\":\"" : ",\"mode\":\"";
+        out += keylink_packet_modes[p.mode];
+        out += '"';
+        first = false;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_TEMPO) {
+        if (p.tempo_milli % 1000) {
+            int n = snprintf(buf, sizeof(buf), "%s\"tempo\":%u.%03u", first ? "" : ",", p.tempo_milli / 1000, p.tempo_milli % 1000);
+            while (buf[n - 1] == '0') n--;
+            out.append(buf, (size_t)n);
+        } else {
+            snprintf(buf, sizeof(buf), "%s\"tempo\":%u", first ? "" : ",", p.tempo_milli / 1000);
+            out += buf;
+        }
+        first = false;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_ENABLED) {
+        out += first ? "\"enabled\":" : ",\"enabled\":";
+        out += (p.flags & KEYLINK_PACKET_ENABLED) ? "true" : "false";
+        first = false;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_CHORD_ENABLED) {
+        out += first ? "\"chordEnabled\":" : ",\"chordEnabled\":";
+        out += (p.flags & KEYLINK_PACKET_CHORD_ENABLED) ? "true" : "false";
+        first = false;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_CHORD) {
+        out += first ? "\"chord\":{\"root\":\"" : ",\"chord\":{\"root\":\"";
+        out += keylink_packet_roots[p.chord_root];
+        out += "\",\"type\":\"";
+        out += keylink_packet_chords[p.chord_type];
+        out += "\"}";
+        first = false;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_CONFIDENCE) {
+        if (p.confidence == 100) snprintf(buf, sizeof(buf), "%s\"confidence\":1", first ? "" : ",");
+        else if (p.confidence % 10 == 0) snprintf(buf, sizeof(buf), "%s\"confidence\":0.%u", first ? "" : ",", p.confidence / 10);
+        else snprintf(buf, sizeof(buf), "%s\"confidence\":0.%02u", first ? "" : ",", p.confidence);
+        out += buf;
+        first = false;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_SCALE) {
+        out += first ? "\"scale\":[" : ",\"scale\":[";
+        bool first_pc = true;
+        for (int pc = 0; pc < 12; pc++) {
+            if (!(p.scale_mask & (1 << pc))) continue;
+            if (!first_pc) out += ',';
+            snprintf(buf, sizeof(buf), "%d", pc);
+            out += buf;
+            first_pc = false;
+        }
+        out += ']';
+    }
+    out += "}}";
+}
@@ -0,0 +1,87 @@
+// keylink_queue.h - Bounded lock-free ring for handing work between threads
+// Multi-producer / single-consumer use: Max's main and scheduler threads push,
+// the asio network thread drains. Based on Dmitry Vyukov's bounded MPMC queue.
+// Slots are preallocated and reused, so a payload assigned into a slot keeps
+// its capacity and steady-state pushes do not touch the allocator.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T>
+class keylink_ring {
+public:
+    // Capacity is rounded up to a power of two
+    explicit keylink_ring(size_t capacity) : enqueue_pos(0), dequeue_pos(0) {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask = cap - 1;
+        cells.reset(new cell[cap]);
+        for (size_t i = 0; i < cap; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Fill a free slot in place with fill(T&). Returns false if the ring is full.
+    template <typename F>
+    bool push(F fill) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(c.data);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Hand the oldest slot to take(T&). Returns false if the ring is empty.
+    template <typename F>
+    bool pop(F take) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells[pos & mask];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    take(c.data);
+                    c.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    // Padding keeps producer and consumer indices on separate cache lines
+    // without needing C++17 over-aligned new
+    std::unique_ptr<cell[]> cells;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> enqueue_pos;
+    char pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> dequeue_pos;
+};
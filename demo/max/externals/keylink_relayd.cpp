@@ -0,0 +1,534 @@
+// keylink_relayd.cpp - Native KeyLink relay daemon
+// Drop-in replacement for relay/relay.js on the hot path: bridges UDP
+// multicast (239.255.0.1:7474) and WebSocket clients (port 20801) with the
+// same URL-path channel semantics, built on the bundled standalone asio.
+// Each message is framed once and the same immutable buffer is queued on
+// every client in the channel; writes are batched per client.
+// (C) Neal Anderson, 2024
+
+#define ASIO_STANDALONE
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <random>
+#include "asio.hpp"
+#include "keylink_ws.h"
+#include "keylink_udp.h"
+#include "keylink_uring.h"
+#include "keylink_packet.h"
+#include "keylink_codec.h"
+#include "keylink_channel.h"
+#include "keylink_fragment.h"
+
+// Default network settings (match relay.js and the Max external). Only the
+// default channel is bridged to UDP, on its group from keylink_channel.h.
+#define KEYLINK_WS_PORT 20801
+#define KEYLINK_DEFAULT_CHANNEL KEYLINK_LAN_CHANNEL
+
+// Limits
+#define KEYLINK_RELAY_MAX_HANDSHAKE 8192
+#define KEYLINK_RELAY_MAX_MESSAGE (16 * 1024 * 1024)
+#define KEYLINK_RELAY_MAX_QUEUE 4096
+#define KEYLINK_RELAY_MAX_BATCH 64
+#define KEYLINK_RELAY_UDP_BUFFER 65536
+#define KEYLINK_RELAY_UDP_MAX_PENDING 4096
+#define KEYLINK_RELAY_URING_BUFFERS 256
+
+using asio::ip::tcp;
+using asio::ip::udp;
+
+typedef std::shared_ptr<const std::string> frame_ptr;
+
+struct relay_server;
+
+// Source id for the relay's own fragments (not a _src: the pieces carry a tagged message)
+static uint64_t relay_random_source() {
+    std::random_device rd;
+    return ((uint64_t)rd() << 32) | rd();
+}
+
+// One connected WebSocket client
+struct relay_client : std::enable_shared_from_this<relay_client> {
+    relay_server *server;
+    tcp::socket socket;
+    std::string channel;
+    bool upgraded;
+    bool closing;
+
+    ws_read_buffer in;
+    ws_message_assembler message;   // Reassembly of fragmented messages
+
+    std::deque<frame_ptr> out_queue;
+    std::vector<asio::const_buffer> out_batch;
+    size_t out_batch_frames;
+    bool writing;
+
+    relay_client(relay_server *s, tcp::socket sock)
+        : server(s), socket(std::move(sock)), upgraded(false), closing(false),
+          message(KEYLINK_RELAY_MAX_MESSAGE), out_batch_frames(0), writing(false) {}
+
+    void start();
+    void read_handshake();
+    bool handle_handshake(const std::string& request);
+    void read_frames();
+    bool handle_frame(const ws_frame& frame);
+    void send(const frame_ptr& frame);
+    void flush();
+    void close();
+};
+
+typedef std::shared_ptr<relay_client> client_ptr;
+
+struct relay_server {
+    asio::io_context& io;
+    tcp::acceptor acceptor;
+    std::unique_ptr<udp::socket> udp_socket;
+    udp::endpoint multicast_endpoint;
+    udp_recv_batch udp_in;          // KEYLINK_UDP_BATCH slots drained per wakeup
+    udp_send_queue udp_out;         // WebSocket -> UDP datagrams, flushed once per loop turn
+    bool udp_flush_posted;
+    bool udp_flush_waiting;
+#if KEYLINK_HAS_IO_URING
+    udp_uring_receiver udp_uring;   // Opt-in (UDP_IO_URING=true) multishot receive
+    std::unique_ptr<asio::posix::stream_descriptor> udp_ring;
+#endif
+    std::map<std::string, std::set<client_ptr> > channels;
+    std::string udp_text;           // MessagePack/CBOR datagram converted for browsers
+    keylink_reassembler udp_reassembly;     // Fragmented UDP messages, whole before they go to browsers
+    std::string udp_whole;
+    uint64_t frag_source;           // Fragments of WebSocket messages sent to UDP
+    uint32_t frag_id;
+    std::string frag_scratch;
+
+    relay_server(asio::io_context& ctx, unsigned short ws_port)
+        : io(ctx), acceptor(ctx), udp_in(KEYLINK_UDP_BATCH, KEYLINK_RELAY_UDP_BUFFER),
+          udp_flush_posted(false), udp_flush_waiting(false), frag_source(relay_random_source()), frag_id(0) {
+        tcp::endpoint ep(tcp::v4(), ws_port);
+        acceptor.open(ep.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.bind(ep);
+        acceptor.listen(asio::socket_base::max_listen_connections);
+        std::printf("KeyLink WS relay listening on ws://0.0.0.0:%u\n", ws_port);
+    }
+
+#if KEYLINK_HAS_IO_URING
+    ~relay_server() {
+        if (udp_ring) udp_ring->release();
+    }
+#endif
+
+    void start_udp(const std::string& group, unsigned short port, bool use_uring) {
+        asio::ip::address multicast_addr = asio::ip::make_address(group);
+        udp::endpoint listen_ep(udp::v4(), port);
+        udp_socket.reset(new udp::socket(io));
+        udp_socket->open(listen_ep.protocol());
+        udp_socket->set_option(udp::socket::reuse_address(true));
+        udp_socket->bind(listen_ep);
+        udp_socket->set_option(asio::ip::multicast::join_group(multicast_addr));
+        udp_socket->set_option(asio::socket_base::broadcast(true));
+        udp_socket->set_option(asio::ip::multicast::hops(128));
+        multicast_endpoint = udp::endpoint(multicast_addr, port);
+        std::printf("KeyLink UDP relay listening on %s:%u\n", group.c_str(), port);
+        if (use_uring && start_uring()) return;
+        udp_do_receive();
+    }
+
+    bool start_uring() {
+#if KEYLINK_HAS_IO_URING
+        std::string error;
+        if (!udp_uring.open(udp_socket->native_handle(), KEYLINK_RELAY_URING_BUFFERS, KEYLINK_RELAY_UDP_BUFFER, error)) {
+            std::printf("io_uring unavailable (%s), using recvmmsg\n", error.c_str());
+            return false;
+        }
+        // The ring fd stays owned by udp_uring
+        udp_ring.reset(new asio::posix::stream_descriptor(io, udp_uring.fd()));
+        std::printf("UDP receive using io_uring multishot recvmsg\n");
+        udp_uring_receive();
+        return true;
+#else
+        std::printf("io_uring is not available on this platform, using batched receive\n");
+        return false;
+#endif
+    }
+
+#if KEYLINK_HAS_IO_URING
+    void udp_uring_receive() {
+        udp_ring->async_wait(asio::posix::stream_descriptor::wait_read, [this](std::error_code ec) {
+            if (ec) return;
+            udp_uring.drain([this](const char *data, size_t len) {
+                forward_udp(data, len);
+            });
+            udp_uring_receive();
+        });
+    }
+#endif
+
+    void accept() {
+        acceptor.async_accept([this](std::error_code ec, tcp::socket sock) {
+            if (!ec) {
+                std::error_code ignored;
+                sock.set_option(tcp::no_delay(true), ignored);
+                std::make_shared<relay_client>(this, std::move(sock))->start();
+            }
+            if (acceptor.is_open()) accept();
+        });
+    }
+
+    // Forward a datagram to the WebSocket clients in the default LAN channel.
+    // Binary state packets must not go out as text frames (browsers reject
+    // non-UTF-8 text); MessagePack/CBOR negotiated between native peers is
+    // converted to JSON text, which every web client reads. Fragments are
+    // held until the message is whole.
+    void forward_udp(const char *data, size_t len) {
+        if (keylink_is_fragment(data, len)) {
+            double now = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            if (!udp_reassembly.add(data, len, now, udp_whole) || keylink_is_fragment(udp_whole.data(), udp_whole.size())) {
+                return;
+            }
+            std::string whole;
+            whole.swap(udp_whole);
+            forward_udp(whole.data(), whole.size());
+            return;
+        }
+        keylink_enc enc = keylink_detect_encoding(data, len);
+        if (enc == KEYLINK_ENC_PACKET) {
+            broadcast(KEYLINK_DEFAULT_CHANNEL, WS_OP_BINARY, data, len, NULL);
+        } else if (enc == KEYLINK_ENC_MSGPACK || enc == KEYLINK_ENC_CBOR) {
+            uint64_t source, seq;
+            if (keylink_decode(enc, data, len, udp_text, source, seq)) {
+                broadcast(KEYLINK_DEFAULT_CHANNEL, WS_OP_TEXT, udp_text.data(), udp_text.size(), NULL);
+            }
+        } else {
+            broadcast(KEYLINK_DEFAULT_CHANNEL, WS_OP_TEXT, data, len, NULL);
+        }
+    }
+
+    // Wait for readiness, then drain the socket with recvmmsg
+    void udp_do_receive() {
+        udp_socket->async_wait(asio::socket_base::wait_read, [this](std::error_code ec) {
+            if (!ec) {
+                int n;
+                while ((n = udp_in.receive(udp_socket->native_handle())) > 0) {
+                    for (int i = 0; i < n; i++) forward_udp(udp_in.data(i), udp_in.size(i));
+                    if ((size_t)n < udp_in.count) break;
+                }
+            }
+            if (ec != asio::error::operation_aborted && udp_socket->is_open()) udp_do_receive();
+        });
+    }
+
+    // Queue a datagram; everything queued during this turn of the event loop
+    // goes out together in sendmmsg calls. Messages over one MTU go as
+    // fragments, all or none of them.
+    void broadcast_udp(const char *data, size_t len) {
+        if (!udp_socket || len > KEYLINK_FRAGMENT_MAX_MESSAGE ||
+            udp_out.pending() + keylink_fragment_count(len) > KEYLINK_RELAY_UDP_MAX_PENDING) {
+            return;
+        }
+        if (len <= KEYLINK_UDP_MTU_PAYLOAD) {
+            udp_out.add(data, len);
+        } else {
+            keylink_fragment_message(frag_source, ++frag_id, data, len, frag_scratch,
+                                     [this](const char *d, size_t n) { udp_out.add(d, n); });
+        }
+        if (!udp_flush_posted && !udp_flush_waiting) {
+            udp_flush_posted = true;
+            asio::post(io, [this]() {
+                udp_flush_posted = false;
+                udp_flush();
+            });
+        }
+    }
+
+    void udp_flush() {
+        if (!udp_socket->is_open() || udp_out.empty()) return;
+        udp_out.flush(udp_socket->native_handle(), multicast_endpoint.data(), (socklen_t)multicast_endpoint.size());
+        if (!udp_out.empty()) {
+            // Socket buffer full: finish when it drains
+            udp_flush_waiting = true;
+            udp_socket->async_wait(asio::socket_base::wait_write, [this](std::error_code ec) {
+                udp_flush_waiting = false;
+                if (!ec) udp_flush();
+            });
+        }
+    }
+
+    // Frame the payload once and queue the shared frame on every client
+    // in the channel except the sender
+    void broadcast(const std::string& channel, uint8_t opcode, const char *data, size_t len, relay_client *sender) {
+        std::map<std::string, std::set<client_ptr> >::iterator it = channels.find(channel);
+        if (it == channels.end()) return;
+
+        std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+        ws_encode_frame(*frame, opcode, data, len);
+        frame_ptr shared = frame;
+
+        for (std::set<client_ptr>::iterator c = it->second.begin(); c != it->second.end(); ++c) {
+            if (c->get() != sender) (*c)->send(shared);
+        }
+    }
+
+    void join(const client_ptr& client) {
+        std::set<client_ptr>& clients = channels[client->channel];
+        clients.insert(client);
+        std::printf("[Relay] New client connected to channel \"%s\". Total clients in channel: %zu\n",
+                    client->channel.c_str(), clients.size());
+    }
+
+    void leave(const client_ptr& client) {
+        std::map<std::string, std::set<client_ptr> >::iterator it = channels.find(client->channel);
+        if (it == channels.end() || !it->second.erase(client)) return;
+        std::printf("[Relay] Client disconnected from channel \"%s\". Total clients in channel: %zu\n",
+                    client->channel.c_str(), it->second.size());
+        if (it->second.empty()) {
+            std::printf("[Relay] Channel \"%s\" is now empty and has been removed.\n", client->channel.c_str());
+            channels.erase(it);
+        }
+    }
+};
+
+void relay_client::start() {
+    read_handshake();
+}
+
+void relay_client::read_handshake() {
+    std::shared_ptr<relay_client> self = shared_from_this();
+    size_t free_len = 0;
+    uint8_t *dst = in.prepare(1024, free_len);
+    socket.async_read_some(asio::buffer(dst, free_len),
+        [self](std::error_code ec, std::size_t n) {
+            if (ec) { self->close(); return; }
+            self->in.commit(n);
+
+            std::string buffered((const char *)self->in.data(), self->in.size());
+            size_t end = buffered.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                if (buffered.size() > KEYLINK_RELAY_MAX_HANDSHAKE) { self->close(); return; }
+                self->read_handshake();
+                return;
+            }
+
+            self->in.consume(end + 4);
+            if (!self->handle_handshake(buffered.substr(0, end + 4))) return;
+            self->read_frames();
+        });
+}
+
+static std::string header_value(const std::string& request, const std::string& name) {
+    std::string lower = request;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    std::string needle = "\r\n" + name + ":";
+    size_t pos = lower.find(needle);
+    if (pos == std::string::npos) return "";
+    pos += needle.size();
+    size_t end = request.find("\r\n", pos);
+    std::string value = request.substr(pos, end - pos);
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t") + 1);
+    return value;
+}
+
+bool relay_client::handle_handshake(const std::string& request) {
+    // Request line: GET <path> HTTP/1.1
+    size_t sp1 = request.find(' ');
+    size_t sp2 = sp1 == std::string::npos ? sp1 : request.find(' ', sp1 + 1);
+    std::string key = header_value(request, "sec-websocket-key");
+
+    if (request.compare(0, 4, "GET ") != 0 || sp2 == std::string::npos || key.empty()) {
+        std::shared_ptr<std::string> resp = std::make_shared<std::string>(
+            "HTTP/1.1 426 Upgrade Required\r\nConnection: close\r\nContent-Length: 16\r\n\r\nUpgrade Required");
+        std::shared_ptr<relay_client> self = shared_from_this();
+        asio::async_write(socket, asio::buffer(*resp), [self, resp](std::error_code, std::size_t) { self->close(); });
+        return false;
+    }
+
+    // Use the URL path as the channel name. Default to LAN channel.
+    std::string path = request.substr(sp1 + 1, sp2 - sp1 - 1);
+    channel = path.size() > 1 ? path.substr(1) : KEYLINK_DEFAULT_CHANNEL;
+
+    std::shared_ptr<std::string> resp = std::make_shared<std::string>(
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + ws_accept_key(key) + "\r\n\r\n");
+    out_queue.push_back(resp);
+    upgraded = true;
+    server->join(shared_from_this());
+    flush();
+    return true;
+}
+
+void relay_client::read_frames() {
+    // Frames may already be buffered behind the handshake
+    size_t want = 4096;
+    while (in.size() > 0) {
+        ws_frame frame;
+        ws_parse_result r = ws_parse_frame(in.data(), in.size(), KEYLINK_RELAY_MAX_MESSAGE, frame);
+        if (r == WS_PARSE_NEED_MORE) {
+            // Size the buffer for the rest of a large frame in one step
+            if (frame.frame_len > in.size() + want) want = frame.frame_len - in.size();
+            break;
+        }
+        if (r == WS_PARSE_ERROR || !handle_frame(frame)) { close(); return; }
+        in.consume(frame.frame_len);
+    }
+    if (closing) return;
+
+    std::shared_ptr<relay_client> self = shared_from_this();
+    size_t free_len = 0;
+    uint8_t *dst = in.prepare(want, free_len);
+    socket.async_read_some(asio::buffer(dst, free_len),
+        [self](std::error_code ec, std::size_t n) {
+            if (ec) { self->close(); return; }
+            self->in.commit(n);
+            self->read_frames();
+        });
+}
+
+bool relay_client::handle_frame(const ws_frame& frame) {
+    const char *payload = (const char *)frame.payload;
+
+    switch (frame.opcode) {
+    case WS_OP_PING: {
+        std::shared_ptr<std::string> pong = std::make_shared<std::string>();
+        ws_encode_frame(*pong, WS_OP_PONG, payload, frame.payload_len);
+        send(pong);
+        return true;
+    }
+    case WS_OP_PONG:
+        return true;
+    case WS_OP_CLOSE: {
+        std::shared_ptr<std::string> reply = std::make_shared<std::string>();
+        ws_encode_frame(*reply, WS_OP_CLOSE, payload, std::min<size_t>(frame.payload_len, 2));
+        send(reply);
+        closing = true;
+        server->leave(shared_from_this());
+        return true;
+    }
+    default:
+        break;
+    }
+
+    // Data frame: forward once a complete message is assembled
+    const char *data = NULL;
+    size_t len = 0;
+    uint8_t opcode = 0;
+    ws_parse_result r = ws_assemble(message, frame, data, len, opcode);
+    if (r == WS_PARSE_ERROR) return false;
+    if (r == WS_PARSE_NEED_MORE) return true;
+
+    // If client is in the LAN channel, also broadcast to UDP
+    if (channel == KEYLINK_DEFAULT_CHANNEL) server->broadcast_udp(data, len);
+
+    // Forward to all other WebSocket clients in the same channel
+    server->broadcast(channel, opcode, data, len, this);
+    return true;
+}
+
+void relay_client::send(const frame_ptr& frame) {
+    if (!socket.is_open()) return;
+    if (out_queue.size() >= KEYLINK_RELAY_MAX_QUEUE) {
+        // Slow consumer: drop it rather than buffer without bound
+        std::printf("[Relay] Client in channel \"%s\" is not keeping up, disconnecting\n", channel.c_str());
+        close();
+        return;
+    }
+    out_queue.push_back(frame);
+    if (!writing) flush();
+}
+
+// Write every queued frame (up to a batch limit) with one gather write
+void relay_client::flush() {
+    if (writing || out_queue.empty() || !socket.is_open()) return;
+
+    out_batch.clear();
+    size_t count = std::min<size_t>(out_queue.size(), KEYLINK_RELAY_MAX_BATCH);
+    for (size_t i = 0; i < count; i++) {
+        out_batch.push_back(asio::buffer(*out_queue[i]));
+    }
+    out_batch_frames = count;
+    writing = true;
+
+    std::shared_ptr<relay_client> self = shared_from_this();
+    asio::async_write(socket, out_batch,
+        [self](std::error_code ec, std::size_t) {
+            self->writing = false;
+            if (ec || !self->socket.is_open()) { self->close(); return; }
+            self->out_queue.erase(self->out_queue.begin(), self->out_queue.begin() + self->out_batch_frames);
+            if (self->out_queue.empty() && self->closing) {
+                std::error_code ignored;
+                self->socket.shutdown(tcp::socket::shutdown_both, ignored);
+                self->socket.close(ignored);
+                return;
+            }
+            self->flush();
+        });
+}
+
+void relay_client::close() {
+    if (upgraded) server->leave(shared_from_this());
+    upgraded = false;
+    std::error_code ignored;
+    socket.close(ignored);
+    // An in-flight gather write still references the queued frames
+    if (!writing) out_queue.clear();
+}
+
+static const char *env_or(const char *name, const char *fallback) {
+    const char *value = std::getenv(name);
+    return (value && *value) ? value : fallback;
+}
+
+int main() {
+    // Configurable settings with environment variable support (same as relay.js)
+    unsigned short udp_port = (unsigned short)std::atoi(env_or("UDP_PORT", "7474"));
+    std::string udp_group = env_or("UDP_MULTICAST_ADDR", KEYLINK_MULTICAST_ADDR);
+    unsigned short ws_port = (unsigned short)std::atoi(env_or("PORT", "20801"));
+    bool enable_udp = std::string(env_or("ENABLE_UDP", "true")) != "false";
+    bool udp_io_uring = std::string(env_or("UDP_IO_URING", "false")) == "true";
+
+    if (std::getenv("SSL_KEY_PATH") || std::getenv("SSL_CERT_PATH")) {
+        std::printf("keylink-relayd does not terminate TLS; serving plain WS (terminate wss:// at the proxy)\n");
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    try {
+        // Single network thread: no locking anywhere on the fan-out path
+        asio::io_context io(1);
+        relay_server server(io, ws_port);
+
+        if (enable_udp) {
+            try {
+                server.start_udp(udp_group, udp_port, udp_io_uring);
+            } catch (const std::exception& e) {
+                std::printf("UDP setup failed: %s\n", e.what());
+            }
+        } else {
+            std::printf("UDP multicast disabled (ENABLE_UDP=false)\n");
+        }
+
+        server.accept();
+
+        asio::signal_set signals(io, SIGINT, SIGTERM);
+        signals.async_wait([&io](std::error_code, int) { io.stop(); });
+
+        io.run();
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "keylink-relayd: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+// --- End of keylink_relayd.cpp ---
@@ -0,0 +1,208 @@
+// keylink_reliable.h - NACK-based recovery of lost states over UDP
+// A sender with "reliable" on keeps the last KEYLINK_RETRANSMIT_RING states
+// it sent, exactly as they went on the wire, and says which state is its
+// newest a moment after it stops sending and every few seconds:
+//   {"type":"state-seq","states":{"9f2c4e01a7b3d658":42}}
+// Receivers only act on sources that have sent such a report. A gap in a
+// source's _seq followed by something other than a state, or a report
+// naming a state newer than the last one received, makes the receiver
+// multicast
+//   {"type":"state-nack","source":"9f2c4e01a7b3d658","seqs":[41,42]}
+// and the sender multicasts those states again, or its report if none of
+// them is a state it still has. A NACK with no answer is repeated every
+// KEYLINK_NACK_RETRY_MS, KEYLINK_NACK_TRIES times. Only states newer than the
+// newest one received are asked for (a later state replaces the lost one),
+// so a loss costs one NACK and one retransmission, and nothing is sent
+// while nothing is lost. A receiver that hears another receiver's NACK
+// waits for the same retransmission instead of sending its own.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// States kept per link for retransmission
+#define KEYLINK_RETRANSMIT_RING 64
+// A state asked for again within this long is not resent (several receivers missed it)
+#define KEYLINK_RETRANSMIT_HOLDOFF_MS 10
+// Quiet time after the last state before the newest one is reported
+#define KEYLINK_STATE_REPORT_MS 20
+// Seqs asked for in one NACK; a NACK is repeated after this long at the earliest
+#define KEYLINK_NACK_MAX_SEQS 32
+#define KEYLINK_NACK_RETRY_MS 100
+#define KEYLINK_NACK_TRIES 3
+// Reliable sources tracked at once; one not reported for this long is forgotten
+#define KEYLINK_RELIABLE_SOURCES 256
+#define KEYLINK_RELIABLE_TIMEOUT_MS 60000
+
+// Sender side: the last states sent, by (source, seq)
+class keylink_retransmit_ring {
+public:
+    keylink_retransmit_ring() : slots(KEYLINK_RETRANSMIT_RING), next(0) {}
+
+    // Copies data into the oldest slot; its buffer is reused, so this does
+    // not allocate once the ring has seen states of this size
+    void put(uint64_t source, uint64_t seq, const char *data, size_t len) {
+        entry& e = slots[next];
+        next = (next + 1) % slots.size();
+        e.source = source;
+        e.seq = seq;
+        e.sent_ms = -KEYLINK_RETRANSMIT_HOLDOFF_MS;
+        e.data.assign(data, len);
+    }
+
+    bool holds(uint64_t source, uint64_t seq) const {
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].source == source && slots[i].seq == seq && !slots[i].data.empty()) return true;
+        }
+        return false;
+    }
+
+    // The state to resend, or NULL if it is gone or was just resent
+    const std::string *resend(uint64_t source, uint64_t seq, double now_ms) {
+        for (size_t i = 0; i < slots.size(); i++) {
+            entry& e = slots[i];
+            if (e.source != source || e.seq != seq || e.data.empty()) continue;
+            if (now_ms - e.sent_ms < KEYLINK_RETRANSMIT_HOLDOFF_MS) return NULL;
+            e.sent_ms = now_ms;
+            return &e.data;
+        }
+        return NULL;
+    }
+
+private:
+    struct entry {
+        uint64_t source, seq;
+        double sent_ms;
+        std::string data;
+
+        entry() : source(0), seq(0), sent_ms(0) {}
+    };
+
+    std::vector<entry> slots;
+    size_t next;
+};
+
+// Receiver side: what has been heard from each reliable source, and which
+// of its states to ask for
+class keylink_nack_tracker {
+public:
+    // A report from source: its newest state is newest. received is the
+    // newest state already had from it (0 if none). Fills nack with newest
+    // if it has not been received.
+    void on_report(uint64_t source, uint64_t newest, uint64_t received, double now_ms, std::vector<uint64_t>& nack) {
+        nack.clear();
+        peer& p = find(source, now_ms);
+        p.reported_ms = now_ms;
+        if (received > p.state_seq) p.state_seq = received;
+        p.tries = 0;
+        if (newest > p.state_seq) ask(p, newest, newest, now_ms, nack);
+    }
+
+    // A message from source arrived. Returns false for a state older than
+    // one already received from a reliable source (a late retransmission),
+    // which should not be output. Fills nack with missing seqs worth asking for.
+    bool on_message(uint64_t source, uint64_t seq, bool state, double now_ms, std::vector<uint64_t>& nack) {
+        nack.clear();
+        std::map<uint64_t, peer>::iterator it = peers.find(source);
+        if (it == peers.end()) return true;
+        peer& p = it->second;
+        if (now_ms - p.reported_ms >= KEYLINK_RELIABLE_TIMEOUT_MS) {
+            peers.erase(it);
+            return true;
+        }
+        if (state && seq < p.state_seq) return false;
+        if (state && p.tries && seq <= p.nacked) p.tries = 0;  // Answered
+
+        // Messages skipped before a non-state may include newer states
+        if (!state && p.highest && seq > p.highest + 1) {
+            uint64_t first = p.highest + 1 > p.state_seq + 1 ? p.highest + 1 : p.state_seq + 1;
+            if (first < seq) ask(p, first, seq - 1, now_ms, nack);
+        }
+        if (seq > p.highest) p.highest = seq;
+        if (state && seq > p.state_seq) p.state_seq = seq;
+        return true;
+    }
+
+    // Another receiver asked source for seqs: its retransmission serves us too
+    void on_nack(uint64_t source, uint64_t last, double now_ms) {
+        std::map<uint64_t, peer>::iterator it = peers.find(source);
+        if (it == peers.end()) return;
+        if (last > it->second.nacked) it->second.nacked = last;
+        it->second.nack_ms = now_ms;
+    }
+
+    // NACKs still unanswered after KEYLINK_NACK_RETRY_MS: ask(source, seqs)
+    // for each. Returns true while any NACK is waiting for an answer.
+    template <typename Ask>
+    bool retry(double now_ms, std::vector<uint64_t>& nack, Ask ask_again) {
+        bool waiting = false;
+        for (std::map<uint64_t, peer>::iterator it = peers.begin(); it != peers.end(); ++it) {
+            peer& p = it->second;
+            if (!p.tries) continue;
+            if (now_ms - p.nack_ms >= KEYLINK_NACK_RETRY_MS) {
+                if (p.tries >= KEYLINK_NACK_TRIES) {
+                    p.tries = 0;
+                    continue;
+                }
+                nack.clear();
+                uint64_t first = p.asked_from > p.state_seq ? p.asked_from : p.state_seq + 1;
+                if (p.nacked >= first + KEYLINK_NACK_MAX_SEQS) first = p.nacked - KEYLINK_NACK_MAX_SEQS + 1;
+                for (uint64_t s = first; s <= p.nacked; s++) nack.push_back(s);
+                p.tries++;
+                p.nack_ms = now_ms;
+                ask_again(it->first, nack);
+            }
+            waiting = true;
+        }
+        return waiting;
+    }
+
+    size_t sources() const { return peers.size(); }
+
+private:
+    struct peer {
+        uint64_t highest;           // Highest seq heard
+        uint64_t state_seq;         // Newest state received
+        uint64_t asked_from;        // Last NACK: asked_from..nacked, at nack_ms
+        uint64_t nacked;
+        double nack_ms;
+        int tries;                  // Times our last NACK was sent, 0 once answered
+        double reported_ms;
+
+        peer() : highest(0), state_seq(0), asked_from(0), nacked(0), nack_ms(0), tries(0), reported_ms(0) {}
+    };
+
+    std::map<uint64_t, peer> peers;
+
+    peer& find(uint64_t source, double now_ms) {
+        std::map<uint64_t, peer>::iterator it = peers.find(source);
+        if (it != peers.end()) return it->second;
+        if (peers.size() >= KEYLINK_RELIABLE_SOURCES) {
+            std::map<uint64_t, peer>::iterator oldest = peers.begin();
+            for (std::map<uint64_t, peer>::iterator i = peers.begin(); i != peers.end(); ++i) {
+                if (i->second.reported_ms < oldest->second.reported_ms) oldest = i;
+            }
+            peers.erase(oldest);
+        }
+        peer& p = peers[source];
+        p.nack_ms = now_ms - KEYLINK_NACK_RETRY_MS;
+        return p;
+    }
+
+    // The newest KEYLINK_NACK_MAX_SEQS of first..last not asked for recently
+    static void ask(peer& p, uint64_t first, uint64_t last, double now_ms, std::vector<uint64_t>& nack) {
+        if (now_ms - p.nack_ms < KEYLINK_NACK_RETRY_MS && p.nacked >= first) first = p.nacked + 1;
+        if (last >= first + KEYLINK_NACK_MAX_SEQS) first = last - KEYLINK_NACK_MAX_SEQS + 1;
+        for (uint64_t s = first; s <= last; s++) nack.push_back(s);
+        if (nack.empty()) return;
+        if (!p.tries || first < p.asked_from) p.asked_from = first;
+        p.nacked = last;
+        p.nack_ms = now_ms;
+        p.tries = 1;
+    }
+};
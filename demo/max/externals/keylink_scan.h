@@ -0,0 +1,320 @@
+// keylink_scan.h - Read a few fields of a KeyLink message without a DOM
+// A message is a small JSON object and a receiver usually wants three or
+// four of its fields. keylink_scan finds where each top-level field's key
+// and value are in the raw text, 16 bytes at a time: SSE2 or NEON compares
+// pick out quotes, backslashes, brackets, commas and colons, and only
+// those bytes are looked at. Nothing is decoded until asked for:
+//   string         plain strings point into the message, no copy
+//   number         decimals of up to 15 digits, without strtod
+//   boolean, object (scans the nested object the same way),
+//   each_integer   arrays of integers
+// Anything the fast readers do not handle (escaped strings, exponents,
+// other arrays) is for json.hpp, on just that value: parse(field).
+// The scanner checks structure, not full JSON grammar: text json.hpp would
+// reject may scan. A message that does not scan (unbalanced, or more than
+// KEYLINK_SCAN_MAX_FIELDS fields) is the caller's to parse in full.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "thirdparty/json.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KEYLINK_SCAN_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define KEYLINK_SCAN_NEON 1
+#endif
+
+#define KEYLINK_SCAN_MAX_FIELDS 32
+
+typedef nlohmann::ordered_json keylink_ojson;
+
+namespace keylink_scan_detail {
+
+// Bit i set if p[i] is one of " \ { } [ ] , :
+inline uint32_t structural(const char *p) {
+#if defined(KEYLINK_SCAN_SSE2)
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')), _mm_cmpeq_epi8(v, _mm_set1_epi8('}')))),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')), _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')), _mm_cmpeq_epi8(v, _mm_set1_epi8(':')))));
+    return (uint32_t)_mm_movemask_epi8(m);
+#elif defined(KEYLINK_SCAN_NEON)
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t m = vorrq_u8(
+        vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\'))),
+                 vorrq_u8(vceqq_u8(v, vdupq_n_u8('{')), vceqq_u8(v, vdupq_n_u8('}')))),
+        vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('[')), vceqq_u8(v, vdupq_n_u8(']'))),
+                 vorrq_u8(vceqq_u8(v, vdupq_n_u8(',')), vceqq_u8(v, vdupq_n_u8(':')))));
+    // No movemask on NEON: weight each lane by its bit and add across halves
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(m, vld1q_u8(weights));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 16; i++) {
+        switch (p[i]) {
+        case '"': case '\\': case '{': case '}': case '[': case ']': case ',': case ':':
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+inline unsigned lowest_bit(uint32_t mask) {
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctz(mask);
+#else
+    unsigned i = 0;
+    while (!(mask & 1)) mask >>= 1, i++;
+    return i;
+#endif
+}
+
+inline bool space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+}  // namespace keylink_scan_detail
+
+class keylink_scan {
+public:
+    struct field {
+        const char *key;
+        size_t key_len;
+        const char *value;      // First byte of the value, whitespace trimmed
+        size_t value_len;
+    };
+
+    keylink_scan() : count(0) {}
+
+    // Index the top-level fields of the object in msg; false if msg is not
+    // one, is unbalanced, or has too many fields
+    bool scan(const char *msg, size_t len) {
+        using namespace keylink_scan_detail;
+        enum { KEY, COLON, VALUE } expect = KEY;
+        count = 0;
+        size_t i = 0;
+        while (i < len && space(msg[i])) i++;
+        if (i >= len || msg[i] != '{') return false;
+        const size_t open = i;
+
+        int depth = 0;
+        bool in_string = false;
+        size_t skip = 0;            // A byte after a backslash is not structural
+        const char *key = NULL, *value = NULL;
+        size_t key_len = 0;
+        char tail[16];
+
+        for (size_t block = open; block < len; block += 16) {
+            const char *p = msg + block;
+            if (len - block < 16) {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, p, len - block);
+                p = tail;
+            }
+            uint32_t mask = structural(p);
+            while (mask) {
+                size_t at = block + lowest_bit(mask);
+                mask &= mask - 1;
+                if (at < skip) continue;
+                char c = msg[at];
+                if (in_string) {
+                    if (c == '\\') {
+                        skip = at + 2;
+                    } else if (c == '"') {
+                        in_string = false;
+                        if (depth == 1 && expect == KEY) {
+                            key_len = (size_t)(msg + at - key);
+                            expect = COLON;
+                        }
+                    }
+                    continue;
+                }
+                switch (c) {
+                case '"':
+                    in_string = true;
+                    if (depth == 1 && expect == KEY) key = msg + at + 1;
+                    break;
+                case ':':
+                    if (depth == 1 && expect == COLON) {
+                        value = msg + at + 1;
+                        expect = VALUE;
+                    }
+                    break;
+                case '{':
+                case '[':
+                    depth++;
+                    break;
+                case ',':
+                case '}':
+                case ']':
+                    if (depth == 1 && c == ']') return false;
+                    if (depth == 1) {
+                        if (expect == VALUE) {
+                            if (!add(key, key_len, value, msg + at)) return false;
+                        } else if (!(expect == KEY && c == '}' && at == skip_space(msg, open + 1, len))) {
+                            return false;       // A comma or brace where a key or colon belongs
+                        }
+                        expect = KEY;
+                    }
+                    if (c != ',' && --depth == 0) return true;
+                    if (depth < 0) return false;
+                    break;
+                }
+            }
+        }
+        return false;
+    }
+
+    size_t size() const { return count; }
+
+    // True if no key is escaped or repeated, so find() sees what json.hpp
+    // would (it decodes keys, and the last of a repeated key wins)
+    bool plain_keys() const {
+        for (size_t i = 0; i < count; i++) {
+            if (memchr(fields[i].key, '\\', fields[i].key_len)) return false;
+            for (size_t k = 0; k < i; k++) {
+                if (fields[k].key_len == fields[i].key_len && memcmp(fields[k].key, fields[i].key, fields[i].key_len) == 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    const field& operator[](size_t i) const { return fields[i]; }
+
+    const field *find(const char *key) const {
+        size_t n = strlen(key);
+        for (size_t i = 0; i < count; i++) {
+            if (fields[i].key_len == n && memcmp(fields[i].key, key, n) == 0) return &fields[i];
+        }
+        return NULL;
+    }
+
+    // Readers take a field (for walking every field) or a key (the first
+    // field with that name). Each is false if the value is not that kind or
+    // needs json.hpp; see parse.
+
+    // A string without escapes, pointing into the message
+    static bool string(const field& f, const char *& out, size_t& out_len) {
+        if (f.value_len < 2 || f.value[0] != '"' || f.value[f.value_len - 1] != '"') return false;
+        if (memchr(f.value + 1, '\\', f.value_len - 2)) return false;
+        out = f.value + 1;
+        out_len = f.value_len - 2;
+        return true;
+    }
+
+    // Up to 15 significant digits with no exponent are read here, exactly as
+    // strtod would (both halves of the division are exact doubles)
+    static bool number(const field& f, double& out) {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+                                        1e14, 1e15};
+        const char *p = f.value, *end = f.value + f.value_len;
+        bool negative = *p == '-';
+        if (negative) p++;
+        if (p >= end || *p < '0' || *p > '9') return false;
+        uint64_t mantissa = 0;
+        int digits = 0, fraction = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        if (p < end && *p == '.') {
+            const char *start = ++p;
+            for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            fraction = (int)(p - start);
+            if (!fraction) return false;
+        }
+        if (p != end || digits > 15) return false;
+        out = (double)mantissa / powers[fraction];
+        if (negative) out = -out;
+        return true;
+    }
+
+    static bool boolean(const field& f, bool& out) {
+        if (f.value_len == 4 && memcmp(f.value, "true", 4) == 0) out = true;
+        else if (f.value_len == 5 && memcmp(f.value, "false", 5) == 0) out = false;
+        else return false;
+        return true;
+    }
+
+    static bool object(const field& f, keylink_scan& out) {
+        return f.value[0] == '{' && out.scan(f.value, f.value_len);
+    }
+
+    // emit(long long) for each element of an array of integers; false (and
+    // maybe some calls made) if the value is anything else
+    template <typename Emit>
+    static bool each_integer(const field& f, Emit emit) {
+        using namespace keylink_scan_detail;
+        if (f.value[0] != '[') return false;
+        const char *p = f.value + 1, *end = f.value + f.value_len - 1;
+        while (p < end && space(*p)) p++;
+        if (p == end) return true;
+        for (;;) {
+            bool negative = *p == '-';
+            if (negative) p++;
+            if (p >= end || *p < '0' || *p > '9') return false;
+            long long v = 0;
+            for (int digits = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+                if (++digits > 18) return false;
+                v = v * 10 + (*p - '0');
+            }
+            emit(negative ? -v : v);
+            while (p < end && space(*p)) p++;
+            if (p == end) return true;
+            if (*p++ != ',') return false;
+            while (p < end && space(*p)) p++;
+        }
+    }
+
+    // The fallback: one value through json.hpp (discarded if it is not JSON)
+    static keylink_ojson parse(const field& f) {
+        return keylink_ojson::parse(f.value, f.value + f.value_len, nullptr, false);
+    }
+
+    bool string(const char *key, const char *& out, size_t& out_len) const {
+        const field *f = find(key);
+        return f && string(*f, out, out_len);
+    }
+
+    bool number(const char *key, double& out) const {
+        const field *f = find(key);
+        return f && number(*f, out);
+    }
+
+    bool boolean(const char *key, bool& out) const {
+        const field *f = find(key);
+        return f && boolean(*f, out);
+    }
+
+    bool object(const char *key, keylink_scan& out) const {
+        const field *f = find(key);
+        return f && object(*f, out);
+    }
+
+private:
+    field fields[KEYLINK_SCAN_MAX_FIELDS];
+    size_t count;
+
+    static size_t skip_space(const char *msg, size_t i, size_t len) {
+        while (i < len && keylink_scan_detail::space(msg[i])) i++;
+        return i;
+    }
+
+    bool add(const char *key, size_t key_len, const char *value, const char *end) {
+        while (value < end && keylink_scan_detail::space(*value)) value++;
+        while (end > value && keylink_scan_detail::space(end[-1])) end--;
+        if (value == end || count == KEYLINK_SCAN_MAX_FIELDS) return false;
+        field& f = fields[count++];
+        f.key = key;
+        f.key_len = key_len;
+        f.value = value;
+        f.value_len = (size_t)(end - value);
+        return true;
+    }
+};
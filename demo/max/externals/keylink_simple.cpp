@@ -9,12 +9,15 @@
 #undef error
 #include <string>
 #include <iostream>
+#include <memory>
+#include "keylink_output.h"
 
 // Struct for the Max object
 typedef struct _keylink_simple {
     t_object ob;
     void *outlet;
     bool running;
+    std::unique_ptr<keylink_output> output;
     
 } t_keylink_simple;
 
@@ -26,6 +29,7 @@ void keylink_simple_bang(t_keylink_simple *x);
 void keylink_simple_symbol(t_keylink_simple *x, t_symbol *s);
 void keylink_simple_start(t_keylink_simple *x);
 void keylink_simple_stop(t_keylink_simple *x);
+void keylink_simple_output(t_keylink_simple *x, t_symbol *s);
 
 // Class pointer
 static t_class *keylink_simple_class = NULL;
@@ -37,6 +41,7 @@ extern "C" void ext_main(void *r) {
     class_addmethod(c, (method)keylink_simple_symbol, "symbol", A_SYM, 0);
     class_addmethod(c, (method)keylink_simple_start, "start", 0);
     class_addmethod(c, (method)keylink_simple_stop, "stop", 0);
+    class_addmethod(c, (method)keylink_simple_output, "output", A_SYM, 0);
     class_addmethod(c, (method)keylink_simple_assist, "assist", A_CANT, 0);
     class_register(CLASS_BOX, c);
     keylink_simple_class = c;
@@ -47,6 +52,7 @@ void *keylink_simple_new(t_symbol *s, long argc, t_atom *argv) {
     if (x) {
         x->outlet = outlet_new((t_object *)x, NULL);
         x->running = false;
+        x->output.reset(new keylink_output());
         
         object_post((t_object *)x, "KeyLink Simple: Ready for local message handling");
     }
@@ -55,13 +61,14 @@ void *keylink_simple_new(t_symbol *s, long argc, t_atom *argv) {
 
 void keylink_simple_free(t_keylink_simple *x) {
     x->running = false;
+    x->output.reset();
 }
 
 void keylink_simple_assist(t_keylink_simple *x, void *b, long m, long a, char *s) {
     if (m == ASSIST_INLET) {
-        sprintf(s, "Input (symbol, bang, start, stop)");
+        sprintf(s, "Input (symbol, bang, start, stop, output)");
     } else {
-        sprintf(s, "Output (JSON string)");
+        sprintf(s, "Output (JSON string, dictionary or fields)");
     }
 }
 
@@ -70,9 +77,7 @@ void keylink_simple_bang(t_keylink_simple *x) {
     
     // Send a simple ping message
     std::string msg = "{\"type\":\"ping\",\"source\":\"max_simple\"}";
-    t_atom a;
-    atom_setsym(&a, gensym(msg.c_str()));
-    outlet_anything(x->outlet, gensym("json"), 1, &a);
+    x->output->send(x->outlet, msg);
     
     object_post((t_object *)x, "KeyLink Simple: Sent ping message");
 }
@@ -81,9 +86,7 @@ void keylink_simple_symbol(t_keylink_simple *x, t_symbol *s) {
     if (!x->running) return;
     
     // Pass the symbol through
-    t_atom a;
-    atom_setsym(&a, s);
-    outlet_anything(x->outlet, gensym("json"), 1, &a);
+    x->output->send(x->outlet, s);
     
     object_post((t_object *)x, "KeyLink Simple: Sent message: %s", s->s_name);
 }
@@ -98,4 +101,13 @@ void keylink_simple_stop(t_keylink_simple *x) {
     object_post((t_object *)x, "KeyLink Simple: Stopped");
 }
 
+// output json|dict|fields (see keylink_output.h)
+void keylink_simple_output(t_keylink_simple *x, t_symbol *s) {
+    if (!x->output->set_mode(s->s_name)) {
+        object_error((t_object *)x, "KeyLink Simple: output must be json, dict or fields");
+        return;
+    }
+    object_post((t_object *)x, "KeyLink Simple: output as %s", x->output->mode_name());
+}
+
 // --- End of keylink_simple.cpp --- 
\ No newline at end of file
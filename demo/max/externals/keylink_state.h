@@ -0,0 +1,362 @@
+// keylink_state.h - A received state as a small typed struct
+// Each state is parsed once, on the network thread, into a keylink_state
+// that every subscriber shares, so [keylink] can send root, mode, chord and
+// tempo from their own outlets without the patcher parsing JSON again.
+// Names are folded to the canonical spellings of [keylink_aliases] and
+// kept as small enums:
+//   roots        the 12 pitch classes, sharps: Db -> C#, Bb -> A#
+//   modes        major, minor, dorian, ... (Ionian -> major, Aeolian -> minor)
+//   chord types  maj, min, 7, maj7, m7, ... (min7 -> m7, major -> maj)
+// A name outside the tables leaves that field out; the rest of the state
+// still counts. Unknown fields are ignored. JSON text is read with
+// keylink_scan, without building a DOM.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "thirdparty/json.hpp"
+#include "keylink_packet.h"
+#include "keylink_scan.h"
+
+enum keylink_state_root {
+    KEYLINK_ROOT_C, KEYLINK_ROOT_CS, KEYLINK_ROOT_D, KEYLINK_ROOT_DS, KEYLINK_ROOT_E, KEYLINK_ROOT_F,
+    KEYLINK_ROOT_FS, KEYLINK_ROOT_G, KEYLINK_ROOT_GS, KEYLINK_ROOT_A, KEYLINK_ROOT_AS, KEYLINK_ROOT_B,
+    KEYLINK_ROOT_COUNT
+};
+
+enum keylink_state_mode {
+    KEYLINK_MODE_MAJOR, KEYLINK_MODE_MINOR, KEYLINK_MODE_DORIAN, KEYLINK_MODE_PHRYGIAN, KEYLINK_MODE_LYDIAN,
+    KEYLINK_MODE_MIXOLYDIAN, KEYLINK_MODE_LOCRIAN, KEYLINK_MODE_HARMONIC_MINOR, KEYLINK_MODE_MELODIC_MINOR,
+    KEYLINK_MODE_PENTATONIC_MAJOR, KEYLINK_MODE_PENTATONIC_MINOR, KEYLINK_MODE_BLUES, KEYLINK_MODE_WHOLE_TONE,
+    KEYLINK_MODE_CHROMATIC,
+    KEYLINK_MODE_COUNT
+};
+
+enum keylink_state_chord {
+    KEYLINK_CHORD_MAJ, KEYLINK_CHORD_MIN, KEYLINK_CHORD_DIM, KEYLINK_CHORD_AUG, KEYLINK_CHORD_SUS2,
+    KEYLINK_CHORD_SUS4, KEYLINK_CHORD_7, KEYLINK_CHORD_MAJ7, KEYLINK_CHORD_M7, KEYLINK_CHORD_DIM7,
+    KEYLINK_CHORD_M7B5, KEYLINK_CHORD_6, KEYLINK_CHORD_MIN6, KEYLINK_CHORD_9, KEYLINK_CHORD_MAJ9,
+    KEYLINK_CHORD_MIN9, KEYLINK_CHORD_ADD9, KEYLINK_CHORD_NONE,
+    KEYLINK_CHORD_COUNT
+};
+
+// Canonical names, index for index with the enums above
+static const char *const keylink_state_roots[KEYLINK_ROOT_COUNT] = {
+    "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"
+};
+static const char *const keylink_state_modes[KEYLINK_MODE_COUNT] = {
+    "major", "minor", "dorian", "phrygian", "lydian", "mixolydian", "locrian", "harmonic_minor", "melodic_minor",
+    "pentatonic_major", "pentatonic_minor", "blues", "whole_tone", "chromatic"
+};
+static const char *const keylink_state_chords[KEYLINK_CHORD_COUNT] = {
+    "maj", "min", "dim", "aug", "sus2", "sus4", "7", "maj7", "m7", "dim7", "m7b5", "6", "min6", "9", "maj9",
+    "min9", "add9", "none"
+};
+
+// has: which fields the state carried
+#define KEYLINK_STATE_HAS_KEY 0x01
+#define KEYLINK_STATE_HAS_MODE 0x02
+#define KEYLINK_STATE_HAS_CHORD 0x04
+#define KEYLINK_STATE_HAS_TEMPO 0x08
+#define KEYLINK_STATE_HAS_ENABLED 0x10
+#define KEYLINK_STATE_HAS_CHORD_ENABLED 0x20
+#define KEYLINK_STATE_HAS_CONFIDENCE 0x40
+#define KEYLINK_STATE_HAS_SCALE 0x80
+
+struct keylink_state {
+    uint8_t has;
+    uint8_t key;            // keylink_state_root
+    uint8_t mode;           // keylink_state_mode
+    uint8_t chord_root;     // keylink_state_root
+    uint8_t chord_type;     // keylink_state_chord
+    bool enabled;
+    bool chord_enabled;
+    uint16_t scale_mask;    // Pitch classes, bit 0 = C
+    double tempo;
+    double confidence;
+};
+
+namespace keylink_state_detail {
+
+struct alias {
+    const char *name;
+    uint8_t value;
+};
+
+// Other spellings senders use, after the canonical names
+static const alias mode_aliases[] = {
+    {"ionian", KEYLINK_MODE_MAJOR}, {"maj", KEYLINK_MODE_MAJOR}, {"aeolian", KEYLINK_MODE_MINOR},
+    {"min", KEYLINK_MODE_MINOR}, {"natural minor", KEYLINK_MODE_MINOR}, {"harmonic minor", KEYLINK_MODE_HARMONIC_MINOR},
+    {"melodic minor", KEYLINK_MODE_MELODIC_MINOR}, {"major pentatonic", KEYLINK_MODE_PENTATONIC_MAJOR},
+    {"pentatonic major", KEYLINK_MODE_PENTATONIC_MAJOR}, {"minor pentatonic", KEYLINK_MODE_PENTATONIC_MINOR},
+    {"pentatonic minor", KEYLINK_MODE_PENTATONIC_MINOR}, {"whole tone", KEYLINK_MODE_WHOLE_TONE}
+};
+static const alias chord_aliases[] = {
+    {"major", KEYLINK_CHORD_MAJ}, {"M", KEYLINK_CHORD_MAJ}, {"minor", KEYLINK_CHORD_MIN}, {"m", KEYLINK_CHORD_MIN},
+    {"diminished", KEYLINK_CHORD_DIM}, {"augmented", KEYLINK_CHORD_AUG}, {"dom7", KEYLINK_CHORD_7},
+    {"dominant7", KEYLINK_CHORD_7}, {"M7", KEYLINK_CHORD_MAJ7}, {"major7", KEYLINK_CHORD_MAJ7},
+    {"min7", KEYLINK_CHORD_M7}, {"minor7", KEYLINK_CHORD_M7}, {"halfdim", KEYLINK_CHORD_M7B5},
+    {"m6", KEYLINK_CHORD_MIN6}, {"m9", KEYLINK_CHORD_MIN9}
+};
+
+inline bool same(const char *a, size_t n, const char *b) {
+    return strlen(b) == n && memcmp(a, b, n) == 0;
+}
+
+inline bool same_nocase(const char *a, size_t n, const char *b) {
+    if (strlen(b) != n) return false;
+    for (size_t i = 0; i < n; i++) {
+        char c = a[i];
+        if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+        if (c != b[i]) return false;
+    }
+    return true;
+}
+
+}  // namespace keylink_state_detail
+
+// C, c, C#, Db, ... as a keylink_state_root; -1 if it is not a note name
+inline int keylink_state_root_of(const char *name, size_t n) {
+    static const int letters[7] = {KEYLINK_ROOT_A, KEYLINK_ROOT_B, KEYLINK_ROOT_C, KEYLINK_ROOT_D,
+                                   KEYLINK_ROOT_E, KEYLINK_ROOT_F, KEYLINK_ROOT_G};
+    if (n == 0 || n > 2) return -1;
+    char c = name[0];
+    if (c >= 'a' && c <= 'g') c = (char)(c - 'a' + 'A');
+    if (c < 'A' || c > 'G') return -1;
+    int pc = letters[c - 'A'];
+    if (n == 2) {
+        if (name[1] == '#') pc += 1;
+        else if (name[1] == 'b') pc += KEYLINK_ROOT_COUNT - 1;
+        else return -1;
+    }
+    return pc % KEYLINK_ROOT_COUNT;
+}
+
+// Case does not matter for modes; -1 if unknown
+inline int keylink_state_mode_of(const char *name, size_t n) {
+    using namespace keylink_state_detail;
+    for (int i = 0; i < KEYLINK_MODE_COUNT; i++) {
+        if (same_nocase(name, n, keylink_state_modes[i])) return i;
+    }
+    for (size_t i = 0; i < sizeof(mode_aliases) / sizeof(mode_aliases[0]); i++) {
+        if (same_nocase(name, n, mode_aliases[i].name)) return mode_aliases[i].value;
+    }
+    return -1;
+}
+
+// Case matters for chord types (M7 is not m7); -1 if unknown
+inline int keylink_state_chord_of(const char *name, size_t n) {
+    using namespace keylink_state_detail;
+    for (int i = 0; i < KEYLINK_CHORD_COUNT; i++) {
+        if (same(name, n, keylink_state_chords[i])) return i;
+    }
+    for (size_t i = 0; i < sizeof(chord_aliases) / sizeof(chord_aliases[0]); i++) {
+        if (same(name, n, chord_aliases[i].name)) return chord_aliases[i].value;
+    }
+    return -1;
+}
+
+inline int keylink_state_root_of(const std::string& name) { return keylink_state_root_of(name.data(), name.size()); }
+inline int keylink_state_mode_of(const std::string& name) { return keylink_state_mode_of(name.data(), name.size()); }
+inline int keylink_state_chord_of(const std::string& name) { return keylink_state_chord_of(name.data(), name.size()); }
+
+namespace keylink_state_detail {
+
+// One field of the state object, from a DOM
+template <typename Json>
+void json_field(const std::string& k, const Json& v, keylink_state& s) {
+    int i;
+    if (k == "key" && v.is_string()) {
+        if ((i = keylink_state_root_of(v.template get_ref<const std::string&>())) < 0) return;
+        s.key = (uint8_t)i;
+        s.has |= KEYLINK_STATE_HAS_KEY;
+    } else if (k == "mode" && v.is_string()) {
+        if ((i = keylink_state_mode_of(v.template get_ref<const std::string&>())) < 0) return;
+        s.mode = (uint8_t)i;
+        s.has |= KEYLINK_STATE_HAS_MODE;
+    } else if (k == "tempo" && v.is_number()) {
+        s.tempo = v.template get<double>();
+        s.has |= KEYLINK_STATE_HAS_TEMPO;
+    } else if (k == "enabled" && v.is_boolean()) {
+        s.enabled = v.template get<bool>();
+        s.has |= KEYLINK_STATE_HAS_ENABLED;
+    } else if (k == "chordEnabled" && v.is_boolean()) {
+        s.chord_enabled = v.template get<bool>();
+        s.has |= KEYLINK_STATE_HAS_CHORD_ENABLED;
+    } else if (k == "chord" && v.is_object()) {
+        typename Json::const_iterator r = v.find("root");
+        typename Json::const_iterator t = v.find("type");
+        if (r == v.end() || t == v.end() || !r->is_string() || !t->is_string()) return;
+        int ri = keylink_state_root_of(r->template get_ref<const std::string&>());
+        int ti = keylink_state_chord_of(t->template get_ref<const std::string&>());
+        if (ri < 0 || ti < 0) return;
+        s.chord_root = (uint8_t)ri;
+        s.chord_type = (uint8_t)ti;
+        s.has |= KEYLINK_STATE_HAS_CHORD;
+    } else if (k == "confidence" && v.is_number()) {
+        s.confidence = v.template get<double>();
+        s.has |= KEYLINK_STATE_HAS_CONFIDENCE;
+    } else if (k == "scale" && v.is_array()) {
+        uint16_t mask = 0;
+        for (size_t n = 0; n < v.size(); n++) {
+            if (v[n].is_number_integer() && v[n].template get<int>() >= 0 && v[n].template get<int>() < 12) {
+                mask |= (uint16_t)(1 << v[n].template get<int>());
+            }
+        }
+        s.scale_mask = mask;
+        s.has |= KEYLINK_STATE_HAS_SCALE;
+    }
+}
+
+// The same, straight from the text; false if the value needs json.hpp
+inline bool scan_field(const keylink_scan::field& f, keylink_state& s) {
+    const char *p, *t;
+    size_t n, tn;
+    int i;
+    bool b;
+    if (same(f.key, f.key_len, "key")) {
+        if (!keylink_scan::string(f, p, n)) return false;
+        if ((i = keylink_state_root_of(p, n)) < 0) return true;
+        s.key = (uint8_t)i;
+        s.has |= KEYLINK_STATE_HAS_KEY;
+    } else if (same(f.key, f.key_len, "mode")) {
+        if (!keylink_scan::string(f, p, n)) return false;
+        if ((i = keylink_state_mode_of(p, n)) < 0) return true;
+        s.mode = (uint8_t)i;
+        s.has |= KEYLINK_STATE_HAS_MODE;
+    } else if (same(f.key, f.key_len, "tempo")) {
+        if (!keylink_scan::number(f, s.tempo)) return false;
+        s.has |= KEYLINK_STATE_HAS_TEMPO;
+    } else if (same(f.key, f.key_len, "enabled")) {
+        if (!keylink_scan::boolean(f, b)) return false;
+        s.enabled = b;
+        s.has |= KEYLINK_STATE_HAS_ENABLED;
+    } else if (same(f.key, f.key_len, "chordEnabled")) {
+        if (!keylink_scan::boolean(f, b)) return false;
+        s.chord_enabled = b;
+        s.has |= KEYLINK_STATE_HAS_CHORD_ENABLED;
+    } else if (same(f.key, f.key_len, "chord")) {
+        keylink_scan chord;
+        if (!keylink_scan::object(f, chord) || !chord.plain_keys() || !chord.string("root", p, n) ||
+            !chord.string("type", t, tn)) {
+            return false;
+        }
+        int ri = keylink_state_root_of(p, n);
+        int ti = keylink_state_chord_of(t, tn);
+        if (ri < 0 || ti < 0) return true;
+        s.chord_root = (uint8_t)ri;
+        s.chord_type = (uint8_t)ti;
+        s.has |= KEYLINK_STATE_HAS_CHORD;
+    } else if (same(f.key, f.key_len, "confidence")) {
+        if (!keylink_scan::number(f, s.confidence)) return false;
+        s.has |= KEYLINK_STATE_HAS_CONFIDENCE;
+    } else if (same(f.key, f.key_len, "scale")) {
+        uint16_t mask = 0;
+        bool ok = keylink_scan::each_integer(f, [&mask](long long pc) {
+            if (pc >= 0 && pc < 12) mask |= (uint16_t)(1 << pc);
+        });
+        if (!ok) return false;
+        s.scale_mask = mask;
+        s.has |= KEYLINK_STATE_HAS_SCALE;
+    }
+    return true;
+}
+
+}  // namespace keylink_state_detail
+
+// Fill s from {"type":"set-state"|"keylink-state"|"state","state":{...}};
+// false (s cleared) for any other message
+template <typename Json>
+bool keylink_state_from_json(const Json& msg, keylink_state& s) {
+    memset(&s, 0, sizeof(s));
+    if (!msg.is_object()) return false;
+    typename Json::const_iterator type = msg.find("type");
+    typename Json::const_iterator state = msg.find("state");
+    if (type == msg.end() || !type->is_string() || state == msg.end() || !state->is_object()) return false;
+    if (*type != "set-state" && *type != "keylink-state" && *type != "state") return false;
+
+    for (typename Json::const_iterator it = state->begin(); it != state->end(); ++it) {
+        keylink_state_detail::json_field(it.key(), it.value(), s);
+    }
+    return true;
+}
+
+// The same from JSON text, reading only the state fields (keylink_scan.h).
+// A field the scanner cannot read goes through json.hpp on its own; only a
+// message that does not scan, has an escaped type, or has escaped or
+// repeated keys is parsed in full.
+inline bool keylink_state_from_text(const char *msg, size_t len, keylink_state& s) {
+    using namespace keylink_state_detail;
+    keylink_scan top, state;
+    const char *p;
+    size_t n;
+    if (!top.scan(msg, len) || !top.plain_keys() || (top.find("type") && !top.string("type", p, n))) {
+        keylink_ojson j = keylink_ojson::parse(msg, msg + len, nullptr, false);
+        return keylink_state_from_json(j, s);
+    }
+    memset(&s, 0, sizeof(s));
+    if (!top.string("type", p, n) ||
+        (!same(p, n, "set-state") && !same(p, n, "keylink-state") && !same(p, n, "state"))) {
+        return false;
+    }
+    if (!top.object("state", state) || !state.plain_keys()) {
+        const keylink_scan::field *f = top.find("state");
+        if (!f || f->value[0] != '{') return false;
+        keylink_ojson j = keylink_ojson::parse(msg, msg + len, nullptr, false);
+        return keylink_state_from_json(j, s);
+    }
+
+    for (size_t i = 0; i < state.size(); i++) {
+        if (!scan_field(state[i], s)) {
+            json_field(std::string(state[i].key, state[i].key_len), keylink_scan::parse(state[i]), s);
+        }
+    }
+    return true;
+}
+
+// A binary state packet needs no parse: its tables map straight across
+inline void keylink_state_from_packet(const keylink_state_packet& p, keylink_state& s) {
+    memset(&s, 0, sizeof(s));
+    int i;
+    if (p.key != KEYLINK_PACKET_NONE && (i = keylink_state_root_of(keylink_packet_roots[p.key])) >= 0) {
+        s.key = (uint8_t)i;
+        s.has |= KEYLINK_STATE_HAS_KEY;
+    }
+    if (p.mode != KEYLINK_PACKET_NONE && (i = keylink_state_mode_of(keylink_packet_modes[p.mode])) >= 0) {
+        s.mode = (uint8_t)i;
+        s.has |= KEYLINK_STATE_HAS_MODE;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_CHORD) {
+        int ri = keylink_state_root_of(keylink_packet_roots[p.chord_root]);
+        int ti = keylink_state_chord_of(keylink_packet_chords[p.chord_type]);
+        if (ri >= 0 && ti >= 0) {
+            s.chord_root = (uint8_t)ri;
+            s.chord_type = (uint8_t)ti;
+            s.has |= KEYLINK_STATE_HAS_CHORD;
+        }
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_TEMPO) {
+        s.tempo = p.tempo_milli / 1000.0;
+        s.has |= KEYLINK_STATE_HAS_TEMPO;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_ENABLED) {
+        s.enabled = (p.flags & KEYLINK_PACKET_ENABLED) != 0;
+        s.has |= KEYLINK_STATE_HAS_ENABLED;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_CHORD_ENABLED) {
+        s.chord_enabled = (p.flags & KEYLINK_PACKET_CHORD_ENABLED) != 0;
+        s.has |= KEYLINK_STATE_HAS_CHORD_ENABLED;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_CONFIDENCE) {
+        s.confidence = p.confidence / 100.0;
+        s.has |= KEYLINK_STATE_HAS_CONFIDENCE;
+    }
+    if (p.flags & KEYLINK_PACKET_HAS_SCALE) {
+        s.scale_mask = p.scale_mask;
+        s.has |= KEYLINK_STATE_HAS_SCALE;
+    }
+}
@@ -0,0 +1,110 @@
+// keylink_timeline.h - Shared beat/tempo timeline
+// A session timeline maps KeyLink time (keylink_clock.h) to beats: at time
+// "time" the session was at beat "beat", moving at "tempo" bpm. Peers
+// announce it with
+//   {"type":"keylink-timeline","version":3,"owner":"9f2c4e01a7b3d658","changed":1718040000000.5,
+//    "tempo":120,"quantum":4,"beat":1024.25,"time":1718040003000.125}
+// where "time" and "changed" are on the announcing peer's clock. A tempo
+// or quantum change makes a new version anchored where the old timeline
+// was, so the beat count never jumps. Every peer orders timelines the same
+// way (version, then the earlier change, then the lower owner) and keeps
+// the greatest, so the session converges on one grid; a peer that just
+// joined starts at version 0 and takes over any established session.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#define KEYLINK_TIMELINE_DEFAULT_TEMPO 120.0
+#define KEYLINK_TIMELINE_DEFAULT_QUANTUM 4.0
+#define KEYLINK_TIMELINE_MIN_TEMPO 20.0
+#define KEYLINK_TIMELINE_MAX_TEMPO 999.0
+
+struct keylink_timeline {
+    double tempo;       // Beats per minute
+    double quantum;     // Beats per bar/loop that phase is measured in
+    double beat;        // Beat at "time"
+    double time;        // KeyLink ms (local clock once received)
+    uint64_t version;   // Bumped by every change
+    uint64_t owner;     // Source that made this version
+    double changed;     // When it was made, on the owner's clock
+
+    keylink_timeline() : tempo(0), quantum(0), beat(0), time(0), version(0), owner(0), changed(0) {}
+
+    bool valid() const { return tempo > 0; }
+
+    double beat_at(double t) const { return beat + (t - time) * tempo / 60000.0; }
+
+    double time_at(double b) const { return time + (b - beat) * 60000.0 / tempo; }
+
+    // Position within the quantum, in [0, quantum)
+    double phase_at(double t) const {
+        if (quantum <= 0) return 0;
+        double p = fmod(beat_at(t), quantum);
+        return p < 0 ? p + quantum : p;
+    }
+
+    // Re-anchor at t without moving the grid (keeps the numbers sent small)
+    void anchor(double t) {
+        beat = beat_at(t);
+        time = t;
+    }
+
+    // The session order: true if this should replace other
+    bool supersedes(const keylink_timeline& other) const {
+        if (!other.valid()) return valid();
+        if (version != other.version) return version > other.version;
+        if (changed != other.changed) return changed < other.changed;
+        return owner < other.owner;
+    }
+};
+
+inline double keylink_clamp_tempo(double bpm) {
+    return bpm < KEYLINK_TIMELINE_MIN_TEMPO ? KEYLINK_TIMELINE_MIN_TEMPO
+                                            : bpm > KEYLINK_TIMELINE_MAX_TEMPO ? KEYLINK_TIMELINE_MAX_TEMPO : bpm;
+}
+
+// A new version of current (or a fresh session if there is none) with the
+// given tempo/quantum (<= 0 keeps the current value), made at t by owner
+inline keylink_timeline keylink_timeline_change(const keylink_timeline& current, double tempo, double quantum, double t,
+                                                uint64_t owner) {
+    keylink_timeline next = current;
+    if (!next.valid()) {
+        next.tempo = KEYLINK_TIMELINE_DEFAULT_TEMPO;
+        next.quantum = KEYLINK_TIMELINE_DEFAULT_QUANTUM;
+        next.beat = 0;
+        next.time = t;
+        next.version = 0;
+    } else {
+        next.anchor(t);
+        next.version++;
+    }
+    if (tempo > 0) next.tempo = keylink_clamp_tempo(tempo);
+    if (quantum > 0) next.quantum = quantum;
+    next.owner = owner;
+    // Rounded as it is sent (%.3f), so every peer compares the same value
+    next.changed = floor(t * 1000 + 0.5) / 1000;
+    return next;
+}
+
+enum keylink_timeline_verdict {
+    KEYLINK_TIMELINE_TAKE,      // Replace ours with it
+    KEYLINK_TIMELINE_IGNORE,
+    KEYLINK_TIMELINE_ANSWER     // Ours orders after it: announce ours
+};
+
+// What to do with a received timeline (already converted to our clock).
+// estimated: the sender's clock offset was measured; from_owner: the sender
+// is in the owner's process. While provisional (just joined, not announced)
+// any established session is taken. A copy of the same version only
+// refreshes ours when its conversion is better: from the owner, or the
+// first measured one.
+inline keylink_timeline_verdict keylink_timeline_judge(const keylink_timeline& ours, bool ours_estimated, bool provisional,
+                                                       const keylink_timeline& theirs, bool estimated, bool from_owner) {
+    bool same = ours.valid() && theirs.version == ours.version && theirs.owner == ours.owner && theirs.changed == ours.changed;
+    if (same) return estimated && (!ours_estimated || from_owner) ? KEYLINK_TIMELINE_TAKE : KEYLINK_TIMELINE_IGNORE;
+    if (provisional || theirs.supersedes(ours)) return KEYLINK_TIMELINE_TAKE;
+    return KEYLINK_TIMELINE_ANSWER;
+}
@@ -0,0 +1,140 @@
+// keylink_udp.h - Batched UDP datagram I/O on a raw socket descriptor
+// udp_recv_batch drains up to N queued datagrams into a preallocated slab
+// and udp_send_queue flushes queued outbound datagrams to one destination.
+// On Linux each call is a single recvmmsg/sendmmsg; elsewhere it falls back
+// to a non-blocking recvfrom/sendto loop. Callers wait for readiness with
+// asio's socket::async_wait and use these on native_handle().
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Datagrams handled per recvmmsg/sendmmsg call
+#define KEYLINK_UDP_BATCH 32
+
+struct udp_recv_batch {
+    std::vector<char> slab;         // count slots of slot_size bytes
+    std::vector<size_t> lengths;    // Bytes received into each slot
+    size_t slot_size;
+    size_t count;
+#ifdef __linux__
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct iovec> iov;
+#endif
+
+    udp_recv_batch(size_t count, size_t slot_size)
+        : slab(count * slot_size), lengths(count), slot_size(slot_size), count(count) {
+#ifdef __linux__
+        msgs.resize(count);
+        iov.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            iov[i].iov_base = &slab[i * slot_size];
+            iov[i].iov_len = slot_size;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+#endif
+    }
+
+    // Receive whatever is queued without blocking. Returns the number of
+    // datagrams (0 if none are waiting) or -1 with errno set.
+    int receive(int fd) {
+#ifdef __linux__
+        int n = recvmmsg(fd, &msgs[0], (unsigned)count, MSG_DONTWAIT, NULL);
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        for (int i = 0; i < n; i++) lengths[i] = msgs[i].msg_len;
+        return n;
+#else
+        int n = 0;
+        while ((size_t)n < count) {
+            ssize_t r = recvfrom(fd, &slab[n * slot_size], slot_size, MSG_DONTWAIT, NULL, NULL);
+            if (r < 0) {
+                if (n > 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+                return -1;
+            }
+            lengths[n++] = (size_t)r;
+        }
+        return n;
+#endif
+    }
+
+    const char *data(size_t i) const { return &slab[i * slot_size]; }
+    size_t size(size_t i) const { return lengths[i] < slot_size ? lengths[i] : slot_size; }
+};
+
+struct udp_send_queue {
+    std::string bytes;              // Payloads back to back, reused between flushes
+    std::vector<size_t> offsets;
+    std::vector<size_t> lengths;
+    size_t sent;                    // Datagrams already handed to the kernel
+#ifdef __linux__
+    std::vector<struct mmsghdr> msgs;
+    std::vector<struct iovec> iov;
+#endif
+
+    udp_send_queue() : sent(0) {}
+
+    void add(const char *data, size_t len) {
+        offsets.push_back(bytes.size());
+        lengths.push_back(len);
+        bytes.append(data, len);
+    }
+
+    bool empty() const { return sent == lengths.size(); }
+    size_t pending() const { return lengths.size() - sent; }
+
+    // Send as much as the socket accepts without blocking. Returns false on
+    // a hard error (errno set); datagrams that would block stay queued.
+    // A datagram the kernel rejects outright is dropped, as with sendto.
+    bool flush(int fd, const struct sockaddr *dest, socklen_t dest_len) {
+        while (sent < lengths.size()) {
+#ifdef __linux__
+            size_t n = lengths.size() - sent;
+            if (n > KEYLINK_UDP_BATCH) n = KEYLINK_UDP_BATCH;
+            msgs.resize(n);
+            iov.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                iov[i].iov_base = &bytes[offsets[sent + i]];
+                iov[i].iov_len = lengths[sent + i];
+                memset(&msgs[i], 0, sizeof(msgs[i]));
+                msgs[i].msg_hdr.msg_name = (void *)dest;
+                msgs[i].msg_hdr.msg_namelen = dest_len;
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int r = sendmmsg(fd, &msgs[0], (unsigned)n, MSG_DONTWAIT);
+#else
+            ssize_t r = sendto(fd, &bytes[offsets[sent]], lengths[sent], MSG_DONTWAIT, dest, dest_len);
+            if (r >= 0) r = 1;
+#endif
+            if (r < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) return true;
+                if (errno == EINTR) continue;
+                int err = errno;
+                sent++;     // Drop the datagram that failed so the rest can go
+                if (sent == lengths.size()) clear();
+                errno = err;
+                return false;
+            }
+            sent += (size_t)r;
+        }
+        clear();
+        return true;
+    }
+
+    void clear() {
+        bytes.clear();
+        offsets.clear();
+        lengths.clear();
+        sent = 0;
+    }
+};
@@ -0,0 +1,248 @@
+// keylink_uring.h - io_uring multishot UDP receive with a provided buffer ring
+// One IORING_OP_RECVMSG with IORING_RECV_MULTISHOT stays armed on the
+// socket; the kernel picks a buffer from a registered buffer ring for each
+// datagram and posts a completion. Steady-state reception therefore needs
+// no re-arming syscalls and no per-packet allocation: the caller waits for
+// the ring fd to become readable (asio stream_descriptor::async_wait),
+// drains completions and hands the buffers back.
+// Talks to the kernel with raw syscalls, no liburing. Linux 6.0+; on other
+// platforms or older kernels udp_uring_receiver::open() returns false and
+// the caller stays on the udp_recv_batch path.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT)
+#define KEYLINK_HAS_IO_URING 1
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define KEYLINK_HAS_IO_URING 0
+#endif
+
+// Provided buffer group used for the multishot receive
+#define KEYLINK_URING_BUF_GROUP 1
+
+#if KEYLINK_HAS_IO_URING
+
+class udp_uring_receiver {
+public:
+    udp_uring_receiver()
+        : ring_fd(-1), socket_fd(-1), sq_ptr(NULL), sq_len(0), cq_ptr(NULL), cq_len(0),
+          sqes(NULL), sqes_len(0), buf_ring(NULL), buf_ring_len(0), buf_count(0), buf_size(0),
+          armed(false), rearms(0) {
+        memset(&msg, 0, sizeof(msg));
+    }
+
+    ~udp_uring_receiver() { close(); }
+
+    // Set up a ring for sock_fd with buf_count buffers (power of two, at most
+    // 32768) of buf_size bytes each. On failure returns false with a reason
+    // in error and leaves nothing allocated.
+    bool open(int sock_fd, unsigned buffers, size_t buffer_size, std::string& error) {
+        close();
+        socket_fd = sock_fd;
+        buf_count = buffers;
+        buf_size = buffer_size;
+
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = buffers * 2;
+        ring_fd = (int)syscall(__NR_io_uring_setup, 4, &p);
+        if (ring_fd < 0) return fail(error, "io_uring_setup");
+
+        // Map the submission queue, completion queue and SQE array
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single && cq_len > sq_len) sq_len = cq_len;
+        sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) { sq_ptr = NULL; return fail(error, "mmap sq"); }
+        if (single) {
+            cq_ptr = sq_ptr;
+        } else {
+            cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) { cq_ptr = NULL; return fail(error, "mmap cq"); }
+        }
+        sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe *)mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) { sqes = NULL; return fail(error, "mmap sqes"); }
+
+        char *sq = (char *)sq_ptr;
+        char *cq = (char *)cq_ptr;
+        sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+        sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+        sq_array = (uint32_t *)(sq + p.sq_off.array);
+        cq_head = (uint32_t *)(cq + p.cq_off.head);
+        cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+        cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+        // Buffer ring: page-aligned array of io_uring_buf shared with the kernel
+        buf_ring_len = buf_count * sizeof(struct io_uring_buf);
+        buf_ring = (struct io_uring_buf_ring *)mmap(NULL, buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_ring == MAP_FAILED) { buf_ring = NULL; return fail(error, "mmap buffer ring"); }
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+        reg.ring_entries = buf_count;
+        reg.bgid = KEYLINK_URING_BUF_GROUP;
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return fail(error, "register buffer ring");
+        }
+
+        slab.assign(buf_count * buf_size, 0);
+        buf_tail = 0;
+        for (unsigned i = 0; i < buf_count; i++) add_buffer((uint16_t)i);
+        publish_buffers();
+
+        // Only the payload is wanted: no source address, no control data
+        msg.msg_namelen = 0;
+        msg.msg_controllen = 0;
+        if (!arm()) return fail(error, "submit multishot recvmsg");
+        return true;
+    }
+
+    void close() {
+        if (buf_ring) munmap(buf_ring, buf_ring_len);
+        if (sqes) munmap(sqes, sqes_len);
+        if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+        if (sq_ptr) munmap(sq_ptr, sq_len);
+        if (ring_fd >= 0) ::close(ring_fd);
+        buf_ring = NULL;
+        sqes = NULL;
+        cq_ptr = sq_ptr = NULL;
+        ring_fd = -1;
+        armed = false;
+    }
+
+    // Pollable: readable whenever completions are waiting
+    int fd() const { return ring_fd; }
+
+    // Hand every completed datagram to on_datagram(const char *data, size_t len),
+    // recycle the buffers, and re-arm if the kernel ended the multishot
+    // (buffer ring ran dry or the CQ overflowed). Returns datagrams delivered.
+    template <typename F>
+    size_t drain(F on_datagram) {
+        size_t delivered = 0;
+        uint32_t head = *cq_head;
+        uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            for (; head != tail; head++) {
+                const struct io_uring_cqe& cqe = cqes[head & cq_mask];
+                if (!(cqe.flags & IORING_CQE_F_MORE)) armed = false;
+                if (cqe.res < 0 || !(cqe.flags & IORING_CQE_F_BUFFER)) continue;
+
+                uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                const char *buf = &slab[(size_t)bid * buf_size];
+                const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *)buf;
+                size_t offset = sizeof(*out) + out->namelen + out->controllen;
+                size_t len = out->payloadlen;
+                // Truncated datagrams carry the full length; clamp to what fit
+                if (offset + len > (size_t)cqe.res) len = (size_t)cqe.res > offset ? (size_t)cqe.res - offset : 0;
+                on_datagram(buf + offset, len);
+                delivered++;
+                add_buffer(bid);
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            publish_buffers();
+            tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        }
+        if (!armed) {
+            arm();
+            rearms++;
+        }
+        return delivered;
+    }
+
+    // Times the multishot had to be resubmitted (0 in steady state)
+    unsigned long rearm_count() const { return rearms; }
+
+private:
+    int ring_fd;
+    int socket_fd;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_len;
+    unsigned buf_count;
+    size_t buf_size;
+    uint16_t buf_tail;
+    std::vector<char> slab;
+    struct msghdr msg;
+    bool armed;
+    unsigned long rearms;
+
+    bool fail(std::string& error, const char *what) {
+        error = std::string(what) + ": " + strerror(errno);
+        close();
+        return false;
+    }
+
+    // Not buf_ring->bufs: in C++ the uapi __DECLARE_FLEX_ARRAY wrapper has a
+    // one-byte empty member in front of the array, shifting it 8 bytes
+    // away from where the kernel reads it
+    void add_buffer(uint16_t bid) {
+        struct io_uring_buf& b = ((struct io_uring_buf *)buf_ring)[buf_tail & (buf_count - 1)];
+        b.addr = (uint64_t)(uintptr_t)&slab[(size_t)bid * buf_size];
+        b.len = (uint32_t)buf_size;
+        b.bid = bid;
+        buf_tail++;
+    }
+
+    void publish_buffers() {
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    bool arm() {
+        uint32_t tail = *sq_tail;
+        uint32_t index = tail & sq_mask;
+        struct io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_RECVMSG;
+        sqe.fd = socket_fd;
+        sqe.addr = (uint64_t)(uintptr_t)&msg;
+        sqe.len = 1;
+        sqe.ioprio = IORING_RECV_MULTISHOT;
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = KEYLINK_URING_BUF_GROUP;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        int r;
+        do {
+            r = (int)syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0);
+        } while (r < 0 && errno == EINTR);
+        armed = r == 1;
+        return armed;
+    }
+};
+
+#endif
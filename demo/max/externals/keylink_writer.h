@@ -0,0 +1,185 @@
+// keylink_writer.h - JSON for outgoing KeyLink messages without a DOM
+// keylink_writer appends to a fixed buffer it owns: no nlohmann::json, no
+// std::string, no heap. keylink_write_state writes a keylink_state from
+// precomputed key fragments and the canonical name tables, so sending
+// state at control rate costs a few hundred bytes of copying:
+//   keylink_writer w;                       // on the stack, or kept and reused
+//   w.literal("{\"type\":\"set-state\",\"state\":");
+//   keylink_write_state(w, s);
+//   w.literal("}");
+//   send(w.data(), w.size());
+// Integers are written two digits at a time. Other numbers are written
+// with up to six decimals (trailing zeros dropped); that is finer than
+// any tempo or confidence needs. Beyond 1e12 they fall back to snprintf.
+// Anything that would overflow the buffer is dropped and ok() turns false.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "keylink_state.h"
+
+// Room for the largest state plus a type, tag and timestamp
+#define KEYLINK_WRITER_SIZE 512
+
+class keylink_writer {
+public:
+    keylink_writer() : len(0), overflow(false) {}
+
+    void clear() {
+        len = 0;
+        overflow = false;
+    }
+
+    const char *data() const { return buf; }
+    size_t size() const { return len; }
+    bool ok() const { return !overflow; }
+
+    void raw(const char *s, size_t n) {
+        if (n > sizeof(buf) - len) {
+            overflow = true;
+            return;
+        }
+        memcpy(buf + len, s, n);
+        len += n;
+    }
+
+    // A string literal, its length known at compile time
+    template <size_t N>
+    void literal(const char (&s)[N]) { raw(s, N - 1); }
+
+    void string(const char *s) {
+        put('"');
+        raw(s, strlen(s));
+        put('"');
+    }
+
+    void integer(long long v) {
+        static const char pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+        char digits[24];
+        char *p = digits + sizeof(digits);
+        unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+        while (u >= 100) {
+            unsigned i = (unsigned)(u % 100) * 2;
+            u /= 100;
+            *--p = pairs[i + 1];
+            *--p = pairs[i];
+        }
+        if (u >= 10) {
+            *--p = pairs[u * 2 + 1];
+            *--p = pairs[u * 2];
+        } else {
+            *--p = (char)('0' + u);
+        }
+        if (v < 0) *--p = '-';
+        raw(p, (size_t)(digits + sizeof(digits) - p));
+    }
+
+    void number(double v) {
+        if (!isfinite(v)) {
+            literal("null");
+            return;
+        }
+        double a = fabs(v);
+        if (a >= 1e12) {
+            char text[32];
+            int n = snprintf(text, sizeof(text), "%.17g", v);
+            raw(text, (size_t)n);
+            return;
+        }
+        // Six decimals as an integer, then the point put back in
+        unsigned long long scaled = (unsigned long long)llround(a * 1e6);
+        unsigned long long whole = scaled / 1000000, fraction = scaled % 1000000;
+        if (v < 0 && scaled) put('-');
+        integer((long long)whole);
+        if (!fraction) return;
+        char digits[7] = {'.'};
+        int n = 6;
+        while (fraction % 10 == 0) fraction /= 10, n--;
+        for (int i = n; i > 0; i--, fraction /= 10) digits[i] = (char)('0' + fraction % 10);
+        raw(digits, (size_t)n + 1);
+    }
+
+    void boolean(bool v) {
+        if (v) literal("true");
+        else literal("false");
+    }
+
+    // An object key fragment such as "\"tempo\":", after a comma unless first
+    template <size_t N>
+    void key(bool& first, const char (&fragment)[N]) {
+        if (!first) put(',');
+        first = false;
+        raw(fragment, N - 1);
+    }
+
+private:
+    char buf[KEYLINK_WRITER_SIZE];
+    size_t len;
+    bool overflow;
+
+    void put(char c) {
+        if (len == sizeof(buf)) {
+            overflow = true;
+            return;
+        }
+        buf[len++] = c;
+    }
+};
+
+// The state object, {"key":"D","mode":"dorian",...}, with the fields s
+// carries, in the order the web SDK sends them
+inline void keylink_write_state(keylink_writer& w, const keylink_state& s) {
+    bool first = true;
+    w.literal("{");
+    if (s.has & KEYLINK_STATE_HAS_ENABLED) {
+        w.key(first, "\"enabled\":");
+        w.boolean(s.enabled);
+    }
+    if (s.has & KEYLINK_STATE_HAS_KEY) {
+        w.key(first, "\"key\":");
+        w.string(keylink_state_roots[s.key]);
+    }
+    if (s.has & KEYLINK_STATE_HAS_MODE) {
+        w.key(first, "\"mode\":");
+        w.string(keylink_state_modes[s.mode]);
+    }
+    if (s.has & KEYLINK_STATE_HAS_TEMPO) {
+        w.key(first, "\"tempo\":");
+        w.number(s.tempo);
+    }
+    if (s.has & KEYLINK_STATE_HAS_CHORD_ENABLED) {
+        w.key(first, "\"chordEnabled\":");
+        w.boolean(s.chord_enabled);
+    }
+    if (s.has & KEYLINK_STATE_HAS_CHORD) {
+        w.key(first, "\"chord\":{\"root\":");
+        w.string(keylink_state_roots[s.chord_root]);
+        w.literal(",\"type\":");
+        w.string(keylink_state_chords[s.chord_type]);
+        w.literal("}");
+    }
+    if (s.has & KEYLINK_STATE_HAS_CONFIDENCE) {
+        w.key(first, "\"confidence\":");
+        w.number(s.confidence);
+    }
+    if (s.has & KEYLINK_STATE_HAS_SCALE) {
+        w.key(first, "\"scale\":[");
+        bool first_pc = true;
+        for (int pc = 0; pc < 12; pc++) {
+            if (!(s.scale_mask & (1 << pc))) continue;
+            if (!first_pc) w.literal(",");
+            w.integer(pc);
+            first_pc = false;
+        }
+        w.literal("]");
+    }
+    w.literal("}");
+}
@@ -0,0 +1,391 @@
+// keylink_ws.h - Minimal RFC 6455 WebSocket framing helpers for KeyLink
+// Shared by the Max external and keylink-relayd. Header-only, no Max SDK
+// dependency, no heap allocation on the framing paths.
+// (C) Neal Anderson, 2024
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WS_MASK_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WS_MASK_NEON 1
+#endif
+
+// WebSocket opcodes
+enum {
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA
+};
+
+// Largest possible frame header: 2 + 8 (64-bit length) + 4 (mask key)
+#define WS_MAX_HEADER_LEN 14
+
+// --- Handshake helpers ---
+
+// SHA-1 of a short string (only used for Sec-WebSocket-Accept)
+inline void ws_sha1(const std::string& input, uint8_t digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string msg = input;
+    uint64_t bit_len = (uint64_t)input.size() * 8;
+    msg.push_back((char)0x80);
+    while (msg.size() % 64 != 56) msg.push_back(0);
+    for (int i = 7; i >= 0; i--) msg.push_back((char)((bit_len >> (i * 8)) & 0xFF));
+
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *p = (const uint8_t *)msg.data() + chunk + i * 4;
+            w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            uint32_t v = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (v << 1) | (v >> 31);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+            uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d; d = c; c = (b << 30) | (b >> 2); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (uint8_t)(h[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)h[i];
+    }
+}
+
+inline std::string ws_base64(const uint8_t *data, size_t len) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((len + 2) / 3 * 4);
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        out.push_back(table[(v >> 18) & 0x3F]);
+        out.push_back(table[(v >> 12) & 0x3F]);
+        out.push_back(i + 1 < len ? table[(v >> 6) & 0x3F] : '=');
+        out.push_back(i + 2 < len ? table[v & 0x3F] : '=');
+    }
+    return out;
+}
+
+// Sec-WebSocket-Accept value for a client's Sec-WebSocket-Key
+inline std::string ws_accept_key(const std::string& client_key) {
+    uint8_t digest[20];
+    ws_sha1(client_key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", digest);
+    return ws_base64(digest, sizeof(digest));
+}
+
+// --- Frame encoding ---
+
+// Write a frame header into out (at least WS_MAX_HEADER_LEN bytes).
+// Pass a 4-byte mask key for client->server frames, NULL for server frames.
+// Returns the header length.
+inline size_t ws_write_header(uint8_t *out, uint8_t opcode, uint64_t payload_len, const uint8_t *mask) {
+    size_t n = 0;
+    out[n++] = (uint8_t)(0x80 | (opcode & 0x0F)); // FIN + opcode
+    uint8_t mask_bit = mask ? 0x80 : 0x00;
+
+    if (payload_len < 126) {
+        out[n++] = (uint8_t)(mask_bit | payload_len);
+    } else if (payload_len < 65536) {
+        out[n++] = (uint8_t)(mask_bit | 126);
+        out[n++] = (uint8_t)((payload_len >> 8) & 0xFF);
+        out[n++] = (uint8_t)(payload_len & 0xFF);
+    } else {
+        out[n++] = (uint8_t)(mask_bit | 127);
+        for (int i = 7; i >= 0; i--) {
+            out[n++] = (uint8_t)((payload_len >> (i * 8)) & 0xFF);
+        }
+    }
+
+    if (mask) {
+        memcpy(out + n, mask, 4);
+        n += 4;
+    }
+    return n;
+}
+
+// Encode a complete unmasked (server) frame. Used to build a frame once
+// and fan the same bytes out to many clients.
+inline void ws_encode_frame(std::string& out, uint8_t opcode, const char *payload, size_t len) {
+    uint8_t header[WS_MAX_HEADER_LEN];
+    size_t header_len = ws_write_header(header, opcode, len, NULL);
+    out.reserve(header_len + len);
+    out.assign((const char *)header, header_len);
+    out.append(payload, len);
+}
+
+// --- Masking ---
+
+// dst[i] = src[i] ^ mask[i % 4], 16 bytes at a time where SIMD is available.
+// dst may equal src (in-place unmasking).
+inline void ws_mask_copy(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t mask[4]) {
+    size_t i = 0;
+#if defined(WS_MASK_SSE2)
+    __m128i m = _mm_set1_epi32((int)((uint32_t)mask[0] | ((uint32_t)mask[1] << 8) |
+                                     ((uint32_t)mask[2] << 16) | ((uint32_t)mask[3] << 24)));
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, m));
+    }
+#elif defined(WS_MASK_NEON)
+    uint8_t pattern[16];
+    for (int k = 0; k < 16; k++) pattern[k] = mask[k & 3];
+    uint8x16_t m = vld1q_u8(pattern);
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), m));
+    }
+#else
+    uint64_t m;
+    uint8_t pattern[8];
+    for (int k = 0; k < 8; k++) pattern[k] = mask[k & 3];
+    memcpy(&m, pattern, 8);
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, src + i, 8);
+        v ^= m;
+        memcpy(dst + i, &v, 8);
+    }
+#endif
+    // Blocks are multiples of 4, so the tail stays in mask phase
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ mask[i & 3];
+    }
+}
+
+inline void ws_apply_mask(uint8_t *data, size_t len, const uint8_t mask[4]) {
+    ws_mask_copy(data, data, len, mask);
+}
+
+// Client frames need an unpredictable mask key per frame (RFC 6455 5.3).
+// xorshift64* is plenty: the key only defeats proxy cache poisoning.
+inline void ws_next_mask(uint64_t& state, uint8_t mask[4]) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    uint64_t v = state * 0x2545F4914F6CDD1DULL;
+    memcpy(mask, &v, 4);
+}
+
+// Frames queued for one gather write. Headers and (masked) payloads live in
+// two reusable byte arrays; after warm-up adding a frame does not allocate.
+struct ws_frame_batch {
+    struct entry {
+        size_t header_offset;
+        size_t header_len;
+        size_t payload_offset;
+        size_t payload_len;
+    };
+
+    std::vector<uint8_t> headers;
+    std::vector<uint8_t> payloads;
+    std::vector<entry> entries;
+    size_t header_used;
+    size_t payload_used;
+
+    ws_frame_batch() : header_used(0), payload_used(0) {}
+
+    bool empty() const { return entries.empty(); }
+    size_t bytes() const { return header_used + payload_used; }
+
+    void clear() {
+        entries.clear();
+        header_used = 0;
+        payload_used = 0;
+    }
+
+    // Queue one frame; mask is NULL for server frames
+    void add(uint8_t opcode, const char *data, size_t len, const uint8_t *mask) {
+        if (headers.size() < header_used + WS_MAX_HEADER_LEN) headers.resize((header_used + WS_MAX_HEADER_LEN) * 2);
+        if (payloads.size() < payload_used + len) payloads.resize((payload_used + len) * 2);
+
+        entry e;
+        e.header_offset = header_used;
+        e.header_len = ws_write_header(&headers[header_used], opcode, len, mask);
+        e.payload_offset = payload_used;
+        e.payload_len = len;
+        if (mask) {
+            ws_mask_copy(&payloads[payload_used], (const uint8_t *)data, len, mask);
+        } else if (len) {
+            memcpy(&payloads[payload_used], data, len);
+        }
+        header_used += e.header_len;
+        payload_used += len;
+        entries.push_back(e);
+    }
+};
+
+// --- Frame decoding ---
+
+enum ws_parse_result {
+    WS_PARSE_NEED_MORE = 0,
+    WS_PARSE_FRAME = 1,
+    WS_PARSE_ERROR = -1
+};
+
+struct ws_frame {
+    bool fin;
+    uint8_t opcode;
+    uint8_t *payload;       // Points into the caller's buffer (already unmasked)
+    size_t payload_len;
+    size_t frame_len;       // Header + payload bytes (also set on NEED_MORE once known)
+};
+
+// Parse one frame from the front of [data, data + len). The payload is
+// unmasked in place. Returns WS_PARSE_NEED_MORE on a partial frame, so the
+// caller can keep the bytes and retry after the next read; once the header
+// is complete frame.frame_len says how many bytes the whole frame needs.
+inline ws_parse_result ws_parse_frame(uint8_t *data, size_t len, uint64_t max_payload, ws_frame& frame) {
+    frame.frame_len = 0;
+    if (len < 2) return WS_PARSE_NEED_MORE;
+
+    uint8_t b0 = data[0];
+    uint8_t b1 = data[1];
+    if (b0 & 0x70) return WS_PARSE_ERROR; // No extensions negotiated, RSV bits must be 0
+
+    frame.fin = (b0 & 0x80) != 0;
+    frame.opcode = b0 & 0x0F;
+    bool masked = (b1 & 0x80) != 0;
+    uint64_t payload_len = b1 & 0x7F;
+    size_t header_len = 2;
+
+    if (payload_len == 126) {
+        if (len < 4) return WS_PARSE_NEED_MORE;
+        payload_len = ((uint64_t)data[2] << 8) | data[3];
+        header_len = 4;
+    } else if (payload_len == 127) {
+        if (len < 10) return WS_PARSE_NEED_MORE;
+        payload_len = 0;
+        for (int i = 0; i < 8; i++) {
+            payload_len = (payload_len << 8) | data[2 + i];
+        }
+        header_len = 10;
+    }
+
+    // Control frames must be short and unfragmented
+    if ((frame.opcode & 0x08) && (payload_len > 125 || !frame.fin)) return WS_PARSE_ERROR;
+    if (payload_len > max_payload) return WS_PARSE_ERROR;
+
+    const uint8_t *mask = NULL;
+    if (masked) {
+        if (len < header_len + 4) return WS_PARSE_NEED_MORE;
+        mask = data + header_len;
+        header_len += 4;
+    }
+
+    frame.frame_len = header_len + (size_t)payload_len;
+    if (len - header_len < payload_len) return WS_PARSE_NEED_MORE;
+
+    frame.payload = data + header_len;
+    frame.payload_len = (size_t)payload_len;
+    if (mask) ws_apply_mask(frame.payload, frame.payload_len, mask);
+    return WS_PARSE_FRAME;
+}
+
+// Growable receive buffer for one connection. Reads append at the tail,
+// parsed frames are consumed from the head, and leftover partial bytes are
+// moved to the front, so storage only grows when a single frame is larger
+// than anything seen before and is otherwise reused for the connection's life.
+struct ws_read_buffer {
+    std::vector<uint8_t> storage;
+    size_t head;
+    size_t tail;
+
+    explicit ws_read_buffer(size_t initial = 4096) : storage(initial), head(0), tail(0) {}
+
+    uint8_t *data() { return storage.data() + head; }
+    size_t size() const { return tail - head; }
+
+    // Make room for at least min_free bytes and return the writable region
+    uint8_t *prepare(size_t min_free, size_t& free_len) {
+        if (head > 0) {
+            if (tail > head) memmove(storage.data(), storage.data() + head, tail - head);
+            tail -= head;
+            head = 0;
+        }
+        if (storage.size() - tail < min_free) {
+            storage.resize(tail + min_free);
+        }
+        free_len = storage.size() - tail;
+        return storage.data() + tail;
+    }
+
+    void commit(size_t n) { tail += n; }
+
+    void consume(size_t n) {
+        head += n;
+        if (head == tail) head = tail = 0;
+    }
+
+    void clear() { head = tail = 0; }
+};
+
+// Reassembles fragmented data messages. Unfragmented messages are handed
+// back pointing straight into the read buffer; fragments are appended to a
+// string that keeps its capacity between messages. Control frames must be
+// handled by the caller before calling ws_assemble.
+struct ws_message_assembler {
+    std::string fragments;
+    uint8_t opcode;             // Opcode of the message in progress, 0 if none
+    uint64_t max_message;
+
+    explicit ws_message_assembler(uint64_t max = 16 * 1024 * 1024) : opcode(0), max_message(max) {}
+
+    void reset() {
+        fragments.clear();
+        opcode = 0;
+    }
+};
+
+// Feed one data frame (text, binary or continuation). Returns WS_PARSE_FRAME
+// with data/len/opcode set when the frame completes a message,
+// WS_PARSE_NEED_MORE when it was a non-final fragment, and WS_PARSE_ERROR on
+// a protocol violation.
+inline ws_parse_result ws_assemble(ws_message_assembler& a, const ws_frame& frame,
+                                   const char *& data, size_t& len, uint8_t& opcode) {
+    const char *payload = (const char *)frame.payload;
+
+    if (frame.opcode == WS_OP_TEXT || frame.opcode == WS_OP_BINARY) {
+        if (a.opcode != 0) return WS_PARSE_ERROR; // New message inside a fragmented one
+        if (!frame.fin) {
+            a.opcode = frame.opcode;
+            a.fragments.assign(payload, frame.payload_len);
+            return WS_PARSE_NEED_MORE;
+        }
+        data = payload;
+        len = frame.payload_len;
+        opcode = frame.opcode;
+        return WS_PARSE_FRAME;
+    }
+
+    if (frame.opcode != WS_OP_CONTINUATION || a.opcode == 0) return WS_PARSE_ERROR;
+    if (a.fragments.size() + frame.payload_len > a.max_message) return WS_PARSE_ERROR;
+    a.fragments.append(payload, frame.payload_len);
+    if (!frame.fin) return WS_PARSE_NEED_MORE;
+
+    data = a.fragments.data();
+    len = a.fragments.size();
+    opcode = a.opcode;
+    a.opcode = 0; // Fragments stay valid until the next ws_assemble call
+    return WS_PARSE_FRAME;
+}
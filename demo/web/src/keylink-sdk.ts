@@ -13,12 +13,98 @@ export type KeyLinkState = {
 type Event = 'open' | 'close' | 'error' | 'status' | 'state';
 type Listener = (...args: any[]) => void;
 
+// 64-bit random source ID as 16 hex digits (see docs/protocol.md, Sequencing)
+function newSourceId(): string {
+  const bytes = new Uint8Array(8);
+  if (typeof crypto !== 'undefined' && crypto.getRandomValues) {
+    crypto.getRandomValues(bytes);
+  } else {
+    for (let i = 0; i < bytes.length; i++) bytes[i] = Math.floor(Math.random() * 256);
+  }
+  return Array.from(bytes, b => b.toString(16).padStart(2, '0')).join('');
+}
+
+// Binary state packet (docs/protocol.md, Binary State Packet). The tables
+// must match keylink_packet.h index for index.
+const PACKET_SIZE = 32;
+const PACKET_ROOTS = ['C', 'C#', 'Db', 'D', 'D#', 'Eb', 'E', 'F', 'F#', 'Gb', 'G', 'G#', 'Ab', 'A', 'A#', 'Bb', 'B'];
+const PACKET_MODES = [
+  'major', 'minor', 'ionian', 'dorian', 'phrygian', 'lydian', 'mixolydian', 'aeolian', 'locrian',
+  'harmonic_minor', 'melodic_minor', 'pentatonic_major', 'pentatonic_minor', 'blues', 'whole_tone', 'chromatic',
+  'Major', 'Minor', 'Ionian', 'Dorian', 'Phrygian', 'Lydian', 'Mixolydian', 'Aeolian', 'Locrian',
+];
+const PACKET_CHORDS = [
+  'maj', 'min', 'dim', 'aug', 'sus2', 'sus4', '7', 'maj7', 'min7', 'm7', 'dim7', 'm7b5', 'none',
+  '6', 'min6', '9', 'maj9', 'min9', 'add9',
+];
+
+// Expand a packet to the message it was packed from; null if it is not one
+export function decodeStatePacket(buf: ArrayBuffer): any | null {
+  const b = new Uint8Array(buf);
+  if (b.length !== PACKET_SIZE || b[0] !== 0xcb || b[1] !== 0x4c || b[2] !== 1) return null;
+  if (b[3] !== 1 && b[3] !== 2) return null;
+  const flags = b[28];
+  if (b[20] !== 0xff && b[20] >= PACKET_ROOTS.length) return null;
+  if (b[21] !== 0xff && b[21] >= PACKET_MODES.length) return null;
+  if ((flags & 0x20) && (b[22] >= PACKET_ROOTS.length || b[23] >= PACKET_CHORDS.length)) return null;
+  const v = new DataView(buf);
+  const hex = (n: number) => n.toString(16).padStart(8, '0');
+  const state: any = {};
+  if (b[20] !== 0xff) state.key = PACKET_ROOTS[b[20]];
+  if (b[21] !== 0xff) state.mode = PACKET_MODES[b[21]];
+  if (flags & 0x10) state.tempo = v.getUint32(24, true) / 1000;
+  if (flags & 0x01) state.enabled = (flags & 0x02) !== 0;
+  if (flags & 0x04) state.chordEnabled = (flags & 0x08) !== 0;
+  if (flags & 0x20) state.chord = { root: PACKET_ROOTS[b[22]], type: PACKET_CHORDS[b[23]] };
+  if (flags & 0x40) state.confidence = b[29] / 100;
+  if (flags & 0x80) {
+    const mask = v.getUint16(30, true);
+    state.scale = [];
+    for (let pc = 0; pc < 12; pc++) if (mask & (1 << pc)) state.scale.push(pc);
+  }
+  return {
+    _src: hex(v.getUint32(8, true)) + hex(v.getUint32(4, true)),
+    _seq: v.getUint32(16, true) * 4294967296 + v.getUint32(12, true),
+    type: b[3] === 1 ? 'set-state' : 'keylink-state',
+    state,
+  };
+}
+
+// Delta updates (docs/protocol.md, Delta Updates)
+const KEYFRAME_INTERVAL_MS = 2000;
+const RESYNC_INTERVAL_MS = 250;
+const STATE_TYPES = ['set-state', 'keylink-state'];
+
+// Last full state heard from a source
+type StateBase = { seq: number; msg: any; resyncAt: number };
+
+// Fields of `after` that differ from `before`; removed fields are null
+function diffFields(before: any, after: any): any {
+  const changes: any = {};
+  for (const k of Object.keys(after)) {
+    if (JSON.stringify(before[k]) !== JSON.stringify(after[k])) changes[k] = after[k];
+  }
+  for (const k of Object.keys(before)) {
+    if (!(k in after)) changes[k] = null;
+  }
+  return changes;
+}
+
 export class KeyLinkClient {
   private ws: WebSocket | null = null;
   private listeners: { [key: string]: Listener[] } = {};
   private state: Partial<KeyLinkState> = {};
+  private readonly source = newSourceId();
+  private seq = 0;
+  private lastSent: any = null;
+  private lastSentSeq = 0;
+  private keyframeAt = 0;
+  private keyframeDue = true;
+  private bases = new Map<string, StateBase>();
 
-  constructor(public opts: { relayUrl: string }) {}
+  // deltas: after a full state, send only the fields that changed
+  // lead: ms after sending that every receiver should apply a state (apply_at)
+  constructor(public opts: { relayUrl: string; deltas?: boolean; lead?: number }) {}
 
   connect() {
     this.emit('status', 'Connecting...');
@@ -80,30 +166,136 @@ export class KeyLinkClient {
     if (data instanceof Blob) {
       const reader = new FileReader();
       reader.onload = () => {
-        this.parseMessage(reader.result as string);
+        this.handleBinary(reader.result as ArrayBuffer);
       };
-      reader.readAsText(data);
+      reader.readAsArrayBuffer(data);
+    } else if (data instanceof ArrayBuffer) {
+      this.handleBinary(data);
     } else {
       this.parseMessage(data);
     }
   }
-  
+
+  // Binary frames are either a state packet or UTF-8 JSON
+  private handleBinary(buf: ArrayBuffer) {
+    const packet = decodeStatePacket(buf);
+    if (packet) {
+      this.handleParsed(packet);
+    } else {
+      this.parseMessage(new TextDecoder().decode(buf));
+    }
+  }
+
   private parseMessage(raw: string) {
     try {
-      const msg = JSON.parse(raw);
-      if (msg.type === 'keylink-state' || msg.type === 'set-state') {
-        this.state = msg.state;
-        this.emit('state', this.state);
-      }
+      this.handleParsed(JSON.parse(raw));
     } catch (err) {
       this.emit('error', 'Failed to parse message:', err);
       console.error('[KeyLink SDK] Failed to parse message:', err);
     }
   }
 
+  private handleParsed(msg: any) {
+    // Senders with redundancy on attach their last few deltas to each state
+    if (Array.isArray(msg._red)) {
+      const red = msg._red;
+      delete msg._red;
+      this.recoverRedundant(msg._src, red);
+    }
+    if (msg.type === 'time-ping') {
+      // Peers estimate our clock offset from this to schedule our apply_at
+      const arrival = Date.now();
+      if (typeof msg._src === 'string' && typeof msg.t0 === 'number') {
+        this.send({ type: 'time-pong', to: msg._src, t0: msg.t0, t1: arrival, t2: Date.now(), sources: [this.source] });
+      }
+      return;
+    } else if (msg.type === 'time-pong') {
+      return;
+    } else if (msg.type === 'state-delta') {
+      msg = this.applyDelta(msg);
+      if (!msg) return;
+    } else if (msg.type === 'state-resync') {
+      if (msg.source === this.source && this.lastSent && Date.now() - this.keyframeAt >= RESYNC_INTERVAL_MS) {
+        this.keyframeDue = true;
+        this.sendState(this.lastSent);
+      }
+      return;
+    } else if (STATE_TYPES.includes(msg.type) && typeof msg._src === 'string') {
+      // A retransmitted state (see "reliable") can arrive after a newer one
+      const base = this.bases.get(msg._src);
+      if (base && base.msg && typeof msg._seq === 'number' && msg._seq <= base.seq) return;
+      this.bases.set(msg._src, { seq: msg._seq, msg, resyncAt: base ? base.resyncAt : 0 });
+    }
+    if (STATE_TYPES.includes(msg.type)) {
+      this.state = msg.state;
+      this.emit('state', this.state);
+    }
+  }
+
+  // Rebuild the full state a delta describes; null (and a resync request)
+  // if we do not hold its base
+  private applyDelta(delta: any): any | null {
+    const base = this.bases.get(delta._src);
+    if (!base || !base.msg || base.seq !== delta.base || typeof base.msg.state !== 'object') {
+      this.requestResync(delta._src);
+      return null;
+    }
+    const state = { ...base.msg.state };
+    for (const k of Object.keys(delta.state || {})) {
+      if (delta.state[k] === null) delete state[k];
+      else state[k] = delta.state[k];
+    }
+    const full: any = { ...base.msg, _seq: delta._seq, state };
+    for (const k of Object.keys(delta)) {
+      if (!['_src', '_seq', 'type', 'base', 'state', '_red'].includes(k)) full[k] = delta[k];
+    }
+    base.seq = delta._seq;
+    base.msg = full;
+    return full;
+  }
+
+  // Output each state in "_red" that we missed, oldest first: those
+  // chained to the base we hold
+  private recoverRedundant(source: string, red: any[]) {
+    for (const entry of red) {
+      const base = this.bases.get(source);
+      if (!base || !base.msg || !entry || typeof entry._seq !== 'number' || entry._seq <= base.seq || entry.base !== base.seq) continue;
+      const full = this.applyDelta({ ...entry, _src: source });
+      if (!full) return;
+      this.state = full.state;
+      this.emit('state', this.state);
+    }
+  }
+
+  private requestResync(source: string) {
+    if (typeof source !== 'string') return;
+    const base = this.bases.get(source) || { seq: 0, msg: null, resyncAt: 0 };
+    this.bases.set(source, base);
+    if (Date.now() - base.resyncAt < RESYNC_INTERVAL_MS) return;
+    base.resyncAt = Date.now();
+    this.send({ type: 'state-resync', source });
+  }
+
   setState(state: Partial<KeyLinkState>) {
     this.state = { ...this.state, ...state };
-    this.send({ type: 'set-state', state: this.state });
+    this.sendState({ type: 'set-state', state: this.state });
+  }
+
+  // With deltas on, a state between keyframes goes out as a state-delta
+  private sendState(msg: any) {
+    if (!this.isConnected()) return;
+    const full = JSON.parse(JSON.stringify(msg));
+    const now = Date.now();
+    const applyAt = this.opts.lead ? { apply_at: now + this.opts.lead } : {};
+    if (!this.opts.deltas || this.keyframeDue || !this.lastSent || this.lastSent.type !== full.type ||
+        now - this.keyframeAt >= KEYFRAME_INTERVAL_MS) {
+      this.keyframeAt = now;
+      this.keyframeDue = false;
+      this.lastSentSeq = this.send({ ...applyAt, ...full });
+    } else {
+      this.lastSentSeq = this.send({ ...applyAt, type: 'state-delta', base: this.lastSentSeq, state: diffFields(this.lastSent.state, full.state) });
+    }
+    this.lastSent = full;
   }
 
   setChord(chord: { root: string; type: string }) {
@@ -121,9 +313,11 @@ export class KeyLinkClient {
     this.send({ type: 'toggle-keylink', enabled });
   }
 
-  private send(msg: any) {
-    if (this.isConnected()) {
-      this.ws?.send(JSON.stringify(msg));
-    }
+  // Returns the message's sequence number, 0 if not connected
+  private send(msg: any): number {
+    if (!this.isConnected()) return 0;
+    // _src/_seq first: receivers drop repeats and echoes by this tag
+    this.ws?.send(JSON.stringify({ _src: this.source, _seq: ++this.seq, ...msg }));
+    return this.seq;
   }
 } 
\ No newline at end of file
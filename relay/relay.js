@@ -65,18 +65,106 @@ function broadcastWSToChannelExceptSender(msg, channel, senderWs) {
   }
 }
 
+// Messages over one MTU travel as fragments (see docs/protocol.md, Fragmentation):
+// a 28-byte header (0xCB 'F', version, source, id, index, count, offset, length)
+// and up to 1372 bytes of the message
+const FRAGMENT_HEADER = 28;
+const UDP_MTU_PAYLOAD = 1400;
+const FRAGMENT_PAYLOAD = UDP_MTU_PAYLOAD - FRAGMENT_HEADER;
+const FRAGMENT_MAX_MESSAGE = 1024 * 1024;
+const REASSEMBLY_SLOTS = 32;
+const REASSEMBLY_TIMEOUT_MS = 2000;
+const fragmentSource = require('crypto').randomBytes(8);
+let fragmentId = 0;
+const reassembly = new Map();
+
+function isFragment(buf) {
+  return buf.length >= FRAGMENT_HEADER && buf[0] === 0xcb && buf[1] === 0x46;
+}
+
+// Returns the whole message once its last fragment arrives, otherwise null
+function reassemble(buf, now) {
+  if (buf[2] !== 1) return null;
+  const index = buf.readUInt16LE(16), count = buf.readUInt16LE(18);
+  const offset = buf.readUInt32LE(20), total = buf.readUInt32LE(24);
+  const chunk = buf.length - FRAGMENT_HEADER;
+  if (count === 0 || index >= count || total > FRAGMENT_MAX_MESSAGE || offset + chunk > total) return null;
+
+  for (const [key, p] of reassembly) {
+    if (now - p.started > REASSEMBLY_TIMEOUT_MS) reassembly.delete(key);
+  }
+  const key = buf.toString('hex', 4, 16);
+  let p = reassembly.get(key);
+  if (!p) {
+    // Maps iterate in insertion order: the first entry is the oldest
+    if (reassembly.size >= REASSEMBLY_SLOTS) reassembly.delete(reassembly.keys().next().value);
+    p = { started: now, data: Buffer.alloc(total), have: new Uint8Array(count), got: 0, count };
+    reassembly.set(key, p);
+  }
+  if (p.count !== count || p.data.length !== total || p.have[index]) return null;
+  buf.copy(p.data, offset, FRAGMENT_HEADER);
+  p.have[index] = 1;
+  if (++p.got < p.count) return null;
+  reassembly.delete(key);
+  return isFragment(p.data) ? null : p.data;
+}
+
 // Broadcast a message to UDP multicast
 function broadcastUDP(msg) {
   if (!ENABLE_UDP || !udpSocket) return;
   const buf = Buffer.from(msg);
-  udpSocket.send(buf, 0, buf.length, UDP_PORT, UDP_MULTICAST_ADDR);
+  if (buf.length <= UDP_MTU_PAYLOAD) {
+    udpSocket.send(buf, 0, buf.length, UDP_PORT, UDP_MULTICAST_ADDR);
+    return;
+  }
+  if (buf.length > FRAGMENT_MAX_MESSAGE) return;
+  const count = Math.ceil(buf.length / FRAGMENT_PAYLOAD);
+  fragmentId = (fragmentId + 1) >>> 0;
+  for (let index = 0; index < count; index++) {
+    const offset = index * FRAGMENT_PAYLOAD;
+    const chunk = buf.subarray(offset, offset + FRAGMENT_PAYLOAD);
+    const frag = Buffer.alloc(FRAGMENT_HEADER + chunk.length);
+    frag[0] = 0xcb;
+    frag[1] = 0x46;
+    frag[2] = 1;
+    fragmentSource.copy(frag, 4);
+    frag.writeUInt32LE(fragmentId, 12);
+    frag.writeUInt16LE(index, 16);
+    frag.writeUInt16LE(count, 18);
+    frag.writeUInt32LE(offset, 20);
+    frag.writeUInt32LE(buf.length, 24);
+    chunk.copy(frag, FRAGMENT_HEADER);
+    udpSocket.send(frag, 0, frag.length, UDP_PORT, UDP_MULTICAST_ADDR);
+  }
+}
+
+// This relay forwards UDP bytes to browsers as-is and cannot convert
+// MessagePack/CBOR, so while browsers are on the LAN channel it announces
+// itself as a JSON-only peer; native peers that negotiate encodings stay on
+// JSON until it goes quiet. The announcement is tagged with the relay's own
+// source, as receivers only act on tagged ones.
+const HELLO_INTERVAL_MS = 20000;
+const RELAY_SOURCE = require('crypto').randomBytes(8).toString('hex');
+let helloSeq = 0;
+let udpBound = false;
+function announceJSONOnly() {
+  if (!udpBound || !channels.has(DEFAULT_CHANNEL)) return;
+  broadcastUDP(JSON.stringify({ _src: RELAY_SOURCE, _seq: ++helloSeq, type: 'keylink-hello', encodings: ['json'] }));
+}
+if (ENABLE_UDP && udpSocket) {
+  setInterval(announceJSONOnly, HELLO_INTERVAL_MS);
 }
 
 // Handle incoming UDP messages
 if (ENABLE_UDP && udpSocket) {
 udpSocket.on('message', (msg, rinfo) => {
   try {
-    // Forward to all WebSocket clients in the default LAN channel
+    // Forward to all WebSocket clients in the default LAN channel, fragmented
+    // messages once they are whole
+    if (isFragment(msg)) {
+      msg = reassemble(msg, Date.now());
+      if (!msg) return;
+    }
     broadcastWSToChannel(msg, DEFAULT_CHANNEL);
   } catch (e) {
     console.error('UDP->WS error:', e);
@@ -90,6 +178,7 @@ udpSocket.bind(UDP_PORT, () => {
   udpSocket.addMembership(UDP_MULTICAST_ADDR);
   udpSocket.setBroadcast(true);
   udpSocket.setMulticastTTL(128);
+  udpBound = true;
   console.log(`KeyLink UDP relay listening on ${UDP_MULTICAST_ADDR}:${UDP_PORT}`);
 });
 } else {
@@ -106,6 +195,7 @@ wss.on('connection', (ws, req) => {
     channels.set(channel, new Set());
   }
   channels.get(channel).add(ws);
+  if (channel === DEFAULT_CHANNEL) announceJSONOnly();
 
   console.log(`[Relay] New client connected to channel "${channel}". Total clients in channel: ${channels.get(channel).size}`);
 